@@ -12,9 +12,18 @@ SOURCES += \
     chatwindow.cpp \
     contactlistwidget.cpp \
     databasemanager.cpp \
+    databasewriter.cpp \
+    statementcache.cpp \
     networkmanager.cpp \
+    chatsession.cpp \
+    framedecoder.cpp \
+    messagecodec.cpp \
+    messageschema.cpp \
+    framecompressor.cpp \
+    framecapture.cpp \
     messagemodel.cpp \
-    heartbeatthread.cpp
+    timerwheel.cpp \
+    keepalivemanager.cpp
 
 HEADERS += \
     mainwindow.h \
@@ -22,14 +31,26 @@ HEADERS += \
     chatwindow.h \
     contactlistwidget.h \
     databasemanager.h \
+    databasewriter.h \
+    statementcache.h \
     networkmanager.h \
+    chatsession.h \
+    framedecoder.h \
+    messagecodec.h \
+    messageschema.h \
+    framecompressor.h \
+    framecapture.h \
     messagemodel.h \
-    heartbeatthread.h
+    timerwheel.h \
+    keepalivemanager.h
 
 FORMS += \
     mainwindow.ui \
     logindialog.ui \
     chatwindow.ui
 
+# 帧压缩使用zlib
+LIBS += -lz
+
 RESOURCES += \
     resources.qrc
@@ -0,0 +1,320 @@
+#include "chatsession.h"
+#include <QDebug>
+
+ChatSession::ChatSession(QObject* parent)
+    : QObject(parent)
+    , m_networkManager(nullptr)
+    , m_port(8888)
+    , m_userId(0)
+    , m_drainCursor(0)
+    , m_completionFlushScheduled(false)
+    , m_syncUserId(0)
+    , m_syncCursor(0)
+    , m_queuedSyncCursor(0)
+    , m_receivedSeq(0)
+{
+    m_networkManager = new NetworkManager(this);
+    // socket读写和消息解析放到网络线程，界面线程只处理已解码的消息
+    m_networkManager->startWorkerThread();
+    
+    // 上线或发送缓冲区回落到低水位后继续发送发件箱中的消息
+    connect(m_networkManager, &NetworkManager::online, this, &ChatSession::drainOutbox);
+    connect(m_networkManager, &NetworkManager::backPressureChanged, this, [this](bool backPressured) {
+        if (!backPressured) {
+            drainOutbox();
+        }
+    });
+    connect(m_networkManager, &NetworkManager::messageStateChanged, this, &ChatSession::onMessageStateChanged);
+    connect(m_networkManager, &NetworkManager::messageSequenced, this, &ChatSession::onMessageSequenced);
+    
+    // 收到的消息先入库再推进同步游标，登录对话框期间重放的消息也不会丢失
+    connect(m_networkManager, &NetworkManager::messagesReceived, this, &ChatSession::onMessagesReceived);
+    // 追赶完成的信号排在重放的消息之后到达，此时它们都已入库
+    connect(m_networkManager, &NetworkManager::catchUpFinished, this, &ChatSession::commitSyncCursor);
+    // 网络层的游标随收到的消息推进；有消息未能入库时，重连前退回到已入库的位置，让服务器重新发送
+    connect(m_networkManager, &NetworkManager::disconnected, this, [this]() {
+        if (!m_unstoredSeqs.isEmpty()) {
+            rewindSyncCursor();
+        }
+    });
+    
+    // 写线程的提交结果排队回到本线程
+    connect(DatabaseManager::instance().writer(), &DatabaseWriter::operationsFinished,
+            this, &ChatSession::onWritesFinished);
+}
+
+void ChatSession::connectToServer(const QString& host, quint16 port)
+{
+    m_host = host;
+    m_port = port;
+    m_networkManager->connectToServer(host, port);
+}
+
+QFuture<RequestResult> ChatSession::login(int userId, const QString& username)
+{
+    loadSyncCursor(userId);
+    return m_networkManager->sendLogin(userId, username);
+}
+
+void ChatSession::setUser(int userId, const QString& username, const QString& nickname)
+{
+    if (userId != m_userId) {
+        m_drainCursor = 0;
+    }
+    m_userId = userId;
+    m_username = username;
+    m_nickname = nickname;
+    
+    if (userId > 0) {
+        loadSyncCursor(userId);
+        m_networkManager->setCredentials(userId, username);
+    }
+}
+
+void ChatSession::loadSyncCursor(int userId)
+{
+    if (userId == m_syncUserId) {
+        return;
+    }
+    
+    // 网络层的游标会随收到的消息推进，只在切换用户时用本地保存的值重置
+    m_syncUserId = userId;
+    m_syncCursor = userId > 0 ? DatabaseManager::instance().lastSyncSeq(userId) : 0;
+    m_queuedSyncCursor = m_syncCursor;
+    m_receivedSeq = m_syncCursor;
+    m_unstoredSeqs.clear();
+    m_networkManager->setSyncCursor(m_syncCursor);
+}
+
+qint64 ChatSession::storableSyncSeq(qint64 seq) const
+{
+    return m_unstoredSeqs.isEmpty() ? seq : qMin(seq, m_unstoredSeqs.firstKey() - 1);
+}
+
+void ChatSession::rewindSyncCursor()
+{
+    m_networkManager->setSyncCursor(m_syncCursor);
+}
+
+void ChatSession::onMessagesReceived(const QVector<ChatMessage>& messages)
+{
+    QList<MessageInfo> stored;
+    stored.reserve(messages.size());
+    qint64 lastSeq = 0;
+    qint64 firstSeq = 0;
+    
+    for (const ChatMessage& message : messages) {
+        MessageInfo info;
+        info.fromUserId = message.fromUserId;
+        info.toUserId = message.toUserId;
+        info.content = message.content;
+        info.timestamp = message.timestamp;
+        info.messageType = 0;
+        info.isGroup = message.isGroup;
+        info.clientMsgId = message.clientMsgId;
+        info.deliveryState = NetworkManager::DeliveryDelivered;
+        info.convSeq = message.convSeq;
+        stored.append(info);
+        lastSeq = qMax(lastSeq, message.seq);
+        if (message.seq > 0 && (firstSeq == 0 || message.seq < firstSeq)) {
+            firstSeq = message.seq;
+        }
+    }
+    m_receivedSeq = qMax(m_receivedSeq, lastSeq);
+    
+    // 整批消息和同步游标作为一个写操作提交；失败时游标不推进，在 onWritesFinished 中重试。
+    // 写线程提交后在 onWritesFinished 中通知界面，收包高峰时本线程不等待磁盘
+    PendingWrite write;
+    write.messages = stored;
+    write.firstSeq = firstSeq;
+    qint64 syncSeq = storableSyncSeq(lastSeq);
+    if (syncSeq > m_queuedSyncCursor) {
+        write.syncUserId = m_syncUserId;
+        write.syncSeq = syncSeq;
+        m_queuedSyncCursor = syncSeq;
+    }
+    quint64 ticket = DatabaseManager::instance().writer()->saveMessages(stored, write.syncUserId, write.syncSeq);
+    m_pendingWrites.insert(ticket, write);
+}
+
+void ChatSession::commitSyncCursor(qint64 seq)
+{
+    // 写操作按排队顺序提交，游标不会先于此前排队的消息落盘；也不越过写入失败的消息
+    m_receivedSeq = qMax(m_receivedSeq, seq);
+    seq = storableSyncSeq(seq);
+    if (m_syncUserId <= 0 || seq <= m_queuedSyncCursor) {
+        return;
+    }
+    
+    PendingWrite write;
+    write.syncUserId = m_syncUserId;
+    write.syncSeq = seq;
+    m_queuedSyncCursor = seq;
+    quint64 ticket = DatabaseManager::instance().writer()->saveMessages(QList<MessageInfo>(), m_syncUserId, seq);
+    m_pendingWrites.insert(ticket, write);
+}
+
+void ChatSession::onWritesFinished(const QVector<WriteResult>& results)
+{
+    bool drain = false;
+    for (const WriteResult& result : results) {
+        auto it = m_pendingWrites.find(result.ticket);
+        if (it == m_pendingWrites.end()) {
+            continue;
+        }
+        PendingWrite write = it.value();
+        m_pendingWrites.erase(it);
+        
+        if (write.outgoing) {
+            if (result.success) {
+                drain = true;
+            } else {
+                // 发件箱写入失败时直接交给网络层，至少保证在线时能发出
+                const MessageInfo& message = write.messages.first();
+                m_networkManager->sendTextMessage(message.fromUserId, message.toUserId, message.content,
+                                                  message.isGroup, message.clientMsgId, message.timestamp);
+            }
+            continue;
+        }
+        
+        if (!result.success && !write.messages.isEmpty()) {
+            // 之后排队的写操作可能带着更大的游标先提交，记下这批消息，游标在它们入库前不越过它们
+            if (write.firstSeq > 0) {
+                m_unstoredSeqs.insert(write.firstSeq, write.messages.size());
+            }
+            if (write.attempts < MaxSaveAttempts) {
+                qDebug() << "保存" << write.messages.size() << "条消息失败，重试";
+                PendingWrite retry = write;
+                retry.syncUserId = 0;
+                retry.syncSeq = 0;
+                ++retry.attempts;
+                m_pendingWrites.insert(DatabaseManager::instance().writer()->saveMessages(retry.messages), retry);
+                continue;
+            }
+            // 放弃：游标停在这批消息之前，下次登录时服务器重新发送
+            qDebug() << "保存" << write.messages.size() << "条消息失败，同步游标保持在" << m_syncCursor;
+            rewindSyncCursor();
+        } else if (!result.success) {
+            qDebug() << "保存同步游标失败，保持在" << m_syncCursor;
+        } else {
+            if (write.syncUserId > 0 && write.syncUserId == m_syncUserId && write.syncSeq > m_syncCursor) {
+                m_syncCursor = write.syncSeq;
+            }
+            if (write.attempts > 1 && m_unstoredSeqs.remove(write.firstSeq) > 0) {
+                // 重试成功，之前被拦住的游标可以继续推进
+                commitSyncCursor(m_receivedSeq);
+            }
+        }
+        if (!write.messages.isEmpty()) {
+            emit messagesStored(write.messages);
+        }
+    }
+    
+    if (drain) {
+        // 统一经由发件箱发送，保证在此之前排队的离线消息先发出
+        drainOutbox();
+    }
+}
+
+MessageInfo ChatSession::sendTextMessage(int toUserId, const QString& content, bool isGroup)
+{
+    MessageInfo message;
+    message.fromUserId = m_userId;
+    message.toUserId = toUserId;
+    message.content = content;
+    message.timestamp = QDateTime::currentMSecsSinceEpoch();
+    message.messageType = 0;
+    message.isGroup = isGroup;
+    message.clientMsgId = m_networkManager->nextClientMsgId();
+    message.deliveryState = NetworkManager::DeliveryPending;
+    
+    // 写入发件箱后在 onWritesFinished 中发送
+    PendingWrite write;
+    write.messages.append(message);
+    write.outgoing = true;
+    m_pendingWrites.insert(DatabaseManager::instance().writer()->saveOutgoingMessage(message), write);
+    return message;
+}
+
+void ChatSession::drainOutbox()
+{
+    if (m_userId <= 0 || !m_networkManager->isOnline()) {
+        return;
+    }
+    
+    // 按客户端消息ID顺序分批交给网络层；同一轮事件循环内交出的消息会合并为一次socket写入。
+    // 背压或未确认消息过多时暂停，等 backPressureChanged(false) 或确认到达后继续
+    while (!m_networkManager->isBackPressured() && m_outstanding.size() < MaxOutstandingMessages) {
+        int limit = qMin(OutboxBatchSize, MaxOutstandingMessages - m_outstanding.size());
+        QList<MessageInfo> batch = DatabaseManager::instance().getOutgoingMessages(m_userId, m_drainCursor, limit);
+        if (batch.isEmpty()) {
+            break;
+        }
+        
+        for (const MessageInfo& message : qAsConst(batch)) {
+            m_networkManager->sendTextMessage(message.fromUserId, message.toUserId, message.content,
+                                              message.isGroup, message.clientMsgId, message.timestamp);
+            m_outstanding.insert(message.clientMsgId);
+            m_drainCursor = message.clientMsgId;
+        }
+        
+        if (batch.size() < limit) {
+            break;
+        }
+    }
+}
+
+void ChatSession::onMessageStateChanged(qint64 clientMsgId, NetworkManager::DeliveryState state)
+{
+    if (!m_outstanding.contains(clientMsgId)) {
+        return;
+    }
+    
+    // 服务器不确认消息时，发出即为最终状态
+    bool finished = state == NetworkManager::DeliveryDelivered || state == NetworkManager::DeliveryFailed
+                    || (state == NetworkManager::DeliverySent && !m_networkManager->isDeliveryAcknowledged());
+    if (!finished) {
+        return;
+    }
+    m_completedIds[state].append(clientMsgId);
+    m_outstanding.remove(clientMsgId);
+    scheduleCompletionFlush();
+}
+
+void ChatSession::onMessageSequenced(qint64 clientMsgId, qint64 convSeq)
+{
+    // 在同一确认的 messageStateChanged 之前到达，此时消息仍在 m_outstanding 中
+    if (!m_outstanding.contains(clientMsgId)) {
+        return;
+    }
+    m_sequencedIds.insert(clientMsgId, convSeq);
+    scheduleCompletionFlush();
+}
+
+void ChatSession::scheduleCompletionFlush()
+{
+    // 确认通常成批到达，合并到一个事务中写入
+    if (!m_completionFlushScheduled) {
+        m_completionFlushScheduled = true;
+        QMetaObject::invokeMethod(this, "flushCompletedMessages", Qt::QueuedConnection);
+    }
+}
+
+void ChatSession::flushCompletedMessages()
+{
+    m_completionFlushScheduled = false;
+    
+    // 交给写线程即可：会话序号先于发送状态排队，同一事务或更早的事务中提交
+    DatabaseWriter* writer = DatabaseManager::instance().writer();
+    if (!m_sequencedIds.isEmpty()) {
+        writer->setMessageConvSeqs(m_userId, m_sequencedIds);
+        m_sequencedIds.clear();
+    }
+    
+    for (auto it = m_completedIds.constBegin(); it != m_completedIds.constEnd(); ++it) {
+        writer->completeOutgoingMessages(m_userId, it.value(), it.key());
+    }
+    m_completedIds.clear();
+    
+    drainOutbox();
+}
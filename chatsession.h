@@ -0,0 +1,107 @@
+#ifndef CHATSESSION_H
+#define CHATSESSION_H
+
+#include <QObject>
+#include <QString>
+#include <QSet>
+#include <QList>
+#include <QMap>
+#include <QHash>
+#include <QVector>
+#include <QFuture>
+#include "networkmanager.h"
+#include "databasemanager.h"
+#include "databasewriter.h"
+
+// 登录会话：持有已认证的服务器连接和当前用户信息，
+// 由登录对话框创建并在登录成功后移交给主窗口，整个进程只建立一次连接、登录一次
+class ChatSession : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit ChatSession(QObject* parent = nullptr);
+
+    NetworkManager* networkManager() const { return m_networkManager; }
+
+    void connectToServer(const QString& host, quint16 port);
+    QString host() const { return m_host; }
+    quint16 port() const { return m_port; }
+
+    // 以该用户登录服务器；登录请求携带本地保存的同步游标
+    QFuture<RequestResult> login(int userId, const QString& username);
+
+    // 设置当前用户；连接（重连）建立后将以该用户自动登录
+    void setUser(int userId, const QString& username, const QString& nickname);
+    int userId() const { return m_userId; }
+    QString username() const { return m_username; }
+    QString nickname() const { return m_nickname; }
+
+    bool isOnline() const { return m_networkManager->isOnline(); }
+    // 已持久化的同步游标（已入库消息的最大服务器序号）
+    qint64 syncCursor() const { return m_syncCursor; }
+
+    // 发送聊天消息：消息先与发件箱记录一起交给写线程写入本地数据库，写入后在线时按顺序分批交给网络层，
+    // 离线时留在发件箱中，重新上线后自动发出。立即返回消息（含客户端消息ID）供界面显示
+    MessageInfo sendTextMessage(int toUserId, const QString& content, bool isGroup);
+    int outstandingCount() const { return m_outstanding.size(); }
+
+    // 每次从发件箱读取的消息数，以及已交给网络层但尚未确认的消息上限
+    static const int OutboxBatchSize = 128;
+    static const int MaxOutstandingMessages = 512;
+    // 收到的消息写入失败时最多尝试的次数
+    static const int MaxSaveAttempts = 3;
+
+signals:
+    // 收到的消息已由写线程提交到本地数据库（写入失败时也会发出），界面据此显示
+    void messagesStored(const QList<MessageInfo>& messages);
+
+private slots:
+    void onMessagesReceived(const QVector<ChatMessage>& messages);
+    void commitSyncCursor(qint64 seq);
+    void drainOutbox();
+    void onMessageStateChanged(qint64 clientMsgId, NetworkManager::DeliveryState state);
+    void onMessageSequenced(qint64 clientMsgId, qint64 convSeq);
+    void flushCompletedMessages();
+    void onWritesFinished(const QVector<WriteResult>& results);
+
+private:
+    void loadSyncCursor(int userId);
+    void scheduleCompletionFlush();
+    // 可以写入的同步游标：不越过仍未入库的消息
+    qint64 storableSyncSeq(qint64 seq) const;
+    void rewindSyncCursor();
+
+    // 已交给写线程、等待提交结果的写操作
+    struct PendingWrite {
+        QList<MessageInfo> messages;
+        bool outgoing = false; // 自己发出的消息：提交后才从发件箱发送
+        int syncUserId = 0;
+        qint64 syncSeq = 0;    // 随同提交的同步游标
+        qint64 firstSeq = 0;   // 收到的消息中最小的服务器序号，0表示没有
+        int attempts = 1;
+    };
+
+    NetworkManager* m_networkManager;
+    QString m_host;
+    quint16 m_port;
+    int m_userId;
+    QString m_username;
+    QString m_nickname;
+
+    QSet<qint64> m_outstanding;       // 已交给网络层、尚未确认的消息
+    qint64 m_drainCursor;             // 已交给网络层的最大客户端消息ID
+    QMap<int, QList<qint64>> m_completedIds; // 发送状态 -> 待批量写入数据库的消息ID
+    QHash<qint64, qint64> m_sequencedIds;    // 客户端消息ID -> 待写入数据库的会话序号
+    bool m_completionFlushScheduled;
+    QHash<quint64, PendingWrite> m_pendingWrites; // 操作编号 -> 写操作
+
+    int m_syncUserId;                 // m_syncCursor 所属的用户
+    qint64 m_syncCursor;
+    qint64 m_queuedSyncCursor;        // 已交给写线程的最大同步游标
+    qint64 m_receivedSeq;             // 已收到的消息的最大服务器序号
+    // 写入失败（重试中或已放弃）的批次的最小序号 -> 该批次的消息数；同步游标不越过其中最小的序号
+    QMap<qint64, int> m_unstoredSeqs;
+};
+
+#endif // CHATSESSION_H
@@ -1,6 +1,8 @@
 #include "chatwindow.h"
 #include "ui_chatwindow.h"
+#include "databasewriter.h"
 #include <QScrollBar>
+#include <QTextCursor>
 #include <QDateTime>
 #include <QDebug>
 #include <QMessageBox>
@@ -14,7 +16,10 @@ ChatWindow::ChatWindow(int contactId, const QString& contactName, bool isGroup,
     , m_contactName(contactName)
     , m_isGroup(isGroup)
     , m_currentUserId(currentUserId)
+    , m_session(nullptr)
     , m_networkManager(nullptr)
+    , m_renderScheduled(false)
+    , m_loadingOlder(false)
 {
     setupUI();
     loadHistoryMessages();
@@ -36,13 +41,6 @@ void ChatWindow::setupUI()
     m_inputEdit = ui->inputEdit;
     m_sendButton = ui->sendButton;
     
-    // 设置标题
-    QString title = m_contactName;
-    if (m_isGroup) {
-        title = "[群聊] " + title;
-    }
-    m_titleLabel->setText(title);
-    
     // 连接信号槽
     connect(m_sendButton, &QPushButton::clicked, this, &ChatWindow::onSendClicked);
     connect(m_inputEdit, &QLineEdit::textChanged, this, &ChatWindow::onTextChanged);
@@ -51,51 +49,188 @@ void ChatWindow::setupUI()
     // 消息模型（用于数据管理，但显示使用QTextEdit）
     m_messageModel = new MessageModel(this);
     m_messageModel->loadMessages(m_currentUserId, m_contactId, m_isGroup);
+    // 显示跟随模型：追加到末尾的消息直接追加显示，插入到中间或移动位置时重绘
+    connect(m_messageModel, &QAbstractItemModel::rowsInserted, this, &ChatWindow::onRowsInserted);
+    connect(m_messageModel, &QAbstractItemModel::rowsMoved, this, &ChatWindow::scheduleRender);
+    // 打开时只加载最新的一页，向上滚动到顶部时再逐页加载
+    connect(m_messageList->verticalScrollBar(), &QScrollBar::valueChanged, this, &ChatWindow::onScrolled);
+    
+    // 设置标题
+    updateTitle();
+}
+
+void ChatWindow::setSession(ChatSession* session)
+{
+    if (m_networkManager) {
+        disconnect(m_networkManager, nullptr, this, nullptr);
+    }
+    m_session = session;
+    m_networkManager = session ? session->networkManager() : nullptr;
+    if (m_networkManager) {
+        connect(m_networkManager, &NetworkManager::messageStateChanged,
+                this, &ChatWindow::onMessageStateChanged);
+        connect(m_networkManager, &NetworkManager::messageSequenced,
+                this, &ChatWindow::onMessageSequenced);
+    }
 }
 
-void ChatWindow::setNetworkManager(NetworkManager* networkManager)
+void ChatWindow::onMessageSequenced(qint64 clientMsgId, qint64 convSeq)
 {
-    m_networkManager = networkManager;
+    // 确认广播给所有聊天窗口，只有发出该消息的窗口能找到它
+    m_messageModel->setConversationSeq(clientMsgId, convSeq);
 }
 
-void ChatWindow::loadHistoryMessages()
+void ChatWindow::onMessageStateChanged(qint64 clientMsgId, NetworkManager::DeliveryState state)
 {
-    QList<MessageInfo> messages = DatabaseManager::instance().getMessages(
-        m_currentUserId, m_contactId, 50, m_isGroup);
+    // 发送状态广播给所有聊天窗口，只处理本窗口发出的消息
+    if (m_messageModel->setDeliveryState(clientMsgId, state)) {
+        updateTitle();
+    }
+}
+
+void ChatWindow::updateTitle()
+{
+    QString title = m_contactName;
+    if (m_isGroup) {
+        title = "[群聊] " + title;
+    }
     
-    m_messageList->clear();
-    for (const MessageInfo& msg : qAsConst(messages)) {
-        bool isOwn = (msg.fromUserId == m_currentUserId);
-        QString formattedMsg = formatMessage(msg, isOwn);
-        m_messageList->append(formattedMsg);
+    int failed = m_messageModel->countInState(NetworkManager::DeliveryFailed);
+    int pending = m_messageModel->countInState(NetworkManager::DeliveryPending)
+                  + m_messageModel->countInState(NetworkManager::DeliverySent);
+    if (failed > 0) {
+        title += QString("（%1条消息发送失败）").arg(failed);
+    } else if (pending > 0) {
+        title += QString("（%1条消息发送中）").arg(pending);
     }
+    m_titleLabel->setText(title);
+}
+
+void ChatWindow::loadHistoryMessages()
+{
+    // 历史消息已由模型加载，直接显示
+    renderMessages();
     
     // 滚动到底部
     QScrollBar* scrollBar = m_messageList->verticalScrollBar();
     scrollBar->setValue(scrollBar->maximum());
 }
 
-void ChatWindow::addMessage(const MessageInfo& message)
+void ChatWindow::onScrolled(int value)
 {
-    // 保存到数据库
-    DatabaseManager::instance().saveMessage(message);
+    if (value == m_messageList->verticalScrollBar()->minimum() && !m_loadingOlder
+        && m_messageModel->canLoadOlder()) {
+        loadOlderMessages();
+    }
+}
+
+void ChatWindow::loadOlderMessages()
+{
+    QScrollBar* scrollBar = m_messageList->verticalScrollBar();
+    int fromBottom = scrollBar->maximum() - scrollBar->value();
+    
+    m_loadingOlder = true;
+    int count = m_messageModel->loadOlderMessages();
+    m_loadingOlder = false;
+    if (count == 0) {
+        return;
+    }
+    
+    // 只把新加载的一页插到开头，已显示的内容不重新生成：每页的代价与已加载多少页无关
+    if (!m_renderScheduled) {
+        m_messageList->setUpdatesEnabled(false);
+        QTextCursor cursor(m_messageList->document());
+        cursor.movePosition(QTextCursor::Start);
+        for (int row = 0; row < count; ++row) {
+            const MessageInfo& message = m_messageModel->messageAt(row);
+            cursor.insertHtml(formatMessage(message, message.fromUserId == m_currentUserId));
+            cursor.insertBlock();
+        }
+        m_messageList->setUpdatesEnabled(true);
+    }
     
-    // 添加到模型
-    m_messageModel->addMessage(message, m_currentUserId);
+    // 保持原来看到的消息在原处
+    scrollBar->setValue(scrollBar->maximum() - fromBottom);
+}
+
+void ChatWindow::onRowsInserted(const QModelIndex& parent, int first, int last)
+{
+    Q_UNUSED(parent)
+    if (m_renderScheduled || m_loadingOlder) {
+        return; // 即将整体重绘，或由 loadOlderMessages 插入显示
+    }
+    if (last != m_messageModel->rowCount() - 1) {
+        // 乱序到达的消息插在中间，本轮事件循环结束后重绘一次
+        scheduleRender();
+        return;
+    }
     
-    // 显示消息
-    bool isOwn = (message.fromUserId == m_currentUserId);
-    QString formattedMsg = formatMessage(message, isOwn);
-    m_messageList->append(formattedMsg);
+    // 整批追加完再重绘
+    m_messageList->setUpdatesEnabled(false);
+    for (int row = first; row <= last; ++row) {
+        const MessageInfo& message = m_messageModel->messageAt(row);
+        m_messageList->append(formatMessage(message, message.fromUserId == m_currentUserId));
+    }
+    m_messageList->setUpdatesEnabled(true);
     
     // 滚动到底部
     QScrollBar* scrollBar = m_messageList->verticalScrollBar();
     scrollBar->setValue(scrollBar->maximum());
 }
 
+void ChatWindow::scheduleRender()
+{
+    if (!m_renderScheduled) {
+        m_renderScheduled = true;
+        QMetaObject::invokeMethod(this, "renderMessages", Qt::QueuedConnection);
+    }
+}
+
+void ChatWindow::renderMessages()
+{
+    m_renderScheduled = false;
+    
+    // 只按模型中已排好的顺序重新生成显示内容，不查询数据库也不排序
+    QScrollBar* scrollBar = m_messageList->verticalScrollBar();
+    bool atBottom = scrollBar->value() == scrollBar->maximum();
+    int position = scrollBar->value();
+    
+    m_messageList->setUpdatesEnabled(false);
+    m_messageList->clear();
+    for (int row = 0; row < m_messageModel->rowCount(); ++row) {
+        const MessageInfo& message = m_messageModel->messageAt(row);
+        m_messageList->append(formatMessage(message, message.fromUserId == m_currentUserId));
+    }
+    m_messageList->setUpdatesEnabled(true);
+    scrollBar->setValue(atBottom ? scrollBar->maximum() : position);
+}
+
+void ChatWindow::addMessage(const MessageInfo& message)
+{
+    // 交给写线程保存到数据库
+    DatabaseManager::instance().writer()->saveMessages(QList<MessageInfo>() << message);
+    
+    appendMessage(message);
+}
+
+void ChatWindow::appendMessage(const MessageInfo& message)
+{
+    appendMessages(QList<MessageInfo>() << message);
+}
+
+void ChatWindow::appendMessages(const QList<MessageInfo>& messages)
+{
+    if (messages.isEmpty()) {
+        return;
+    }
+    
+    // 添加到模型（按会话序号定位，通常是一次行插入），显示由 onRowsInserted 更新
+    m_messageModel->addMessages(messages, m_currentUserId);
+}
+
 QString ChatWindow::formatMessage(const MessageInfo& message, bool isOwn)
 {
-    QString timeStr = message.timestamp.toString("hh:mm:ss");
+    QString timeStr = QDateTime::fromMSecsSinceEpoch(message.timestamp).toString("hh:mm:ss");
     QString align = isOwn ? "right" : "left";
     QString bgColor = isOwn ? "#95ec69" : "#ffffff";
     QString senderName = QString::number(message.fromUserId);
@@ -126,29 +261,22 @@ void ChatWindow::onSendClicked()
         return;
     }
     
-    if (!m_networkManager || !m_networkManager->isConnected()) {
-        QMessageBox::warning(this, "提示", "未连接到服务器，消息将仅保存到本地");
+    if (m_session) {
+        // 会话负责保存消息并写入发件箱：在线时立即发出，离线时在重新上线后自动发出；
+        // 发送状态随后通过 messageStateChanged 更新
+        appendMessage(m_session->sendTextMessage(m_contactId, content, m_isGroup));
+    } else {
+        // 没有会话（未登录的网络连接）时只保存到本地
+        MessageInfo message;
+        message.fromUserId = m_currentUserId;
+        message.toUserId = m_contactId;
+        message.content = content;
+        message.timestamp = QDateTime::currentMSecsSinceEpoch();
+        message.messageType = 0;
+        message.isGroup = m_isGroup;
+        addMessage(message);
     }
-    
-    // 创建消息
-    MessageInfo message;
-    message.fromUserId = m_currentUserId;
-    message.toUserId = m_contactId;
-    message.content = content;
-    message.timestamp = QDateTime::currentDateTime();
-    message.messageType = 0;
-    message.isGroup = m_isGroup;
-    
-    // 保存到数据库
-    DatabaseManager::instance().saveMessage(message);
-    
-    // 发送到服务器
-    if (m_networkManager && m_networkManager->isConnected()) {
-        m_networkManager->sendTextMessage(m_currentUserId, m_contactId, content, m_isGroup);
-    }
-    
-    // 显示消息
-    addMessage(message);
+    updateTitle();
     
     // 清空输入框
     m_inputEdit->clear();
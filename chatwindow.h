@@ -12,6 +12,7 @@
 #include "messagemodel.h"
 #include "networkmanager.h"
 #include "databasemanager.h"
+#include "chatsession.h"
 
 QT_BEGIN_NAMESPACE
 namespace Ui { class ChatWindow; }
@@ -26,14 +27,27 @@ public:
                        int currentUserId, QWidget* parent = nullptr);
     ~ChatWindow();
     
-    void setNetworkManager(NetworkManager* networkManager);
+    // 发送消息经由会话的发件箱；发送状态从会话的网络连接获取
+    void setSession(ChatSession* session);
+    // 保存并显示一条消息
     void addMessage(const MessageInfo& message);
+    // 显示已入库的消息
+    void appendMessage(const MessageInfo& message);
+    void appendMessages(const QList<MessageInfo>& messages);
     int getContactId() const { return m_contactId; }
     QString getContactName() const { return m_contactName; }
+    qint64 conversationId() const { return DatabaseManager::conversationId(m_currentUserId, m_contactId, m_isGroup); }
 
 private slots:
     void onSendClicked();
     void onTextChanged();
+    void onMessageStateChanged(qint64 clientMsgId, NetworkManager::DeliveryState state);
+    void onMessageSequenced(qint64 clientMsgId, qint64 convSeq);
+    void onRowsInserted(const QModelIndex& parent, int first, int last);
+    // 滚动到顶部时加载更早的一页
+    void onScrolled(int value);
+    void scheduleRender();
+    void renderMessages();
 
 private:
     Ui::ChatWindow* ui;
@@ -47,10 +61,15 @@ private:
     MessageModel* m_messageModel;
     QLineEdit* m_inputEdit;
     QPushButton* m_sendButton;
+    ChatSession* m_session;
     NetworkManager* m_networkManager;
+    bool m_renderScheduled;
+    bool m_loadingOlder;
     
     void setupUI();
     void loadHistoryMessages();
+    void loadOlderMessages();
+    void updateTitle();
     QString formatMessage(const MessageInfo& message, bool isOwn);
 };
 
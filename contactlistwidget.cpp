@@ -7,6 +7,7 @@
 ContactListWidget::ContactListWidget(QWidget* parent)
     : QWidget(parent)
     , m_currentUserId(0)
+    , m_networkManager(nullptr)
 {
     setupUI();
 }
@@ -127,78 +128,103 @@ void ContactListWidget::loadContacts(int userId)
 void ContactListWidget::populateContacts()
 {
     m_treeWidget->clear();
+    m_groupItems.clear();
+    m_contactItems.clear();
     
     QList<ContactInfo> contacts = DatabaseManager::instance().getContacts(m_currentUserId);
     
-    QHash<QString, QTreeWidgetItem*> groupItems;
-    
     for (const ContactInfo& contact : qAsConst(contacts)) {
-        QTreeWidgetItem* groupItem = findGroupItem(contact.groupName);
-        if (!groupItem) {
-            groupItem = new QTreeWidgetItem(m_treeWidget);
-            groupItem->setText(0, contact.groupName);
-            groupItem->setExpanded(true);
-            groupItems[contact.groupName] = groupItem;
-        }
-        
-        QTreeWidgetItem* contactItem = new QTreeWidgetItem(groupItem);
-        QString displayName = contact.contactName;
-        if (contact.isGroup) {
-            displayName = "[群] " + displayName;
-        }
-        contactItem->setText(0, displayName);
-        contactItem->setData(0, Qt::UserRole, contact.contactId);
-        contactItem->setData(0, Qt::UserRole + 1, contact.isGroup);
-        contactItem->setData(0, Qt::UserRole + 2, contact.contactName);
+        QTreeWidgetItem* contactItem = new QTreeWidgetItem(groupItemFor(contact.groupName));
+        setContactItemData(contactItem, contact);
+        m_contactItems.insert(contact.contactId, contactItem);
     }
 }
 
 QTreeWidgetItem* ContactListWidget::findGroupItem(const QString& groupName)
 {
-    for (int i = 0; i < m_treeWidget->topLevelItemCount(); ++i) {
-        QTreeWidgetItem* item = m_treeWidget->topLevelItem(i);
-        if (item->text(0) == groupName) {
-            return item;
-        }
-    }
-    return nullptr;
+    return m_groupItems.value(groupName, nullptr);
 }
 
 QTreeWidgetItem* ContactListWidget::findContactItem(int contactId)
 {
-    for (int i = 0; i < m_treeWidget->topLevelItemCount(); ++i) {
-        QTreeWidgetItem* groupItem = m_treeWidget->topLevelItem(i);
-        for (int j = 0; j < groupItem->childCount(); ++j) {
-            QTreeWidgetItem* contactItem = groupItem->child(j);
-            if (contactItem->data(0, Qt::UserRole).toInt() == contactId) {
-                return contactItem;
-            }
-        }
-    }
-    return nullptr;
+    return m_contactItems.value(contactId, nullptr);
 }
 
-void ContactListWidget::addContact(const ContactInfo& contact)
+QTreeWidgetItem* ContactListWidget::groupItemFor(const QString& groupName)
 {
-    QTreeWidgetItem* groupItem = findGroupItem(contact.groupName);
+    QTreeWidgetItem* groupItem = findGroupItem(groupName);
     if (!groupItem) {
         groupItem = new QTreeWidgetItem(m_treeWidget);
-        groupItem->setText(0, contact.groupName);
+        groupItem->setText(0, groupName);
         groupItem->setExpanded(true);
+        m_groupItems.insert(groupName, groupItem);
     }
-    
-    QTreeWidgetItem* contactItem = new QTreeWidgetItem(groupItem);
+    return groupItem;
+}
+
+void ContactListWidget::setContactItemData(QTreeWidgetItem* item, const ContactInfo& contact)
+{
     QString displayName = contact.contactName;
     if (contact.isGroup) {
         displayName = "[群] " + displayName;
     }
-    contactItem->setText(0, displayName);
-    contactItem->setData(0, Qt::UserRole, contact.contactId);
-    contactItem->setData(0, Qt::UserRole + 1, contact.isGroup);
-    contactItem->setData(0, Qt::UserRole + 2, contact.contactName);
+    item->setText(0, displayName);
+    item->setData(0, Qt::UserRole, contact.contactId);
+    item->setData(0, Qt::UserRole + 1, contact.isGroup);
+    item->setData(0, Qt::UserRole + 2, contact.contactName);
 }
 
-void ContactListWidget::updateContactLastMessage(int userId, int contactId, const QDateTime& time)
+void ContactListWidget::removeContactItem(QTreeWidgetItem* item)
+{
+    QTreeWidgetItem* groupItem = item->parent();
+    m_contactItems.remove(item->data(0, Qt::UserRole).toInt());
+    delete item;
+    
+    // 分组中最后一个联系人被移走后删除分组
+    if (groupItem && groupItem->childCount() == 0) {
+        m_groupItems.remove(groupItem->text(0));
+        delete groupItem;
+    }
+}
+
+void ContactListWidget::addContact(const ContactInfo& contact)
+{
+    QString groupName = contact.groupName.isEmpty() ? QString("默认分组") : contact.groupName;
+    QTreeWidgetItem* contactItem = findContactItem(contact.contactId);
+    
+    if (contactItem && contactItem->parent() && contactItem->parent()->text(0) != groupName) {
+        // 分组变化：移到新分组
+        removeContactItem(contactItem);
+        contactItem = nullptr;
+    }
+    
+    if (!contactItem) {
+        contactItem = new QTreeWidgetItem(groupItemFor(groupName));
+        m_contactItems.insert(contact.contactId, contactItem);
+    }
+    setContactItemData(contactItem, contact);
+}
+
+void ContactListWidget::applyContactDelta(const QList<ContactInfo>& upserts, const QList<int>& removed)
+{
+    // 首次同步可能有数千项，批量修改期间暂停重绘
+    m_treeWidget->setUpdatesEnabled(false);
+    
+    for (int contactId : removed) {
+        QTreeWidgetItem* item = findContactItem(contactId);
+        if (item) {
+            removeContactItem(item);
+        }
+    }
+    
+    for (const ContactInfo& contact : upserts) {
+        addContact(contact);
+    }
+    
+    m_treeWidget->setUpdatesEnabled(true);
+}
+
+void ContactListWidget::updateContactLastMessage(int userId, int contactId, qint64 time)
 {
     Q_UNUSED(userId)
     Q_UNUSED(time)
@@ -236,23 +262,45 @@ void ContactListWidget::onAddContactClicked()
         if (ok && !contactName.isEmpty()) {
             QString groupName = QInputDialog::getText(this, "添加联系人", "请输入分组名称:", QLineEdit::Normal, "默认分组", &ok);
             if (ok) {
-                if (DatabaseManager::instance().addContact(m_currentUserId, contactId, contactName, groupName)) {
-                    ContactInfo info;
-                    info.contactId = contactId;
-                    info.contactName = contactName;
-                    info.groupName = groupName.isEmpty() ? "默认分组" : groupName;
-                    info.userId = m_currentUserId;
-                    info.isGroup = false;
-                    addContact(info);
-                    QMessageBox::information(this, "成功", "联系人添加成功");
-                } else {
-                    QMessageBox::warning(this, "错误", "添加联系人失败");
+                // 服务器的花名册是联系人的权威来源，只保存在本地的联系人会在完整同步时被删除
+                if (!m_networkManager || !m_networkManager->isOnline()) {
+                    QMessageBox::warning(this, "错误", "未连接到服务器，无法添加联系人");
+                    return;
                 }
+                ContactInfo info;
+                info.contactId = contactId;
+                info.contactName = contactName;
+                info.groupName = groupName.isEmpty() ? "默认分组" : groupName;
+                info.userId = m_currentUserId;
+                info.isGroup = false;
+                m_addButton->setEnabled(false);
+                NetworkManager::onRequestFinished(
+                    m_networkManager->sendAddContact(m_currentUserId, contactId, contactName, info.groupName),
+                    this, [this, info](const RequestResult& result) { onAddContactFinished(info, result); });
             }
         }
     }
 }
 
+void ContactListWidget::onAddContactFinished(const ContactInfo& contact, const RequestResult& result)
+{
+    m_addButton->setEnabled(true);
+    if (!result.success) {
+        QMessageBox::warning(this, "错误", "添加联系人失败: "
+                             + (result.timedOut ? QString("服务器无响应") : result.error));
+        return;
+    }
+    
+    // 服务器已记录，再写入本地；花名册版本留给下次同步推进
+    if (DatabaseManager::instance().addContact(m_currentUserId, contact.contactId, contact.contactName,
+                                               contact.groupName)) {
+        addContact(contact);
+        QMessageBox::information(this, "成功", "联系人添加成功");
+    } else {
+        QMessageBox::warning(this, "错误", "添加联系人失败");
+    }
+}
+
 void ContactListWidget::onRefreshClicked()
 {
     populateContacts();
@@ -282,11 +330,33 @@ void ContactListWidget::onDeleteContact()
     int contactId = item->data(0, Qt::UserRole).toInt();
     
     if (QMessageBox::question(this, "确认", "确定要删除这个联系人吗？") == QMessageBox::Yes) {
-        if (DatabaseManager::instance().removeContact(m_currentUserId, contactId)) {
-            delete item;
-            QMessageBox::information(this, "成功", "联系人已删除");
-        } else {
-            QMessageBox::warning(this, "错误", "删除联系人失败");
+        // 与添加相同：只在本地删除的联系人会在下次完整同步时重新出现
+        if (!m_networkManager || !m_networkManager->isOnline()) {
+            QMessageBox::warning(this, "错误", "未连接到服务器，无法删除联系人");
+            return;
+        }
+        NetworkManager::onRequestFinished(
+            m_networkManager->sendRemoveContact(m_currentUserId, contactId),
+            this, [this, contactId](const RequestResult& result) { onRemoveContactFinished(contactId, result); });
+    }
+}
+
+void ContactListWidget::onRemoveContactFinished(int contactId, const RequestResult& result)
+{
+    if (!result.success) {
+        QMessageBox::warning(this, "错误", "删除联系人失败: "
+                             + (result.timedOut ? QString("服务器无响应") : result.error));
+        return;
+    }
+    
+    // 等待响应期间联系人可能已被同步删除，按ID重新查找
+    if (DatabaseManager::instance().removeContact(m_currentUserId, contactId)) {
+        QTreeWidgetItem* item = findContactItem(contactId);
+        if (item) {
+            removeContactItem(item);
         }
+        QMessageBox::information(this, "成功", "联系人已删除");
+    } else {
+        QMessageBox::warning(this, "错误", "删除联系人失败");
     }
 }
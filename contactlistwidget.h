@@ -9,7 +9,9 @@
 #include <QLineEdit>
 #include <QMenu>
 #include <QContextMenuEvent>
+#include <QHash>
 #include "databasemanager.h"
+#include "networkmanager.h"
 
 class ContactListWidget : public QWidget
 {
@@ -19,8 +21,13 @@ public:
     explicit ContactListWidget(QWidget* parent = nullptr);
     
     void loadContacts(int userId);
+    // 添加和删除联系人经服务器确认后才修改本地数据库
+    void setNetworkManager(NetworkManager* networkManager) { m_networkManager = networkManager; }
+    // 添加联系人；已存在时更新名称和分组
     void addContact(const ContactInfo& contact);
-    void updateContactLastMessage(int userId, int contactId, const QDateTime& time);
+    // 按同步结果增量更新列表，不重建整棵树
+    void applyContactDelta(const QList<ContactInfo>& upserts, const QList<int>& removed);
+    void updateContactLastMessage(int userId, int contactId, qint64 time);
 
 signals:
     void contactSelected(int contactId, const QString& contactName, bool isGroup);
@@ -39,11 +46,20 @@ private:
     QPushButton* m_refreshButton;
     QLineEdit* m_searchEdit;
     int m_currentUserId;
+    NetworkManager* m_networkManager;
+    // 分组名/联系人ID到树节点的索引，增量更新时O(1)定位
+    QHash<QString, QTreeWidgetItem*> m_groupItems;
+    QHash<int, QTreeWidgetItem*> m_contactItems;
     
     void setupUI();
+    void onAddContactFinished(const ContactInfo& contact, const RequestResult& result);
+    void onRemoveContactFinished(int contactId, const RequestResult& result);
     void populateContacts();
     QTreeWidgetItem* findGroupItem(const QString& groupName);
     QTreeWidgetItem* findContactItem(int contactId);
+    QTreeWidgetItem* groupItemFor(const QString& groupName);
+    void setContactItemData(QTreeWidgetItem* item, const ContactInfo& contact);
+    void removeContactItem(QTreeWidgetItem* item);
 };
 
 #endif // CONTACTLISTWIDGET_H
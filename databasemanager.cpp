@@ -1,10 +1,99 @@
 #include "databasemanager.h"
+#include "databasewriter.h"
 #include <QStandardPaths>
 #include <QDir>
 #include <QDebug>
+#include <QSet>
+#include <QVariantList>
+#include <QStringList>
+#include <limits>
+
+namespace {
+// 联系人按(user_id, contact_id)唯一；冲突时只更新服务器下发的字段，保留本地的最后消息时间
+const char* const UpsertContactSql =
+    "INSERT INTO contacts (user_id, contact_id, contact_name, group_name, is_group) "
+    "VALUES (?, ?, ?, ?, ?) "
+    "ON CONFLICT(user_id, contact_id) DO UPDATE SET "
+    "contact_name = excluded.contact_name, group_name = excluded.group_name, is_group = excluded.is_group";
+
+// 含时间列的表，%1 为表名（迁移时先建临时名的新表）。时间一律为UTC毫秒数
+const char* const ContactsTableSql =
+    "CREATE TABLE IF NOT EXISTS %1 ("
+    "id INTEGER PRIMARY KEY AUTOINCREMENT,"
+    "user_id INTEGER NOT NULL,"
+    "contact_id INTEGER NOT NULL,"
+    "contact_name TEXT NOT NULL,"
+    "group_name TEXT DEFAULT '默认分组',"
+    "is_group INTEGER DEFAULT 0,"
+    "last_message_time INTEGER,"
+    "FOREIGN KEY(user_id) REFERENCES users(user_id))";
+
+const char* const MessagesTableSql =
+    "CREATE TABLE IF NOT EXISTS %1 ("
+    "message_id INTEGER PRIMARY KEY AUTOINCREMENT,"
+    "from_user_id INTEGER NOT NULL,"
+    "to_user_id INTEGER NOT NULL,"
+    "content TEXT NOT NULL,"
+    "message_type INTEGER DEFAULT 0,"
+    "is_group INTEGER DEFAULT 0,"
+    "timestamp INTEGER NOT NULL DEFAULT 0,"
+    "client_msg_id INTEGER DEFAULT 0,"
+    "delivery_state INTEGER DEFAULT 0,"
+    "conv_seq INTEGER DEFAULT 0,"
+    "conversation_id INTEGER NOT NULL DEFAULT 0,"
+    "FOREIGN KEY(from_user_id) REFERENCES users(user_id))";
+
+const char* const OutboxTableSql =
+    "CREATE TABLE IF NOT EXISTS %1 ("
+    "client_msg_id INTEGER PRIMARY KEY,"
+    "user_id INTEGER NOT NULL,"
+    "to_user_id INTEGER NOT NULL,"
+    "content TEXT NOT NULL,"
+    "is_group INTEGER DEFAULT 0,"
+    "timestamp INTEGER)";
+
+// 与 DatabaseManager::conversationId 相同的计算，供升级时填充已有的消息
+const char* const ConversationIdSql =
+    "CASE WHEN is_group = 1 THEN -to_user_id "
+    "ELSE (MIN(from_user_id, to_user_id) << 32) | MAX(from_user_id, to_user_id) END";
+
+// 历史消息分页，都是 idx_messages_conversation 上的索引范围扫描（索引隐含 message_id），不需要排序。
+// 向前翻页沿索引逆序取一页，外层再把这不超过一页的行按显示顺序排好，逐行交出时就是最终顺序
+const char* const SequencedBeforeSql =
+    "SELECT * FROM ("
+    "SELECT message_id, from_user_id, to_user_id, content, message_type, is_group, timestamp, "
+    "client_msg_id, delivery_state, conv_seq "
+    "FROM messages WHERE conversation_id = ? AND conv_seq <> 0 AND (conv_seq, message_id) < (?, ?) "
+    "ORDER BY conv_seq DESC, message_id DESC LIMIT ?) "
+    "ORDER BY conv_seq, message_id";
+const char* const PendingBeforeSql =
+    "SELECT * FROM ("
+    "SELECT message_id, from_user_id, to_user_id, content, message_type, is_group, timestamp, "
+    "client_msg_id, delivery_state, conv_seq "
+    "FROM messages WHERE conversation_id = ? AND conv_seq = 0 AND message_id < ? "
+    "ORDER BY message_id DESC LIMIT ?) "
+    "ORDER BY message_id";
+const char* const CountPendingBeforeSql =
+    "SELECT COUNT(*) FROM ("
+    "SELECT 1 FROM messages WHERE conversation_id = ? AND conv_seq = 0 AND message_id < ? LIMIT ?)";
+const char* const SequencedAfterSql =
+    "SELECT message_id, from_user_id, to_user_id, content, message_type, is_group, timestamp, "
+    "client_msg_id, delivery_state, conv_seq "
+    "FROM messages WHERE conversation_id = ? AND conv_seq <> 0 AND (conv_seq, message_id) > (?, ?) "
+    "ORDER BY conv_seq, message_id LIMIT ?";
+const char* const PendingAfterSql =
+    "SELECT message_id, from_user_id, to_user_id, content, message_type, is_group, timestamp, "
+    "client_msg_id, delivery_state, conv_seq "
+    "FROM messages WHERE conversation_id = ? AND conv_seq = 0 AND message_id > ? "
+    "ORDER BY message_id LIMIT ?";
+}
+
+const char* const DatabaseManager::RosterVersionKey = "roster_version";
+const char* const DatabaseManager::LastSeqKey = "last_seq";
 
 DatabaseManager::DatabaseManager(QObject* parent)
     : QObject(parent)
+    , m_writer(nullptr)
 {
     QString dataPath = QStandardPaths::writableLocation(QStandardPaths::AppDataLocation);
     QDir dir;
@@ -12,11 +101,13 @@ DatabaseManager::DatabaseManager(QObject* parent)
         dir.mkpath(dataPath);
     }
     m_dbPath = dataPath + "/chat.db";
+    m_writer = new DatabaseWriter(m_dbPath);
 }
 
 DatabaseManager::~DatabaseManager()
 {
     close();
+    delete m_writer;
 }
 
 DatabaseManager& DatabaseManager::instance()
@@ -35,11 +126,68 @@ bool DatabaseManager::init()
         return false;
     }
     
-    return createTables();
+    m_statements.setDatabase(m_db);
+    
+    // 日志模式在其他连接打开之前切换；升级旧库时也受益于WAL
+    bool wal = applyProfile(m_db, m_profile, true);
+    
+    if (!createTables()) {
+        return false;
+    }
+    
+    // 升级完成后主连接不再自动检查点，由写线程在后台完成，界面线程的提交不会被检查点拖慢
+    if (wal) {
+        QSqlQuery query(m_db);
+        query.exec("PRAGMA wal_autocheckpoint = 0");
+    }
+    
+    // 建表和升级完成后再启动写线程，写线程使用自己的连接
+    m_writer->setProfile(m_profile);
+    m_writer->start();
+    return true;
+}
+
+bool DatabaseManager::applyProfile(QSqlDatabase& db, const DatabaseProfile& profile, bool setJournalMode)
+{
+    QSqlQuery query(db);
+    query.exec(QString("PRAGMA busy_timeout = %1").arg(profile.busyTimeoutMs));
+    
+    // 日志模式保存在数据库文件中。切换失败（网络文件系统不支持WAL、其他进程正在使用）时
+    // PRAGMA 返回原来的模式，保持原模式继续运行；WAL库不能被3.7.0之前的SQLite打开
+    if (setJournalMode) {
+        query.exec(profile.wal ? "PRAGMA journal_mode = WAL" : "PRAGMA journal_mode = DELETE");
+    } else {
+        query.exec("PRAGMA journal_mode");
+    }
+    bool wal = query.next() && query.value(0).toString().compare("wal", Qt::CaseInsensitive) == 0;
+    if (setJournalMode && profile.wal && !wal) {
+        qDebug() << "无法切换到WAL日志模式，继续使用" << query.value(0).toString();
+    }
+    query.finish();
+    
+    // NORMAL 只在WAL下安全：掉电最多丢失最近的提交，不会损坏数据库；回滚日志模式下每次提交都要同步
+    query.exec(QString("PRAGMA synchronous = %1").arg(wal && profile.synchronousNormal ? "NORMAL" : "FULL"));
+    query.exec(QString("PRAGMA mmap_size = %1").arg(profile.mmapSize));
+    query.exec(QString("PRAGMA cache_size = %1").arg(-profile.cacheSizeKb));
+    query.exec(QString("PRAGMA temp_store = %1").arg(profile.tempStoreMemory ? "MEMORY" : "DEFAULT"));
+    return wal;
+}
+
+QString DatabaseManager::journalMode()
+{
+    QSqlQuery query(m_db);
+    if (query.exec("PRAGMA journal_mode") && query.next()) {
+        return query.value(0).toString().toLower();
+    }
+    return QString();
 }
 
 void DatabaseManager::close()
 {
+    // 先提交写线程中排队的操作
+    m_writer->stop();
+    // 缓存的语句在连接关闭之前释放
+    m_statements.clear();
     if (m_db.isOpen()) {
         m_db.close();
     }
@@ -49,6 +197,13 @@ bool DatabaseManager::createTables()
 {
     QSqlQuery query(m_db);
     
+    // 建表之前判断是新数据库还是已有的数据库：新数据库直接建成最新结构，
+    // 已有的数据库（包括引入版本号之前创建的，版本号为0）按版本依次升级
+    query.exec("PRAGMA user_version");
+    int version = query.next() ? query.value(0).toInt() : 0;
+    query.exec("SELECT 1 FROM sqlite_master WHERE type = 'table' AND name = 'messages'");
+    bool existing = query.next();
+    
     // 用户表
     query.exec("CREATE TABLE IF NOT EXISTS users ("
                "user_id INTEGER PRIMARY KEY AUTOINCREMENT,"
@@ -60,26 +215,20 @@ bool DatabaseManager::createTables()
                "created_at DATETIME DEFAULT CURRENT_TIMESTAMP)");
     
     // 联系人表
-    query.exec("CREATE TABLE IF NOT EXISTS contacts ("
-               "id INTEGER PRIMARY KEY AUTOINCREMENT,"
+    query.exec(QString(ContactsTableSql).arg("contacts"));
+    
+    // 同步状态表：每个用户的同步游标（如花名册版本）
+    query.exec("CREATE TABLE IF NOT EXISTS sync_state ("
                "user_id INTEGER NOT NULL,"
-               "contact_id INTEGER NOT NULL,"
-               "contact_name TEXT NOT NULL,"
-               "group_name TEXT DEFAULT '默认分组',"
-               "is_group INTEGER DEFAULT 0,"
-               "last_message_time DATETIME,"
-               "FOREIGN KEY(user_id) REFERENCES users(user_id))");
+               "name TEXT NOT NULL,"
+               "value INTEGER NOT NULL DEFAULT 0,"
+               "PRIMARY KEY(user_id, name))");
     
     // 消息表
-    query.exec("CREATE TABLE IF NOT EXISTS messages ("
-               "message_id INTEGER PRIMARY KEY AUTOINCREMENT,"
-               "from_user_id INTEGER NOT NULL,"
-               "to_user_id INTEGER NOT NULL,"
-               "content TEXT NOT NULL,"
-               "message_type INTEGER DEFAULT 0,"
-               "is_group INTEGER DEFAULT 0,"
-               "timestamp DATETIME DEFAULT CURRENT_TIMESTAMP,"
-               "FOREIGN KEY(from_user_id) REFERENCES users(user_id))");
+    query.exec(QString(MessagesTableSql).arg("messages"));
+    
+    // 发件箱：尚未被服务器确认的消息，按客户端消息ID（递增）顺序发送
+    query.exec(QString(OutboxTableSql).arg("outbox"));
     
     // 分组表
     query.exec("CREATE TABLE IF NOT EXISTS groups ("
@@ -88,30 +237,252 @@ bool DatabaseManager::createTables()
                "user_id INTEGER NOT NULL,"
                "FOREIGN KEY(user_id) REFERENCES users(user_id))");
     
-    return query.lastError().type() == QSqlError::NoError;
+    if (query.lastError().type() != QSqlError::NoError) {
+        qDebug() << "建表失败:" << query.lastError().text();
+        return false;
+    }
+    
+    if (!existing) {
+        query.exec(QString("PRAGMA user_version = %1").arg(SchemaVersion));
+    } else if (version > SchemaVersion) {
+        qDebug() << "数据库版本" << version << "比程序支持的版本" << SchemaVersion << "新，不做升级";
+    } else if (version < SchemaVersion && !migrate(version)) {
+        return false;
+    }
+    
+    // 索引在升级之后创建：升级中重建的表不带旧索引，新增的列也要先存在
+    return createIndexes();
 }
 
-bool DatabaseManager::registerUser(const QString& username, const QString& password, const QString& nickname)
+bool DatabaseManager::createIndexes()
 {
     QSqlQuery query(m_db);
-    query.prepare("INSERT INTO users (username, password, nickname) VALUES (?, ?, ?)");
-    query.addBindValue(username);
-    query.addBindValue(password); // 实际应用中应该加密
-    query.addBindValue(nickname);
     
-    return query.exec();
+    // 联系人按(user_id, contact_id)唯一；联系人列表按分组和最后消息时间排列，直接沿索引读出
+    bool ok = query.exec("CREATE UNIQUE INDEX IF NOT EXISTS idx_contacts_user_contact ON contacts(user_id, contact_id)")
+              && query.exec("CREATE INDEX IF NOT EXISTS idx_contacts_user_group "
+                            "ON contacts(user_id, group_name, last_message_time DESC)");
+    
+    // 打开会话：按会话ID定位，沿会话序号逆序读取最新的消息，不扫描全表也不排序
+    ok = ok && query.exec("CREATE INDEX IF NOT EXISTS idx_messages_conversation ON messages(conversation_id, conv_seq)")
+         && query.exec("CREATE INDEX IF NOT EXISTS idx_messages_client_msg_id ON messages(client_msg_id)")
+         && query.exec("CREATE INDEX IF NOT EXISTS idx_outbox_user ON outbox(user_id, client_msg_id)");
+    
+    if (!ok) {
+        qDebug() << "创建索引失败:" << query.lastError().text();
+    }
+    return ok;
 }
 
-bool DatabaseManager::loginUser(const QString& username, const QString& password, int& userId, QString& nickname)
+// 升级步骤按版本号顺序排列。新数据库直接建成最新结构，不经过这些步骤
+const DatabaseManager::Migration DatabaseManager::Migrations[] = {
+    { 1, "联系人去重并按(user_id, contact_id)建唯一索引", &DatabaseManager::migrateUniqueContacts },
+    { 2, "消息增加客户端消息ID和发送状态", &DatabaseManager::migrateDeliveryState },
+    { 3, "消息增加会话序号", &DatabaseManager::migrateConversationSeq },
+    { 4, "时间列改为UTC毫秒数", &DatabaseManager::migrateTimestamps },
+    { 5, "消息增加会话ID", &DatabaseManager::migrateConversationIds },
+};
+
+bool DatabaseManager::migrate(int fromVersion)
 {
     QSqlQuery query(m_db);
-    query.prepare("SELECT user_id, nickname FROM users WHERE username = ? AND password = ?");
-    query.addBindValue(username);
-    query.addBindValue(password);
+    for (const Migration& migration : Migrations) {
+        if (migration.version <= fromVersion) {
+            continue;
+        }
+        
+        qDebug() << "升级数据库到版本" << migration.version << ":" << migration.description;
+        if (!(this->*migration.apply)()) {
+            qDebug() << "升级数据库到版本" << migration.version << "失败";
+            return false;
+        }
+        
+        // 每一步完成后才记录版本号：中途退出时下次启动从未完成的那一步重做，每一步都可以安全地重复执行
+        if (!query.exec(QString("PRAGMA user_version = %1").arg(migration.version))) {
+            qDebug() << "记录数据库版本失败:" << query.lastError().text();
+            return false;
+        }
+    }
+    return true;
+}
+
+bool DatabaseManager::migrateUniqueContacts()
+{
+    // 旧版本没有唯一约束，INSERT OR REPLACE 会插入重复行；建唯一索引前只保留每个联系人最新的一行
+    QSqlQuery query(m_db);
+    return query.exec("DELETE FROM contacts WHERE id NOT IN "
+                      "(SELECT MAX(id) FROM contacts GROUP BY user_id, contact_id)")
+           && query.exec("CREATE UNIQUE INDEX IF NOT EXISTS idx_contacts_user_contact ON contacts(user_id, contact_id)");
+}
+
+bool DatabaseManager::migrateDeliveryState()
+{
+    // 发送状态：客户端消息ID用于匹配服务器确认
+    return ensureColumn("messages", "client_msg_id", "INTEGER DEFAULT 0")
+           && ensureColumn("messages", "delivery_state", "INTEGER DEFAULT 0");
+}
+
+bool DatabaseManager::migrateConversationSeq()
+{
+    // 会话序号：会话内按服务器分配的序号排列，不受各端时钟影响。
+    // 升级前的消息没有序号，按入库顺序编为负数，排在所有服务器序号之前。
+    // 已编号的行（中途退出后重做时）跳过；升级期间没有新消息写入，最大消息ID不变，重做时编号相同
+    return ensureColumn("messages", "conv_seq", "INTEGER DEFAULT 0")
+           && execInBatches("messages",
+               "UPDATE messages SET conv_seq = message_id - (SELECT MAX(message_id) FROM messages) - 1 "
+               "WHERE message_id > ? AND message_id <= ? AND conv_seq = 0");
+}
+
+bool DatabaseManager::migrateTimestamps()
+{
+    return migrateTimestampColumn("contacts", "last_message_time", ContactsTableSql)
+           && migrateTimestampColumn("messages", "timestamp", MessagesTableSql)
+           && migrateTimestampColumn("outbox", "timestamp", OutboxTableSql);
+}
+
+bool DatabaseManager::migrateConversationIds()
+{
+    // 已填过的行（中途退出后重做时）跳过；会话序号的旧索引由会话ID索引代替
+    QSqlQuery query(m_db);
+    return ensureColumn("messages", "conversation_id", "INTEGER NOT NULL DEFAULT 0")
+           && execInBatches("messages", QString("UPDATE messages SET conversation_id = %1 "
+                                                "WHERE message_id > ? AND message_id <= ? AND conversation_id = 0")
+                                        .arg(ConversationIdSql))
+           && query.exec("DROP INDEX IF EXISTS idx_messages_conv_seq");
+}
+
+bool DatabaseManager::ensureColumn(const QString& table, const QString& column, const QString& definition)
+{
+    QSqlQuery query(m_db);
+    if (!query.exec(QString("PRAGMA table_info(%1)").arg(table))) {
+        return false;
+    }
+    
+    while (query.next()) {
+        if (query.value(1).toString() == column) {
+            return true;
+        }
+    }
+    
+    return query.exec(QString("ALTER TABLE %1 ADD COLUMN %2 %3").arg(table, column, definition));
+}
+
+bool DatabaseManager::migrateTimestampColumn(const QString& table, const QString& column, const char* createSql)
+{
+    QSqlQuery query(m_db);
+    if (!query.exec(QString("PRAGMA table_info(%1)").arg(table))) {
+        return false;
+    }
     
-    if (query.exec() && query.next()) {
-        userId = query.value(0).toInt();
-        nickname = query.value(1).toString();
+    QStringList columns;
+    QString declaredType;
+    while (query.next()) {
+        columns.append(query.value(1).toString());
+        if (query.value(1).toString() == column) {
+            declaredType = query.value(2).toString();
+        }
+    }
+    if (declaredType.isEmpty() || declaredType.compare("INTEGER", Qt::CaseInsensitive) == 0) {
+        return true;
+    }
+    
+    // 旧版本的时间列为 DATETIME，值是Qt写入的本地时间ISO-8601文本，按本地时区转换为UTC毫秒数。
+    // SQLite不能修改列的类型：按新定义建表并分批复制，再替换旧表；旧表的索引随之删除，由 createIndexes 重建。
+    // 中途退出时留下的临时表在重做时丢弃
+    QStringList values = columns;
+    values[columns.indexOf(column)] = QString(
+        "CASE WHEN typeof(%1) = 'text' "
+        "THEN COALESCE(CAST(ROUND((julianday(%1, 'utc') - 2440587.5) * 86400000.0) AS INTEGER), 0) "
+        "ELSE %1 END").arg(column);
+    QString migrating = table + "_migrating";
+    
+    if (!query.exec(QString("DROP TABLE IF EXISTS %1").arg(migrating))
+        || !query.exec(QString(createSql).arg(migrating))
+        || !execInBatches(table, QString("INSERT INTO %1 (%2) SELECT %3 FROM %4 WHERE rowid > ? AND rowid <= ?")
+                                 .arg(migrating, columns.join(", "), values.join(", "), table))) {
+        qDebug() << "迁移" << table << "的时间列失败:" << query.lastError().text();
+        return false;
+    }
+    
+    if (!m_db.transaction()) {
+        qDebug() << "开始事务失败:" << m_db.lastError().text();
+        return false;
+    }
+    
+    bool ok = query.exec(QString("DROP TABLE %1").arg(table))
+              && query.exec(QString("ALTER TABLE %1 RENAME TO %2").arg(migrating, table));
+    
+    if (!ok || !m_db.commit()) {
+        qDebug() << "迁移" << table << "的时间列失败:" << query.lastError().text();
+        m_db.rollback();
+        return false;
+    }
+    
+    qDebug() << "已将" << table << "的时间列转换为毫秒数";
+    return true;
+}
+
+bool DatabaseManager::execInBatches(const QString& table, const QString& sql)
+{
+    // 几GB的历史库升级时不长时间持有写锁，回滚日志也只有一批的大小。
+    // 每批的上界取第 MigrationBatchSize 个 rowid，主键不连续（如发件箱的客户端消息ID）时批次大小也不变
+    QSqlQuery bound(m_db);
+    bound.prepare(QString("SELECT rowid FROM %1 WHERE rowid > ? ORDER BY rowid LIMIT 1 OFFSET %2")
+                  .arg(table).arg(MigrationBatchSize - 1));
+    QSqlQuery batch(m_db);
+    batch.prepare(sql);
+    
+    qint64 after = std::numeric_limits<qint64>::min();
+    for (;;) {
+        bound.addBindValue(after);
+        if (!bound.exec()) {
+            qDebug() << "分批处理" << table << "失败:" << bound.lastError().text();
+            return false;
+        }
+        bool last = !bound.next();
+        qint64 upTo = last ? std::numeric_limits<qint64>::max() : bound.value(0).toLongLong();
+        bound.finish();
+        
+        if (!m_db.transaction()) {
+            qDebug() << "开始事务失败:" << m_db.lastError().text();
+            return false;
+        }
+        batch.addBindValue(after);
+        batch.addBindValue(upTo);
+        if (!batch.exec() || !m_db.commit()) {
+            qDebug() << "分批处理" << table << "失败:" << batch.lastError().text();
+            m_db.rollback();
+            return false;
+        }
+        
+        if (last) {
+            return true;
+        }
+        after = upTo;
+    }
+}
+
+bool DatabaseManager::registerUser(const QString& username, const QString& password, const QString& nickname)
+{
+    StatementCache::Statement query = m_statements.prepare(
+        "INSERT INTO users (username, password, nickname) VALUES (?, ?, ?)");
+    query->addBindValue(username);
+    query->addBindValue(password); // 实际应用中应该加密
+    query->addBindValue(nickname);
+    
+    return query->exec();
+}
+
+bool DatabaseManager::loginUser(const QString& username, const QString& password, int& userId, QString& nickname)
+{
+    StatementCache::Statement query = m_statements.prepare(
+        "SELECT user_id, nickname FROM users WHERE username = ? AND password = ?");
+    query->addBindValue(username);
+    query->addBindValue(password);
+    
+    if (query->exec() && query->next()) {
+        userId = query->value(0).toInt();
+        nickname = query->value(1).toString();
         updateUserStatus(userId, true);
         return true;
     }
@@ -121,26 +492,25 @@ bool DatabaseManager::loginUser(const QString& username, const QString& password
 
 bool DatabaseManager::updateUserStatus(int userId, bool isOnline)
 {
-    QSqlQuery query(m_db);
-    query.prepare("UPDATE users SET is_online = ? WHERE user_id = ?");
-    query.addBindValue(isOnline ? 1 : 0);
-    query.addBindValue(userId);
-    return query.exec();
+    StatementCache::Statement query = m_statements.prepare("UPDATE users SET is_online = ? WHERE user_id = ?");
+    query->addBindValue(isOnline ? 1 : 0);
+    query->addBindValue(userId);
+    return query->exec();
 }
 
 UserInfo DatabaseManager::getUserInfo(int userId)
 {
     UserInfo info;
-    QSqlQuery query(m_db);
-    query.prepare("SELECT user_id, username, nickname, avatar, is_online FROM users WHERE user_id = ?");
-    query.addBindValue(userId);
+    StatementCache::Statement query = m_statements.prepare(
+        "SELECT user_id, username, nickname, avatar, is_online FROM users WHERE user_id = ?");
+    query->addBindValue(userId);
     
-    if (query.exec() && query.next()) {
-        info.userId = query.value(0).toInt();
-        info.username = query.value(1).toString();
-        info.nickname = query.value(2).toString();
-        info.avatar = query.value(3).toString();
-        info.isOnline = query.value(4).toBool();
+    if (query->exec() && query->next()) {
+        info.userId = query->value(0).toInt();
+        info.username = query->value(1).toString();
+        info.nickname = query->value(2).toString();
+        info.avatar = query->value(3).toString();
+        info.isOnline = query->value(4).toBool();
     }
     
     return info;
@@ -148,145 +518,384 @@ UserInfo DatabaseManager::getUserInfo(int userId)
 
 bool DatabaseManager::addContact(int userId, int contactId, const QString& contactName, const QString& groupName, bool isGroup)
 {
-    QSqlQuery query(m_db);
-    query.prepare("INSERT OR REPLACE INTO contacts (user_id, contact_id, contact_name, group_name, is_group) "
-                  "VALUES (?, ?, ?, ?, ?)");
-    query.addBindValue(userId);
-    query.addBindValue(contactId);
-    query.addBindValue(contactName);
-    query.addBindValue(groupName);
-    query.addBindValue(isGroup ? 1 : 0);
+    StatementCache::Statement query = m_statements.prepare(UpsertContactSql);
+    query->addBindValue(userId);
+    query->addBindValue(contactId);
+    query->addBindValue(contactName);
+    query->addBindValue(groupName.isEmpty() ? QString("默认分组") : groupName);
+    query->addBindValue(isGroup ? 1 : 0);
     
-    return query.exec();
+    return query->exec();
 }
 
 bool DatabaseManager::removeContact(int userId, int contactId)
 {
-    QSqlQuery query(m_db);
-    query.prepare("DELETE FROM contacts WHERE user_id = ? AND contact_id = ?");
-    query.addBindValue(userId);
-    query.addBindValue(contactId);
-    return query.exec();
+    StatementCache::Statement query = m_statements.prepare("DELETE FROM contacts WHERE user_id = ? AND contact_id = ?");
+    query->addBindValue(userId);
+    query->addBindValue(contactId);
+    return query->exec();
 }
 
 QList<ContactInfo> DatabaseManager::getContacts(int userId)
 {
     QList<ContactInfo> contacts;
-    QSqlQuery query(m_db);
-    query.prepare("SELECT contact_id, contact_name, group_name, is_group, last_message_time "
-                  "FROM contacts WHERE user_id = ? ORDER BY group_name, last_message_time DESC");
-    query.addBindValue(userId);
+    StatementCache::Statement query = m_statements.prepare(
+        "SELECT contact_id, contact_name, group_name, is_group, last_message_time "
+        "FROM contacts WHERE user_id = ? ORDER BY group_name, last_message_time DESC");
+    query->addBindValue(userId);
     
-    while (query.next()) {
+    if (!query->exec()) {
+        qDebug() << "查询联系人失败:" << query->lastError().text();
+        return contacts;
+    }
+    
+    while (query->next()) {
         ContactInfo info;
-        info.contactId = query.value(0).toInt();
-        info.contactName = query.value(1).toString();
-        info.groupName = query.value(2).toString();
+        info.contactId = query->value(0).toInt();
+        info.contactName = query->value(1).toString();
+        info.groupName = query->value(2).toString();
         info.userId = userId;
-        info.isGroup = query.value(3).toBool();
-        info.lastMessageTime = query.value(4).toDateTime();
+        info.isGroup = query->value(3).toBool();
+        info.lastMessageTime = query->value(4).toLongLong();
         contacts.append(info);
     }
     
     return contacts;
 }
 
-bool DatabaseManager::updateContactLastMessage(int userId, int contactId, const QDateTime& time)
+bool DatabaseManager::updateContactLastMessage(int userId, int contactId, qint64 time)
 {
-    QSqlQuery query(m_db);
-    query.prepare("UPDATE contacts SET last_message_time = ? WHERE user_id = ? AND contact_id = ?");
-    query.addBindValue(time);
-    query.addBindValue(userId);
-    query.addBindValue(contactId);
-    return query.exec();
+    StatementCache::Statement query = m_statements.prepare(
+        "UPDATE contacts SET last_message_time = ? WHERE user_id = ? AND contact_id = ?");
+    query->addBindValue(time);
+    query->addBindValue(userId);
+    query->addBindValue(contactId);
+    return query->exec();
 }
 
-bool DatabaseManager::saveMessage(const MessageInfo& message)
+bool DatabaseManager::applyContactDelta(int userId, const QList<ContactInfo>& upserts, QList<int>& removed,
+                                        bool full, qint64 rosterVersion, QList<ContactInfo>* unsynced)
 {
+    // 首次同步：本地已有的联系人都还没有和服务器的花名册对过，不能当作已删除
+    bool bootstrap = full && this->rosterVersion(userId) == 0;
+    
+    // 数千个联系人在一个事务中写入，只同步落盘一次
+    if (!m_db.transaction()) {
+        qDebug() << "开始事务失败:" << m_db.lastError().text();
+        return false;
+    }
+    
     QSqlQuery query(m_db);
-    query.prepare("INSERT INTO messages (from_user_id, to_user_id, content, message_type, is_group, timestamp) "
-                  "VALUES (?, ?, ?, ?, ?, ?)");
-    query.addBindValue(message.fromUserId);
-    query.addBindValue(message.toUserId);
-    query.addBindValue(message.content);
-    query.addBindValue(message.messageType);
-    query.addBindValue(message.isGroup ? 1 : 0);
-    query.addBindValue(message.timestamp);
-    
-    bool success = query.exec();
-    
-    if (success) {
-        updateContactLastMessage(message.fromUserId, message.toUserId, message.timestamp);
-        if (!message.isGroup) {
-            updateContactLastMessage(message.toUserId, message.fromUserId, message.timestamp);
+    bool ok = true;
+    
+    if (full) {
+        // 完整列表：本地有而服务器没有的联系人视为已删除
+        QSet<int> listed; // 服务器列出的联系人和删除项，删除项不重复追加
+        listed.reserve(upserts.size() + removed.size());
+        for (const ContactInfo& contact : upserts) {
+            listed.insert(contact.contactId);
+        }
+        for (int contactId : qAsConst(removed)) {
+            listed.insert(contactId);
+        }
+        
+        query.prepare("SELECT contact_id, contact_name, group_name, is_group FROM contacts WHERE user_id = ?");
+        query.addBindValue(userId);
+        ok = query.exec();
+        while (ok && query.next()) {
+            int contactId = query.value(0).toInt();
+            if (listed.contains(contactId)) {
+                continue;
+            }
+            if (!bootstrap) {
+                removed.append(contactId);
+            } else if (unsynced) {
+                ContactInfo contact;
+                contact.userId = userId;
+                contact.contactId = contactId;
+                contact.contactName = query.value(1).toString();
+                contact.groupName = query.value(2).toString();
+                contact.isGroup = query.value(3).toBool();
+                unsynced->append(contact);
+            }
+        }
+    }
+    
+    if (ok && !removed.isEmpty()) {
+        QVariantList userIds;
+        QVariantList contactIds;
+        userIds.reserve(removed.size());
+        contactIds.reserve(removed.size());
+        for (int contactId : qAsConst(removed)) {
+            userIds.append(userId);
+            contactIds.append(contactId);
         }
+        
+        query.prepare("DELETE FROM contacts WHERE user_id = ? AND contact_id = ?");
+        query.addBindValue(userIds);
+        query.addBindValue(contactIds);
+        ok = query.execBatch();
+    }
+    
+    if (ok && !upserts.isEmpty()) {
+        // 一条预编译语句批量执行，不为每个联系人重新解析SQL
+        QVariantList userIds;
+        QVariantList contactIds;
+        QVariantList names;
+        QVariantList groupNames;
+        QVariantList isGroups;
+        for (const ContactInfo& contact : upserts) {
+            userIds.append(userId);
+            contactIds.append(contact.contactId);
+            names.append(contact.contactName);
+            groupNames.append(contact.groupName.isEmpty() ? QString("默认分组") : contact.groupName);
+            isGroups.append(contact.isGroup ? 1 : 0);
+        }
+        
+        query.prepare(UpsertContactSql);
+        query.addBindValue(userIds);
+        query.addBindValue(contactIds);
+        query.addBindValue(names);
+        query.addBindValue(groupNames);
+        query.addBindValue(isGroups);
+        ok = query.execBatch();
+    }
+    
+    if (!ok) {
+        qDebug() << "同步联系人失败:" << query.lastError().text();
+        m_db.rollback();
+        return false;
+    }
+    
+    if (!setSyncValue(userId, RosterVersionKey, rosterVersion) || !m_db.commit()) {
+        qDebug() << "保存联系人同步结果失败:" << m_db.lastError().text();
+        m_db.rollback();
+        return false;
     }
     
-    return success;
+    return true;
+}
+
+qint64 DatabaseManager::rosterVersion(int userId)
+{
+    return syncValue(userId, RosterVersionKey);
+}
+
+qint64 DatabaseManager::lastSyncSeq(int userId)
+{
+    return syncValue(userId, LastSeqKey);
+}
+
+qint64 DatabaseManager::syncValue(int userId, const QString& name, qint64 defaultValue)
+{
+    StatementCache::Statement query = m_statements.prepare(
+        "SELECT value FROM sync_state WHERE user_id = ? AND name = ?");
+    query->addBindValue(userId);
+    query->addBindValue(name);
+    
+    if (query->exec() && query->next()) {
+        return query->value(0).toLongLong();
+    }
+    return defaultValue;
+}
+
+bool DatabaseManager::setSyncValue(int userId, const QString& name, qint64 value)
+{
+    StatementCache::Statement query = m_statements.prepare(
+        "INSERT OR REPLACE INTO sync_state (user_id, name, value) VALUES (?, ?, ?)");
+    query->addBindValue(userId);
+    query->addBindValue(name);
+    query->addBindValue(value);
+    return query->exec();
 }
 
 QList<MessageInfo> DatabaseManager::getMessages(int userId, int contactId, int limit, bool isGroup)
+{
+    return getMessagesBefore(conversationId(userId, contactId, isGroup), MessageCursor(), limit);
+}
+
+QList<MessageInfo> DatabaseManager::getMessagesBefore(qint64 conversationId, const MessageCursor& cursor, int limit)
 {
     QList<MessageInfo> messages;
-    QSqlQuery query(m_db);
+    messages.reserve(limit);
+    forEachMessageBefore(conversationId, cursor, limit, [&messages](const MessageInfo& message) {
+        messages.append(message);
+        return true;
+    });
+    return messages;
+}
+
+QList<MessageInfo> DatabaseManager::getMessagesAfter(qint64 conversationId, const MessageCursor& cursor, int limit)
+{
+    QList<MessageInfo> messages;
+    messages.reserve(limit);
+    forEachMessageAfter(conversationId, cursor, limit, [&messages](const MessageInfo& message) {
+        messages.append(message);
+        return true;
+    });
+    return messages;
+}
+
+int DatabaseManager::forEachMessageBefore(qint64 conversationId, const MessageCursor& cursor, int limit,
+                                          const MessageCallback& callback)
+{
+    if (limit <= 0) {
+        return 0;
+    }
+    const qint64 end = std::numeric_limits<qint64>::max();
+    
+    // 游标在未分配序号的部分（或为空）：这一页先取游标之前未分配序号的消息（它们最新），不足的从有序号的部分补齐。
+    // 结果要按显示顺序交出，先只数出前者的条数，有序号的部分读完后再读它们
+    int pending = 0;
+    qint64 pendingBefore = cursor.isNull() ? end : cursor.messageId;
+    if (cursor.convSeq == 0) {
+        StatementCache::Statement query = m_statements.prepare(CountPendingBeforeSql);
+        query->addBindValue(conversationId);
+        query->addBindValue(pendingBefore);
+        query->addBindValue(limit);
+        if (!query->exec() || !query->next()) {
+            qDebug() << "查询消息失败:" << query->lastError().text();
+            return 0;
+        }
+        pending = query->value(0).toInt();
+    }
+    
+    int count = 0;
+    bool stopped = false;
+    if (pending < limit) {
+        StatementCache::Statement query = m_statements.prepare(SequencedBeforeSql);
+        query->addBindValue(conversationId);
+        query->addBindValue(cursor.convSeq != 0 ? cursor.convSeq : end);
+        query->addBindValue(cursor.convSeq != 0 ? cursor.messageId : end);
+        query->addBindValue(limit - pending);
+        count += readMessages(*query, callback, &stopped);
+    }
+    if (pending > 0 && !stopped) {
+        StatementCache::Statement query = m_statements.prepare(PendingBeforeSql);
+        query->addBindValue(conversationId);
+        query->addBindValue(pendingBefore);
+        query->addBindValue(pending);
+        count += readMessages(*query, callback, &stopped);
+    }
+    return count;
+}
+
+int DatabaseManager::forEachMessageAfter(qint64 conversationId, const MessageCursor& cursor, int limit,
+                                         const MessageCallback& callback)
+{
+    if (limit <= 0) {
+        return 0;
+    }
+    const qint64 begin = std::numeric_limits<qint64>::min();
+    
+    // 游标在有序号的部分（或为空）：先顺着索引读有序号的消息，不足的从未分配序号的部分补齐
+    int count = 0;
+    bool stopped = false;
+    bool sequenced = cursor.isNull() || cursor.convSeq != 0;
+    if (sequenced) {
+        StatementCache::Statement query = m_statements.prepare(SequencedAfterSql);
+        query->addBindValue(conversationId);
+        query->addBindValue(cursor.isNull() ? begin : cursor.convSeq);
+        query->addBindValue(cursor.isNull() ? begin : cursor.messageId);
+        query->addBindValue(limit);
+        count += readMessages(*query, callback, &stopped);
+    }
+    if (count < limit && !stopped) {
+        StatementCache::Statement query = m_statements.prepare(PendingAfterSql);
+        query->addBindValue(conversationId);
+        query->addBindValue(sequenced ? begin : cursor.messageId);
+        query->addBindValue(limit - count);
+        count += readMessages(*query, callback, &stopped);
+    }
+    return count;
+}
+
+int DatabaseManager::readMessages(QSqlQuery& query, const MessageCallback& callback, bool* stopped)
+{
+    if (!query.exec()) {
+        qDebug() << "查询消息失败:" << query.lastError().text();
+        return 0;
+    }
     
+    int count = 0;
+    while (query.next()) {
+        MessageInfo msg;
+        msg.messageId = query.value(0).toInt();
+        msg.fromUserId = query.value(1).toInt();
+        msg.toUserId = query.value(2).toInt();
+        msg.content = query.value(3).toString();
+        msg.messageType = query.value(4).toInt();
+        msg.isGroup = query.value(5).toBool();
+        msg.timestamp = query.value(6).toLongLong();
+        msg.clientMsgId = query.value(7).toLongLong();
+        msg.deliveryState = query.value(8).toInt();
+        msg.convSeq = query.value(9).toLongLong();
+        ++count;
+        if (!callback(msg)) {
+            *stopped = true;
+            break;
+        }
+    }
+    return count;
+}
+
+qint64 DatabaseManager::conversationId(int fromUserId, int toUserId, bool isGroup)
+{
     if (isGroup) {
-        query.prepare("SELECT message_id, from_user_id, to_user_id, content, message_type, timestamp "
-                      "FROM messages WHERE to_user_id = ? AND is_group = 1 "
-                      "ORDER BY timestamp DESC LIMIT ?");
-        query.addBindValue(contactId);
-    } else {
-        query.prepare("SELECT message_id, from_user_id, to_user_id, content, message_type, timestamp "
-                      "FROM messages WHERE ((from_user_id = ? AND to_user_id = ?) OR "
-                      "(from_user_id = ? AND to_user_id = ?)) AND is_group = 0 "
-                      "ORDER BY timestamp DESC LIMIT ?");
-        query.addBindValue(userId);
-        query.addBindValue(contactId);
-        query.addBindValue(contactId);
-        query.addBindValue(userId);
+        return -static_cast<qint64>(toUserId);
     }
-    query.addBindValue(limit);
+    return (static_cast<qint64>(qMin(fromUserId, toUserId)) << 32) | qMax(fromUserId, toUserId);
+}
+
+QList<MessageInfo> DatabaseManager::getRecentMessages(int userId, int limit)
+{
+    QList<MessageInfo> messages;
+    StatementCache::Statement query = m_statements.prepare(
+        "SELECT DISTINCT m.message_id, m.from_user_id, m.to_user_id, m.content, "
+        "m.message_type, m.timestamp, m.is_group "
+        "FROM messages m "
+        "WHERE m.from_user_id = ? OR m.to_user_id = ? "
+        "ORDER BY m.timestamp DESC LIMIT ?");
+    query->addBindValue(userId);
+    query->addBindValue(userId);
+    query->addBindValue(limit);
     
-    if (query.exec()) {
-        while (query.next()) {
+    if (query->exec()) {
+        while (query->next()) {
             MessageInfo msg;
-            msg.messageId = query.value(0).toInt();
-            msg.fromUserId = query.value(1).toInt();
-            msg.toUserId = query.value(2).toInt();
-            msg.content = query.value(3).toString();
-            msg.messageType = query.value(4).toInt();
-            msg.timestamp = query.value(5).toDateTime();
-            msg.isGroup = isGroup;
-            messages.prepend(msg); // 反转顺序，使时间正序
+            msg.messageId = query->value(0).toInt();
+            msg.fromUserId = query->value(1).toInt();
+            msg.toUserId = query->value(2).toInt();
+            msg.content = query->value(3).toString();
+            msg.messageType = query->value(4).toInt();
+            msg.timestamp = query->value(5).toLongLong();
+            msg.isGroup = query->value(6).toBool();
+            messages.append(msg);
         }
     }
     
     return messages;
 }
 
-QList<MessageInfo> DatabaseManager::getRecentMessages(int userId, int limit)
+QList<MessageInfo> DatabaseManager::getOutgoingMessages(int userId, qint64 afterClientMsgId, int limit)
 {
     QList<MessageInfo> messages;
-    QSqlQuery query(m_db);
-    query.prepare("SELECT DISTINCT m.message_id, m.from_user_id, m.to_user_id, m.content, "
-                  "m.message_type, m.timestamp, m.is_group "
-                  "FROM messages m "
-                  "WHERE m.from_user_id = ? OR m.to_user_id = ? "
-                  "ORDER BY m.timestamp DESC LIMIT ?");
-    query.addBindValue(userId);
-    query.addBindValue(userId);
-    query.addBindValue(limit);
-    
-    if (query.exec()) {
-        while (query.next()) {
+    StatementCache::Statement query = m_statements.prepare(
+        "SELECT client_msg_id, to_user_id, content, is_group, timestamp FROM outbox "
+        "WHERE user_id = ? AND client_msg_id > ? ORDER BY client_msg_id LIMIT ?");
+    query->addBindValue(userId);
+    query->addBindValue(afterClientMsgId);
+    query->addBindValue(limit);
+    
+    if (query->exec()) {
+        while (query->next()) {
             MessageInfo msg;
-            msg.messageId = query.value(0).toInt();
-            msg.fromUserId = query.value(1).toInt();
-            msg.toUserId = query.value(2).toInt();
-            msg.content = query.value(3).toString();
-            msg.messageType = query.value(4).toInt();
-            msg.timestamp = query.value(5).toDateTime();
-            msg.isGroup = query.value(6).toBool();
+            msg.fromUserId = userId;
+            msg.clientMsgId = query->value(0).toLongLong();
+            msg.toUserId = query->value(1).toInt();
+            msg.content = query->value(2).toString();
+            msg.isGroup = query->value(3).toBool();
+            msg.timestamp = query->value(4).toLongLong();
             messages.append(msg);
         }
     }
@@ -296,22 +905,25 @@ QList<MessageInfo> DatabaseManager::getRecentMessages(int userId, int limit)
 
 bool DatabaseManager::addGroup(const QString& groupName, int userId)
 {
-    QSqlQuery query(m_db);
-    query.prepare("INSERT INTO groups (group_name, user_id) VALUES (?, ?)");
-    query.addBindValue(groupName);
-    query.addBindValue(userId);
-    return query.exec();
+    StatementCache::Statement query = m_statements.prepare("INSERT INTO groups (group_name, user_id) VALUES (?, ?)");
+    query->addBindValue(groupName);
+    query->addBindValue(userId);
+    return query->exec();
 }
 
 QList<QString> DatabaseManager::getGroups(int userId)
 {
     QList<QString> groups;
-    QSqlQuery query(m_db);
-    query.prepare("SELECT DISTINCT group_name FROM contacts WHERE user_id = ? ORDER BY group_name");
-    query.addBindValue(userId);
+    StatementCache::Statement query = m_statements.prepare(
+        "SELECT DISTINCT group_name FROM contacts WHERE user_id = ? ORDER BY group_name");
+    query->addBindValue(userId);
     
-    while (query.next()) {
-        groups.append(query.value(0).toString());
+    if (!query->exec()) {
+        return groups;
+    }
+    
+    while (query->next()) {
+        groups.append(query->value(0).toString());
     }
     
     return groups;
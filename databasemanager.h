@@ -0,0 +1,197 @@
+#ifndef DATABASEMANAGER_H
+#define DATABASEMANAGER_H
+
+#include <QObject>
+#include <QSqlDatabase>
+#include <QSqlQuery>
+#include <QSqlError>
+#include <QDateTime>
+#include <QString>
+#include <QList>
+#include <QHash>
+#include <QPair>
+#include <functional>
+#include "statementcache.h"
+
+class DatabaseWriter;
+
+struct UserInfo {
+    int userId = 0;
+    QString username;
+    QString nickname;
+    QString avatar;
+    bool isOnline = false;
+};
+
+struct ContactInfo {
+    int userId = 0;
+    int contactId = 0;
+    QString contactName;
+    QString groupName;
+    bool isGroup = false;
+    qint64 lastMessageTime = 0; // UTC毫秒数
+};
+
+struct MessageInfo {
+    int messageId = 0;
+    int fromUserId = 0;
+    int toUserId = 0;
+    QString content;
+    int messageType = 0;     // 0:文本
+    bool isGroup = false;
+    qint64 timestamp = 0;    // 发送时间，UTC毫秒数；只在显示时格式化
+    qint64 clientMsgId = 0;  // 客户端生成的消息ID，用于送达确认和去重
+    int deliveryState = 0;   // 发送状态，见 NetworkManager::DeliveryState
+    qint64 convSeq = 0;      // 服务器分配的会话序号，会话内按它排列；0表示尚未分配（如未确认的自己发出的消息）
+};
+
+// 历史消息分页游标：一条消息在会话中的位置。会话内的显示顺序为有会话序号的消息按 (conv_seq, message_id) 升序，
+// 之后是未分配序号的消息按 message_id 升序。空游标在向前翻页时表示最新处，向后翻页时表示最早处
+struct MessageCursor {
+    qint64 convSeq = 0;
+    qint64 messageId = 0;
+
+    bool isNull() const { return convSeq == 0 && messageId == 0; }
+    static MessageCursor at(const MessageInfo& message)
+    {
+        MessageCursor cursor;
+        cursor.convSeq = message.convSeq;
+        cursor.messageId = message.messageId;
+        return cursor;
+    }
+};
+
+// SQLite连接的性能参数，主连接和写线程的连接打开时应用
+struct DatabaseProfile {
+    bool wal = true;                   // WAL日志：提交只追加日志，读写互不阻塞；文件系统不支持时保持原日志模式
+    bool synchronousNormal = true;     // WAL下提交不等待fsync，检查点时才同步；非WAL模式下始终为FULL
+    qint64 mmapSize = 256 * 1024 * 1024; // 内存映射读取的字节数，0为关闭
+    int cacheSizeKb = 16 * 1024;       // 每个连接的页缓存
+    bool tempStoreMemory = true;       // 排序和临时索引放在内存中
+    int busyTimeoutMs = 5000;          // 另一连接持有锁时等待的时间
+    int walAutoCheckpointPages = 1000; // 写线程提交后WAL超过该页数时做一次检查点
+    int checkpointIntervalMs = 30000;  // 写线程定时检查点的间隔，0为关闭
+};
+
+class DatabaseManager : public QObject
+{
+    Q_OBJECT
+
+public:
+    static DatabaseManager& instance();
+
+    // 性能参数，需在 init 之前设置
+    void setProfile(const DatabaseProfile& profile) { m_profile = profile; }
+    DatabaseProfile profile() const { return m_profile; }
+    // 在连接上应用性能参数；setJournalMode 为true时设置日志模式（需在没有其他连接时），返回是否处于WAL模式
+    static bool applyProfile(QSqlDatabase& db, const DatabaseProfile& profile, bool setJournalMode);
+
+    bool init();
+    // 提交写线程中排队的操作后关闭数据库，退出前调用
+    void close();
+    // 实际使用的日志模式，如 "wal"、"delete"
+    QString journalMode();
+    // 主连接的预编译语句缓存命中情况（写线程的见 DatabaseWriter::statementCacheStats）
+    StatementCache::Stats statementCacheStats() const { return m_statements.stats(); }
+
+    // 消息写入线程：收发消息产生的写操作都经由它异步提交，界面线程不等待磁盘。
+    // 本类的其他方法仍在调用线程中同步执行
+    DatabaseWriter* writer() const { return m_writer; }
+
+    // sync_state 中的游标名称
+    static const char* const RosterVersionKey;
+    static const char* const LastSeqKey;
+
+    // 用户
+    bool registerUser(const QString& username, const QString& password, const QString& nickname);
+    bool loginUser(const QString& username, const QString& password, int& userId, QString& nickname);
+    bool updateUserStatus(int userId, bool isOnline);
+    UserInfo getUserInfo(int userId);
+
+    // 联系人
+    bool addContact(int userId, int contactId, const QString& contactName,
+                    const QString& groupName = "默认分组", bool isGroup = false);
+    bool removeContact(int userId, int contactId);
+    QList<ContactInfo> getContacts(int userId);
+    bool updateContactLastMessage(int userId, int contactId, qint64 time);
+    // 在一个事务中应用联系人同步结果并记录新的花名册版本：upserts 批量插入或更新，
+    // removed 批量删除；full 为true时 upserts 是完整列表，本地多出的联系人也被删除并追加到 removed。
+    // 首次同步（本地花名册版本为0）时本地多出的联系人是从未上传过的本地添加，保留并追加到 unsynced
+    bool applyContactDelta(int userId, const QList<ContactInfo>& upserts, QList<int>& removed,
+                           bool full, qint64 rosterVersion, QList<ContactInfo>* unsynced = nullptr);
+    qint64 rosterVersion(int userId);
+    // 已入库消息的最大服务器序号（重连追赶的同步游标）
+    qint64 lastSyncSeq(int userId);
+
+    // 同步状态（按用户保存的同步游标）
+    qint64 syncValue(int userId, const QString& name, qint64 defaultValue = 0);
+    bool setSyncValue(int userId, const QString& name, qint64 value);
+
+    // 消息（写入见 DatabaseWriter）
+    // 逐条接收查询结果，返回false停止读取
+    using MessageCallback = std::function<bool(const MessageInfo&)>;
+    // 会话中最新的 limit 条消息
+    QList<MessageInfo> getMessages(int userId, int contactId, int limit = 100, bool isGroup = false);
+    // 按游标分页：游标之前（更早）或之后（更新）的最多 limit 条消息，结果已按显示顺序排列。
+    // 沿 (conversation_id, conv_seq, message_id) 索引定位到游标后顺序读取，翻到多深的历史代价都相同
+    QList<MessageInfo> getMessagesBefore(qint64 conversationId, const MessageCursor& cursor, int limit);
+    QList<MessageInfo> getMessagesAfter(qint64 conversationId, const MessageCursor& cursor, int limit);
+    // 同上，按显示顺序逐条交给 callback，不在内存中组装整页；返回读取的条数
+    int forEachMessageBefore(qint64 conversationId, const MessageCursor& cursor, int limit,
+                             const MessageCallback& callback);
+    int forEachMessageAfter(qint64 conversationId, const MessageCursor& cursor, int limit,
+                            const MessageCallback& callback);
+    QList<MessageInfo> getRecentMessages(int userId, int limit = 50);
+    // 会话ID：单聊由两个用户ID组成（与方向无关），群为负的群ID。消息按它建索引，打开会话是一次索引范围扫描
+    static qint64 conversationId(int fromUserId, int toUserId, bool isGroup);
+
+    // 离线发件箱：自己发出的消息与消息记录在同一事务中写入发件箱，服务器确认或最终失败后移出。
+    // 进程重启后未确认的消息仍在发件箱中，重新上线后按客户端消息ID顺序继续发送
+    QList<MessageInfo> getOutgoingMessages(int userId, qint64 afterClientMsgId, int limit);
+
+    // 分组
+    bool addGroup(const QString& groupName, int userId);
+    QList<QString> getGroups(int userId);
+
+private:
+    explicit DatabaseManager(QObject* parent = nullptr);
+    ~DatabaseManager();
+    DatabaseManager(const DatabaseManager&) = delete;
+    DatabaseManager& operator=(const DatabaseManager&) = delete;
+
+    // 数据库结构版本（PRAGMA user_version）：修改表结构时加一，并在 Migrations 末尾追加对应的升级步骤
+    static const int SchemaVersion = 5;
+    static const int MigrationBatchSize = 10000;
+
+    struct Migration {
+        int version;
+        const char* description;
+        bool (DatabaseManager::*apply)();
+    };
+    static const Migration Migrations[];
+
+    bool createTables();
+    bool createIndexes();
+    bool migrate(int fromVersion);
+    bool migrateUniqueContacts();
+    bool migrateDeliveryState();
+    bool migrateConversationSeq();
+    bool migrateTimestamps();
+    bool migrateConversationIds();
+
+    bool ensureColumn(const QString& table, const QString& column, const QString& definition);
+    bool migrateTimestampColumn(const QString& table, const QString& column, const char* createSql);
+    // sql 的两个参数为 rowid 区间 (after, upTo]，按 rowid 顺序每批 MigrationBatchSize 行、每批一个事务执行
+    bool execInBatches(const QString& table, const QString& sql);
+
+    // 读出查询结果中的消息交给 callback；callback 要求停止时把 *stopped 置为true
+    int readMessages(QSqlQuery& query, const MessageCallback& callback, bool* stopped);
+
+    QSqlDatabase m_db;
+    StatementCache m_statements;
+    QString m_dbPath;
+    DatabaseProfile m_profile;
+    DatabaseWriter* m_writer;
+};
+
+#endif // DATABASEMANAGER_H
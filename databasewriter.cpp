@@ -0,0 +1,403 @@
+#include "databasewriter.h"
+#include <QSqlError>
+#include <QTimer>
+#include <QMutexLocker>
+#include <QVariantList>
+#include <QPair>
+#include <QDebug>
+
+namespace {
+const char* const InsertMessageSql =
+    "INSERT INTO messages (from_user_id, to_user_id, content, message_type, is_group, timestamp, "
+    "client_msg_id, delivery_state, conv_seq, conversation_id) VALUES (?, ?, ?, ?, ?, ?, ?, ?, ?, ?)";
+const char* const UpdateLastMessageTimeSql =
+    "UPDATE contacts SET last_message_time = ? WHERE user_id = ? AND contact_id = ?";
+const char* const SetSyncValueSql = "INSERT OR REPLACE INTO sync_state (user_id, name, value) VALUES (?, ?, ?)";
+const char* const InsertOutboxSql =
+    "INSERT INTO outbox (client_msg_id, user_id, to_user_id, content, is_group, timestamp) VALUES (?, ?, ?, ?, ?, ?)";
+const char* const DeleteOutboxSql = "DELETE FROM outbox WHERE client_msg_id = ? AND user_id = ?";
+// 客户端消息ID只在发送方内唯一，收到的消息保存的是对方生成的ID：只更新自己发出的消息
+const char* const UpdateDeliveryStateSql =
+    "UPDATE messages SET delivery_state = ? WHERE client_msg_id = ? AND from_user_id = ?";
+const char* const UpdateConvSeqSql = "UPDATE messages SET conv_seq = ? WHERE client_msg_id = ? AND from_user_id = ?";
+}
+
+DatabaseWriter::DatabaseWriter(const QString& path, QObject* parent)
+    : QObject(parent)
+    , m_path(path)
+    , m_thread(nullptr)
+    , m_flushScheduled(false)
+    , m_nextTicket(0)
+    , m_connectionName(QString("chat-writer-%1").arg(reinterpret_cast<quintptr>(this)))
+    , m_wal(false)
+    , m_checkpointTimer(nullptr)
+{
+    qRegisterMetaType<WriteResult>();
+    qRegisterMetaType<QVector<WriteResult>>();
+}
+
+DatabaseWriter::~DatabaseWriter()
+{
+    stop();
+}
+
+QSqlDatabase DatabaseWriter::database()
+{
+    QSqlDatabase db = QSqlDatabase::database(m_connectionName, false);
+    if (db.isOpen()) {
+        return db;
+    }
+    
+    if (!db.isValid()) {
+        db = QSqlDatabase::addDatabase("QSQLITE", m_connectionName);
+        db.setDatabaseName(m_path);
+    }
+    if (!db.open()) {
+        qDebug() << "写线程无法打开数据库:" << db.lastError().text();
+        return db;
+    }
+    
+    // 日志模式已由主连接设置，这里只应用连接级的参数；WAL提交后由本连接自动检查点
+    m_statements.setDatabase(db);
+    m_wal = DatabaseManager::applyProfile(db, m_profile, false);
+    if (m_wal) {
+        QSqlQuery query(db);
+        query.exec(QString("PRAGMA wal_autocheckpoint = %1").arg(m_profile.walAutoCheckpointPages));
+    }
+    return db;
+}
+
+void DatabaseWriter::start()
+{
+    if (m_thread) {
+        return;
+    }
+    
+    m_thread = new QThread;
+    m_thread->setObjectName("chat-db-writer");
+    moveToThread(m_thread);
+    m_thread->start();
+    
+    // 主连接不做自动检查点，由写线程定时补做：界面线程的写入（联系人同步等）也会使WAL增长
+    QMetaObject::invokeMethod(this, [this]() {
+        database();
+        if (m_wal && m_profile.checkpointIntervalMs > 0) {
+            m_checkpointTimer = new QTimer(this);
+            connect(m_checkpointTimer, &QTimer::timeout, this, &DatabaseWriter::checkpoint);
+            m_checkpointTimer->start(m_profile.checkpointIntervalMs);
+        }
+    }, Qt::QueuedConnection);
+    
+    // 启动前排队的操作
+    QMutexLocker locker(&m_mutex);
+    if (!m_pending.isEmpty()) {
+        m_flushScheduled = true;
+        QMetaObject::invokeMethod(this, "flush", Qt::QueuedConnection);
+    }
+}
+
+void DatabaseWriter::stop()
+{
+    if (!m_thread) {
+        return;
+    }
+    
+    // 在写线程中提交剩余的操作并关闭连接，然后把对象交还给调用线程
+    QThread* owner = QThread::currentThread();
+    QMetaObject::invokeMethod(this, [this, owner]() {
+        flush();
+        delete m_checkpointTimer;
+        m_checkpointTimer = nullptr;
+        m_statements.clear();
+        {
+            // 退出前把WAL全部写回并截断，下次启动不必先恢复一个大的WAL文件
+            QSqlDatabase db = QSqlDatabase::database(m_connectionName, false);
+            if (db.isOpen() && m_wal) {
+                QSqlQuery query(db);
+                query.exec("PRAGMA wal_checkpoint(TRUNCATE)");
+            }
+            db.close();
+        }
+        QSqlDatabase::removeDatabase(m_connectionName);
+        moveToThread(owner);
+    }, Qt::BlockingQueuedConnection);
+    
+    m_thread->quit();
+    m_thread->wait();
+    delete m_thread;
+    m_thread = nullptr;
+}
+
+quint64 DatabaseWriter::saveMessages(const QList<MessageInfo>& messages, int syncUserId, qint64 lastSeq)
+{
+    Operation operation;
+    operation.kind = SaveMessages;
+    operation.messages = messages;
+    operation.userId = syncUserId;
+    operation.value = lastSeq;
+    return enqueue(operation);
+}
+
+quint64 DatabaseWriter::saveOutgoingMessage(const MessageInfo& message)
+{
+    Operation operation;
+    operation.kind = SaveOutgoingMessage;
+    operation.messages.append(message);
+    return enqueue(operation);
+}
+
+quint64 DatabaseWriter::completeOutgoingMessages(int userId, const QList<qint64>& clientMsgIds, int deliveryState)
+{
+    Operation operation;
+    operation.kind = CompleteOutgoingMessages;
+    operation.userId = userId;
+    operation.clientMsgIds = clientMsgIds;
+    operation.value = deliveryState;
+    return enqueue(operation);
+}
+
+quint64 DatabaseWriter::setMessageConvSeqs(int userId, const QHash<qint64, qint64>& convSeqs)
+{
+    Operation operation;
+    operation.kind = SetMessageConvSeqs;
+    operation.userId = userId;
+    operation.convSeqs = convSeqs;
+    return enqueue(operation);
+}
+
+quint64 DatabaseWriter::enqueue(Operation& operation)
+{
+    QMutexLocker locker(&m_mutex);
+    operation.ticket = ++m_nextTicket;
+    m_pending.append(operation);
+    if (!m_thread) {
+        return operation.ticket;
+    }
+    
+    // 攒满一批立即提交；否则为一批操作只安排一次延迟提交，定时器在写线程中启动
+    if (m_pending.size() == MaxBatchOperations) {
+        QMetaObject::invokeMethod(this, "flush", Qt::QueuedConnection);
+    } else if (!m_flushScheduled) {
+        m_flushScheduled = true;
+        QMetaObject::invokeMethod(this, [this]() {
+            QTimer::singleShot(FlushDelayMs, this, &DatabaseWriter::flush);
+        }, Qt::QueuedConnection);
+    }
+    return operation.ticket;
+}
+
+void DatabaseWriter::flush()
+{
+    // 每个事务最多 MaxBatchOperations 个操作，积压时连续提交多批
+    for (;;) {
+        QVector<Operation> operations;
+        {
+            QMutexLocker locker(&m_mutex);
+            if (m_pending.size() <= MaxBatchOperations) {
+                operations.swap(m_pending);
+                m_flushScheduled = false;
+            } else {
+                operations = m_pending.mid(0, MaxBatchOperations);
+                m_pending.remove(0, MaxBatchOperations);
+            }
+        }
+        if (operations.isEmpty()) {
+            return;
+        }
+        
+        commit(operations);
+        if (operations.size() < MaxBatchOperations) {
+            return;
+        }
+    }
+}
+
+void DatabaseWriter::commit(const QVector<Operation>& operations)
+{
+    QVector<WriteResult> results;
+    results.reserve(operations.size());
+    for (const Operation& operation : operations) {
+        WriteResult result;
+        result.ticket = operation.ticket;
+        results.append(result);
+    }
+    
+    QSqlDatabase db = database();
+    if (!db.isOpen() || !db.transaction()) {
+        qDebug() << "丢弃" << operations.size() << "个待写入的操作:" << db.lastError().text();
+        emit operationsFinished(results);
+        return;
+    }
+    
+    for (int i = 0; i < operations.size(); ++i) {
+        // 每个操作在自己的保存点中执行：失败只撤销该操作，同一批的其他操作照常提交
+        m_statements.prepare("SAVEPOINT operation")->exec();
+        results[i].success = apply(operations.at(i));
+        if (!results[i].success) {
+            m_statements.prepare("ROLLBACK TO operation")->exec();
+        }
+        m_statements.prepare("RELEASE operation")->exec();
+    }
+    
+    if (!db.commit()) {
+        qDebug() << "提交" << operations.size() << "个写操作失败:" << db.lastError().text();
+        db.rollback();
+        for (WriteResult& result : results) {
+            result.success = false;
+        }
+    }
+    
+    emit operationsFinished(results);
+}
+
+bool DatabaseWriter::apply(const Operation& operation)
+{
+    switch (operation.kind) {
+    case SaveMessages:
+        if (!insertMessages(operation.messages)) {
+            return false;
+        }
+        if (operation.value > 0 && operation.userId > 0) {
+            StatementCache::Statement query = m_statements.prepare(SetSyncValueSql);
+            query->addBindValue(operation.userId);
+            query->addBindValue(DatabaseManager::LastSeqKey);
+            query->addBindValue(operation.value);
+            if (!query->exec()) {
+                qDebug() << "保存同步游标失败:" << query->lastError().text();
+                return false;
+            }
+        }
+        return true;
+        
+    case SaveOutgoingMessage: {
+        const MessageInfo& message = operation.messages.first();
+        StatementCache::Statement query = m_statements.prepare(InsertOutboxSql);
+        query->addBindValue(message.clientMsgId);
+        query->addBindValue(message.fromUserId);
+        query->addBindValue(message.toUserId);
+        query->addBindValue(message.content);
+        query->addBindValue(message.isGroup ? 1 : 0);
+        query->addBindValue(message.timestamp);
+        if (!query->exec()) {
+            qDebug() << "保存待发送消息失败:" << query->lastError().text();
+            return false;
+        }
+        return insertMessages(operation.messages);
+    }
+    
+    case CompleteOutgoingMessages: {
+        if (operation.clientMsgIds.isEmpty()) {
+            return true;
+        }
+        QVariantList ids;
+        QVariantList states;
+        QVariantList userIds;
+        ids.reserve(operation.clientMsgIds.size());
+        states.reserve(operation.clientMsgIds.size());
+        userIds.reserve(operation.clientMsgIds.size());
+        for (qint64 id : operation.clientMsgIds) {
+            ids.append(id);
+            states.append(operation.value);
+            userIds.append(operation.userId);
+        }
+        
+        StatementCache::Statement deleteOutbox = m_statements.prepare(DeleteOutboxSql);
+        StatementCache::Statement updateState = m_statements.prepare(UpdateDeliveryStateSql);
+        deleteOutbox->addBindValue(ids);
+        deleteOutbox->addBindValue(userIds);
+        updateState->addBindValue(states);
+        updateState->addBindValue(ids);
+        updateState->addBindValue(userIds);
+        if (!deleteOutbox->execBatch() || !updateState->execBatch()) {
+            qDebug() << "更新消息发送状态失败:" << updateState->lastError().text();
+            return false;
+        }
+        return true;
+    }
+    
+    case SetMessageConvSeqs: {
+        if (operation.convSeqs.isEmpty()) {
+            return true;
+        }
+        QVariantList seqs;
+        QVariantList ids;
+        QVariantList userIds;
+        seqs.reserve(operation.convSeqs.size());
+        ids.reserve(operation.convSeqs.size());
+        userIds.reserve(operation.convSeqs.size());
+        for (auto it = operation.convSeqs.constBegin(); it != operation.convSeqs.constEnd(); ++it) {
+            ids.append(it.key());
+            seqs.append(it.value());
+            userIds.append(operation.userId);
+        }
+        
+        StatementCache::Statement query = m_statements.prepare(UpdateConvSeqSql);
+        query->addBindValue(seqs);
+        query->addBindValue(ids);
+        query->addBindValue(userIds);
+        if (!query->execBatch()) {
+            qDebug() << "更新会话序号失败:" << query->lastError().text();
+            return false;
+        }
+        return true;
+    }
+    }
+    return false;
+}
+
+bool DatabaseWriter::insertMessages(const QList<MessageInfo>& messages)
+{
+    StatementCache::Statement query = m_statements.prepare(InsertMessageSql);
+    
+    // (user_id, contact_id) -> 本批中最后一条消息的时间
+    QHash<QPair<int, int>, qint64> lastMessageTimes;
+    for (const MessageInfo& message : messages) {
+        query->addBindValue(message.fromUserId);
+        query->addBindValue(message.toUserId);
+        query->addBindValue(message.content);
+        query->addBindValue(message.messageType);
+        query->addBindValue(message.isGroup ? 1 : 0);
+        query->addBindValue(message.timestamp);
+        query->addBindValue(message.clientMsgId);
+        query->addBindValue(message.deliveryState);
+        query->addBindValue(message.convSeq);
+        query->addBindValue(DatabaseManager::conversationId(message.fromUserId, message.toUserId, message.isGroup));
+        if (!query->exec()) {
+            qDebug() << "保存消息失败:" << query->lastError().text();
+            return false;
+        }
+        
+        qint64& time = lastMessageTimes[qMakePair(message.fromUserId, message.toUserId)];
+        time = qMax(time, message.timestamp);
+        if (!message.isGroup) {
+            qint64& reverseTime = lastMessageTimes[qMakePair(message.toUserId, message.fromUserId)];
+            reverseTime = qMax(reverseTime, message.timestamp);
+        }
+    }
+    
+    StatementCache::Statement update = m_statements.prepare(UpdateLastMessageTimeSql);
+    for (auto it = lastMessageTimes.constBegin(); it != lastMessageTimes.constEnd(); ++it) {
+        update->addBindValue(it.value());
+        update->addBindValue(it.key().first);
+        update->addBindValue(it.key().second);
+        if (!update->exec()) {
+            qDebug() << "更新最后消息时间失败:" << update->lastError().text();
+            return false;
+        }
+    }
+    return true;
+}
+
+void DatabaseWriter::checkpoint()
+{
+    QSqlDatabase db = database();
+    if (!db.isOpen() || !m_wal) {
+        return;
+    }
+    
+    // PASSIVE：不等待也不阻塞正在读取的连接，读者仍在使用的页留到下一次
+    QSqlQuery query(db);
+    if (!query.exec("PRAGMA wal_checkpoint(PASSIVE)") || !query.next()) {
+        qDebug() << "WAL检查点失败:" << query.lastError().text();
+    }
+}
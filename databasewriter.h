@@ -0,0 +1,103 @@
+#ifndef DATABASEWRITER_H
+#define DATABASEWRITER_H
+
+#include <QObject>
+#include <QThread>
+#include <QMutex>
+#include <QVector>
+#include <QList>
+#include <QHash>
+#include <QSqlDatabase>
+#include <QSqlQuery>
+#include "databasemanager.h"
+#include "statementcache.h"
+
+// 一个写操作的结果，ticket 为排队时返回的操作编号
+struct WriteResult {
+    quint64 ticket = 0;
+    bool success = false;
+};
+Q_DECLARE_METATYPE(WriteResult)
+
+// 消息写入线程：持有独立的数据库连接，界面线程只把写操作排进队列，不等待磁盘。
+// 排队的操作合并为组事务提交，攒满 MaxBatchOperations 个或第一个操作排队后 FlushDelayMs 毫秒，先到者为准；
+// 每个操作在自己的保存点中执行，失败只撤销该操作。提交后通过 operationsFinished 报告每个操作的结果
+class QTimer;
+
+class DatabaseWriter : public QObject
+{
+    Q_OBJECT
+
+public:
+    static const int MaxBatchOperations = 256;
+    static const int FlushDelayMs = 20;
+
+    explicit DatabaseWriter(const QString& path, QObject* parent = nullptr);
+    ~DatabaseWriter();
+
+    // 性能参数，需在 start 之前设置
+    void setProfile(const DatabaseProfile& profile) { m_profile = profile; }
+    // 写线程连接的预编译语句缓存命中情况
+    StatementCache::Stats statementCacheStats() const { return m_statements.stats(); }
+
+    // 启动写线程；stop 提交排队中的全部操作后结束写线程
+    void start();
+    void stop();
+
+    // 以下方法可在任意线程调用，返回操作编号
+    // 保存一批消息，每个会话的最后消息时间只更新一次；lastSeq 大于0时同时把 syncUserId 的同步游标推进到该值
+    quint64 saveMessages(const QList<MessageInfo>& messages, int syncUserId = 0, qint64 lastSeq = 0);
+    // 自己发出的消息与发件箱记录一起写入；服务器确认或最终失败后由 completeOutgoingMessages 移出发件箱。
+    // 客户端消息ID只在发送方内唯一，以下两个操作只匹配 userId 发出的消息
+    quint64 saveOutgoingMessage(const MessageInfo& message);
+    quint64 completeOutgoingMessages(int userId, const QList<qint64>& clientMsgIds, int deliveryState);
+    // 记录服务器在确认中为自己发出的消息分配的会话序号（客户端消息ID -> 会话序号）
+    quint64 setMessageConvSeqs(int userId, const QHash<qint64, qint64>& convSeqs);
+
+signals:
+    // 在写线程中发出，每次提交一次，按排队顺序列出该事务中的操作
+    void operationsFinished(const QVector<WriteResult>& results);
+
+private slots:
+    void flush();
+    // WAL检查点：把已提交的页写回数据库文件，WAL不会无限增长
+    void checkpoint();
+
+private:
+    enum OperationKind {
+        SaveMessages,
+        SaveOutgoingMessage,
+        CompleteOutgoingMessages,
+        SetMessageConvSeqs
+    };
+
+    struct Operation {
+        OperationKind kind = SaveMessages;
+        quint64 ticket = 0;
+        QList<MessageInfo> messages;
+        int userId = 0;      // 同步游标所属的用户，或发出消息的用户
+        qint64 value = 0;    // 同步游标或发送状态
+        QList<qint64> clientMsgIds;
+        QHash<qint64, qint64> convSeqs;
+    };
+
+    quint64 enqueue(Operation& operation);
+    QSqlDatabase database();
+    void commit(const QVector<Operation>& operations);
+    bool apply(const Operation& operation);
+    bool insertMessages(const QList<MessageInfo>& messages);
+
+    QString m_path;
+    QThread* m_thread;
+    QMutex m_mutex;
+    QVector<Operation> m_pending;
+    bool m_flushScheduled;
+    quint64 m_nextTicket;
+    QString m_connectionName;
+    StatementCache m_statements; // 写线程连接的语句，只在写线程中使用
+    DatabaseProfile m_profile;
+    bool m_wal;
+    QTimer* m_checkpointTimer;
+};
+
+#endif // DATABASEWRITER_H
@@ -0,0 +1,121 @@
+#include "framecapture.h"
+#include "framedecoder.h"
+#include <QtEndian>
+#include <QDebug>
+#include <cstring>
+
+namespace {
+const quint32 CaptureMagic = 0x43434150; // "CCAP"
+const quint32 CaptureVersion = 1;
+const int FileHeaderSize = 16;
+const int RecordHeaderSize = 8 + FrameDecoder::HeaderSize;
+}
+
+FrameCaptureWriter::FrameCaptureWriter()
+    : m_readTimeUs(0)
+    , m_frameCount(0)
+{
+}
+
+FrameCaptureWriter::~FrameCaptureWriter()
+{
+    close();
+}
+
+bool FrameCaptureWriter::open(const QString& path, QString* errorString)
+{
+    close();
+    m_file.setFileName(path);
+    if (!m_file.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+        if (errorString) {
+            *errorString = m_file.errorString();
+        }
+        return false;
+    }
+    
+    char header[FileHeaderSize];
+    qToBigEndian<quint32>(CaptureMagic, header);
+    qToBigEndian<quint32>(CaptureVersion, header + 4);
+    qToBigEndian<qint64>(QDateTime::currentMSecsSinceEpoch(), header + 8);
+    m_file.write(header, FileHeaderSize);
+    
+    m_clock.start();
+    m_readTimeUs = 0;
+    m_frameCount = 0;
+    return true;
+}
+
+void FrameCaptureWriter::close()
+{
+    if (m_file.isOpen()) {
+        m_file.close();
+    }
+}
+
+void FrameCaptureWriter::beginRead()
+{
+    m_readTimeUs = m_clock.nsecsElapsed() / 1000;
+}
+
+void FrameCaptureWriter::write(const QByteArray& frame, int flags)
+{
+    if (!m_file.isOpen()) {
+        return;
+    }
+    
+    // 记录头部和负载拼成一次写入，QFile自带缓冲，不会每帧都进行系统调用
+    m_record.resize(RecordHeaderSize + frame.size());
+    char* data = m_record.data();
+    qToBigEndian<qint64>(m_readTimeUs, data);
+    FrameDecoder::writeHeader(data + 8, static_cast<quint32>(frame.size()), flags);
+    memcpy(data + RecordHeaderSize, frame.constData(), frame.size());
+    if (m_file.write(m_record) != m_record.size()) {
+        qDebug() << "写入抓包文件失败:" << m_file.errorString();
+        close();
+        return;
+    }
+    ++m_frameCount;
+}
+
+FrameCaptureReader::FrameCaptureReader()
+{
+}
+
+bool FrameCaptureReader::open(const QString& path, QString* errorString)
+{
+    m_file.setFileName(path);
+    if (!m_file.open(QIODevice::ReadOnly)) {
+        if (errorString) {
+            *errorString = m_file.errorString();
+        }
+        return false;
+    }
+    
+    QByteArray header = m_file.read(FileHeaderSize);
+    if (header.size() != FileHeaderSize
+        || qFromBigEndian<quint32>(header.constData()) != CaptureMagic
+        || qFromBigEndian<quint32>(header.constData() + 4) != CaptureVersion) {
+        if (errorString) {
+            *errorString = QStringLiteral("不是有效的抓包文件");
+        }
+        m_file.close();
+        return false;
+    }
+    m_startTime = QDateTime::fromMSecsSinceEpoch(qFromBigEndian<qint64>(header.constData() + 8));
+    return true;
+}
+
+bool FrameCaptureReader::readNext(Record& record)
+{
+    char header[RecordHeaderSize];
+    if (m_file.read(header, RecordHeaderSize) != RecordHeaderSize) {
+        return false;
+    }
+    
+    record.arrivalUs = qFromBigEndian<qint64>(header);
+    quint32 length = qFromBigEndian<quint32>(header + 8) & FrameDecoder::LengthMask;
+    record.frame.resize(FrameDecoder::HeaderSize + static_cast<int>(length));
+    memcpy(record.frame.data(), header + 8, FrameDecoder::HeaderSize);
+    // 抓包在写入中途被中断时最后一条记录不完整，视为文件结束
+    return m_file.read(record.frame.data() + FrameDecoder::HeaderSize, length) == static_cast<qint64>(length);
+}
@@ -0,0 +1,61 @@
+#ifndef FRAMECAPTURE_H
+#define FRAMECAPTURE_H
+
+#include <QByteArray>
+#include <QDateTime>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QString>
+
+// 入站帧抓包文件格式（大端）：
+//   文件头：4字节魔数 "CCAP"、4字节版本号、8字节开始抓包时的时间（自1970年的毫秒数）
+//   记录：8字节到达时间（相对开始抓包的微秒数）+ 与线路上完全相同的帧（4字节头部 + 负载）
+// 同一次读取中解出的帧到达时间相同，重放时据此还原原来的批次边界
+
+// 在网络线程中逐帧写入抓包文件
+class FrameCaptureWriter
+{
+public:
+    FrameCaptureWriter();
+    ~FrameCaptureWriter();
+
+    bool open(const QString& path, QString* errorString = nullptr);
+    void close();
+    bool isOpen() const { return m_file.isOpen(); }
+
+    // 开始一次socket读取，之后写入的帧都记为该时刻到达
+    void beginRead();
+    // frame 为帧负载（未解压），flags 为帧头部中的标志
+    void write(const QByteArray& frame, int flags);
+    quint64 frameCount() const { return m_frameCount; }
+
+private:
+    QFile m_file;
+    QElapsedTimer m_clock;
+    qint64 m_readTimeUs;
+    quint64 m_frameCount;
+    QByteArray m_record; // 复用的记录缓冲区
+};
+
+// 顺序读取抓包文件
+class FrameCaptureReader
+{
+public:
+    struct Record {
+        qint64 arrivalUs = 0;
+        QByteArray frame; // 完整的线路帧（含头部），可直接交给 FrameDecoder
+    };
+
+    FrameCaptureReader();
+
+    bool open(const QString& path, QString* errorString = nullptr);
+    QDateTime startTime() const { return m_startTime; }
+    // 读取下一条记录；到达文件末尾或记录不完整时返回false
+    bool readNext(Record& record);
+
+private:
+    QFile m_file;
+    QDateTime m_startTime;
+};
+
+#endif // FRAMECAPTURE_H
@@ -0,0 +1,89 @@
+#include "framecompressor.h"
+#include <QtEndian>
+#include <zlib.h>
+
+namespace {
+const int LengthPrefixSize = 4;
+}
+
+FrameCompressor::FrameCompressor(int level)
+    : m_deflate(nullptr)
+    , m_inflate(nullptr)
+    , m_level(level)
+{
+}
+
+FrameCompressor::~FrameCompressor()
+{
+    if (m_deflate) {
+        deflateEnd(m_deflate);
+        delete m_deflate;
+    }
+    if (m_inflate) {
+        inflateEnd(m_inflate);
+        delete m_inflate;
+    }
+}
+
+bool FrameCompressor::compress(const char* data, int size, QByteArray& out)
+{
+    if (!m_deflate) {
+        m_deflate = new z_stream();
+        if (deflateInit(m_deflate, m_level) != Z_OK) {
+            delete m_deflate;
+            m_deflate = nullptr;
+            return false;
+        }
+    } else {
+        deflateReset(m_deflate);
+    }
+    
+    uLong bound = deflateBound(m_deflate, static_cast<uLong>(size));
+    out.resize(LengthPrefixSize + static_cast<int>(bound));
+    qToBigEndian<quint32>(static_cast<quint32>(size), out.data());
+    
+    m_deflate->next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data));
+    m_deflate->avail_in = static_cast<uInt>(size);
+    m_deflate->next_out = reinterpret_cast<Bytef*>(out.data() + LengthPrefixSize);
+    m_deflate->avail_out = static_cast<uInt>(bound);
+    
+    if (deflate(m_deflate, Z_FINISH) != Z_STREAM_END) {
+        return false;
+    }
+    
+    out.resize(LengthPrefixSize + static_cast<int>(m_deflate->total_out));
+    return true;
+}
+
+bool FrameCompressor::decompress(const char* data, int size, QByteArray& out, quint32 maxSize)
+{
+    if (size < LengthPrefixSize) {
+        return false;
+    }
+    
+    quint32 originalSize = qFromBigEndian<quint32>(data);
+    if (originalSize > maxSize) {
+        return false;
+    }
+    
+    if (!m_inflate) {
+        m_inflate = new z_stream();
+        if (inflateInit(m_inflate) != Z_OK) {
+            delete m_inflate;
+            m_inflate = nullptr;
+            return false;
+        }
+    } else {
+        inflateReset(m_inflate);
+    }
+    
+    out.resize(static_cast<int>(originalSize));
+    
+    m_inflate->next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data + LengthPrefixSize));
+    m_inflate->avail_in = static_cast<uInt>(size - LengthPrefixSize);
+    m_inflate->next_out = reinterpret_cast<Bytef*>(out.data());
+    m_inflate->avail_out = static_cast<uInt>(originalSize);
+    
+    int result = inflate(m_inflate, Z_FINISH);
+    return result == Z_STREAM_END && m_inflate->total_out == originalSize;
+}
@@ -0,0 +1,31 @@
+#ifndef FRAMECOMPRESSOR_H
+#define FRAMECOMPRESSOR_H
+
+#include <QByteArray>
+
+struct z_stream_s;
+
+// 帧负载压缩（zlib）
+// 压缩/解压上下文在对象生命周期内复用（deflateReset/inflateReset），不为每帧重新分配；
+// 压缩结果为 4字节大端原始长度 + zlib数据，解压时据此一次性分配输出并检查上限
+class FrameCompressor
+{
+public:
+    explicit FrameCompressor(int level = 6);
+    ~FrameCompressor();
+
+    // 压缩 data 到 out（out 的容量会被复用），失败返回false
+    bool compress(const char* data, int size, QByteArray& out);
+    // 解压到 out，原始长度超过 maxSize 时返回false
+    bool decompress(const char* data, int size, QByteArray& out, quint32 maxSize);
+
+private:
+    FrameCompressor(const FrameCompressor&) = delete;
+    FrameCompressor& operator=(const FrameCompressor&) = delete;
+
+    z_stream_s* m_deflate;
+    z_stream_s* m_inflate;
+    int m_level;
+};
+
+#endif // FRAMECOMPRESSOR_H
@@ -0,0 +1,122 @@
+#include "framedecoder.h"
+#include <QtEndian>
+#include <cstring>
+
+FrameDecoder::FrameDecoder(quint32 maxFrameSize)
+    : m_readPos(0)
+    , m_writePos(0)
+    , m_maxFrameSize(maxFrameSize)
+    , m_initialCapacity(DefaultInitialCapacity)
+    , m_lastFrameLength(0)
+{
+}
+
+qint64 FrameDecoder::readFrom(QIODevice* device)
+{
+    qint64 available = device->bytesAvailable();
+    if (available <= 0) {
+        return 0;
+    }
+    
+    char* tail = reserveTail(static_cast<int>(available));
+    qint64 bytesRead = device->read(tail, available);
+    if (bytesRead > 0) {
+        m_writePos += static_cast<int>(bytesRead);
+    }
+    return bytesRead;
+}
+
+void FrameDecoder::append(const char* data, int size)
+{
+    if (size <= 0) {
+        return;
+    }
+    
+    char* tail = reserveTail(size);
+    memcpy(tail, data, size);
+    m_writePos += size;
+}
+
+FrameDecoder::Status FrameDecoder::next(QByteArray& frame, int* flags)
+{
+    if (m_writePos - m_readPos < HeaderSize) {
+        return NeedMoreData;
+    }
+    
+    const uchar* header = reinterpret_cast<const uchar*>(m_buffer.constData() + m_readPos);
+    quint32 headerValue = qFromBigEndian<quint32>(header);
+    quint32 msgLength = headerValue & LengthMask;
+    
+    if (msgLength > m_maxFrameSize) {
+        m_lastFrameLength = msgLength;
+        return FrameTooLarge;
+    }
+    
+    if (static_cast<quint32>(m_writePos - m_readPos - HeaderSize) < msgLength) {
+        return NeedMoreData;
+    }
+    
+    if (flags) {
+        *flags = static_cast<int>(headerValue >> FlagShift);
+    }
+    frame = QByteArray::fromRawData(m_buffer.constData() + m_readPos + HeaderSize,
+                                    static_cast<int>(msgLength));
+    m_readPos += HeaderSize + static_cast<int>(msgLength);
+    
+    // 缓冲区已全部消费，游标归零即可，无需移动数据
+    if (m_readPos == m_writePos) {
+        m_readPos = 0;
+        m_writePos = 0;
+    }
+    
+    return FrameReady;
+}
+
+void FrameDecoder::writeHeader(char* dst, quint32 length, int flags)
+{
+    quint32 headerValue = (length & LengthMask) | (static_cast<quint32>(flags) << FlagShift);
+    qToBigEndian<quint32>(headerValue, dst);
+}
+
+void FrameDecoder::squeeze()
+{
+    if (m_readPos == m_writePos && m_buffer.size() > m_initialCapacity) {
+        m_buffer = QByteArray();
+        m_readPos = 0;
+        m_writePos = 0;
+    }
+}
+
+void FrameDecoder::reset()
+{
+    m_readPos = 0;
+    m_writePos = 0;
+    m_lastFrameLength = 0;
+}
+
+char* FrameDecoder::reserveTail(int size)
+{
+    if (m_buffer.size() - m_writePos < size) {
+        int pending = m_writePos - m_readPos;
+        
+        // 先尝试整理：把未消费的数据移到头部
+        if (m_readPos > 0) {
+            if (pending > 0) {
+                memmove(m_buffer.data(), m_buffer.constData() + m_readPos, pending);
+            }
+            m_readPos = 0;
+            m_writePos = pending;
+        }
+        
+        // 整理后仍不够则扩容（按倍数增长，避免频繁分配）
+        if (m_buffer.size() - m_writePos < size) {
+            int capacity = qMax(m_buffer.size(), m_initialCapacity);
+            while (capacity - m_writePos < size) {
+                capacity *= 2;
+            }
+            m_buffer.resize(capacity);
+        }
+    }
+    
+    return m_buffer.data() + m_writePos;
+}
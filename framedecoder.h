@@ -0,0 +1,67 @@
+#ifndef FRAMEDECODER_H
+#define FRAMEDECODER_H
+
+#include <QByteArray>
+#include <QIODevice>
+
+// 长度前缀帧解码器：4字节大端头部 + 负载
+// 头部高2位为帧标志（FrameFlag），低30位为负载长度
+// 使用读游标遍历可复用的缓冲区，仅在尾部空间不足时才整理（memmove）缓冲区，
+// 取出的帧是指向内部缓冲区的视图，不产生拷贝
+class FrameDecoder
+{
+public:
+    enum Status {
+        NeedMoreData,   // 数据不完整，等待更多数据
+        FrameReady,     // 已取出一个完整帧
+        FrameTooLarge   // 长度前缀超过上限，流已不可信
+    };
+
+    // 帧标志，取头部的高2位
+    enum FrameFlag {
+        FlagCbor = 0x1,       // 负载为CBOR编码（否则为JSON）
+        FlagCompressed = 0x2  // 负载经过压缩
+    };
+
+    static const int HeaderSize = 4;
+    static const quint32 LengthMask = 0x3FFFFFFF;
+    static const int FlagShift = 30;
+    static const quint32 DefaultMaxFrameSize = 16 * 1024 * 1024; // 16MB
+    static const int DefaultInitialCapacity = 64 * 1024;
+
+    explicit FrameDecoder(quint32 maxFrameSize = DefaultMaxFrameSize);
+
+    void setMaxFrameSize(quint32 size) { m_maxFrameSize = size; }
+    quint32 maxFrameSize() const { return m_maxFrameSize; }
+    // 缓冲区首次分配的容量；服务器端连接数多，可以设小一些
+    void setInitialCapacity(int capacity) { m_initialCapacity = qMax(HeaderSize, capacity); }
+    // 没有未消费的数据且缓冲区超过初始容量时释放缓冲区（例如收到大帧之后）
+    void squeeze();
+
+    // 从设备读取所有可用数据到缓冲区尾部，返回读取的字节数
+    qint64 readFrom(QIODevice* device);
+    void append(const char* data, int size);
+
+    // 取出下一帧；frame 是内部缓冲区的视图，仅在下一次 readFrom/append/reset 之前有效
+    Status next(QByteArray& frame, int* flags = nullptr);
+
+    // 写入4字节帧头部
+    static void writeHeader(char* dst, quint32 length, int flags);
+
+    void reset();
+    int bufferedBytes() const { return m_writePos - m_readPos; }
+    // 最近一次 FrameTooLarge 时读到的长度前缀
+    quint32 lastFrameLength() const { return m_lastFrameLength; }
+
+private:
+    char* reserveTail(int size);
+
+    QByteArray m_buffer;
+    int m_readPos;
+    int m_writePos;
+    quint32 m_maxFrameSize;
+    int m_initialCapacity;
+    quint32 m_lastFrameLength;
+};
+
+#endif // FRAMEDECODER_H
@@ -0,0 +1,152 @@
+#include "keepalivemanager.h"
+#include <QDebug>
+
+KeepaliveManager::KeepaliveManager(TimerWheel* wheel, QObject* parent)
+    : QObject(parent)
+    , m_wheel(wheel)
+    , m_heartbeatInterval(30000)
+    , m_probeTimeout(5000)
+    , m_peerDetection(false)
+    , m_active(false)
+    , m_lastSent(0)
+    , m_lastReceived(0)
+    , m_awaitingReplySince(-1)
+    , m_probeSent(false)
+    , m_idleTimer(0)
+    , m_probeTimer(0)
+{
+}
+
+void KeepaliveManager::setHeartbeatInterval(int msecs)
+{
+    m_heartbeatInterval = qMax(1, msecs);
+    if (m_active) {
+        armIdleTimer(m_heartbeatInterval);
+    }
+}
+
+void KeepaliveManager::setProbeTimeout(int msecs)
+{
+    m_probeTimeout = qMax(1, msecs);
+}
+
+void KeepaliveManager::setPeerDetectionEnabled(bool enabled)
+{
+    m_peerDetection = enabled;
+    if (!enabled) {
+        m_awaitingReplySince = -1;
+        m_probeSent = false;
+    }
+}
+
+void KeepaliveManager::start()
+{
+    m_active = true;
+    m_lastSent = m_lastReceived = m_wheel->elapsed();
+    m_awaitingReplySince = -1;
+    m_probeSent = false;
+    armIdleTimer(m_heartbeatInterval);
+}
+
+void KeepaliveManager::stop()
+{
+    m_active = false;
+    m_awaitingReplySince = -1;
+    m_probeSent = false;
+    cancelTimers();
+}
+
+void KeepaliveManager::noteSent(bool expectsReply)
+{
+    m_lastSent = m_wheel->elapsed();
+    
+    // 只为最早一个未得到回应的帧计时，之后的帧不再操作定时器
+    if (expectsReply && m_peerDetection && m_active && m_awaitingReplySince < 0) {
+        m_awaitingReplySince = m_lastSent;
+        if (!m_probeTimer) {
+            armProbeTimer();
+        }
+    }
+}
+
+void KeepaliveManager::noteReceived()
+{
+    // 收到任何数据都说明对端存活；探测定时器不取消，到期时发现已有回应即结束
+    m_lastReceived = m_wheel->elapsed();
+    m_awaitingReplySince = -1;
+    m_probeSent = false;
+}
+
+void KeepaliveManager::armIdleTimer(int delayMs)
+{
+    if (m_idleTimer) {
+        m_wheel->cancel(m_idleTimer);
+    }
+    m_idleTimer = m_wheel->schedule(delayMs, [this]() { onIdleTimeout(); });
+}
+
+void KeepaliveManager::onIdleTimeout()
+{
+    m_idleTimer = 0;
+    if (!m_active) {
+        return;
+    }
+    
+    qint64 now = m_wheel->elapsed();
+    qint64 oldest = qMin(m_lastSent, m_lastReceived);
+    if (now - oldest < m_heartbeatInterval) {
+        // 两个方向在间隔内都有流量，不需要心跳，睡到较早的一方满一个间隔
+        armIdleTimer(static_cast<int>(oldest + m_heartbeatInterval - now));
+        return;
+    }
+    
+    emit heartbeatDue();
+    armIdleTimer(m_heartbeatInterval);
+}
+
+void KeepaliveManager::armProbeTimer()
+{
+    m_probeTimer = m_wheel->schedule(m_probeTimeout, [this]() { onProbeTimeout(); });
+}
+
+void KeepaliveManager::onProbeTimeout()
+{
+    m_probeTimer = 0;
+    if (!m_active || !m_peerDetection || m_awaitingReplySince < 0) {
+        return; // 已收到回应
+    }
+    
+    // 回应后又有新的待回应帧，按新帧的发送时间重新计时
+    qint64 now = m_wheel->elapsed();
+    qint64 deadline = m_awaitingReplySince + m_probeTimeout;
+    if (now < deadline) {
+        m_probeTimer = m_wheel->schedule(static_cast<int>(deadline - now), [this]() { onProbeTimeout(); });
+        return;
+    }
+    
+    if (!m_probeSent) {
+        // 先发一次心跳探测，排除对端只是暂时没有数据要发的情况
+        m_probeSent = true;
+        m_awaitingReplySince = now;
+        emit heartbeatDue();
+        armProbeTimer();
+        return;
+    }
+    
+    qDebug() << "服务器在" << (now - m_lastReceived) << "毫秒内没有任何响应，判定连接已失效";
+    m_awaitingReplySince = -1;
+    m_probeSent = false;
+    emit peerTimedOut();
+}
+
+void KeepaliveManager::cancelTimers()
+{
+    if (m_idleTimer) {
+        m_wheel->cancel(m_idleTimer);
+        m_idleTimer = 0;
+    }
+    if (m_probeTimer) {
+        m_wheel->cancel(m_probeTimer);
+        m_probeTimer = 0;
+    }
+}
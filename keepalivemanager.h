@@ -0,0 +1,61 @@
+#ifndef KEEPALIVEMANAGER_H
+#define KEEPALIVEMANAGER_H
+
+#include <QObject>
+#include "timerwheel.h"
+
+// 连接保活与对端存活检测，替代原来的心跳线程和固定30秒心跳定时器：
+// - 收发流量都在心跳间隔内出现过时不发心跳，只在某一方向空闲满一个间隔时发出；
+// - 发出需要响应的帧（请求、待确认消息、心跳探测）后，探测超时内没有收到任何数据则再探测一次，
+//   仍无响应即判定对端失联（半开连接），由 NetworkManager 断开并重连；
+// - 空闲时每个心跳间隔只唤醒一次线程。
+// 所有定时器都挂在同一个时间轮上，在网络线程中使用；不得比时间轮活得更久（通常以时间轮为父对象）
+class KeepaliveManager : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit KeepaliveManager(TimerWheel* wheel, QObject* parent = nullptr);
+
+    void setHeartbeatInterval(int msecs);
+    int heartbeatInterval() const { return m_heartbeatInterval; }
+    void setProbeTimeout(int msecs);
+    int probeTimeout() const { return m_probeTimeout; }
+
+    // 对端会回应心跳时才启用存活检测（旧版服务器不回应，只保留保活）
+    void setPeerDetectionEnabled(bool enabled);
+
+    // 连接建立/断开时调用
+    void start();
+    void stop();
+    bool isActive() const { return m_active; }
+
+    // 由 NetworkManager 在收发帧时调用，通常只记录时间，不操作定时器
+    void noteSent(bool expectsReply);
+    void noteReceived();
+
+signals:
+    void heartbeatDue();  // 需要发送心跳
+    void peerTimedOut();  // 对端失联
+
+private:
+    void armIdleTimer(int delayMs);
+    void onIdleTimeout();
+    void armProbeTimer();
+    void onProbeTimeout();
+    void cancelTimers();
+
+    TimerWheel* m_wheel;
+    int m_heartbeatInterval;
+    int m_probeTimeout;
+    bool m_peerDetection;
+    bool m_active;
+    qint64 m_lastSent;
+    qint64 m_lastReceived;
+    qint64 m_awaitingReplySince; // 最早一个未得到回应的帧的发送时间，-1表示没有
+    bool m_probeSent;
+    TimerWheel::TimerId m_idleTimer;
+    TimerWheel::TimerId m_probeTimer;
+};
+
+#endif // KEEPALIVEMANAGER_H
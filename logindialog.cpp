@@ -6,9 +6,11 @@
 LoginDialog::LoginDialog(QWidget* parent)
     : QDialog(parent)
     , ui(new Ui::LoginDialog)
+    , m_session(nullptr)
     , m_networkManager(nullptr)
     , m_userId(0)
     , m_isProcessing(false)
+    , m_pendingAction(NoPendingAction)
 {
     ui->setupUi(this);
     
@@ -35,14 +37,12 @@ LoginDialog::LoginDialog(QWidget* parent)
     
     setFixedSize(450, 520);
     
-    m_networkManager = new NetworkManager(this);
-    connect(m_networkManager, &NetworkManager::loginSuccess, this, &LoginDialog::onLoginSuccess);
-    connect(m_networkManager, &NetworkManager::loginFailed, this, &LoginDialog::onLoginFailed);
-    connect(m_networkManager, &NetworkManager::registerSuccess, this, &LoginDialog::onRegisterSuccess);
-    connect(m_networkManager, &NetworkManager::registerFailed, this, &LoginDialog::onRegisterFailed);
+    m_session = new ChatSession(this);
+    m_networkManager = m_session->networkManager();
     connect(m_networkManager, &NetworkManager::connected, this, &LoginDialog::onNetworkConnected);
     connect(m_networkManager, &NetworkManager::disconnected, this, &LoginDialog::onNetworkDisconnected);
     connect(m_networkManager, &NetworkManager::errorOccurred, this, &LoginDialog::onNetworkError);
+    connect(m_networkManager, &NetworkManager::connectionStateChanged, this, &LoginDialog::onConnectionStateChanged);
     
     connect(ui->loginButton, &QPushButton::clicked, this, &LoginDialog::onLoginClicked);
     connect(ui->registerButton, &QPushButton::clicked, this, &LoginDialog::onRegisterClicked);
@@ -58,17 +58,40 @@ LoginDialog::~LoginDialog()
     delete ui;
 }
 
+ChatSession* LoginDialog::takeSession()
+{
+    ChatSession* session = m_session;
+    if (session) {
+        session->setParent(nullptr);
+        m_session = nullptr;
+    }
+    return session;
+}
+
+void LoginDialog::accept()
+{
+    // 登录成功：把用户信息记录到会话中，离线登录的会话在连上服务器后也会自动登录
+    m_session->setUser(m_userId, m_username, m_nickname);
+    QDialog::accept();
+}
+
 void LoginDialog::setupUI()
 {
     // UI已在.ui文件中定义
 }
 
-bool LoginDialog::connectToServer()
+void LoginDialog::connectToServer()
 {
     QString host = ui->serverEdit->text().isEmpty() ? "127.0.0.1" : ui->serverEdit->text();
     quint16 port = ui->portEdit->text().isEmpty() ? 8888 : ui->portEdit->text().toUShort();
     
-    return m_networkManager->connectToServer(host, port);
+    m_session->connectToServer(host, port);
+}
+
+bool LoginDialog::isServerReachable() const
+{
+    NetworkManager::ConnectionState state = m_networkManager->connectionState();
+    return state == NetworkManager::StateAuthenticating || state == NetworkManager::StateOnline;
 }
 
 void LoginDialog::onLoginClicked()
@@ -88,25 +111,12 @@ void LoginDialog::onLoginClicked()
     m_isProcessing = true;
     ui->loginButton->setEnabled(false);
     
-    // 优先尝试网络登录，如果网络未连接则使用本地登录
-    if (m_networkManager->isConnected()) {
+    // 优先尝试网络登录；连接尚未建立时等待连接结果，连接失败则使用本地登录
+    if (isServerReachable()) {
         tryNetworkLogin(username, password);
     } else {
-        // 尝试连接服务器
-        if (connectToServer()) {
-            // 连接成功，等待连接完成后再登录
-            // 使用定时器等待连接完成
-            QTimer::singleShot(500, this, [this, username, password]() {
-                if (m_networkManager->isConnected()) {
-                    tryNetworkLogin(username, password);
-                } else {
-                    tryLocalLogin(username, password);
-                }
-            });
-        } else {
-            // 连接失败，使用本地登录
-            tryLocalLogin(username, password);
-        }
+        m_pendingAction = PendingLogin;
+        connectToServer();
     }
 }
 
@@ -120,9 +130,9 @@ void LoginDialog::tryNetworkLogin(const QString& username, const QString& passwo
         m_userId = userId;
         m_username = username;
         m_nickname = nickname;
-        // 发送网络登录请求
-        m_networkManager->sendLogin(userId, username);
-        // 等待网络响应，onLoginSuccess会处理accept
+        // 发送网络登录请求，响应、超时或断线后由onLoginFinished处理
+        NetworkManager::onRequestFinished(m_session->login(userId, username), this,
+                                          [this](const RequestResult& result) { onLoginFinished(result); });
     } else {
         // 本地数据库中没有该用户，提示错误
         m_isProcessing = false;
@@ -172,24 +182,12 @@ void LoginDialog::onRegisterClicked()
     m_isProcessing = true;
     ui->registerButton->setEnabled(false);
     
-    // 优先尝试网络注册，如果网络未连接则使用本地注册
-    if (m_networkManager->isConnected()) {
+    // 优先尝试网络注册；连接尚未建立时等待连接结果，连接失败则使用本地注册
+    if (isServerReachable()) {
         tryNetworkRegister(username, password, nickname);
     } else {
-        // 尝试连接服务器
-        if (connectToServer()) {
-            // 连接成功，等待连接完成后再注册
-            QTimer::singleShot(500, this, [this, username, password, nickname]() {
-                if (m_networkManager->isConnected()) {
-                    tryNetworkRegister(username, password, nickname);
-                } else {
-                    tryLocalRegister(username, password, nickname);
-                }
-            });
-        } else {
-            // 连接失败，使用本地注册
-            tryLocalRegister(username, password, nickname);
-        }
+        m_pendingAction = PendingRegister;
+        connectToServer();
     }
 }
 
@@ -206,9 +204,9 @@ void LoginDialog::tryNetworkRegister(const QString& username, const QString& pas
         return;
     }
     
-    // 发送网络注册请求
-    m_networkManager->sendRegister(username, password, nickname);
-    // 等待网络响应，onRegisterSuccess会处理后续操作
+    // 发送网络注册请求，响应、超时或断线后由onRegisterFinished处理
+    NetworkManager::onRequestFinished(m_networkManager->sendRegister(username, password, nickname), this,
+                                      [this](const RequestResult& result) { onRegisterFinished(result); });
 }
 
 void LoginDialog::tryLocalRegister(const QString& username, const QString& password, const QString& nickname)
@@ -237,35 +235,46 @@ void LoginDialog::tryLocalRegister(const QString& username, const QString& passw
     }
 }
 
-void LoginDialog::onLoginSuccess(int userId, const QString& username)
-{
-    Q_UNUSED(userId)
-    Q_UNUSED(username)
-    // 网络登录成功，用户信息已经在tryNetworkLogin中设置
-    m_isProcessing = false;
-    ui->loginButton->setEnabled(true);
-    accept();
-}
-
-void LoginDialog::onLoginFailed(const QString& reason)
+void LoginDialog::onLoginFinished(const RequestResult& result)
 {
-    // 网络登录失败，尝试本地登录
+    if (result.success) {
+        // 网络登录成功，用户信息已经在tryNetworkLogin中设置
+        m_isProcessing = false;
+        ui->loginButton->setEnabled(true);
+        accept();
+        return;
+    }
+    
+    // 网络登录失败或超时，尝试本地登录
     QString username = ui->loginUsernameEdit->text().trimmed();
     QString password = ui->loginPasswordEdit->text();
     
-    qDebug() << "网络登录失败:" << reason << "，尝试本地登录";
+    qDebug() << "网络登录失败:" << result.error << "，尝试本地登录";
     tryLocalLogin(username, password);
 }
 
-void LoginDialog::onRegisterSuccess(int userId)
+void LoginDialog::onRegisterFinished(const RequestResult& result)
 {
+    if (!result.success) {
+        // 网络注册失败或超时，尝试本地注册
+        QString username = ui->registerUsernameEdit->text().trimmed();
+        QString password = ui->registerPasswordEdit->text();
+        QString nickname = ui->registerNicknameEdit->text().trimmed();
+        
+        qDebug() << "网络注册失败:" << result.error << "，尝试本地注册";
+        tryLocalRegister(username, password, nickname);
+        return;
+    }
+    
+    int userId = result.data.value("user_id").toInt();
+    
     // 网络注册成功，需要在本地数据库中也注册并登录
     QString username = ui->registerUsernameEdit->text().trimmed();
     QString password = ui->registerPasswordEdit->text();
     QString nickname = ui->registerNicknameEdit->text().trimmed();
     
     // 确保本地数据库也有该用户（如果网络注册成功但本地没有）
-    int localUserId;
+    int localUserId = 0;
     QString localNickname;
     if (!DatabaseManager::instance().loginUser(username, password, localUserId, localNickname)) {
         // 本地数据库中没有，添加进去
@@ -283,17 +292,6 @@ void LoginDialog::onRegisterSuccess(int userId)
     accept();
 }
 
-void LoginDialog::onRegisterFailed(const QString& reason)
-{
-    // 网络注册失败，尝试本地注册
-    QString username = ui->registerUsernameEdit->text().trimmed();
-    QString password = ui->registerPasswordEdit->text();
-    QString nickname = ui->registerNicknameEdit->text().trimmed();
-    
-    qDebug() << "网络注册失败:" << reason << "，尝试本地注册";
-    tryLocalRegister(username, password, nickname);
-}
-
 void LoginDialog::onNetworkConnected()
 {
     ui->statusLabel->setText("已连接");
@@ -314,3 +312,47 @@ void LoginDialog::onNetworkError(const QString& error)
     ui->statusLabel->setStyleSheet("QLabel { color: #d32f2f; font-weight: bold; padding: 5px; background: #ffebee; border-radius: 3px; }");
     qDebug() << "网络错误:" << error;
 }
+
+void LoginDialog::onConnectionStateChanged(NetworkManager::ConnectionState state)
+{
+    switch (state) {
+    case NetworkManager::StateResolving:
+    case NetworkManager::StateConnecting:
+        ui->statusLabel->setText("正在连接...");
+        break;
+    case NetworkManager::StateAuthenticating:
+        runPendingAction(true);
+        break;
+    case NetworkManager::StateBackoff:
+    case NetworkManager::StateIdle:
+        runPendingAction(false);
+        break;
+    default:
+        break;
+    }
+}
+
+void LoginDialog::runPendingAction(bool networkAvailable)
+{
+    PendingAction action = m_pendingAction;
+    m_pendingAction = NoPendingAction;
+    
+    if (action == PendingLogin) {
+        QString username = ui->loginUsernameEdit->text().trimmed();
+        QString password = ui->loginPasswordEdit->text();
+        if (networkAvailable) {
+            tryNetworkLogin(username, password);
+        } else {
+            tryLocalLogin(username, password);
+        }
+    } else if (action == PendingRegister) {
+        QString username = ui->registerUsernameEdit->text().trimmed();
+        QString password = ui->registerPasswordEdit->text();
+        QString nickname = ui->registerNicknameEdit->text().trimmed();
+        if (networkAvailable) {
+            tryNetworkRegister(username, password, nickname);
+        } else {
+            tryLocalRegister(username, password, nickname);
+        }
+    }
+}
@@ -11,6 +11,7 @@
 #include <QMessageBox>
 #include "databasemanager.h"
 #include "networkmanager.h"
+#include "chatsession.h"
 
 QT_BEGIN_NAMESPACE
 namespace Ui { class LoginDialog; }
@@ -26,32 +27,48 @@ public:
 
     int getUserId() const { return m_userId; }
     QString getUsername() const { return m_username; }
+    // 取走登录会话（含已建立的连接），调用方负责释放
+    ChatSession* takeSession();
+    ChatSession* session() const { return m_session; }
+
+public slots:
+    void accept() override;
 
 private slots:
     void onLoginClicked();
     void onRegisterClicked();
-    void onLoginSuccess(int userId, const QString& username);
-    void onLoginFailed(const QString& reason);
-    void onRegisterSuccess(int userId);
-    void onRegisterFailed(const QString& reason);
     void onNetworkConnected();
     void onNetworkDisconnected();
     void onNetworkError(const QString& error);
+    void onConnectionStateChanged(NetworkManager::ConnectionState state);
 
 private:
     Ui::LoginDialog* ui;
+    ChatSession* m_session;
     NetworkManager* m_networkManager;
     int m_userId;
     QString m_username;
     QString m_nickname;
     bool m_isProcessing;  // 防止重复操作
     
+    // 点击登录/注册时连接尚未建立，等待连接结果后再执行的操作
+    enum PendingAction {
+        NoPendingAction,
+        PendingLogin,
+        PendingRegister
+    };
+    PendingAction m_pendingAction;
+    
     void setupUI();
-    bool connectToServer();
+    void connectToServer();
+    bool isServerReachable() const;
+    void runPendingAction(bool networkAvailable);
     void tryNetworkLogin(const QString& username, const QString& password);
     void tryLocalLogin(const QString& username, const QString& password);
     void tryNetworkRegister(const QString& username, const QString& password, const QString& nickname);
     void tryLocalRegister(const QString& username, const QString& password, const QString& nickname);
+    void onLoginFinished(const RequestResult& result);
+    void onRegisterFinished(const RequestResult& result);
 };
 
 #endif // LOGINDIALOG_H
@@ -1,8 +1,40 @@
 #include "mainwindow.h"
 #include "logindialog.h"
 #include "databasemanager.h"
+#include "chatsession.h"
 #include <QApplication>
 #include <QStyleFactory>
+#include <QCommandLineParser>
+#include <QElapsedTimer>
+#include <QTimer>
+#include <QDebug>
+#include <memory>
+
+namespace {
+// 重放抓包并统计整条处理链路（解码 -> 入库 -> 显示）的耗时。
+// replayFinished 与 messagesReceived 由同一线程发出、按顺序排队，
+// 界面线程收到它时所有重放的消息都已入库并显示
+void startReplay(NetworkManager* network, const QString& path, bool fast, bool quitWhenDone)
+{
+    auto clock = std::make_shared<QElapsedTimer>();
+    QObject::connect(network, &NetworkManager::replayFinished, qApp,
+                     [clock, quitWhenDone](int frameCount, int messageCount, qint64 elapsedMs) {
+        qDebug() << "重放完成:" << frameCount << "帧," << messageCount << "条消息, 网络线程耗时"
+                 << elapsedMs << "毫秒, 含入库和显示共" << clock->elapsed() << "毫秒";
+        if (quitWhenDone) {
+            // 先让本轮排队的重绘完成再退出
+            QTimer::singleShot(0, qApp, &QCoreApplication::quit);
+        }
+    });
+    
+    clock->start();
+    NetworkManager::ReplayPacing pacing = fast ? NetworkManager::ReplayAsFastAsPossible
+                                               : NetworkManager::ReplayOriginalPacing;
+    if (!network->startReplay(path, pacing) && quitWhenDone) {
+        QTimer::singleShot(0, qApp, &QCoreApplication::quit);
+    }
+}
+}
 
 int main(int argc, char *argv[])
 {
@@ -11,18 +43,40 @@ int main(int argc, char *argv[])
     // 设置应用样式
     app.setStyle(QStyleFactory::create("Fusion"));
     
+    // 抓包与重放：用于离线复现收包高峰并测量客户端处理链路
+    QCommandLineParser parser;
+    parser.addHelpOption();
+    QCommandLineOption captureOption("capture", "把收到的每一帧及到达时间写入抓包文件", "file");
+    QCommandLineOption replayOption("replay", "登录后断开服务器并重放抓包文件", "file");
+    QCommandLineOption replayFastOption("replay-fast", "全速重放（默认按录制时的间隔）");
+    QCommandLineOption replayQuitOption("replay-quit", "重放完成后退出");
+    parser.addOptions({captureOption, replayOption, replayFastOption, replayQuitOption});
+    parser.process(app);
+    
     // 初始化数据库
     DatabaseManager::instance().init();
     
     // 显示登录对话框
     LoginDialog loginDialog;
+    if (parser.isSet(captureOption)) {
+        // 登录对话框稍后才发起连接，在此之前开始抓包可以录到登录后的追赶
+        loginDialog.session()->networkManager()->startCapture(parser.value(captureOption));
+    }
     if (loginDialog.exec() == QDialog::Accepted) {
-        MainWindow window;
-        window.setCurrentUserId(loginDialog.getUserId());
-        window.setCurrentUsername(loginDialog.getUsername());
+        // 复用登录时建立的连接和会话
+        ChatSession* session = loginDialog.takeSession();
+        MainWindow window(session);
         window.show();
-        return app.exec();
+        if (parser.isSet(replayOption)) {
+            startReplay(session->networkManager(), parser.value(replayOption),
+                        parser.isSet(replayFastOption), parser.isSet(replayQuitOption));
+        }
+        int exitCode = app.exec();
+        // 退出前提交写线程中排队的消息
+        DatabaseManager::instance().close();
+        return exitCode;
     }
     
+    DatabaseManager::instance().close();
     return 0;
 }
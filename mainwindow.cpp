@@ -4,11 +4,16 @@
 #include <QLabel>
 #include <QMessageBox>
 
-MainWindow::MainWindow(QWidget* parent)
+MainWindow::MainWindow(ChatSession* session, QWidget* parent)
     : QMainWindow(parent)
     , ui(new Ui::MainWindow)
-    , m_currentUserId(0)
+    , m_session(session)
+    , m_networkManager(session->networkManager())
+    , m_currentUserId(session->userId())
+    , m_currentUsername(session->username())
 {
+    m_session->setParent(this);
+    
     ui->setupUi(this);
     setWindowTitle("即时通讯系统");
     setMinimumSize(1000, 700);
@@ -43,6 +48,7 @@ void MainWindow::setupUI()
     
     connect(m_contactList, &ContactListWidget::contactSelected, 
             this, &MainWindow::onContactSelected);
+    m_contactList->setNetworkManager(m_networkManager);
     
     // 右侧聊天窗口标签页
     m_chatTabs = new QTabWidget(this);
@@ -78,8 +84,7 @@ void MainWindow::setupUI()
         if (widget) {
             ChatWindow* chatWindow = qobject_cast<ChatWindow*>(widget);
             if (chatWindow) {
-                int contactId = chatWindow->getContactId();
-                m_chatWindows.remove(contactId);
+                m_chatWindows.remove(chatWindow->conversationId());
             }
             m_chatTabs->removeTab(index);
             widget->deleteLater();
@@ -106,18 +111,33 @@ void MainWindow::setupUI()
 
 void MainWindow::setupNetwork()
 {
-    m_networkManager = new NetworkManager(this);
-    connect(m_networkManager, &NetworkManager::messageReceived, 
-            this, &MainWindow::onMessageReceived);
+    connect(m_session, &ChatSession::messagesStored, 
+            this, &MainWindow::onMessagesStored);
+    connect(m_networkManager, &NetworkManager::catchUpFinished, 
+            this, &MainWindow::onCatchUpFinished);
     connect(m_networkManager, &NetworkManager::connected, 
             this, &MainWindow::onNetworkConnected);
     connect(m_networkManager, &NetworkManager::disconnected, 
             this, &MainWindow::onNetworkDisconnected);
     connect(m_networkManager, &NetworkManager::errorOccurred, 
             this, &MainWindow::onNetworkError);
+    connect(m_networkManager, &NetworkManager::online, 
+            this, &MainWindow::onNetworkOnline);
+    connect(m_networkManager, &NetworkManager::rosterReceived, 
+            this, &MainWindow::onRosterReceived);
+    
+    // 先显示本地缓存的联系人
+    if (m_currentUserId > 0) {
+        m_contactList->loadContacts(m_currentUserId);
+    }
     
-    // 尝试连接服务器
-    m_networkManager->connectToServer("127.0.0.1", 8888);
+    // 连接和登录已在登录对话框中完成；离线登录时会话会在后台重连并自动登录
+    if (m_networkManager->isOnline()) {
+        onNetworkOnline();
+    } else if (m_networkManager->connectionState() == NetworkManager::StateIdle) {
+        m_session->connectToServer(m_session->host().isEmpty() ? "127.0.0.1" : m_session->host(),
+                                   m_session->port());
+    }
 }
 
 void MainWindow::onContactSelected(int contactId, const QString& contactName, bool isGroup)
@@ -137,64 +157,132 @@ void MainWindow::onContactSelected(int contactId, const QString& contactName, bo
 
 ChatWindow* MainWindow::getOrCreateChatWindow(int contactId, const QString& contactName, bool isGroup)
 {
-    if (m_chatWindows.contains(contactId)) {
-        return m_chatWindows[contactId];
+    qint64 conversation = DatabaseManager::conversationId(m_currentUserId, contactId, isGroup);
+    if (m_chatWindows.contains(conversation)) {
+        return m_chatWindows[conversation];
     }
     
     ChatWindow* chatWindow = new ChatWindow(contactId, contactName, isGroup, m_currentUserId, this);
-    chatWindow->setNetworkManager(m_networkManager);
-    m_chatWindows[contactId] = chatWindow;
+    chatWindow->setSession(m_session);
+    m_chatWindows[conversation] = chatWindow;
     
     return chatWindow;
 }
 
-void MainWindow::onMessageReceived(int fromUserId, int toUserId, const QString& content, 
-                                    const QDateTime& timestamp, bool isGroup)
+ChatWindow* MainWindow::showConversation(int contactId, bool isGroup)
 {
-    // 确定消息应该显示在哪个聊天窗口
-    int targetContactId = (fromUserId == m_currentUserId) ? toUserId : fromUserId;
-    
-    ChatWindow* chatWindow = getOrCreateChatWindow(targetContactId, 
-                                                   QString::number(targetContactId), 
-                                                   isGroup);
+    ChatWindow* chatWindow = getOrCreateChatWindow(contactId, QString::number(contactId), isGroup);
     
     // 如果窗口不在标签页中，添加到标签页
     int tabIndex = m_chatTabs->indexOf(chatWindow);
     if (tabIndex < 0) {
-        QString tabName = QString::number(targetContactId);
+        QString tabName = QString::number(contactId);
         if (isGroup) {
             tabName = "[群]" + tabName;
         }
         tabIndex = m_chatTabs->addTab(chatWindow, tabName);
     }
     
-    // 显示消息
-    MessageInfo msg;
-    msg.fromUserId = fromUserId;
-    msg.toUserId = toUserId;
-    msg.content = content;
-    msg.timestamp = timestamp;
-    msg.isGroup = isGroup;
-    msg.messageType = 0;
-    
-    chatWindow->addMessage(msg);
-    
     // 高亮标签页（如果有未读消息）
-    m_chatTabs->setTabText(tabIndex, m_chatTabs->tabText(tabIndex) + " *");
+    QString tabText = m_chatTabs->tabText(tabIndex);
+    if (!tabText.endsWith(" *")) {
+        m_chatTabs->setTabText(tabIndex, tabText + " *");
+    }
+    return chatWindow;
+}
+
+void MainWindow::onMessagesStored(const QList<MessageInfo>& messages)
+{
+    // 按会话分组（保持首次出现的顺序），每个聊天窗口整批追加一次
+    QHash<qint64, QList<MessageInfo>> conversations;
+    QList<qint64> order;
+    for (const MessageInfo& message : messages) {
+        qint64 conversation = DatabaseManager::conversationId(message.fromUserId, message.toUserId, message.isGroup);
+        QHash<qint64, QList<MessageInfo>>::iterator it = conversations.find(conversation);
+        if (it == conversations.end()) {
+            order.append(conversation);
+            it = conversations.insert(conversation, QList<MessageInfo>());
+        }
+        it->append(message);
+    }
+    
+    for (qint64 conversation : qAsConst(order)) {
+        const QList<MessageInfo>& batch = conversations[conversation];
+        // 确定消息应该显示在哪个聊天窗口：群消息属于群，单聊属于对方
+        const MessageInfo& first = batch.first();
+        int contactId = first.isGroup ? first.toUserId
+                                      : (first.fromUserId == m_currentUserId ? first.toUserId : first.fromUserId);
+        // 新建的聊天窗口创建时已从数据库加载了这些消息（已由会话入库），不再重复追加
+        bool created = !m_chatWindows.contains(conversation);
+        ChatWindow* chatWindow = showConversation(contactId, first.isGroup);
+        if (!created) {
+            chatWindow->appendMessages(batch);
+        }
+    }
+}
+
+void MainWindow::onCatchUpFinished(qint64 lastSeq, int messageCount)
+{
+    Q_UNUSED(lastSeq)
+    if (messageCount > 0) {
+        statusBar()->showMessage(QString("已同步%1条离线消息").arg(messageCount), 3000);
+    }
 }
 
 void MainWindow::onNetworkConnected()
 {
     statusBar()->showMessage("已连接到服务器", 3000);
+}
+
+void MainWindow::onNetworkOnline()
+{
+    statusBar()->showMessage("已登录到服务器", 3000);
     if (m_currentUserId > 0) {
-        m_networkManager->sendLogin(m_currentUserId, m_currentUsername);
-        m_networkManager->sendGetContacts(m_currentUserId);
+        // 只请求上次同步之后的联系人变化
+        m_networkManager->sendGetContacts(m_currentUserId,
+                                          DatabaseManager::instance().rosterVersion(m_currentUserId));
+    }
+}
+
+void MainWindow::onRosterReceived(const RosterDelta& delta)
+{
+    if (m_currentUserId <= 0) {
+        return;
     }
     
-    // 加载联系人列表
-    if (m_currentUserId > 0) {
-        m_contactList->loadContacts(m_currentUserId);
+    QList<ContactInfo> upserts;
+    upserts.reserve(delta.contacts.size());
+    for (const RosterContact& contact : delta.contacts) {
+        ContactInfo info;
+        info.userId = m_currentUserId;
+        info.contactId = contact.contactId;
+        info.contactName = contact.contactName;
+        info.groupName = contact.groupName.isEmpty() ? QString("默认分组") : contact.groupName;
+        info.isGroup = contact.isGroup;
+        upserts.append(info);
+    }
+    QList<int> removed;
+    removed.reserve(delta.removed.size());
+    for (int contactId : delta.removed) {
+        removed.append(contactId);
+    }
+    
+    // 先入库（一个事务），成功后再把差异应用到联系人列表
+    QList<ContactInfo> unsynced;
+    if (!DatabaseManager::instance().applyContactDelta(m_currentUserId, upserts, removed,
+                                                       delta.full, delta.version, &unsynced)) {
+        statusBar()->showMessage("联系人同步失败", 3000);
+        return;
+    }
+    
+    m_contactList->applyContactDelta(upserts, removed);
+    // 旧版本只保存在本地的联系人补发给服务器，之后的同步中就会列出它们
+    for (const ContactInfo& contact : qAsConst(unsynced)) {
+        m_networkManager->sendAddContact(m_currentUserId, contact.contactId, contact.contactName,
+                                         contact.groupName, contact.isGroup);
     }
+    qDebug() << "联系人同步完成, 版本:" << delta.version
+             << "更新:" << upserts.size() << "删除:" << removed.size();
 }
 
 void MainWindow::onNetworkDisconnected()
@@ -8,6 +8,7 @@
 #include "contactlistwidget.h"
 #include "chatwindow.h"
 #include "networkmanager.h"
+#include "chatsession.h"
 #include "databasemanager.h"
 
 QT_BEGIN_NAMESPACE
@@ -19,16 +20,17 @@ class MainWindow : public QMainWindow
     Q_OBJECT
 
 public:
-    explicit MainWindow(QWidget* parent = nullptr);
+    // 接管登录对话框移交的会话（含已认证的连接）
+    explicit MainWindow(ChatSession* session, QWidget* parent = nullptr);
     ~MainWindow();
 
-    void setCurrentUserId(int userId) { m_currentUserId = userId; }
-    void setCurrentUsername(const QString& username) { m_currentUsername = username; }
-
 private slots:
     void onContactSelected(int contactId, const QString& contactName, bool isGroup);
-    void onMessageReceived(int fromUserId, int toUserId, const QString& content, const QDateTime& timestamp, bool isGroup);
+    void onMessagesStored(const QList<MessageInfo>& messages);
+    void onCatchUpFinished(qint64 lastSeq, int messageCount);
+    void onRosterReceived(const RosterDelta& delta);
     void onNetworkConnected();
+    void onNetworkOnline();
     void onNetworkDisconnected();
     void onNetworkError(const QString& error);
 
@@ -36,15 +38,17 @@ private:
     Ui::MainWindow* ui;
     ContactListWidget* m_contactList;
     QTabWidget* m_chatTabs;
+    ChatSession* m_session;
     NetworkManager* m_networkManager;
     int m_currentUserId;
     QString m_currentUsername;
     
-    QHash<int, ChatWindow*> m_chatWindows; // contactId -> ChatWindow
+    QHash<qint64, ChatWindow*> m_chatWindows; // 会话ID -> ChatWindow（用户N和群N是不同的会话）
     
     void setupUI();
     void setupNetwork();
     ChatWindow* getOrCreateChatWindow(int contactId, const QString& contactName, bool isGroup);
+    ChatWindow* showConversation(int contactId, bool isGroup);
 };
 
 #endif // MAINWINDOW_H
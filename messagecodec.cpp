@@ -0,0 +1,264 @@
+#include "messagecodec.h"
+#include "framedecoder.h"
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QJsonArray>
+#include <QCborStreamWriter>
+#include <QDateTime>
+#include <QHash>
+#include <cmath>
+#include <cstring>
+
+namespace {
+
+const char* const FieldNames[MessageCodec::FieldCount] = {
+    "",
+    "user_id",
+    "username",
+    "password",
+    "nickname",
+    "from_user_id",
+    "to_user_id",
+    "content",
+    "is_group",
+    "timestamp",
+    "success",
+    "reason",
+    "contacts",
+    "contact_id",
+    "contact_name",
+    "group_name",
+    "protocol_version",
+    "encodings",
+    "encoding",
+    "compression",
+    "client_msg_id",
+    "client_msg_ids",
+    "request_id",
+    "roster_version",
+    "removed",
+    "full",
+    "seq",
+    "last_seq",
+    "messages",
+    "done",
+    "conv_seq",
+    "conv_seqs"
+};
+
+QByteArray buildFrame(const QByteArray& body, int flags)
+{
+    QByteArray frame(FrameDecoder::HeaderSize + body.size(), Qt::Uninitialized);
+    FrameDecoder::writeHeader(frame.data(), static_cast<quint32>(body.size()), flags);
+    memcpy(frame.data() + FrameDecoder::HeaderSize, body.constData(), body.size());
+    return frame;
+}
+
+}
+
+QByteArray MessageCodec::encode(int type, const QCborMap& data, Encoding encoding)
+{
+    if (encoding == EncodingCbor) {
+        // 直接写出 [type, {字段}]，不为外层数组构造 QCborArray
+        QByteArray body;
+        QCborStreamWriter writer(&body);
+        writer.startArray(2);
+        writer.append(static_cast<qint64>(type));
+        QCborValue(data).toCbor(writer);
+        writer.endArray();
+        return body;
+    }
+    
+    QJsonObject message;
+    message["type"] = type;
+    message["data"] = toJson(data);
+    return QJsonDocument(message).toJson(QJsonDocument::Compact);
+}
+
+QByteArray MessageCodec::encodeFrame(int type, const QCborMap& data, Encoding encoding)
+{
+    return buildFrame(encode(type, data, encoding), frameFlags(encoding));
+}
+
+int MessageCodec::frameFlags(Encoding encoding)
+{
+    return encoding == EncodingCbor ? FrameDecoder::FlagCbor : 0;
+}
+
+bool MessageCodec::decodeFrame(const QByteArray& payload, int flags, int& type, QCborMap& data,
+                               QString* errorString)
+{
+    if (flags & FrameDecoder::FlagCbor) {
+        QCborParserError error;
+        QCborValue value = QCborValue::fromCbor(payload, &error);
+        if (error.error != QCborError::NoError) {
+            if (errorString) {
+                *errorString = "CBOR解析错误: " + error.errorString();
+            }
+            return false;
+        }
+        
+        QCborArray message = value.toArray();
+        if (message.size() < 2 || !message.at(0).isInteger()) {
+            if (errorString) {
+                *errorString = "CBOR消息格式错误";
+            }
+            return false;
+        }
+        
+        type = static_cast<int>(message.at(0).toInteger());
+        data = message.at(1).toMap();
+        return true;
+    }
+    
+    QJsonParseError error;
+    QJsonDocument doc = QJsonDocument::fromJson(payload, &error);
+    if (error.error != QJsonParseError::NoError) {
+        if (errorString) {
+            *errorString = "JSON解析错误: " + error.errorString();
+        }
+        return false;
+    }
+    
+    QJsonObject obj = doc.object();
+    type = obj["type"].toInt();
+    data = fromJson(obj["data"]).toMap();
+    return true;
+}
+
+QLatin1String MessageCodec::encodingName(Encoding encoding)
+{
+    return encoding == EncodingCbor ? QLatin1String("cbor") : QLatin1String("json");
+}
+
+MessageCodec::Encoding MessageCodec::encodingFromName(const QString& name, bool* ok)
+{
+    if (ok) {
+        *ok = (name == QLatin1String("cbor") || name == QLatin1String("json"));
+    }
+    return name == QLatin1String("cbor") ? EncodingCbor : EncodingJson;
+}
+
+QLatin1String MessageCodec::fieldName(int field)
+{
+    if (field <= 0 || field >= FieldCount) {
+        return QLatin1String();
+    }
+    return QLatin1String(FieldNames[field]);
+}
+
+int MessageCodec::fieldFromName(const QString& name)
+{
+    static const QHash<QString, int> fields = []() {
+        QHash<QString, int> result;
+        for (int field = 1; field < FieldCount; ++field) {
+            result.insert(QString::fromLatin1(FieldNames[field]), field);
+        }
+        return result;
+    }();
+    return fields.value(name, 0);
+}
+
+bool MessageCodec::isTimestampField(int field)
+{
+    return field == FieldTimestamp;
+}
+
+QJsonValue MessageCodec::toJson(const QCborValue& value, int field)
+{
+    if (value.isMap()) {
+        QJsonObject obj;
+        const QCborMap map = value.toMap();
+        for (auto it = map.constBegin(); it != map.constEnd(); ++it) {
+            QCborValue key = it.key();
+            if (key.isInteger()) {
+                int keyField = static_cast<int>(key.toInteger());
+                QLatin1String name = fieldName(keyField);
+                QString jsonKey = name.size() > 0 ? QString(name) : QString::number(keyField);
+                obj.insert(jsonKey, toJson(it.value(), keyField));
+            } else {
+                obj.insert(key.toString(), toJson(it.value()));
+            }
+        }
+        return obj;
+    }
+    
+    if (value.isArray()) {
+        QJsonArray array;
+        const QCborArray items = value.toArray();
+        for (const QCborValue& item : items) {
+            array.append(toJson(item));
+        }
+        return array;
+    }
+    
+    if (value.isInteger()) {
+        if (isTimestampField(field)) {
+            return QDateTime::fromMSecsSinceEpoch(value.toInteger()).toString(Qt::ISODate);
+        }
+        return QJsonValue(value.toInteger());
+    }
+    
+    if (value.isBool()) {
+        return value.toBool();
+    }
+    if (value.isDouble()) {
+        return value.toDouble();
+    }
+    if (value.isString()) {
+        return value.toString();
+    }
+    return QJsonValue();
+}
+
+QCborValue MessageCodec::fromJson(const QJsonValue& value, int field)
+{
+    switch (value.type()) {
+    case QJsonValue::Object: {
+        QCborMap map;
+        const QJsonObject obj = value.toObject();
+        for (auto it = obj.constBegin(); it != obj.constEnd(); ++it) {
+            int keyField = fieldFromName(it.key());
+            if (keyField > 0) {
+                map.insert(keyField, fromJson(it.value(), keyField));
+            } else {
+                map.insert(it.key(), fromJson(it.value()));
+            }
+        }
+        return map;
+    }
+    
+    case QJsonValue::Array: {
+        QCborArray array;
+        const QJsonArray items = value.toArray();
+        for (const QJsonValue& item : items) {
+            array.append(fromJson(item));
+        }
+        return array;
+    }
+    
+    case QJsonValue::Double: {
+        // JSON数字统一为double，整数值还原为整数
+        double number = value.toDouble();
+        if (std::floor(number) == number && std::fabs(number) < 9007199254740992.0) {
+            return QCborValue(static_cast<qint64>(number));
+        }
+        return QCborValue(number);
+    }
+    
+    case QJsonValue::String:
+        if (isTimestampField(field)) {
+            QDateTime time = QDateTime::fromString(value.toString(), Qt::ISODate);
+            if (time.isValid()) {
+                return QCborValue(time.toMSecsSinceEpoch());
+            }
+        }
+        return QCborValue(value.toString());
+        
+    case QJsonValue::Bool:
+        return QCborValue(value.toBool());
+        
+    default:
+        return QCborValue(QCborValue::Null);
+    }
+}
@@ -0,0 +1,86 @@
+#ifndef MESSAGECODEC_H
+#define MESSAGECODEC_H
+
+#include <QByteArray>
+#include <QString>
+#include <QLatin1String>
+#include <QCborMap>
+#include <QCborArray>
+#include <QCborValue>
+#include <QJsonValue>
+
+// 消息编解码：同一条消息可编码为JSON（兼容旧服务器）或紧凑的CBOR二进制格式
+//
+// 内部统一使用以字段编号为键的 QCborMap 表示消息数据，时间戳为UTC毫秒数。
+// CBOR帧为 [type, {字段编号: 值}]，整数按CBOR变长整数编码；
+// JSON帧为 {"type": type, "data": {"字段名": 值}}，时间戳为ISO-8601字符串
+class MessageCodec
+{
+public:
+    enum Encoding {
+        EncodingJson = 0,
+        EncodingCbor = 1
+    };
+
+    // 字段编号，对应JSON中的字段名（见 fieldName）
+    enum Field {
+        FieldUserId = 1,
+        FieldUsername = 2,
+        FieldPassword = 3,
+        FieldNickname = 4,
+        FieldFromUserId = 5,
+        FieldToUserId = 6,
+        FieldContent = 7,
+        FieldIsGroup = 8,
+        FieldTimestamp = 9,
+        FieldSuccess = 10,
+        FieldReason = 11,
+        FieldContacts = 12,
+        FieldContactId = 13,
+        FieldContactName = 14,
+        FieldGroupName = 15,
+        FieldProtocolVersion = 16,
+        FieldEncodings = 17,
+        FieldEncoding = 18,
+        FieldCompression = 19,
+        FieldClientMsgId = 20,
+        FieldClientMsgIds = 21,
+        FieldRequestId = 22,
+        FieldRosterVersion = 23,
+        FieldRemoved = 24,
+        FieldFull = 25,
+        FieldSeq = 26,
+        FieldLastSeq = 27,
+        FieldMessages = 28,
+        FieldDone = 29,
+        FieldConvSeq = 30,
+        FieldConvSeqs = 31,
+        FieldCount
+    };
+
+    // 客户端协议版本：2起支持CBOR编码协商、消息确认和心跳回应，3起接受 MSG_BATCH 多消息帧，
+    // 4起聊天消息和确认带有会话序号，并可以用 MSG_BACKFILL 补齐序号空洞
+    static const int ProtocolVersion = 4;
+
+    // 编码消息体（不含帧头部）
+    static QByteArray encode(int type, const QCborMap& data, Encoding encoding);
+    // 编码为完整的帧（含4字节头部）
+    static QByteArray encodeFrame(int type, const QCborMap& data, Encoding encoding);
+    static int frameFlags(Encoding encoding);
+    // 解码帧负载，flags 为帧头部中的标志位
+    static bool decodeFrame(const QByteArray& payload, int flags, int& type, QCborMap& data,
+                            QString* errorString = nullptr);
+
+    static QLatin1String encodingName(Encoding encoding);
+    static Encoding encodingFromName(const QString& name, bool* ok = nullptr);
+
+    static QLatin1String fieldName(int field);
+    static int fieldFromName(const QString& name);
+    static bool isTimestampField(int field);
+
+    // 内部表示与JSON之间的转换（字段编号 <-> 字段名，毫秒时间戳 <-> ISO字符串）
+    static QJsonValue toJson(const QCborValue& value, int field = 0);
+    static QCborValue fromJson(const QJsonValue& value, int field = 0);
+};
+
+#endif // MESSAGECODEC_H
@@ -1,9 +1,14 @@
 #include "messagemodel.h"
+#include <QDateTime>
 #include <QDebug>
+#include <algorithm>
 
 MessageModel::MessageModel(QObject* parent)
     : QAbstractListModel(parent)
+    , m_sequencedCount(0)
     , m_currentUserId(0)
+    , m_conversationId(0)
+    , m_hasOlder(false)
 {
 }
 
@@ -31,13 +36,17 @@ QVariant MessageModel::data(const QModelIndex& index, int role) const
     case ContentRole:
         return message.content;
     case TimestampRole:
-        return message.timestamp.toString("yyyy-MM-dd hh:mm:ss");
+        return timestampText(message.timestamp);
     case MessageTypeRole:
         return message.messageType;
     case IsGroupRole:
         return message.isGroup;
     case IsOwnMessageRole:
         return message.fromUserId == m_currentUserId;
+    case ClientMsgIdRole:
+        return message.clientMsgId;
+    case DeliveryStateRole:
+        return message.deliveryState;
     default:
         return QVariant();
     }
@@ -54,29 +63,229 @@ QHash<int, QByteArray> MessageModel::roleNames() const
     roles[MessageTypeRole] = "messageType";
     roles[IsGroupRole] = "isGroup";
     roles[IsOwnMessageRole] = "isOwnMessage";
+    roles[ClientMsgIdRole] = "clientMsgId";
+    roles[DeliveryStateRole] = "deliveryState";
     return roles;
 }
 
+QString MessageModel::timestampText(qint64 timestamp) const
+{
+    qint64 second = timestamp / 1000;
+    QHash<qint64, QString>::const_iterator it = m_timestampText.constFind(second);
+    if (it != m_timestampText.constEnd()) {
+        return it.value();
+    }
+    
+    // 视图反复取同一批行的数据，缓存只需覆盖可见范围附近的消息，超过上限时整体清空
+    if (m_timestampText.size() >= MaxCachedTimestamps) {
+        m_timestampText.clear();
+    }
+    QString text = QDateTime::fromMSecsSinceEpoch(timestamp).toString("yyyy-MM-dd hh:mm:ss");
+    m_timestampText.insert(second, text);
+    return text;
+}
+
 void MessageModel::loadMessages(int userId, int contactId, bool isGroup)
 {
     beginResetModel();
     m_currentUserId = userId;
-    m_messages = DatabaseManager::instance().getMessages(userId, contactId, 100, isGroup);
+    m_conversationId = DatabaseManager::conversationId(userId, contactId, isGroup);
+    m_messages = DatabaseManager::instance().getMessagesBefore(m_conversationId, MessageCursor(), PageSize);
+    m_hasOlder = m_messages.size() == PageSize;
+    // 数据库已按同样的规则排好序
+    m_sequencedCount = 0;
+    while (m_sequencedCount < m_messages.size() && m_messages.at(m_sequencedCount).convSeq != 0) {
+        ++m_sequencedCount;
+    }
     endResetModel();
 }
 
+int MessageModel::loadOlderMessages()
+{
+    // 以第一行为游标；第一行是还没有入库编号的新消息时，会话打开时数据库中没有消息
+    MessageCursor cursor = m_messages.isEmpty() ? MessageCursor() : MessageCursor::at(m_messages.first());
+    if (!m_hasOlder || cursor.isNull()) {
+        m_hasOlder = false;
+        return 0;
+    }
+    
+    QList<MessageInfo> older = DatabaseManager::instance().getMessagesBefore(m_conversationId, cursor, PageSize);
+    m_hasOlder = older.size() == PageSize;
+    if (older.isEmpty()) {
+        return 0;
+    }
+    
+    int sequenced = 0;
+    for (const MessageInfo& message : older) {
+        if (message.convSeq != 0) {
+            ++sequenced;
+        }
+    }
+    
+    // 逐条加到开头（QList在开头预留空间，每条是常数时间），只复制这一页
+    beginInsertRows(QModelIndex(), 0, older.size() - 1);
+    for (int i = older.size() - 1; i >= 0; --i) {
+        m_messages.prepend(older.at(i));
+    }
+    m_sequencedCount += sequenced;
+    endInsertRows();
+    return older.size();
+}
+
 void MessageModel::addMessage(const MessageInfo& message, int currentUserId)
 {
     m_currentUserId = currentUserId;
+    insertMessage(message);
+}
+
+void MessageModel::addMessages(const QList<MessageInfo>& messages, int currentUserId)
+{
+    if (messages.isEmpty()) {
+        return;
+    }
+    m_currentUserId = currentUserId;
     
-    beginInsertRows(QModelIndex(), m_messages.size(), m_messages.size());
-    m_messages.append(message);
-    endInsertRows();
+    if (canAppend(messages)) {
+        beginInsertRows(QModelIndex(), m_messages.size(), m_messages.size() + messages.size() - 1);
+        m_messages.append(messages);
+        if (messages.first().convSeq != 0) {
+            m_sequencedCount += messages.size();
+        }
+        endInsertRows();
+        return;
+    }
+    
+    // 批内乱序或与已有消息交错：逐条定位插入
+    for (const MessageInfo& message : messages) {
+        insertMessage(message);
+    }
 }
 
 void MessageModel::clear()
 {
     beginResetModel();
     m_messages.clear();
+    m_sequencedCount = 0;
+    m_hasOlder = false;
     endResetModel();
 }
+
+bool MessageModel::canAppend(const QList<MessageInfo>& messages) const
+{
+    // 全部没有序号：按到达顺序追加
+    bool anySequenced = std::any_of(messages.cbegin(), messages.cend(),
+                                    [](const MessageInfo& message) { return message.convSeq != 0; });
+    if (!anySequenced) {
+        return true;
+    }
+    
+    // 全部有序号、批内升序、且都大于已有的最大序号，末尾也没有未分配序号的消息
+    if (m_sequencedCount != m_messages.size()) {
+        return false;
+    }
+    bool hasPrevious = m_sequencedCount > 0;
+    qint64 previous = hasPrevious ? m_messages.at(m_sequencedCount - 1).convSeq : 0;
+    for (const MessageInfo& message : messages) {
+        if (message.convSeq == 0 || (hasPrevious && message.convSeq <= previous)) {
+            return false;
+        }
+        previous = message.convSeq;
+        hasPrevious = true;
+    }
+    return true;
+}
+
+int MessageModel::sequencedPosition(qint64 convSeq) const
+{
+    // 快速路径：比已有的序号都大，排在有序号部分的末尾
+    if (m_sequencedCount == 0 || m_messages.at(m_sequencedCount - 1).convSeq < convSeq) {
+        return m_sequencedCount;
+    }
+    
+    QList<MessageInfo>::const_iterator end = m_messages.cbegin() + m_sequencedCount;
+    QList<MessageInfo>::const_iterator it = std::upper_bound(
+        m_messages.cbegin(), end, convSeq,
+        [](qint64 seq, const MessageInfo& message) { return seq < message.convSeq; });
+    return static_cast<int>(it - m_messages.cbegin());
+}
+
+void MessageModel::insertMessage(const MessageInfo& message)
+{
+    int row = message.convSeq != 0 ? sequencedPosition(message.convSeq) : m_messages.size();
+    // 会话序号在会话内唯一：写线程提交后、通知到达前打开的会话已从数据库读到这条消息
+    if (message.convSeq != 0 && row > 0 && m_messages.at(row - 1).convSeq == message.convSeq) {
+        return;
+    }
+    // 比已加载的第一行还早而更早的历史还没加载：不插入，翻页时从数据库读到，已加载的部分始终是连续的一段
+    if (row == 0 && m_hasOlder && !m_messages.isEmpty()) {
+        return;
+    }
+    
+    beginInsertRows(QModelIndex(), row, row);
+    m_messages.insert(row, message);
+    if (message.convSeq != 0) {
+        ++m_sequencedCount;
+    }
+    endInsertRows();
+}
+
+bool MessageModel::setConversationSeq(qint64 clientMsgId, qint64 convSeq)
+{
+    if (clientMsgId == 0 || convSeq == 0) {
+        return false;
+    }
+    
+    // 待确认的消息在末尾未分配序号的部分，从尾部向前查找
+    for (int row = m_messages.size() - 1; row >= m_sequencedCount; --row) {
+        if (m_messages.at(row).clientMsgId != clientMsgId || m_messages.at(row).fromUserId != m_currentUserId) {
+            continue;
+        }
+        
+        int target = sequencedPosition(convSeq);
+        if (target != row) {
+            beginMoveRows(QModelIndex(), row, row, QModelIndex(), target);
+            m_messages.move(row, target);
+            m_messages[target].convSeq = convSeq;
+            ++m_sequencedCount;
+            endMoveRows();
+        } else {
+            m_messages[row].convSeq = convSeq;
+            ++m_sequencedCount;
+        }
+        return true;
+    }
+    return false;
+}
+
+bool MessageModel::setDeliveryState(qint64 clientMsgId, int state)
+{
+    if (clientMsgId == 0) {
+        return false;
+    }
+    
+    // 状态更新几乎总是针对最近发出的消息，从尾部向前查找
+    for (int row = m_messages.size() - 1; row >= 0; --row) {
+        MessageInfo& message = m_messages[row];
+        if (message.clientMsgId == clientMsgId && message.fromUserId == m_currentUserId) {
+            if (message.deliveryState != state) {
+                message.deliveryState = state;
+                QModelIndex idx = index(row);
+                emit dataChanged(idx, idx, {DeliveryStateRole});
+            }
+            return true;
+        }
+    }
+    return false;
+}
+
+int MessageModel::countInState(int state) const
+{
+    int count = 0;
+    for (const MessageInfo& message : m_messages) {
+        if (message.fromUserId == m_currentUserId && message.clientMsgId != 0
+            && message.deliveryState == state) {
+            ++count;
+        }
+    }
+    return count;
+}
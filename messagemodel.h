@@ -3,6 +3,7 @@
 
 #include <QAbstractListModel>
 #include <QList>
+#include <QHash>
 #include "databasemanager.h"
 
 class MessageModel : public QAbstractListModel
@@ -18,7 +19,9 @@ public:
         TimestampRole,
         MessageTypeRole,
         IsGroupRole,
-        IsOwnMessageRole
+        IsOwnMessageRole,
+        ClientMsgIdRole,
+        DeliveryStateRole
     };
 
     explicit MessageModel(QObject* parent = nullptr);
@@ -27,13 +30,42 @@ public:
     QVariant data(const QModelIndex& index, int role = Qt::DisplayRole) const override;
     QHash<int, QByteArray> roleNames() const override;
 
+    // 消息按会话序号排列：有序号的消息按序号升序，未分配序号的消息（尚未确认的自己发出的消息、
+    // 旧版服务器的消息）按到达顺序排在最后。乱序到达的消息二分查找插入位置，不重新排序
+    // 打开会话时只加载最新的一页，更早的消息由 loadOlderMessages 逐页加到开头
     void loadMessages(int userId, int contactId, bool isGroup = false);
+    // 加载已有消息之前的一页，返回加载的条数；数据库中没有更早的消息时返回0
+    int loadOlderMessages();
+    bool canLoadOlder() const { return m_hasOlder; }
     void addMessage(const MessageInfo& message, int currentUserId);
+    // 整批都排在已有消息之后时（最常见的情况）一次追加，只发出一次行插入通知
+    void addMessages(const QList<MessageInfo>& messages, int currentUserId);
     void clear();
+    const MessageInfo& messageAt(int row) const { return m_messages.at(row); }
+
+    // 自己发出的消息得到会话序号后移到对应位置；找不到该消息时返回false
+    bool setConversationSeq(qint64 clientMsgId, qint64 convSeq);
+
+    // 更新自己发出的消息的发送状态；找不到该消息时返回false
+    bool setDeliveryState(qint64 clientMsgId, int state);
+    int countInState(int state) const;
 
 private:
+    // 时间只在显示时格式化，同一秒内的消息共用一个字符串
+    QString timestampText(qint64 timestamp) const;
+    void insertMessage(const MessageInfo& message);
+    bool canAppend(const QList<MessageInfo>& messages) const;
+    int sequencedPosition(qint64 convSeq) const;
+
+    static const int MaxCachedTimestamps = 4096;
+    static const int PageSize = 100;
+
     QList<MessageInfo> m_messages;
+    int m_sequencedCount; // 开头有会话序号的消息数，其后都是未分配序号的消息
     int m_currentUserId;
+    qint64 m_conversationId;
+    bool m_hasOlder; // 数据库中可能还有比第一行更早的消息
+    mutable QHash<qint64, QString> m_timestampText; // 秒 -> 显示文本
 };
 
 #endif // MESSAGEMODEL_H
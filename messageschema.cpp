@@ -0,0 +1,359 @@
+#include "messageschema.h"
+#include "framedecoder.h"
+#include <QCborStreamReader>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QJsonArray>
+#include <QDateTime>
+#include <cmath>
+#include <cstring>
+
+namespace {
+
+void setError(QString* errorString, const QString& message)
+{
+    if (errorString) {
+        *errorString = message;
+    }
+}
+
+bool readCborString(QCborStreamReader& reader, QString& text)
+{
+    // 字符串可能分块编码，逐块拼接
+    text.clear();
+    QCborStreamReader::StringResult<QString> chunk = reader.readString();
+    while (chunk.status == QCborStreamReader::Ok) {
+        text += chunk.data;
+        chunk = reader.readString();
+    }
+    return chunk.status == QCborStreamReader::EndOfString;
+}
+
+bool jsonInteger(const QJsonValue& value, qint64& number)
+{
+    if (!value.isDouble()) {
+        return false;
+    }
+    double d = value.toDouble();
+    if (std::floor(d) != d || std::fabs(d) >= 9007199254740992.0) {
+        return false;
+    }
+    number = static_cast<qint64>(d);
+    return true;
+}
+
+}
+
+DecodedMessage::DecodedMessage()
+    : m_type(0)
+{
+    memset(m_index, -1, sizeof(m_index));
+}
+
+DecodedMessage::Slot& DecodedMessage::slot(int field)
+{
+    if (m_index[field] < 0) {
+        m_index[field] = static_cast<qint8>(m_slots.size());
+        m_slots.append(Slot());
+    }
+    return m_slots[m_index[field]];
+}
+
+const DecodedMessage::Slot* DecodedMessage::findSlot(int field) const
+{
+    if (field <= 0 || field >= MessageCodec::FieldCount || m_index[field] < 0) {
+        return nullptr;
+    }
+    return &m_slots[m_index[field]];
+}
+
+bool DecodedMessage::decode(const QByteArray& payload, int flags, DecodedMessage& message, QString* errorString)
+{
+    message = DecodedMessage();
+    
+    if (flags & FrameDecoder::FlagCbor) {
+        // CBOR帧为 [type, {字段编号: 值}]，直接在字节流上读取
+        QCborStreamReader reader(payload);
+        if (!reader.isArray() || !reader.enterContainer() || !reader.isInteger()) {
+            setError(errorString, "CBOR消息格式错误");
+            return false;
+        }
+        message.m_type = static_cast<int>(reader.toInteger());
+        reader.next();
+        if (!reader.isMap()) {
+            setError(errorString, "CBOR消息格式错误");
+            return false;
+        }
+        if (!message.readCborFields(reader, message.m_type, errorString)) {
+            return false;
+        }
+        // 忽略数组中多余的元素（更新的协议可能追加）
+        while (reader.hasNext() && reader.next()) {
+        }
+        if (reader.lastError() != QCborError::NoError) {
+            setError(errorString, "CBOR解析错误: " + reader.lastError().toString());
+            return false;
+        }
+        return message.checkRequired(errorString);
+    }
+    
+    QJsonParseError error;
+    QJsonDocument doc = QJsonDocument::fromJson(payload, &error);
+    if (error.error != QJsonParseError::NoError) {
+        setError(errorString, "JSON解析错误: " + error.errorString());
+        return false;
+    }
+    
+    QJsonObject obj = doc.object();
+    message.m_type = obj.value(QLatin1String("type")).toInt();
+    if (!message.readJsonFields(obj.value(QLatin1String("data")).toObject(), message.m_type, errorString)) {
+        return false;
+    }
+    return message.checkRequired(errorString);
+}
+
+bool DecodedMessage::readCborFields(QCborStreamReader& reader, int type, QString* errorString)
+{
+    if (!reader.enterContainer()) {
+        setError(errorString, "CBOR消息格式错误");
+        return false;
+    }
+    
+    while (reader.hasNext()) {
+        // 键为字段编号；字符串键按字段名查找（兼容手工构造的消息）
+        int field = 0;
+        if (reader.isInteger()) {
+            qint64 key = reader.toInteger();
+            field = (key > 0 && key < MessageCodec::FieldCount) ? static_cast<int>(key) : 0;
+            reader.next();
+        } else if (reader.isString()) {
+            QString name;
+            if (!readCborString(reader, name)) {
+                break;
+            }
+            field = MessageCodec::fieldFromName(name);
+        } else {
+            reader.next();
+        }
+        
+        // 未知字段和不属于该类型的字段跳过（含嵌套的容器）
+        MessageSchema::ValueKind kind = MessageSchema::fieldKind(field);
+        if (kind == MessageSchema::KindUnknown || !MessageSchema::allows(type, field)) {
+            reader.next();
+            continue;
+        }
+        
+        bool ok = true;
+        switch (kind) {
+        case MessageSchema::KindInteger:
+        case MessageSchema::KindTimestamp:
+            ok = reader.isInteger();
+            if (ok) {
+                slot(field).number = reader.toInteger();
+                reader.next();
+            }
+            break;
+            
+        case MessageSchema::KindBool:
+            ok = reader.isBool() || reader.isInteger();
+            if (ok) {
+                slot(field).number = reader.isBool() ? reader.toBool() : reader.toInteger() != 0;
+                reader.next();
+            }
+            break;
+            
+        case MessageSchema::KindString:
+            ok = reader.isString() && readCborString(reader, slot(field).text);
+            break;
+            
+        case MessageSchema::KindIntegerList: {
+            ok = reader.isArray() && reader.enterContainer();
+            QVector<qint64>& integers = slot(field).integers;
+            while (ok && reader.hasNext()) {
+                ok = reader.isInteger();
+                if (ok) {
+                    integers.append(reader.toInteger());
+                    reader.next();
+                }
+            }
+            ok = ok && reader.leaveContainer();
+            break;
+        }
+        
+        case MessageSchema::KindMessages:
+            // 数组中的每一项按单条聊天消息的描述解码和校验
+            ok = reader.isArray() && reader.enterContainer();
+            slot(field);
+            while (ok && reader.hasNext()) {
+                DecodedMessage item;
+                item.m_type = NetworkManager::MSG_TEXT;
+                ok = reader.isMap() && item.readCborFields(reader, item.m_type, errorString)
+                     && item.checkRequired(errorString);
+                if (ok) {
+                    m_messages.append(item);
+                }
+            }
+            ok = ok && reader.leaveContainer();
+            break;
+            
+        case MessageSchema::KindValue:
+            slot(field).value = QCborValue::fromCbor(reader);
+            break;
+            
+        case MessageSchema::KindUnknown:
+            break;
+        }
+        
+        if (!ok) {
+            if (errorString && errorString->isEmpty()) {
+                *errorString = QString("字段%1类型错误").arg(MessageCodec::fieldName(field));
+            }
+            return false;
+        }
+    }
+    
+    if (reader.lastError() != QCborError::NoError || !reader.leaveContainer()) {
+        setError(errorString, "CBOR解析错误: " + reader.lastError().toString());
+        return false;
+    }
+    return true;
+}
+
+bool DecodedMessage::readJsonFields(const QJsonObject& object, int type, QString* errorString)
+{
+    for (auto it = object.constBegin(); it != object.constEnd(); ++it) {
+        int field = MessageCodec::fieldFromName(it.key());
+        MessageSchema::ValueKind kind = MessageSchema::fieldKind(field);
+        if (kind == MessageSchema::KindUnknown || !MessageSchema::allows(type, field)) {
+            continue;
+        }
+        
+        const QJsonValue value = it.value();
+        bool ok = true;
+        switch (kind) {
+        case MessageSchema::KindInteger:
+            ok = jsonInteger(value, slot(field).number);
+            break;
+            
+        case MessageSchema::KindTimestamp:
+            // JSON中的时间戳为ISO-8601字符串，旧版服务器也可能直接发送毫秒数
+            if (value.isString()) {
+                QDateTime time = QDateTime::fromString(value.toString(), Qt::ISODate);
+                ok = time.isValid();
+                slot(field).number = ok ? time.toMSecsSinceEpoch() : 0;
+            } else {
+                ok = jsonInteger(value, slot(field).number);
+            }
+            break;
+            
+        case MessageSchema::KindBool:
+            ok = value.isBool() || value.isDouble();
+            slot(field).number = value.isBool() ? value.toBool() : value.toDouble() != 0;
+            break;
+            
+        case MessageSchema::KindString:
+            ok = value.isString();
+            slot(field).text = value.toString();
+            break;
+            
+        case MessageSchema::KindIntegerList: {
+            ok = value.isArray();
+            QVector<qint64>& integers = slot(field).integers;
+            const QJsonArray items = value.toArray();
+            for (const QJsonValue& item : items) {
+                qint64 number = 0;
+                ok = ok && jsonInteger(item, number);
+                integers.append(number);
+            }
+            break;
+        }
+        
+        case MessageSchema::KindMessages: {
+            ok = value.isArray();
+            slot(field);
+            const QJsonArray items = value.toArray();
+            for (const QJsonValue& item : items) {
+                DecodedMessage message;
+                message.m_type = NetworkManager::MSG_TEXT;
+                ok = ok && item.isObject() && message.readJsonFields(item.toObject(), message.m_type, errorString)
+                     && message.checkRequired(errorString);
+                m_messages.append(message);
+            }
+            break;
+        }
+        
+        case MessageSchema::KindValue:
+            slot(field).value = MessageCodec::fromJson(value, field);
+            break;
+            
+        case MessageSchema::KindUnknown:
+            break;
+        }
+        
+        if (!ok) {
+            if (errorString && errorString->isEmpty()) {
+                *errorString = QString("字段%1类型错误").arg(it.key());
+            }
+            return false;
+        }
+    }
+    return true;
+}
+
+bool DecodedMessage::checkRequired(QString* errorString) const
+{
+    quint64 required = MessageSchema::requiredFields(m_type);
+    for (int field = 1; field < MessageCodec::FieldCount; ++field) {
+        if (((required >> field) & 1) && m_index[field] < 0) {
+            setError(errorString, QString("消息类型%1缺少字段%2").arg(m_type).arg(MessageCodec::fieldName(field)));
+            return false;
+        }
+    }
+    return true;
+}
+
+QCborMap DecodedMessage::toCborMap() const
+{
+    QCborMap map;
+    for (int field = 1; field < MessageCodec::FieldCount; ++field) {
+        const Slot* entry = findSlot(field);
+        if (!entry) {
+            continue;
+        }
+        
+        switch (MessageSchema::fieldKind(field)) {
+        case MessageSchema::KindInteger:
+        case MessageSchema::KindTimestamp:
+            map.insert(field, entry->number);
+            break;
+        case MessageSchema::KindBool:
+            map.insert(field, entry->number != 0);
+            break;
+        case MessageSchema::KindString:
+            map.insert(field, entry->text);
+            break;
+        case MessageSchema::KindIntegerList: {
+            QCborArray array;
+            for (qint64 number : entry->integers) {
+                array.append(number);
+            }
+            map.insert(field, array);
+            break;
+        }
+        case MessageSchema::KindMessages: {
+            QCborArray array;
+            for (const DecodedMessage& message : m_messages) {
+                array.append(message.toCborMap());
+            }
+            map.insert(field, array);
+            break;
+        }
+        case MessageSchema::KindValue:
+            map.insert(field, entry->value);
+            break;
+        case MessageSchema::KindUnknown:
+            break;
+        }
+    }
+    return map;
+}
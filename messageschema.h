@@ -0,0 +1,258 @@
+#ifndef MESSAGESCHEMA_H
+#define MESSAGESCHEMA_H
+
+#include <QString>
+#include <QVector>
+#include <QVarLengthArray>
+#include <QCborMap>
+#include <QCborArray>
+#include <QCborValue>
+#include "messagecodec.h"
+#include "networkmanager.h"
+
+class DecodedMessage;
+class QCborStreamReader;
+class QJsonObject;
+
+// 协议的编译期描述：每个字段的值类型，以及每种消息类型的必需字段和允许字段。
+// 解码时按描述一次遍历完成取值和校验；构造发送的消息时字段是否属于该类型在编译期检查
+class MessageSchema
+{
+public:
+    enum ValueKind {
+        KindUnknown,
+        KindInteger,
+        KindBool,
+        KindString,
+        KindTimestamp,   // UTC毫秒数；JSON中为ISO-8601字符串
+        KindIntegerList,
+        KindMessages,    // 聊天消息数组（MSG_BATCH / MSG_SYNC_BATCH）
+        KindValue        // 结构不固定的值（联系人列表、编码列表），保留为 QCborValue
+    };
+
+    static constexpr ValueKind fieldKind(int field)
+    {
+        switch (field) {
+        case MessageCodec::FieldUserId:
+        case MessageCodec::FieldFromUserId:
+        case MessageCodec::FieldToUserId:
+        case MessageCodec::FieldContactId:
+        case MessageCodec::FieldProtocolVersion:
+        case MessageCodec::FieldClientMsgId:
+        case MessageCodec::FieldRequestId:
+        case MessageCodec::FieldRosterVersion:
+        case MessageCodec::FieldSeq:
+        case MessageCodec::FieldLastSeq:
+        case MessageCodec::FieldConvSeq:
+            return KindInteger;
+        case MessageCodec::FieldIsGroup:
+        case MessageCodec::FieldSuccess:
+        case MessageCodec::FieldFull:
+        case MessageCodec::FieldDone:
+            return KindBool;
+        case MessageCodec::FieldUsername:
+        case MessageCodec::FieldPassword:
+        case MessageCodec::FieldNickname:
+        case MessageCodec::FieldContent:
+        case MessageCodec::FieldReason:
+        case MessageCodec::FieldContactName:
+        case MessageCodec::FieldGroupName:
+        case MessageCodec::FieldEncoding:
+            return KindString;
+        case MessageCodec::FieldTimestamp:
+            return KindTimestamp;
+        case MessageCodec::FieldClientMsgIds:
+        case MessageCodec::FieldRemoved:
+        case MessageCodec::FieldConvSeqs:
+            return KindIntegerList;
+        case MessageCodec::FieldMessages:
+            return KindMessages;
+        case MessageCodec::FieldContacts:
+        case MessageCodec::FieldEncodings:
+        case MessageCodec::FieldCompression: // 请求中为数组，响应中为字符串
+            return KindValue;
+        default:
+            return KindUnknown;
+        }
+    }
+
+    template <typename... Fields>
+    static constexpr quint64 fields(Fields... field)
+    {
+        return (quint64(0) | ... | (quint64(1) << field));
+    }
+
+    // 收到该类型的消息时必须带有的字段，缺少即视为格式错误
+    static constexpr quint64 requiredFields(int type)
+    {
+        switch (type) {
+        case NetworkManager::MSG_TEXT:
+        case NetworkManager::MSG_GROUP_MESSAGE:
+            return fields(MessageCodec::FieldFromUserId, MessageCodec::FieldContent);
+        case NetworkManager::MSG_SYNC_BATCH:
+        case NetworkManager::MSG_BATCH:
+            return fields(MessageCodec::FieldMessages);
+        default:
+            return 0;
+        }
+    }
+
+    // 该类型的消息（请求和响应两个方向）可以携带的字段；其他字段解码时忽略，构造时编译失败
+    static constexpr quint64 allowedFields(int type)
+    {
+        switch (type) {
+        case NetworkManager::MSG_LOGIN:
+            return fields(MessageCodec::FieldUserId, MessageCodec::FieldUsername, MessageCodec::FieldLastSeq,
+                          MessageCodec::FieldProtocolVersion, MessageCodec::FieldEncodings,
+                          MessageCodec::FieldEncoding, MessageCodec::FieldCompression,
+                          MessageCodec::FieldSuccess, MessageCodec::FieldReason, MessageCodec::FieldRequestId);
+        case NetworkManager::MSG_REGISTER:
+            return fields(MessageCodec::FieldUsername, MessageCodec::FieldPassword, MessageCodec::FieldNickname,
+                          MessageCodec::FieldUserId, MessageCodec::FieldSuccess, MessageCodec::FieldReason,
+                          MessageCodec::FieldRequestId);
+        case NetworkManager::MSG_TEXT:
+        case NetworkManager::MSG_GROUP_MESSAGE:
+            return fields(MessageCodec::FieldClientMsgId, MessageCodec::FieldFromUserId, MessageCodec::FieldToUserId,
+                          MessageCodec::FieldContent, MessageCodec::FieldIsGroup, MessageCodec::FieldTimestamp,
+                          MessageCodec::FieldSeq, MessageCodec::FieldConvSeq);
+        case NetworkManager::MSG_HEARTBEAT:
+            return fields(MessageCodec::FieldUserId);
+        case NetworkManager::MSG_ACK:
+            return fields(MessageCodec::FieldClientMsgId, MessageCodec::FieldClientMsgIds,
+                          MessageCodec::FieldConvSeq, MessageCodec::FieldConvSeqs);
+        case NetworkManager::MSG_GET_CONTACTS:
+            return fields(MessageCodec::FieldUserId, MessageCodec::FieldRosterVersion, MessageCodec::FieldContacts,
+                          MessageCodec::FieldRemoved, MessageCodec::FieldFull, MessageCodec::FieldSuccess,
+                          MessageCodec::FieldReason, MessageCodec::FieldRequestId);
+        case NetworkManager::MSG_ADD_CONTACT:
+            return fields(MessageCodec::FieldUserId, MessageCodec::FieldContactId, MessageCodec::FieldContactName,
+                          MessageCodec::FieldGroupName, MessageCodec::FieldIsGroup, MessageCodec::FieldRosterVersion,
+                          MessageCodec::FieldSuccess, MessageCodec::FieldReason, MessageCodec::FieldRequestId);
+        case NetworkManager::MSG_REMOVE_CONTACT:
+            return fields(MessageCodec::FieldUserId, MessageCodec::FieldContactId, MessageCodec::FieldRosterVersion,
+                          MessageCodec::FieldSuccess, MessageCodec::FieldReason, MessageCodec::FieldRequestId);
+        case NetworkManager::MSG_SYNC_BATCH:
+            return fields(MessageCodec::FieldMessages, MessageCodec::FieldSeq, MessageCodec::FieldDone);
+        case NetworkManager::MSG_BATCH:
+            return fields(MessageCodec::FieldMessages);
+        case NetworkManager::MSG_BACKFILL:
+            return fields(MessageCodec::FieldContactId, MessageCodec::FieldIsGroup, MessageCodec::FieldConvSeq);
+        default:
+            return ~quint64(0); // 未知类型：不限制字段，交给调用方处理
+        }
+    }
+
+    static constexpr bool allows(int type, int field)
+    {
+        return (allowedFields(type) >> field) & 1;
+    }
+
+    // 字段值在C++中的类型
+    template <ValueKind Kind> struct KindType;
+
+    template <int Field>
+    using FieldType = typename KindType<fieldKind(Field)>::Type;
+};
+
+template <> struct MessageSchema::KindType<MessageSchema::KindInteger> { using Type = qint64; };
+template <> struct MessageSchema::KindType<MessageSchema::KindBool> { using Type = bool; };
+template <> struct MessageSchema::KindType<MessageSchema::KindString> { using Type = QString; };
+template <> struct MessageSchema::KindType<MessageSchema::KindTimestamp> { using Type = qint64; };
+template <> struct MessageSchema::KindType<MessageSchema::KindIntegerList> { using Type = QVector<qint64>; };
+template <> struct MessageSchema::KindType<MessageSchema::KindMessages> { using Type = QVector<DecodedMessage>; };
+template <> struct MessageSchema::KindType<MessageSchema::KindValue> { using Type = QCborValue; };
+
+// 按描述解码的一条消息：字段值直接从CBOR流（或JSON文档）读入，不构造中间的 QCborMap 树，
+// 读取时按字段编号定位，不做字符串哈希。字段缺失时返回该类型的默认值
+class DecodedMessage
+{
+public:
+    DecodedMessage();
+
+    // 解码帧负载并按消息类型校验：CBOR帧的字段在一次遍历中取值和检查类型，
+    // 任一字段类型不符或缺少必需字段即整帧拒绝
+    static bool decode(const QByteArray& payload, int flags, DecodedMessage& message,
+                       QString* errorString = nullptr);
+
+    int type() const { return m_type; }
+    bool contains(int field) const { return field > 0 && field < MessageCodec::FieldCount && m_index[field] >= 0; }
+
+    template <int Field>
+    MessageSchema::FieldType<Field> get() const;
+
+    const QVector<DecodedMessage>& messages() const { return m_messages; }
+
+    // 转换回通用表示，供请求结果等非热点路径使用
+    QCborMap toCborMap() const;
+
+private:
+    struct Slot {
+        qint64 number = 0;
+        QString text;
+        QVector<qint64> integers;
+        QCborValue value;
+    };
+
+    bool readCborFields(QCborStreamReader& reader, int type, QString* errorString);
+    bool readJsonFields(const QJsonObject& object, int type, QString* errorString);
+    bool checkRequired(QString* errorString) const;
+    Slot& slot(int field);
+    const Slot* findSlot(int field) const;
+
+    int m_type;
+    qint8 m_index[MessageCodec::FieldCount]; // 字段编号 -> m_slots 下标，-1为不存在
+    QVarLengthArray<Slot, 8> m_slots;
+    QVector<DecodedMessage> m_messages;
+};
+
+template <int Field>
+MessageSchema::FieldType<Field> DecodedMessage::get() const
+{
+    constexpr MessageSchema::ValueKind kind = MessageSchema::fieldKind(Field);
+    static_assert(kind != MessageSchema::KindUnknown, "未在协议描述中定义的字段");
+
+    const Slot* entry = findSlot(Field);
+    if constexpr (kind == MessageSchema::KindMessages) {
+        return m_messages;
+    } else if constexpr (kind == MessageSchema::KindBool) {
+        return entry && entry->number != 0;
+    } else if constexpr (kind == MessageSchema::KindInteger || kind == MessageSchema::KindTimestamp) {
+        return entry ? entry->number : 0;
+    } else if constexpr (kind == MessageSchema::KindString) {
+        return entry ? entry->text : QString();
+    } else if constexpr (kind == MessageSchema::KindIntegerList) {
+        return entry ? entry->integers : QVector<qint64>();
+    } else {
+        return entry ? entry->value : QCborValue();
+    }
+}
+
+// 构造要发送的消息：字段是否属于消息类型、值的类型是否正确都在编译期检查
+template <int Type>
+class MessageBuilder
+{
+public:
+    template <int Field>
+    MessageBuilder& set(const MessageSchema::FieldType<Field>& value)
+    {
+        static_assert(MessageSchema::allows(Type, Field), "该字段不属于此消息类型");
+        constexpr MessageSchema::ValueKind kind = MessageSchema::fieldKind(Field);
+        if constexpr (kind == MessageSchema::KindIntegerList) {
+            QCborArray array;
+            for (qint64 item : value) {
+                array.append(item);
+            }
+            m_data.insert(Field, array);
+        } else {
+            m_data.insert(Field, QCborValue(value));
+        }
+        return *this;
+    }
+
+    const QCborMap& data() const { return m_data; }
+
+private:
+    QCborMap m_data;
+};
+
+#endif // MESSAGESCHEMA_H
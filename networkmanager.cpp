@@ -1,270 +1,1407 @@
 #include "networkmanager.h"
+#include "messageschema.h"
 #include <QDebug>
 #include <QHostAddress>
 #include <QDateTime>
+#include <QMetaMethod>
+#include <QRandomGenerator>
+#include <memory>
+#include <algorithm>
 
 NetworkManager::NetworkManager(QObject* parent)
     : QObject(parent)
+    , m_ioThread(nullptr)
+    , m_ioContext(nullptr)
     , m_socket(nullptr)
     , m_port(8888)
+    , m_timerWheel(nullptr)
+    , m_keepalive(nullptr)
+    , m_reconnectTimer(0)
+    , m_connectTimer(0)
+    , m_connectTimeout(5000)
     , m_autoReconnect(true)
+    , m_backoffAttempt(0)
+    , m_initialBackoffMs(1000)
+    , m_maxBackoffMs(60000)
+    , m_flushScheduled(false)
+    , m_lowWaterMark(256 * 1024)
+    , m_highWaterMark(1024 * 1024)
     , m_currentUserId(0)
+    , m_encoding(MessageCodec::EncodingJson)
+    , m_preferredEncoding(MessageCodec::EncodingCbor)
+    , m_compressionEnabled(true)
+    , m_compressionActive(false)
+    , m_compressionThreshold(1024)
+    , m_sendWindow(128)
+    , m_catchUpCount(0)
+    , m_backfillSupported(false)
+    , m_capture(nullptr)
+    , m_replayReader(nullptr)
+    , m_replayHasRecord(false)
+    , m_replayPacing(ReplayAsFastAsPossible)
+    , m_replayTimer(nullptr)
+    , m_replayBaseUs(0)
+    , m_replayFrames(0)
+    , m_replayMessages(0)
+    , m_nextRequestId(0)
+    , m_requestTimeout(10000)
+    , m_socketState(QAbstractSocket::UnconnectedState)
+    , m_state(StateIdle)
+    , m_backPressured(false)
+    , m_pendingBytes(0)
+    , m_queuedFrames(0)
+    , m_totalFrames(0)
+    , m_totalBytes(0)
+    , m_totalWrites(0)
+    , m_inFlightCount(0)
+    , m_nextClientMsgId(QDateTime::currentMSecsSinceEpoch() << 10)
+    , m_pendingRequestCount(0)
+    , m_reliableDelivery(false)
+    , m_syncCursor(0)
+    , m_catchingUp(false)
+    , m_replaying(false)
+    , m_maxFrameSize(FrameDecoder::DefaultMaxFrameSize)
 {
-    m_socket = new QTcpSocket(this);
+    qRegisterMetaType<ChatMessage>();
+    qRegisterMetaType<QVector<ChatMessage>>();
+    qRegisterMetaType<NetworkManager::ConnectionState>();
+    qRegisterMetaType<NetworkManager::DeliveryState>();
+    qRegisterMetaType<RequestResult>();
+    qRegisterMetaType<RosterDelta>();
     
-    connect(m_socket, &QTcpSocket::connected, this, &NetworkManager::onConnected);
-    connect(m_socket, &QTcpSocket::disconnected, this, &NetworkManager::onDisconnected);
-    connect(m_socket, &QTcpSocket::readyRead, this, &NetworkManager::onReadyRead);
+    // socket和定时器挂在m_ioContext下，工作线程模式下整体迁移到网络线程；
+    // 内部信号一律使用直接连接，保证槽在socket所在线程执行
+    m_ioContext = new QObject;
+    m_socket = new QTcpSocket(m_ioContext);
+    
+    connect(m_socket, &QTcpSocket::connected, this, &NetworkManager::onConnected, Qt::DirectConnection);
+    connect(m_socket, &QTcpSocket::disconnected, this, &NetworkManager::onDisconnected, Qt::DirectConnection);
+    connect(m_socket, &QTcpSocket::readyRead, this, &NetworkManager::onReadyRead, Qt::DirectConnection);
+    connect(m_socket, &QTcpSocket::bytesWritten, this, &NetworkManager::onBytesWritten, Qt::DirectConnection);
+    connect(m_socket, &QAbstractSocket::stateChanged, this, &NetworkManager::onStateChanged, Qt::DirectConnection);
 #if QT_VERSION >= QT_VERSION_CHECK(6, 0, 0)
-    connect(m_socket, &QAbstractSocket::errorOccurred, this, &NetworkManager::onError);
+    connect(m_socket, &QAbstractSocket::errorOccurred, this, &NetworkManager::onError, Qt::DirectConnection);
 #else
     connect(m_socket, static_cast<void(QAbstractSocket::*)(QAbstractSocket::SocketError)>(&QAbstractSocket::error),
-            this, &NetworkManager::onError);
+            this, &NetworkManager::onError, Qt::DirectConnection);
 #endif
     
-    m_reconnectTimer = new QTimer(this);
-    m_reconnectTimer->setSingleShot(true);
-    m_reconnectTimer->setInterval(3000);
-    connect(m_reconnectTimer, &QTimer::timeout, this, &NetworkManager::reconnect);
+    // 所有超时（重连退避、连接超时、请求超时、保活）都挂在同一个时间轮上，
+    // 网络线程只在最近一个到期时刻被唤醒
+    m_timerWheel = new TimerWheel(100, m_ioContext);
+    m_keepalive = new KeepaliveManager(m_timerWheel, m_timerWheel);
+    connect(m_keepalive, &KeepaliveManager::heartbeatDue, this, &NetworkManager::sendHeartbeat, Qt::DirectConnection);
+    connect(m_keepalive, &KeepaliveManager::peerTimedOut, this, &NetworkManager::onPeerTimedOut, Qt::DirectConnection);
     
-    m_heartbeatTimer = new QTimer(this);
-    m_heartbeatTimer->setInterval(30000); // 30秒心跳
-    connect(m_heartbeatTimer, &QTimer::timeout, this, &NetworkManager::sendHeartbeat);
+    // 按原节奏重放需要毫秒级的定时，不使用时间轮
+    m_replayTimer = new QTimer(m_ioContext);
+    m_replayTimer->setSingleShot(true);
+    m_replayTimer->setTimerType(Qt::PreciseTimer);
+    connect(m_replayTimer, &QTimer::timeout, this, &NetworkManager::replayNext, Qt::DirectConnection);
 }
 
 NetworkManager::~NetworkManager()
 {
-    disconnectFromServer();
+    if (m_ioThread) {
+        QMetaObject::invokeMethod(m_ioContext, [this]() { doDisconnect(); }, Qt::BlockingQueuedConnection);
+        // m_ioContext在线程结束时由deleteLater释放
+        m_ioThread->quit();
+        m_ioThread->wait();
+    } else {
+        doDisconnect();
+        delete m_ioContext;
+    }
+    delete m_capture;
+    delete m_replayReader;
+}
+
+template <typename Func>
+void NetworkManager::runOnIoThread(Func func)
+{
+    if (QThread::currentThread() == m_ioContext->thread()) {
+        func();
+    } else {
+        QMetaObject::invokeMethod(m_ioContext, std::move(func), Qt::QueuedConnection);
+    }
+}
+
+void NetworkManager::startWorkerThread()
+{
+    if (m_ioThread) {
+        return;
+    }
+    
+    if (m_socketState != QAbstractSocket::UnconnectedState) {
+        qDebug() << "已建立连接，无法切换到网络工作线程模式";
+        return;
+    }
+    
+    m_ioThread = new QThread(this);
+    m_ioThread->setObjectName("NetworkThread");
+    m_ioContext->moveToThread(m_ioThread);
+    connect(m_ioThread, &QThread::finished, m_ioContext, &QObject::deleteLater);
+    m_ioThread->start();
+}
+
+void NetworkManager::connectToServer(const QString& host, quint16 port)
+{
+    runOnIoThread([this, host, port]() { doConnect(host, port); });
 }
 
-bool NetworkManager::connectToServer(const QString& host, quint16 port)
+void NetworkManager::doConnect(const QString& host, quint16 port)
 {
+    bool sameServer = (host == m_host && port == m_port);
     m_host = host;
     m_port = port;
+    m_autoReconnect = true;
     
-    if (m_socket->state() == QAbstractSocket::ConnectedState) {
-        return true;
+    if (sameServer && m_socket->state() == QAbstractSocket::ConnectedState) {
+        return;
+    }
+    
+    // 主动发起的连接立即进行，不再等待退避
+    m_timerWheel->cancel(m_reconnectTimer);
+    m_reconnectTimer = 0;
+    m_backoffAttempt = 0;
+    if (m_socket->state() != QAbstractSocket::UnconnectedState) {
+        m_socket->abort();
     }
     
-    m_socket->connectToHost(host, port);
-    return m_socket->waitForConnected(3000);
+    reconnect();
 }
 
 void NetworkManager::disconnectFromServer()
+{
+    runOnIoThread([this]() { doDisconnect(); });
+}
+
+void NetworkManager::doDisconnect()
 {
     m_autoReconnect = false;
-    m_heartbeatTimer->stop();
-    m_reconnectTimer->stop();
+    m_keepalive->stop();
+    m_timerWheel->cancel(m_reconnectTimer);
+    m_timerWheel->cancel(m_connectTimer);
+    m_reconnectTimer = m_connectTimer = 0;
     
     if (m_socket->state() != QAbstractSocket::UnconnectedState) {
+        // 先把本轮尚未合并写出的帧交给socket，disconnectFromHost会等待其发送完毕
+        flushSendQueue();
         m_socket->disconnectFromHost();
     }
+    
+    failPendingRequests("已断开连接");
+    setState(StateIdle);
+}
+
+void NetworkManager::setCredentials(int userId, const QString& username)
+{
+    runOnIoThread([this, userId, username]() {
+        bool changed = (userId != m_currentUserId);
+        m_currentUserId = userId;
+        m_currentUsername = username;
+        
+        // 已连接但尚未以该用户登录（例如网络注册成功后），立即登录
+        if (changed && userId > 0 && connectionState() == StateAuthenticating) {
+            sendLogin(userId, username);
+        }
+    });
+}
+
+void NetworkManager::whenOnline(QObject* context, std::function<void()> func)
+{
+    // 先连接信号再检查状态，避免检查与连接之间错过状态变化
+    auto connection = std::make_shared<QMetaObject::Connection>();
+    auto fired = std::make_shared<bool>(false);
+    auto invoke = [connection, fired, func]() {
+        if (*fired) {
+            return;
+        }
+        *fired = true;
+        QObject::disconnect(*connection);
+        func();
+    };
+    
+    *connection = connect(this, &NetworkManager::online, context, invoke, Qt::QueuedConnection);
+    if (isOnline()) {
+        QMetaObject::invokeMethod(context, invoke, Qt::QueuedConnection);
+    }
+}
+
+void NetworkManager::setReconnectBackoff(int initialDelayMs, int maxDelayMs)
+{
+    runOnIoThread([this, initialDelayMs, maxDelayMs]() {
+        m_initialBackoffMs = qMax(1, initialDelayMs);
+        m_maxBackoffMs = qMax(m_initialBackoffMs, maxDelayMs);
+    });
+}
+
+void NetworkManager::setConnectTimeout(int msecs)
+{
+    runOnIoThread([this, msecs]() { m_connectTimeout = qMax(1, msecs); });
+}
+
+void NetworkManager::setKeepalive(int heartbeatIntervalMs, int probeTimeoutMs)
+{
+    runOnIoThread([this, heartbeatIntervalMs, probeTimeoutMs]() {
+        m_keepalive->setHeartbeatInterval(heartbeatIntervalMs);
+        m_keepalive->setProbeTimeout(probeTimeoutMs);
+    });
 }
 
 bool NetworkManager::isConnected() const
 {
-    return m_socket->state() == QAbstractSocket::ConnectedState;
+    return m_socketState == QAbstractSocket::ConnectedState;
+}
+
+void NetworkManager::setMaxFrameSize(quint32 size)
+{
+    runOnIoThread([this, size]() {
+        m_decoder.setMaxFrameSize(size);
+        m_maxFrameSize = size;
+    });
+}
+
+quint32 NetworkManager::maxFrameSize() const
+{
+    // 解码器只在网络线程中访问，其他线程读取原子副本
+    return m_maxFrameSize;
+}
+
+void NetworkManager::setWriteWaterMarks(qint64 lowWaterMark, qint64 highWaterMark)
+{
+    runOnIoThread([this, lowWaterMark, highWaterMark]() {
+        m_lowWaterMark = qMin(lowWaterMark, highWaterMark);
+        m_highWaterMark = highWaterMark;
+        updateBackPressure();
+    });
+}
+
+NetworkManager::SendQueueStats NetworkManager::sendQueueStats() const
+{
+    SendQueueStats stats;
+    stats.queuedBytes = m_pendingBytes;
+    stats.queuedFrames = m_queuedFrames;
+    stats.totalFrames = m_totalFrames;
+    stats.totalBytes = m_totalBytes;
+    stats.totalWrites = m_totalWrites;
+    return stats;
 }
 
-void NetworkManager::sendLogin(int userId, const QString& username)
+QFuture<RequestResult> NetworkManager::sendLogin(int userId, const QString& username)
 {
-    QJsonObject data;
-    data["user_id"] = userId;
-    data["username"] = username;
+    QFutureInterface<RequestResult> promise;
+    promise.reportStarted();
+    
+    runOnIoThread([this, userId, username, promise]() {
+        MessageBuilder<MSG_LOGIN> login;
+        login.set<MessageCodec::FieldUserId>(userId);
+        login.set<MessageCodec::FieldUsername>(username);
+        // 同步游标：服务器只重放该序号之后的消息
+        login.set<MessageCodec::FieldLastSeq>(m_syncCursor.load());
+        
+        // 协商编码：声明协议版本和支持的编码，服务器在登录响应中选定本连接使用的编码
+        login.set<MessageCodec::FieldProtocolVersion>(MessageCodec::ProtocolVersion);
+        QCborArray encodings;
+        if (m_preferredEncoding == MessageCodec::EncodingCbor) {
+            encodings.append(QString(MessageCodec::encodingName(MessageCodec::EncodingCbor)));
+        }
+        encodings.append(QString(MessageCodec::encodingName(MessageCodec::EncodingJson)));
+        login.set<MessageCodec::FieldEncodings>(encodings);
+        if (m_compressionEnabled) {
+            login.set<MessageCodec::FieldCompression>(QCborArray{ QStringLiteral("zlib") });
+        }
+        
+        sendRequest(MSG_LOGIN, login.data(), promise);
+        m_currentUserId = userId;
+        m_currentUsername = username;
+    });
     
-    QByteArray msg = createMessage(MSG_LOGIN, data);
-    m_socket->write(msg);
-    m_currentUserId = userId;
+    return promise.future();
 }
 
-void NetworkManager::sendRegister(const QString& username, const QString& password, const QString& nickname)
+void NetworkManager::setSyncCursor(qint64 seq)
 {
-    QJsonObject data;
-    data["username"] = username;
-    data["password"] = password;
-    data["nickname"] = nickname;
+    runOnIoThread([this, seq]() { m_syncCursor = qMax<qint64>(0, seq); });
+}
+
+QFuture<RequestResult> NetworkManager::sendRegister(const QString& username, const QString& password, const QString& nickname)
+{
+    MessageBuilder<MSG_REGISTER> message;
+    message.set<MessageCodec::FieldUsername>(username);
+    message.set<MessageCodec::FieldPassword>(password);
+    message.set<MessageCodec::FieldNickname>(nickname);
     
-    QByteArray msg = createMessage(MSG_REGISTER, data);
-    m_socket->write(msg);
+    return request(MSG_REGISTER, message.data());
 }
 
-void NetworkManager::sendTextMessage(int fromUserId, int toUserId, const QString& content, bool isGroup)
+qint64 NetworkManager::sendTextMessage(int fromUserId, int toUserId, const QString& content, bool isGroup,
+                                       qint64 clientMsgId, qint64 timestamp)
 {
-    QJsonObject data;
-    data["from_user_id"] = fromUserId;
-    data["to_user_id"] = toUserId;
-    data["content"] = content;
-    data["is_group"] = isGroup;
-    data["timestamp"] = QDateTime::currentDateTime().toString(Qt::ISODate);
+    // ID以启动时刻的毫秒数为基数递增，重启后不会与之前的ID重复
+    if (clientMsgId == 0) {
+        clientMsgId = nextClientMsgId();
+    }
+    
+    // 单聊和群聊共用同一描述
+    MessageBuilder<MSG_TEXT> chat;
+    chat.set<MessageCodec::FieldClientMsgId>(clientMsgId);
+    chat.set<MessageCodec::FieldFromUserId>(fromUserId);
+    chat.set<MessageCodec::FieldToUserId>(toUserId);
+    chat.set<MessageCodec::FieldContent>(content);
+    chat.set<MessageCodec::FieldIsGroup>(isGroup);
+    chat.set<MessageCodec::FieldTimestamp>(timestamp > 0 ? timestamp : QDateTime::currentMSecsSinceEpoch());
+    
+    OutgoingMessage message;
+    message.clientMsgId = clientMsgId;
+    message.type = isGroup ? MSG_GROUP_MESSAGE : MSG_TEXT;
+    message.data = chat.data();
     
-    QByteArray msg = createMessage(isGroup ? MSG_GROUP_MESSAGE : MSG_TEXT, data);
-    m_socket->write(msg);
+    // 总是排队执行（即使已在网络线程），保证调用方拿到消息ID之后才会收到它的状态变化
+    QMetaObject::invokeMethod(m_ioContext, [this, message]() {
+        m_outgoingMessages.enqueue(message);
+        emit messageStateChanged(message.clientMsgId, DeliveryPending);
+        pumpOutgoingMessages();
+    }, Qt::QueuedConnection);
+    
+    return clientMsgId;
 }
 
 void NetworkManager::sendHeartbeat()
 {
-    QJsonObject data;
-    data["user_id"] = m_currentUserId;
+    runOnIoThread([this]() {
+        MessageBuilder<MSG_HEARTBEAT> heartbeat;
+        heartbeat.set<MessageCodec::FieldUserId>(m_currentUserId);
+        
+        sendMessage(MSG_HEARTBEAT, heartbeat.data());
+    });
+}
+
+QFuture<RequestResult> NetworkManager::sendGetContacts(int userId, qint64 rosterVersion)
+{
+    MessageBuilder<MSG_GET_CONTACTS> message;
+    message.set<MessageCodec::FieldUserId>(userId);
+    message.set<MessageCodec::FieldRosterVersion>(rosterVersion);
+    
+    return request(MSG_GET_CONTACTS, message.data());
+}
+
+QFuture<RequestResult> NetworkManager::sendAddContact(int userId, int contactId, const QString& contactName,
+                                                      const QString& groupName, bool isGroup)
+{
+    MessageBuilder<MSG_ADD_CONTACT> message;
+    message.set<MessageCodec::FieldUserId>(userId);
+    message.set<MessageCodec::FieldContactId>(contactId);
+    message.set<MessageCodec::FieldContactName>(contactName);
+    if (!groupName.isEmpty()) {
+        message.set<MessageCodec::FieldGroupName>(groupName);
+    }
+    message.set<MessageCodec::FieldIsGroup>(isGroup);
     
-    QByteArray msg = createMessage(MSG_HEARTBEAT, data);
-    m_socket->write(msg);
+    return request(MSG_ADD_CONTACT, message.data());
 }
 
-void NetworkManager::sendGetContacts(int userId)
+QFuture<RequestResult> NetworkManager::sendRemoveContact(int userId, int contactId)
 {
-    QJsonObject data;
-    data["user_id"] = userId;
+    MessageBuilder<MSG_REMOVE_CONTACT> message;
+    message.set<MessageCodec::FieldUserId>(userId);
+    message.set<MessageCodec::FieldContactId>(contactId);
     
-    QByteArray msg = createMessage(MSG_GET_CONTACTS, data);
-    m_socket->write(msg);
+    return request(MSG_REMOVE_CONTACT, message.data());
+}
+
+void NetworkManager::setRequestTimeout(int msecs)
+{
+    runOnIoThread([this, msecs]() { m_requestTimeout = qMax(1, msecs); });
 }
 
-void NetworkManager::sendAddContact(int userId, int contactId, const QString& contactName)
+bool NetworkManager::startCapture(const QString& path)
 {
-    QJsonObject data;
-    data["user_id"] = userId;
-    data["contact_id"] = contactId;
-    data["contact_name"] = contactName;
+    FrameCaptureWriter* capture = new FrameCaptureWriter;
+    QString errorString;
+    if (!capture->open(path, &errorString)) {
+        qDebug() << "无法创建抓包文件:" << path << errorString;
+        delete capture;
+        return false;
+    }
     
-    QByteArray msg = createMessage(MSG_ADD_CONTACT, data);
-    m_socket->write(msg);
+    runOnIoThread([this, capture]() {
+        delete m_capture;
+        m_capture = capture;
+        qDebug() << "开始抓包";
+    });
+    return true;
+}
+
+void NetworkManager::stopCapture()
+{
+    runOnIoThread([this]() {
+        if (m_capture) {
+            qDebug() << "停止抓包, 帧数:" << m_capture->frameCount();
+            delete m_capture;
+            m_capture = nullptr;
+        }
+    });
+}
+
+bool NetworkManager::startReplay(const QString& path, ReplayPacing pacing)
+{
+    FrameCaptureReader* reader = new FrameCaptureReader;
+    QString errorString;
+    if (!reader->open(path, &errorString)) {
+        qDebug() << "无法打开抓包文件:" << path << errorString;
+        delete reader;
+        return false;
+    }
+    
+    runOnIoThread([this, reader, pacing]() {
+        // 重放期间不连接服务器，避免实时数据与重放的数据交错；socket中尚未读取的数据直接丢弃
+        doDisconnect();
+        m_socket->abort();
+        m_decoder.reset();
+        delete m_replayReader;
+        m_replayReader = reader;
+        m_replayPacing = pacing;
+        m_replayFrames = 0;
+        m_replayMessages = 0;
+        m_replayHasRecord = reader->readNext(m_replayRecord);
+        m_replayBaseUs = m_replayRecord.arrivalUs;
+        m_replaying = true;
+        qDebug() << "开始重放抓包, 录制时间:" << reader->startTime().toString(Qt::ISODate);
+        
+        m_replayClock.start();
+        if (m_replayHasRecord) {
+            m_replayTimer->start(0);
+        } else {
+            finishReplay();
+        }
+    });
+    return true;
+}
+
+void NetworkManager::replayNext()
+{
+    if (!m_replaying || !m_replayHasRecord) {
+        return;
+    }
+    
+    // 到达时间相同的帧是同一次socket读取收到的，一起交给解码器，保持原来的批次边界
+    qint64 readTimeUs = m_replayRecord.arrivalUs;
+    do {
+        m_decoder.append(m_replayRecord.frame.constData(), m_replayRecord.frame.size());
+        ++m_replayFrames;
+        m_replayHasRecord = m_replayReader->readNext(m_replayRecord);
+    } while (m_replayHasRecord && m_replayRecord.arrivalUs == readTimeUs);
+    processFrames();
+    
+    if (!m_replaying) {
+        return; // 帧错误，已结束
+    }
+    if (!m_replayHasRecord) {
+        finishReplay();
+        return;
+    }
+    
+    // 全速重放也每次读取之后回到事件循环，与实际收包一样让出线程
+    qint64 delayMs = 0;
+    if (m_replayPacing == ReplayOriginalPacing) {
+        qint64 dueUs = m_replayRecord.arrivalUs - m_replayBaseUs;
+        delayMs = qMax<qint64>(0, (dueUs - m_replayClock.nsecsElapsed() / 1000) / 1000);
+    }
+    m_replayTimer->start(static_cast<int>(delayMs));
+}
+
+void NetworkManager::finishReplay()
+{
+    flushReceivedMessages();
+    m_replayTimer->stop();
+    m_decoder.reset();
+    delete m_replayReader;
+    m_replayReader = nullptr;
+    m_replayHasRecord = false;
+    m_replaying = false;
+    
+    qint64 elapsedMs = m_replayClock.elapsed();
+    qDebug() << "抓包重放结束, 帧数:" << m_replayFrames << "消息数:" << m_replayMessages << "耗时:" << elapsedMs << "毫秒";
+    emit replayFinished(m_replayFrames, m_replayMessages, elapsedMs);
+}
+
+void NetworkManager::setPreferredEncoding(MessageCodec::Encoding encoding)
+{
+    runOnIoThread([this, encoding]() { m_preferredEncoding = encoding; });
+}
+
+void NetworkManager::setSendWindow(int messages)
+{
+    runOnIoThread([this, messages]() {
+        m_sendWindow = qMax(1, messages);
+        pumpOutgoingMessages();
+    });
+}
+
+void NetworkManager::setCompressionEnabled(bool enabled)
+{
+    runOnIoThread([this, enabled]() { m_compressionEnabled = enabled; });
+}
+
+void NetworkManager::setCompressionThreshold(int bytes)
+{
+    runOnIoThread([this, bytes]() { m_compressionThreshold = bytes; });
 }
 
 void NetworkManager::onConnected()
 {
-    m_autoReconnect = true;
-    m_reconnectTimer->stop();
-    m_heartbeatTimer->start();
+    m_decoder.reset();
+    // 每个新连接都从JSON开始，登录时重新协商编码
+    m_encoding = MessageCodec::EncodingJson;
+    m_compressionActive = false;
+    m_reliableDelivery = false;
+    m_backfillSupported = false;
+    m_catchingUp = false;
+    m_timerWheel->cancel(m_connectTimer);
+    m_connectTimer = 0;
+    // 登录响应确认服务器会回应心跳之前只做保活，不做存活检测
+    m_keepalive->setPeerDetectionEnabled(false);
+    m_keepalive->start();
+    setState(StateAuthenticating);
     emit connected();
     qDebug() << "已连接到服务器";
+    
+    // 已有登录凭据（重连）时自动重新登录
+    if (m_currentUserId > 0) {
+        sendLogin(m_currentUserId, m_currentUsername);
+    }
 }
 
 void NetworkManager::onDisconnected()
 {
-    m_heartbeatTimer->stop();
+    m_keepalive->stop();
+    clearSendQueue();
+    // 响应不会再到达，等待中的请求立即以失败结束
+    failPendingRequests("与服务器的连接已断开");
     emit disconnected();
     qDebug() << "与服务器断开连接";
     
     if (m_autoReconnect) {
-        m_reconnectTimer->start();
+        scheduleReconnect();
+    } else {
+        setState(StateIdle);
     }
 }
 
 void NetworkManager::onReadyRead()
 {
-    QByteArray data = m_socket->readAll();
-    m_buffer.append(data);
-    
+    m_decoder.readFrom(m_socket);
+    m_keepalive->noteReceived();
+    if (m_capture) {
+        m_capture->beginRead();
+    }
+    processFrames();
+}
+
+void NetworkManager::processFrames()
+{
     // 解析消息（简单协议：前4字节为消息长度）
-    while (m_buffer.size() >= 4) {
-        quint32 msgLength;
-        QDataStream stream(&m_buffer, QIODevice::ReadOnly);
-        stream >> msgLength;
-        
-        if (m_buffer.size() < msgLength + 4) {
+    QByteArray messageData;
+    int frameFlags = 0;
+    for (;;) {
+        FrameDecoder::Status status = m_decoder.next(messageData, &frameFlags);
+        if (status == FrameDecoder::NeedMoreData) {
             break; // 数据不完整，等待更多数据
         }
         
-        QByteArray messageData = m_buffer.mid(4, msgLength);
-        m_buffer.remove(0, msgLength + 4);
+        if (status == FrameDecoder::FrameTooLarge) {
+            QString reason = QString("消息长度%1超过上限%2")
+                                 .arg(m_decoder.lastFrameLength())
+                                 .arg(m_decoder.maxFrameSize());
+            qDebug() << "帧错误:" << reason;
+            emit errorOccurred(reason);
+            // 长度前缀已不可信，丢弃连接，重连后重新同步
+            m_decoder.reset();
+            if (m_replaying) {
+                finishReplay();
+            } else {
+                m_socket->abort();
+            }
+            break;
+        }
+        
+        if (m_capture && !m_replaying) {
+            m_capture->write(messageData, frameFlags);
+        }
         
-        parseMessage(messageData);
+        if (frameFlags & FrameDecoder::FlagCompressed) {
+            if (!m_compressor.decompress(messageData.constData(), messageData.size(),
+                                         m_decompressBuffer, m_decoder.maxFrameSize())) {
+                qDebug() << "解压消息失败，丢弃该帧";
+                continue;
+            }
+            parseMessage(m_decompressBuffer, frameFlags & ~FrameDecoder::FlagCompressed);
+        } else {
+            parseMessage(messageData, frameFlags);
+        }
     }
+    
+    flushReceivedMessages();
 }
 
 void NetworkManager::onError(QAbstractSocket::SocketError error)
 {
+    Q_UNUSED(error)
     QString errorString = m_socket->errorString();
     emit errorOccurred(errorString);
     qDebug() << "网络错误:" << errorString;
     
     if (m_autoReconnect && m_socket->state() != QAbstractSocket::ConnectedState) {
-        m_reconnectTimer->start();
+        scheduleReconnect();
     }
 }
 
 void NetworkManager::reconnect()
 {
+    m_reconnectTimer = 0;
     if (!m_autoReconnect) {
         return;
     }
     
-    qDebug() << "尝试重连服务器...";
+    qDebug() << "尝试连接服务器..." << m_host << m_port;
+    m_timerWheel->cancel(m_connectTimer);
+    m_connectTimer = m_timerWheel->schedule(m_connectTimeout, [this]() {
+        m_connectTimer = 0;
+        onConnectTimeout();
+    });
     m_socket->connectToHost(m_host, m_port);
 }
 
-void NetworkManager::parseMessage(const QByteArray& data)
+void NetworkManager::onConnectTimeout()
 {
-    QJsonParseError error;
-    QJsonDocument doc = QJsonDocument::fromJson(data, &error);
+    if (m_socket->state() == QAbstractSocket::ConnectedState) {
+        return;
+    }
     
-    if (error.error != QJsonParseError::NoError) {
-        qDebug() << "JSON解析错误:" << error.errorString();
+    qDebug() << "连接服务器超时";
+    emit errorOccurred("连接服务器超时");
+    m_socket->abort();
+    scheduleReconnect();
+}
+
+void NetworkManager::onPeerTimedOut()
+{
+    // 半开连接：TCP层可能很久都不会报错，主动断开，由 onDisconnected 安排重连
+    emit errorOccurred("服务器无响应");
+    m_socket->abort();
+}
+
+void NetworkManager::scheduleReconnect()
+{
+    m_timerWheel->cancel(m_connectTimer);
+    m_connectTimer = 0;
+    
+    // error和disconnected可能先后到达，同一次失败只安排一次重连
+    if (m_reconnectTimer) {
+        return;
+    }
+    
+    if (!m_autoReconnect) {
+        setState(StateIdle);
+        return;
+    }
+    
+    int delay = nextBackoffDelay();
+    qDebug() << "将在" << delay << "毫秒后重连";
+    setState(StateBackoff);
+    m_reconnectTimer = m_timerWheel->schedule(delay, [this]() { reconnect(); });
+}
+
+int NetworkManager::nextBackoffDelay()
+{
+    // 指数退避，上限m_maxBackoffMs；在[delay/2, delay]之间随机取值，
+    // 避免服务器重启后大量客户端同时重连
+    qint64 delay = m_initialBackoffMs;
+    for (int i = 0; i < m_backoffAttempt && delay < m_maxBackoffMs; ++i) {
+        delay *= 2;
+    }
+    delay = qMin<qint64>(delay, m_maxBackoffMs);
+    ++m_backoffAttempt;
+    
+    int half = static_cast<int>(delay / 2);
+    return half + QRandomGenerator::global()->bounded(half + 1);
+}
+
+void NetworkManager::setState(ConnectionState state)
+{
+    if (m_state == state) {
         return;
     }
     
-    QJsonObject obj = doc.object();
-    int type = obj["type"].toInt();
-    QJsonObject payload = obj["data"].toObject();
+    m_state = state;
+    emit connectionStateChanged(state);
+    
+    if (state == StateOnline) {
+        m_backoffAttempt = 0;
+        emit online();
+        // 登录完成：先按原顺序重传上次连接中未确认的消息，再继续发送排队的消息
+        requeueInFlightMessages();
+        pumpOutgoingMessages();
+    }
+}
+
+void NetworkManager::onStateChanged(QAbstractSocket::SocketState state)
+{
+    m_socketState = state;
+    
+    if (state == QAbstractSocket::HostLookupState) {
+        setState(StateResolving);
+    } else if (state == QAbstractSocket::ConnectingState) {
+        setState(StateConnecting);
+    }
+}
+
+void NetworkManager::onBytesWritten(qint64 bytes)
+{
+    Q_UNUSED(bytes)
+    updateBackPressure();
+}
+
+void NetworkManager::sendMessage(MessageType type, const QCborMap& data)
+{
+    // 在网络线程中按本连接协商的编码序列化
+    runOnIoThread([this, type, data]() {
+        QByteArray body = MessageCodec::encode(type, data, m_encoding);
+        int flags = MessageCodec::frameFlags(m_encoding);
+        
+        // 超过阈值的帧（联系人列表等）在协商启用压缩后压缩，压缩无收益时按原样发送
+        if (m_compressionActive && body.size() >= m_compressionThreshold
+            && m_compressor.compress(body.constData(), body.size(), m_compressBuffer)
+            && m_compressBuffer.size() < body.size()) {
+            enqueueFrame(m_compressBuffer, flags | FrameDecoder::FlagCompressed);
+        } else {
+            enqueueFrame(body, flags);
+        }
+        
+        // 除确认帧外，服务器对每种帧都会回应（请求的响应、消息的确认、心跳的回应）
+        m_keepalive->noteSent(type != MSG_ACK);
+    });
+}
+
+void NetworkManager::enqueueFrame(const QByteArray& body, int flags)
+{
+    // 头部和负载直接写入发送队列，不构造中间帧
+    int offset = m_sendQueue.size();
+    m_sendQueue.resize(offset + FrameDecoder::HeaderSize);
+    FrameDecoder::writeHeader(m_sendQueue.data() + offset, static_cast<quint32>(body.size()), flags);
+    m_sendQueue.append(body);
+    ++m_queuedFrames;
+    
+    // 同一轮事件循环内产生的帧合并为一次write
+    if (!m_flushScheduled) {
+        m_flushScheduled = true;
+        QMetaObject::invokeMethod(m_ioContext, [this]() { flushSendQueue(); }, Qt::QueuedConnection);
+    }
+    
+    updateBackPressure();
+}
+
+void NetworkManager::flushSendQueue()
+{
+    m_flushScheduled = false;
+    
+    if (m_sendQueue.isEmpty()) {
+        return;
+    }
+    
+    if (m_socket->state() != QAbstractSocket::ConnectedState) {
+        qDebug() << "未连接，丢弃" << m_queuedFrames << "个待发送帧";
+        clearSendQueue();
+        return;
+    }
+    
+    qint64 written = m_socket->write(m_sendQueue);
+    if (written < 0) {
+        qDebug() << "写入失败:" << m_socket->errorString();
+        clearSendQueue();
+        return;
+    }
+    
+    ++m_totalWrites;
+    m_totalFrames += m_queuedFrames;
+    m_totalBytes += m_sendQueue.size();
+    
+    // 保留已分配的容量，下一轮复用
+    m_sendQueue.resize(0);
+    m_queuedFrames = 0;
+    
+    updateBackPressure();
+}
+
+void NetworkManager::clearSendQueue()
+{
+    m_sendQueue.resize(0);
+    m_queuedFrames = 0;
+    updateBackPressure();
+}
+
+void NetworkManager::updateBackPressure()
+{
+    qint64 pending = m_sendQueue.size() + m_socket->bytesToWrite();
+    m_pendingBytes = pending;
+    
+    if (!m_backPressured && pending >= m_highWaterMark) {
+        m_backPressured = true;
+        qDebug() << "发送缓冲区超过高水位:" << pending;
+        emit backPressureChanged(true);
+    } else if (m_backPressured && pending <= m_lowWaterMark) {
+        m_backPressured = false;
+        emit backPressureChanged(false);
+    }
+}
+
+void NetworkManager::parseMessage(const QByteArray& data, int flags)
+{
+    // 按协议描述一次完成解码和校验，字段类型不符或缺少必需字段的消息整帧丢弃
+    DecodedMessage payload;
+    QString errorString;
+    if (!DecodedMessage::decode(data, flags, payload, &errorString)) {
+        qDebug() << "丢弃格式错误的消息:" << errorString;
+        return;
+    }
+    int type = payload.type();
+    
+    // 重放只处理服务器推送的聊天消息
+    if (m_replaying && type != MSG_TEXT && type != MSG_GROUP_MESSAGE && type != MSG_SYNC_BATCH && type != MSG_BATCH) {
+        return;
+    }
+    
+    // 聊天消息整批投递；其他类型的消息先把已解析的聊天消息发出去，保持顺序
+    if (type != MSG_TEXT && type != MSG_GROUP_MESSAGE && type != MSG_SYNC_BATCH && type != MSG_BATCH) {
+        flushReceivedMessages();
+    }
     
     switch (type) {
     case MSG_LOGIN:
-        if (payload["success"].toBool()) {
-            emit loginSuccess(payload["user_id"].toInt(), payload["username"].toString());
+        if (payload.get<MessageCodec::FieldSuccess>()) {
+            // 服务器选定的编码，未声明则继续使用JSON（旧版服务器）
+            bool ok = false;
+            MessageCodec::Encoding encoding = MessageCodec::encodingFromName(
+                payload.get<MessageCodec::FieldEncoding>(), &ok);
+            m_encoding = ok ? encoding : MessageCodec::EncodingJson;
+            m_compressionActive = m_compressionEnabled
+                && payload.get<MessageCodec::FieldCompression>().toString() == QLatin1String("zlib");
+            // 协议版本2的服务器对每条聊天消息回复MSG_ACK；旧服务器不确认，按发出即视为完成处理
+            m_reliableDelivery = payload.get<MessageCodec::FieldProtocolVersion>() >= 2;
+            // 协议版本2的服务器同时会回应心跳，可以据此检测半开连接
+            m_keepalive->setPeerDetectionEnabled(m_reliableDelivery);
+            // 会话序号只在本次登录内跟踪，离线期间的消息由追赶补齐
+            m_backfillSupported = payload.get<MessageCodec::FieldProtocolVersion>() >= 4;
+            for (const ConversationTrack& track : qAsConst(m_conversations)) {
+                m_timerWheel->cancel(track.backfillTimer);
+            }
+            m_conversations.clear();
+            
+            // 支持追赶的服务器在响应中返回最新序号，大于本地游标时随后以 MSG_SYNC_BATCH 重放缺失的消息
+            if (payload.contains(MessageCodec::FieldLastSeq)) {
+                qint64 serverSeq = payload.get<MessageCodec::FieldLastSeq>();
+                m_catchUpCount = 0;
+                m_catchingUp = serverSeq > m_syncCursor;
+                if (m_catchingUp) {
+                    qDebug() << "开始追赶离线消息, 本地序号:" << m_syncCursor.load() << "服务器序号:" << serverSeq;
+                }
+            }
+            
+            setState(StateOnline);
+            emit loginSuccess(static_cast<int>(payload.get<MessageCodec::FieldUserId>()),
+                              payload.get<MessageCodec::FieldUsername>());
         } else {
-            emit loginFailed(payload["reason"].toString());
+            emit loginFailed(payload.get<MessageCodec::FieldReason>());
         }
+        // 状态已切换后再完成请求，等待者看到的是登录后的状态
+        completeRequest(type, payload);
         break;
         
     case MSG_REGISTER:
-        if (payload["success"].toBool()) {
-            emit registerSuccess(payload["user_id"].toInt());
+        if (payload.get<MessageCodec::FieldSuccess>()) {
+            emit registerSuccess(static_cast<int>(payload.get<MessageCodec::FieldUserId>()));
         } else {
-            emit registerFailed(payload["reason"].toString());
+            emit registerFailed(payload.get<MessageCodec::FieldReason>());
         }
+        completeRequest(type, payload);
         break;
         
     case MSG_TEXT:
-    case MSG_GROUP_MESSAGE: {
-        int fromUserId = payload["from_user_id"].toInt();
-        int toUserId = payload["to_user_id"].toInt();
-        QString content = payload["content"].toString();
-        QDateTime timestamp = QDateTime::fromString(payload["timestamp"].toString(), Qt::ISODate);
-        bool isGroup = payload["is_group"].toBool();
+    case MSG_GROUP_MESSAGE:
+        receiveChatMessage(payload);
+        break;
+        
+    case MSG_BATCH: {
+        // 一帧多条消息，解码一次后并入同一批投递
+        const QVector<DecodedMessage>& messages = payload.messages();
+        for (const DecodedMessage& message : messages) {
+            receiveChatMessage(message);
+        }
+        break;
+    }
         
-        emit messageReceived(fromUserId, toUserId, content, timestamp, isGroup);
+    case MSG_SYNC_BATCH: {
+        // 服务器按序号顺序分批重放，多个批次的消息合并投递
+        const QVector<DecodedMessage>& messages = payload.messages();
+        for (const DecodedMessage& message : messages) {
+            receiveChatMessage(message);
+        }
+        if (m_replaying) {
+            break;
+        }
+        m_catchUpCount += messages.size();
+        // 批次中的消息可能已被服务器过滤，游标以批次声明的序号为准
+        m_syncCursor = qMax(m_syncCursor.load(), payload.get<MessageCodec::FieldSeq>());
+        
+        if (payload.get<MessageCodec::FieldDone>()) {
+            flushReceivedMessages();
+            m_catchingUp = false;
+            qDebug() << "离线消息追赶完成, 消息数:" << m_catchUpCount << "序号:" << m_syncCursor.load();
+            emit catchUpFinished(m_syncCursor, m_catchUpCount);
+        }
         break;
     }
     
-    case MSG_GET_CONTACTS:
-        if (payload.contains("contacts")) {
-            emit contactsReceived(payload["contacts"].toArray());
+    case MSG_GET_CONTACTS: {
+        completeRequest(type, payload);
+        
+        // 在网络线程中解析成结构体，界面线程直接批量入库和更新列表
+        RosterDelta delta;
+        delta.version = payload.get<MessageCodec::FieldRosterVersion>();
+        // 旧版服务器不返回版本号：列表只用于合并，不据此删除本地联系人
+        delta.full = payload.contains(MessageCodec::FieldFull) && payload.contains(MessageCodec::FieldRosterVersion)
+                     && payload.get<MessageCodec::FieldFull>();
+        
+        const QCborArray contacts = payload.get<MessageCodec::FieldContacts>().toArray();
+        delta.contacts.reserve(contacts.size());
+        for (const QCborValue& value : contacts) {
+            const QCborMap item = value.toMap();
+            RosterContact contact;
+            contact.contactId = static_cast<int>(item.value(MessageCodec::FieldContactId).toInteger());
+            contact.contactName = item.value(MessageCodec::FieldContactName).toString();
+            contact.groupName = item.value(MessageCodec::FieldGroupName).toString();
+            contact.isGroup = item.value(MessageCodec::FieldIsGroup).toBool();
+            if (contact.contactId > 0) {
+                delta.contacts.append(contact);
+            }
+        }
+        
+        const QVector<qint64> removed = payload.get<MessageCodec::FieldRemoved>();
+        delta.removed.reserve(removed.size());
+        for (qint64 contactId : removed) {
+            delta.removed.append(static_cast<int>(contactId));
+        }
+        
+        emit rosterReceived(delta);
+        
+        // 原始JSON数组仅在有接收者时构造
+        static const QMetaMethod contactsReceivedSignal = QMetaMethod::fromSignal(&NetworkManager::contactsReceived);
+        if (isSignalConnected(contactsReceivedSignal) && payload.contains(MessageCodec::FieldContacts)) {
+            emit contactsReceived(MessageCodec::toJson(payload.get<MessageCodec::FieldContacts>()).toArray());
         }
         break;
+    }
+        
+    case MSG_ADD_CONTACT:
+    case MSG_REMOVE_CONTACT:
+        completeRequest(type, payload);
+        break;
         
     case MSG_ACK:
-        // 确认消息，可以用于消息送达确认
+        handleAck(payload);
+        break;
+        
+    case MSG_BACKFILL:
+        finishBackfill(payload);
         break;
         
+    case MSG_HEARTBEAT:
+        break; // 心跳回应，收到数据时已刷新保活状态
+        
     default:
         qDebug() << "未知消息类型:" << type;
     }
 }
 
-QByteArray NetworkManager::createMessage(MessageType type, const QJsonObject& data)
+QFuture<RequestResult> NetworkManager::request(MessageType type, const QCborMap& data)
+{
+    QFutureInterface<RequestResult> promise;
+    promise.reportStarted();
+    
+    runOnIoThread([this, type, data, promise]() { sendRequest(type, data, promise); });
+    
+    return promise.future();
+}
+
+void NetworkManager::sendRequest(MessageType type, QCborMap data, QFutureInterface<RequestResult> promise)
+{
+    if (m_socket->state() != QAbstractSocket::ConnectedState) {
+        RequestResult result;
+        result.error = "未连接到服务器";
+        finishRequest(promise, result);
+        return;
+    }
+    
+    // 请求ID为0表示未携带，跳过
+    if (++m_nextRequestId == 0) {
+        ++m_nextRequestId;
+    }
+    data.insert(MessageCodec::FieldRequestId, static_cast<qint64>(m_nextRequestId));
+    
+    quint32 requestId = m_nextRequestId;
+    PendingRequest pending;
+    pending.type = type;
+    pending.timer = m_timerWheel->schedule(m_requestTimeout, [this, requestId]() { onRequestTimeout(requestId); });
+    pending.promise = promise;
+    m_pendingRequests.insert(requestId, pending);
+    m_pendingRequestCount = m_pendingRequests.size();
+    
+    sendMessage(type, data);
+}
+
+void NetworkManager::completeRequest(int type, const DecodedMessage& payload)
+{
+    QHash<quint32, PendingRequest>::iterator it = m_pendingRequests.end();
+    if (payload.contains(MessageCodec::FieldRequestId)) {
+        it = m_pendingRequests.find(static_cast<quint32>(payload.get<MessageCodec::FieldRequestId>()));
+    } else {
+        // 旧版服务器不回显请求ID：按类型匹配最早发出的请求
+        for (QHash<quint32, PendingRequest>::iterator i = m_pendingRequests.begin(); i != m_pendingRequests.end(); ++i) {
+            if (i->type == type && (it == m_pendingRequests.end() || i.key() < it.key())) {
+                it = i;
+            }
+        }
+    }
+    
+    if (it == m_pendingRequests.end()) {
+        return; // 已超时或非本客户端发起的请求（如重连后的自动登录）
+    }
+    
+    RequestResult result;
+    // 获取联系人等响应不带success字段，收到即视为成功
+    result.success = !payload.contains(MessageCodec::FieldSuccess)
+                     || payload.get<MessageCodec::FieldSuccess>();
+    result.error = payload.get<MessageCodec::FieldReason>();
+    QCborMap summary = payload.toCborMap();
+    if (type == MSG_GET_CONTACTS) {
+        // 联系人列表可能有数千项，通过 rosterReceived 投递，不再转换成JSON放进请求结果
+        summary.remove(MessageCodec::FieldContacts);
+        summary.remove(MessageCodec::FieldRemoved);
+    }
+    result.data = MessageCodec::toJson(summary).toObject();
+    
+    m_timerWheel->cancel(it->timer);
+    QFutureInterface<RequestResult> promise = it->promise;
+    m_pendingRequests.erase(it);
+    m_pendingRequestCount = m_pendingRequests.size();
+    finishRequest(promise, result);
+}
+
+void NetworkManager::onRequestTimeout(quint32 requestId)
+{
+    QHash<quint32, PendingRequest>::iterator it = m_pendingRequests.find(requestId);
+    if (it == m_pendingRequests.end()) {
+        return;
+    }
+    
+    qDebug() << "请求超时, 类型:" << it->type << "请求ID:" << requestId;
+    RequestResult result;
+    result.timedOut = true;
+    result.error = "请求超时";
+    
+    QFutureInterface<RequestResult> promise = it->promise;
+    m_pendingRequests.erase(it);
+    m_pendingRequestCount = m_pendingRequests.size();
+    finishRequest(promise, result);
+}
+
+void NetworkManager::failPendingRequests(const QString& reason)
+{
+    if (m_pendingRequests.isEmpty()) {
+        return;
+    }
+    
+    RequestResult result;
+    result.error = reason;
+    
+    QHash<quint32, PendingRequest> pending;
+    pending.swap(m_pendingRequests);
+    m_pendingRequestCount = 0;
+    
+    for (PendingRequest& entry : pending) {
+        m_timerWheel->cancel(entry.timer);
+        finishRequest(entry.promise, result);
+    }
+}
+
+void NetworkManager::finishRequest(QFutureInterface<RequestResult>& promise, const RequestResult& result)
+{
+    promise.reportResult(result);
+    promise.reportFinished();
+}
+
+void NetworkManager::pumpOutgoingMessages()
+{
+    if (connectionState() != StateOnline) {
+        return;
+    }
+    
+    while (!m_outgoingMessages.isEmpty()
+           && (!m_reliableDelivery || m_inFlightMessages.size() < m_sendWindow)) {
+        OutgoingMessage message = m_outgoingMessages.dequeue();
+        ++message.attempts;
+        sendMessage(message.type, message.data);
+        
+        if (m_reliableDelivery) {
+            m_inFlightMessages.insert(message.clientMsgId, message);
+        }
+        emit messageStateChanged(message.clientMsgId, DeliverySent);
+    }
+    
+    m_inFlightCount = m_inFlightMessages.size();
+}
+
+void NetworkManager::requeueInFlightMessages()
+{
+    if (m_inFlightMessages.isEmpty()) {
+        return;
+    }
+    
+    // 未确认的消息ID都小于排队中的消息，倒序插回队首即可保持发送顺序
+    for (auto it = m_inFlightMessages.end(); it != m_inFlightMessages.begin();) {
+        --it;
+        if (it->attempts >= MaxSendAttempts) {
+            qDebug() << "消息多次重传未确认，放弃:" << it->clientMsgId;
+            emit messageStateChanged(it->clientMsgId, DeliveryFailed);
+            continue;
+        }
+        m_outgoingMessages.prepend(it.value());
+    }
+    
+    m_inFlightMessages.clear();
+    m_inFlightCount = 0;
+}
+
+void NetworkManager::handleAck(const DecodedMessage& payload)
+{
+    QVector<qint64> ids = payload.get<MessageCodec::FieldClientMsgIds>();
+    QVector<qint64> convSeqs = payload.get<MessageCodec::FieldConvSeqs>();
+    if (payload.contains(MessageCodec::FieldClientMsgId)) {
+        ids.append(payload.get<MessageCodec::FieldClientMsgId>());
+        convSeqs.resize(ids.size() - 1);
+        convSeqs.append(payload.get<MessageCodec::FieldConvSeq>());
+    }
+    
+    for (int i = 0; i < ids.size(); ++i) {
+        qint64 id = ids.at(i);
+        QMap<qint64, OutgoingMessage>::iterator it = m_inFlightMessages.find(id);
+        if (it == m_inFlightMessages.end()) {
+            continue;
+        }
+        
+        // 协议版本4的服务器在确认中返回为消息分配的会话序号
+        qint64 convSeq = i < convSeqs.size() ? convSeqs.at(i) : 0;
+        if (convSeq > 0) {
+            const QCborMap& data = it->data;
+            trackConversationSeq(static_cast<int>(data.value(MessageCodec::FieldToUserId).toInteger()),
+                                 data.value(MessageCodec::FieldIsGroup).toBool(), convSeq);
+            emit messageSequenced(id, convSeq);
+        }
+        m_inFlightMessages.erase(it);
+        emit messageStateChanged(id, DeliveryDelivered);
+    }
+    
+    m_inFlightCount = m_inFlightMessages.size();
+    pumpOutgoingMessages();
+}
+
+void NetworkManager::receiveChatMessage(const DecodedMessage& payload)
+{
+    ChatMessage message;
+    message.clientMsgId = payload.get<MessageCodec::FieldClientMsgId>();
+    message.seq = payload.get<MessageCodec::FieldSeq>();
+    message.fromUserId = static_cast<int>(payload.get<MessageCodec::FieldFromUserId>());
+    message.toUserId = static_cast<int>(payload.get<MessageCodec::FieldToUserId>());
+    message.content = payload.get<MessageCodec::FieldContent>();
+    message.timestamp = payload.get<MessageCodec::FieldTimestamp>();
+    message.isGroup = payload.get<MessageCodec::FieldIsGroup>();
+    message.convSeq = payload.get<MessageCodec::FieldConvSeq>();
+    
+    // 重放的序号属于录制时的账号，不能写入本地游标
+    if (m_replaying) {
+        message.seq = 0;
+        ++m_replayMessages;
+    }
+    
+    // 重复的消息也推进游标，下次登录不再重放
+    if (message.seq > m_syncCursor) {
+        m_syncCursor = message.seq;
+    }
+    if (isDuplicateMessage(message.fromUserId, message.clientMsgId)) {
+        return;
+    }
+    if (message.convSeq > 0 && !m_replaying) {
+        trackConversationSeq(message.isGroup ? message.toUserId : message.fromUserId, message.isGroup,
+                             message.convSeq);
+    }
+    
+    m_receivedMessages.append(message);
+    if (m_receivedMessages.size() >= MaxMessageBatchSize) {
+        flushReceivedMessages();
+    }
+}
+
+bool NetworkManager::isDuplicateMessage(int fromUserId, qint64 clientMsgId)
 {
-    QJsonObject message;
-    message["type"] = type;
-    message["data"] = data;
+    if (clientMsgId == 0) {
+        return false;
+    }
     
-    QJsonDocument doc(message);
-    QByteArray jsonData = doc.toJson(QJsonDocument::Compact);
+    QPair<int, qint64> key(fromUserId, clientMsgId);
+    if (m_seenMessages.contains(key)) {
+        return true;
+    }
     
-    // 添加消息长度前缀
-    QByteArray result;
-    QDataStream stream(&result, QIODevice::WriteOnly);
-    stream << static_cast<quint32>(jsonData.size());
-    result.append(jsonData);
+    // 只保留最近的4096条记录，重传只会发生在重连后的短时间内
+    m_seenMessages.insert(key);
+    m_seenMessageOrder.enqueue(key);
+    if (m_seenMessageOrder.size() > 4096) {
+        m_seenMessages.remove(m_seenMessageOrder.dequeue());
+    }
+    return false;
+}
+
+void NetworkManager::trackConversationSeq(int peerId, bool isGroup, qint64 convSeq)
+{
+    if (!m_backfillSupported) {
+        return;
+    }
+    
+    quint64 key = conversationTrackKey(peerId, isGroup);
+    ConversationTrack& track = m_conversations[key];
+    if (track.contiguous == 0) {
+        // 本次登录内第一次见到该会话，之前的消息由历史记录和追赶负责
+        track.peerId = peerId;
+        track.isGroup = isGroup;
+        track.contiguous = convSeq;
+        return;
+    }
+    if (convSeq <= track.contiguous) {
+        return; // 迟到的消息（补发或重传），不影响空洞
+    }
+    
+    if (convSeq > track.contiguous + 1) {
+        track.ahead.insert(convSeq);
+    } else {
+        track.contiguous = convSeq;
+        while (track.ahead.remove(track.contiguous + 1)) {
+            ++track.contiguous;
+        }
+    }
+    
+    if (track.ahead.isEmpty()) {
+        m_timerWheel->cancel(track.backfillTimer);
+        track.backfillTimer = 0;
+        track.backfillAttempts = 0;
+    } else if (track.backfillTimer == 0) {
+        // 其他线程投递的消息可能稍晚到达，等一会儿仍未补上再请求补发
+        track.backfillTimer = m_timerWheel->schedule(BackfillDelayMs, [this, key]() { requestBackfill(key); });
+    }
+}
+
+void NetworkManager::requestBackfill(quint64 key)
+{
+    QHash<quint64, ConversationTrack>::iterator it = m_conversations.find(key);
+    if (it == m_conversations.end()) {
+        return;
+    }
+    
+    ConversationTrack& track = it.value();
+    track.backfillTimer = 0;
+    if (track.ahead.isEmpty()) {
+        track.backfillAttempts = 0;
+        return;
+    }
+    
+    if (track.backfillAttempts >= MaxBackfillAttempts) {
+        // 重发后仍没有回复（请求或回复丢失、不回复补发结束的旧版服务器）：放弃这个空洞，不再等待
+        qDebug() << "会话" << track.peerId << "的补发请求没有回复，放弃序号" << track.contiguous + 1 << "之后的空洞";
+        QSet<qint64>::const_iterator last = std::max_element(track.ahead.constBegin(), track.ahead.constEnd());
+        track.contiguous = *last;
+        track.ahead.clear();
+        track.backfillAttempts = 0;
+        return;
+    }
+    qDebug() << "会话" << track.peerId << "的序号" << track.contiguous + 1 << "之后有空洞，请求补发";
+    
+    MessageBuilder<MSG_BACKFILL> backfill;
+    backfill.set<MessageCodec::FieldContactId>(track.peerId);
+    backfill.set<MessageCodec::FieldIsGroup>(track.isGroup);
+    backfill.set<MessageCodec::FieldConvSeq>(track.contiguous);
+    sendMessage(MSG_BACKFILL, backfill.data());
+    
+    // 空洞保留到收到补发结束的回复；超时未回复时重发
+    ++track.backfillAttempts;
+    track.backfillTimer = m_timerWheel->schedule(BackfillReplyTimeoutMs, [this, key]() { requestBackfill(key); });
+}
+
+void NetworkManager::finishBackfill(const DecodedMessage& payload)
+{
+    int peerId = static_cast<int>(payload.get<MessageCodec::FieldContactId>());
+    bool isGroup = payload.get<MessageCodec::FieldIsGroup>();
+    quint64 key = conversationTrackKey(peerId, isGroup);
+    QHash<quint64, ConversationTrack>::iterator it = m_conversations.find(key);
+    if (it == m_conversations.end()) {
+        return;
+    }
+    
+    // 补发的消息在这条回复之前到达，已按序号计入。服务器最新序号之内仍缺的消息已超出信箱保留范围，不再等待
+    ConversationTrack& track = it.value();
+    qint64 lastConvSeq = payload.get<MessageCodec::FieldConvSeq>();
+    if (lastConvSeq > track.contiguous) {
+        track.contiguous = lastConvSeq;
+        QSet<qint64>::iterator seq = track.ahead.begin();
+        while (seq != track.ahead.end()) {
+            if (*seq <= track.contiguous) {
+                seq = track.ahead.erase(seq);
+            } else {
+                ++seq;
+            }
+        }
+        while (track.ahead.remove(track.contiguous + 1)) {
+            ++track.contiguous;
+        }
+    }
+    
+    m_timerWheel->cancel(track.backfillTimer);
+    track.backfillTimer = 0;
+    track.backfillAttempts = 0;
+    if (!track.ahead.isEmpty()) {
+        track.backfillTimer = m_timerWheel->schedule(BackfillDelayMs, [this, key]() { requestBackfill(key); });
+    }
+}
+
+quint64 NetworkManager::conversationTrackKey(int peerId, bool isGroup)
+{
+    return (isGroup ? (quint64(1) << 32) : 0) | static_cast<quint32>(peerId);
+}
+
+void NetworkManager::flushReceivedMessages()
+{
+    if (m_receivedMessages.isEmpty()) {
+        return;
+    }
+    
+    // 逐条信号仅在有接收者时发出，避免工作线程模式下产生大量排队事件
+    static const QMetaMethod messageReceivedSignal = QMetaMethod::fromSignal(&NetworkManager::messageReceived);
+    if (isSignalConnected(messageReceivedSignal)) {
+        for (const ChatMessage& message : qAsConst(m_receivedMessages)) {
+            emit messageReceived(message.fromUserId, message.toUserId, message.content,
+                                 message.timestamp, message.isGroup);
+        }
+    }
     
-    return result;
+    QVector<ChatMessage> batch;
+    batch.swap(m_receivedMessages);
+    emit messagesReceived(batch);
 }
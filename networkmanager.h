@@ -4,11 +4,72 @@
 #include <QObject>
 #include <QTcpSocket>
 #include <QTimer>
+#include <QThread>
 #include <QJsonObject>
 #include <QJsonDocument>
 #include <QJsonArray>
 #include <QByteArray>
 #include <QDataStream>
+#include <QDateTime>
+#include <QVector>
+#include <QMap>
+#include <QQueue>
+#include <QSet>
+#include <QPair>
+#include <QHash>
+#include <QFuture>
+#include <QFutureInterface>
+#include <QFutureWatcher>
+#include <QElapsedTimer>
+#include <atomic>
+#include <functional>
+#include "framedecoder.h"
+#include "messagecodec.h"
+#include "framecompressor.h"
+#include "timerwheel.h"
+#include "keepalivemanager.h"
+#include "framecapture.h"
+
+class DecodedMessage;
+
+// 已解码的聊天消息（单聊/群聊），在网络线程中构造后整批投递给界面线程
+struct ChatMessage {
+    int fromUserId = 0;
+    int toUserId = 0;
+    QString content;
+    qint64 timestamp = 0;   // 发送时间，UTC毫秒数
+    bool isGroup = false;
+    qint64 clientMsgId = 0; // 发送方生成的消息ID
+    qint64 seq = 0;         // 服务器为接收账号分配的递增序号，0表示服务器未提供
+    qint64 convSeq = 0;     // 服务器为会话分配的递增序号，消息按它排列；0表示服务器未提供
+};
+Q_DECLARE_METATYPE(ChatMessage)
+
+// 联系人同步结果：服务器按客户端上次同步的花名册版本只返回新增/修改的联系人和被删除的联系人ID；
+// full 为true时 contacts 是完整列表（首次同步、版本过旧或旧版服务器），本地多出的联系人应删除
+struct RosterContact {
+    int contactId = 0;
+    QString contactName;
+    QString groupName;
+    bool isGroup = false;
+};
+
+struct RosterDelta {
+    qint64 version = 0;
+    bool full = true;
+    QVector<RosterContact> contacts;
+    QVector<int> removed;
+};
+Q_DECLARE_METATYPE(RosterDelta)
+
+// 请求（登录、注册、获取/添加联系人）的响应结果
+struct RequestResult {
+    bool success = false;
+    bool timedOut = false; // 超过截止时间仍未收到响应
+    QString error;         // 失败原因（服务器返回的reason或本地错误）
+    QJsonObject data;      // 响应数据，字段名与JSON格式一致
+};
+Q_DECLARE_METATYPE(RequestResult)
 
 class NetworkManager : public QObject
 {
@@ -23,54 +84,339 @@ public:
         MSG_ACK = 5,
         MSG_GET_CONTACTS = 6,
         MSG_ADD_CONTACT = 7,
-        MSG_GROUP_MESSAGE = 8
+        MSG_GROUP_MESSAGE = 8,
+        MSG_SYNC_BATCH = 9,     // 重连追赶：服务器分批重放同步游标之后的消息
+        MSG_BATCH = 10,         // 多条聊天消息合并为一帧（协议版本3）
+        MSG_BACKFILL = 11,      // 请求补发一个会话中缺失的消息，服务器以 MSG_BATCH 回复（协议版本4）
+        MSG_REMOVE_CONTACT = 12
+    };
+
+    // 连接状态机：
+    // Idle -> Resolving -> Connecting -> Authenticating -> Online
+    // 任一阶段失败或连接断开后进入 Backoff，按指数退避（带随机抖动）等待后重新连接
+    enum ConnectionState {
+        StateIdle,
+        StateResolving,
+        StateConnecting,
+        StateAuthenticating, // TCP已连接，等待登录完成
+        StateOnline,
+        StateBackoff
     };
+    Q_ENUM(ConnectionState)
+
+    // 聊天消息的发送状态
+    enum DeliveryState {
+        DeliveryPending,   // 等待发送（未连接或发送窗口已满）
+        DeliverySent,      // 已发出，等待服务器确认
+        DeliveryDelivered, // 服务器已确认（MSG_ACK）
+        DeliveryFailed     // 多次重传仍未确认，放弃
+    };
+    Q_ENUM(DeliveryState)
+
+    // 抓包重放的节奏
+    enum ReplayPacing {
+        ReplayOriginalPacing,   // 按抓包时的到达间隔
+        ReplayAsFastAsPossible  // 不等待，每轮事件循环处理一次读取的数据
+    };
+
+    // 发送队列统计
+    struct SendQueueStats {
+        qint64 queuedBytes = 0;   // 尚未写入网络的字节数（发送队列 + socket缓冲区）
+        int queuedFrames = 0;     // 发送队列中等待合并写入的帧数
+        quint64 totalFrames = 0;  // 累计发送帧数
+        quint64 totalBytes = 0;   // 累计发送字节数
+        quint64 totalWrites = 0;  // 累计socket写入次数
+    };
+
+    // 单次 messagesReceived 投递的最大消息数，避免一次性占满界面线程
+    static const int MaxMessageBatchSize = 256;
+    // 同一条消息最多发送的次数（每次重连重传一次）
+    static const int MaxSendAttempts = 5;
+    // 会话序号出现空洞后等待乱序消息到达的时间，超过后向服务器请求补发
+    static const int BackfillDelayMs = 2000;
+    // 补发请求等待服务器回复补发结束的时间；超时重发一次，仍无回复时放弃该空洞
+    static const int BackfillReplyTimeoutMs = 5000;
+    static const int MaxBackfillAttempts = 2;
 
     explicit NetworkManager(QObject* parent = nullptr);
     ~NetworkManager();
 
-    bool connectToServer(const QString& host, quint16 port);
+    // 网络工作线程模式：socket、帧解码和消息解析在独立线程中运行，
+    // 信号通过队列连接投递到接收者所在线程。需在连接服务器之前调用
+    void startWorkerThread();
+    bool isWorkerThreadEnabled() const { return m_ioThread != nullptr; }
+
+    // 异步连接，不阻塞调用线程；结果通过 connectionStateChanged/connected/online 通知
+    void connectToServer(const QString& host, quint16 port);
     void disconnectFromServer();
     bool isConnected() const;
+    ConnectionState connectionState() const { return static_cast<ConnectionState>(m_state.load()); }
+    bool isOnline() const { return connectionState() == StateOnline; }
+
+    // 设置登录凭据后，每次(重新)建立连接都会自动登录并进入 Online 状态；
+    // 若当前已连接但尚未以该用户登录，则立即登录
+    void setCredentials(int userId, const QString& username);
+
+    // 进入 Online 状态时在 context 所在线程调用 func（仅一次）；已在线则立即排队调用
+    void whenOnline(QObject* context, std::function<void()> func);
+
+    // 重连退避参数：第n次重试等待 min(maxDelay, initialDelay * 2^n)，并在其后半段随机取值
+    void setReconnectBackoff(int initialDelayMs, int maxDelayMs);
+    void setConnectTimeout(int msecs);
 
-    // 发送消息
-    void sendLogin(int userId, const QString& username);
-    void sendRegister(const QString& username, const QString& password, const QString& nickname);
-    void sendTextMessage(int fromUserId, int toUserId, const QString& content, bool isGroup = false);
+    // 保活：任一方向空闲满 heartbeatIntervalMs 才发心跳；协议版本2的服务器回应心跳，
+    // 发出需要响应的帧后 probeTimeoutMs 内无任何数据则探测一次，再超时即断开重连
+    void setKeepalive(int heartbeatIntervalMs, int probeTimeoutMs);
+
+    // 单帧长度上限，防止错误的长度前缀导致分配超大内存
+    void setMaxFrameSize(quint32 size);
+    quint32 maxFrameSize() const;
+
+    // 发送队列水位：待发送字节数超过高水位时进入背压状态，回落到低水位以下时解除
+    void setWriteWaterMarks(qint64 lowWaterMark, qint64 highWaterMark);
+    bool isBackPressured() const { return m_backPressured; }
+    qint64 queuedBytes() const { return m_pendingBytes; }
+    int queuedFrames() const { return m_queuedFrames; }
+    SendQueueStats sendQueueStats() const;
+
+    // 期望的线路编码：登录时向服务器声明支持CBOR，服务器同意后本连接改用CBOR，否则保持JSON
+    void setPreferredEncoding(MessageCodec::Encoding encoding);
+    // 帧压缩：登录时声明支持zlib，服务器同意后负载不小于阈值的帧压缩发送
+    void setCompressionEnabled(bool enabled);
+    void setCompressionThreshold(int bytes);
+
+    // 发送窗口：最多允许多少条消息同时处于已发送未确认状态
+    void setSendWindow(int messages);
+    int inFlightCount() const { return m_inFlightCount; }
+    // 当前连接的服务器是否确认聊天消息；为false时消息发出（DeliverySent）即为最终状态
+    bool isDeliveryAcknowledged() const { return m_reliableDelivery; }
+    // 分配客户端消息ID（递增），可在任意线程调用
+    qint64 nextClientMsgId() { return ++m_nextClientMsgId; }
+
+    // 同步游标：已收到的最大消息序号。登录时发给服务器，服务器只重放该序号之后的消息
+    // （以 MSG_SYNC_BATCH 分批发送），重连的开销与错过的消息数成正比。
+    // 登录前设置为本地已持久化的游标；之后随收到的消息自动推进
+    void setSyncCursor(qint64 seq);
+    qint64 syncCursor() const { return m_syncCursor; }
+    bool isCatchingUp() const { return m_catchingUp; }
+
+    // 请求超时：登录、注册、获取/添加联系人在该时间内未收到响应则以超时失败结束
+    void setRequestTimeout(int msecs);
+    int pendingRequestCount() const { return m_pendingRequestCount; }
+
+    // 抓包：把收到的每一帧（解压前）连同到达时间写入文件，用于离线重放
+    bool startCapture(const QString& path);
+    void stopCapture();
+    // 重放抓包文件：断开服务器连接，把文件中的帧按原来的读取批次交给帧解码器，
+    // 与从socket收到的数据走同一条解码、入库和显示路径。只重放聊天消息（请求响应、确认和心跳属于录制时的连接），
+    // 重放不推进同步游标。结束时发出 replayFinished
+    bool startReplay(const QString& path, ReplayPacing pacing);
+    bool isReplaying() const { return m_replaying; }
+
+    // 请求完成时在 context 所在线程调用 func(const RequestResult&)；context 销毁后不再调用
+    template <typename Func>
+    static void onRequestFinished(const QFuture<RequestResult>& future, QObject* context, Func func);
+
+    // 发送消息（可在任意线程调用）
+    // 请求类消息带请求ID，返回的QFuture在收到对应响应、超时或连接断开时完成，
+    // 可同时发出多个请求再分别等待结果
+    QFuture<RequestResult> sendLogin(int userId, const QString& username);
+    QFuture<RequestResult> sendRegister(const QString& username, const QString& password, const QString& nickname);
+    // 返回客户端消息ID；消息进入发送窗口，服务器确认前断线会在重新登录后重传。
+    // clientMsgId 为0时分配新ID；重发发件箱中的消息时传入原ID和原时间
+    qint64 sendTextMessage(int fromUserId, int toUserId, const QString& content, bool isGroup = false,
+                           qint64 clientMsgId = 0, qint64 timestamp = 0);
     void sendHeartbeat();
-    void sendGetContacts(int userId);
-    void sendAddContact(int userId, int contactId, const QString& contactName);
+    // 携带本地花名册版本，服务器只返回该版本之后的变化；0表示请求完整列表
+    QFuture<RequestResult> sendGetContacts(int userId, qint64 rosterVersion = 0);
+    // 联系人以服务器的花名册为准：收到成功响应后才写入本地数据库，否则下次完整同步会把它删掉
+    QFuture<RequestResult> sendAddContact(int userId, int contactId, const QString& contactName,
+                                          const QString& groupName = QString(), bool isGroup = false);
+    // 删除同样经服务器确认后才从本地删除，否则完整同步时联系人会重新出现
+    QFuture<RequestResult> sendRemoveContact(int userId, int contactId);
 
 signals:
     void connected();
     void disconnected();
+    void online();
+    void connectionStateChanged(NetworkManager::ConnectionState state);
     void loginSuccess(int userId, const QString& username);
     void loginFailed(const QString& reason);
     void registerSuccess(int userId);
     void registerFailed(const QString& reason);
-    void messageReceived(int fromUserId, int toUserId, const QString& content, const QDateTime& timestamp, bool isGroup);
+    void messageReceived(int fromUserId, int toUserId, const QString& content, qint64 timestamp, bool isGroup);
+    void messagesReceived(const QVector<ChatMessage>& messages);
     void contactsReceived(const QJsonArray& contacts);
+    void rosterReceived(const RosterDelta& delta);
     void errorOccurred(const QString& error);
+    void backPressureChanged(bool backPressured);
+    void messageStateChanged(qint64 clientMsgId, NetworkManager::DeliveryState state);
+    // 自己发出的消息得到了服务器分配的会话序号（在同一确认的 messageStateChanged 之前发出）
+    void messageSequenced(qint64 clientMsgId, qint64 convSeq);
+    // 登录后的重放已全部收到（消息已先经 messagesReceived 投递）
+    void catchUpFinished(qint64 lastSeq, int messageCount);
+    // 抓包重放结束（消息已先经 messagesReceived 投递）；elapsedMs 为网络线程的处理耗时
+    void replayFinished(int frameCount, int messageCount, qint64 elapsedMs);
 
 private slots:
+    // 以下槽均以直接连接方式在网络线程中执行
     void onConnected();
     void onDisconnected();
     void onReadyRead();
     void onError(QAbstractSocket::SocketError error);
+    void onStateChanged(QAbstractSocket::SocketState state);
     void reconnect();
+    void onConnectTimeout();
+    void onPeerTimedOut();
+    void onBytesWritten(qint64 bytes);
+    void flushSendQueue();
+    void replayNext();
 
 private:
-    void parseMessage(const QByteArray& data);
-    QByteArray createMessage(MessageType type, const QJsonObject& data);
-    
+    void doConnect(const QString& host, quint16 port);
+    void doDisconnect();
+    void setState(ConnectionState state);
+    void scheduleReconnect();
+    int nextBackoffDelay();
+
+    void processFrames();
+    void finishReplay();
+    void parseMessage(const QByteArray& data, int flags);
+    void receiveChatMessage(const DecodedMessage& payload);
+    void flushReceivedMessages();
+    void sendMessage(MessageType type, const QCborMap& data);
+    QFuture<RequestResult> request(MessageType type, const QCborMap& data);
+    void sendRequest(MessageType type, QCborMap data, QFutureInterface<RequestResult> promise);
+    void completeRequest(int type, const DecodedMessage& payload);
+    void onRequestTimeout(quint32 requestId);
+    void failPendingRequests(const QString& reason);
+    static void finishRequest(QFutureInterface<RequestResult>& promise, const RequestResult& result);
+    void pumpOutgoingMessages();
+    void requeueInFlightMessages();
+    void handleAck(const DecodedMessage& payload);
+    bool isDuplicateMessage(int fromUserId, qint64 clientMsgId);
+    void trackConversationSeq(int peerId, bool isGroup, qint64 convSeq);
+    void requestBackfill(quint64 key);
+    void finishBackfill(const DecodedMessage& payload);
+    static quint64 conversationTrackKey(int peerId, bool isGroup);
+    void enqueueFrame(const QByteArray& body, int flags);
+    void updateBackPressure();
+    void clearSendQueue();
+
+    // 在网络线程中执行；若已在网络线程则直接调用
+    template <typename Func>
+    void runOnIoThread(Func func);
+
+    QThread* m_ioThread;
+    QObject* m_ioContext; // socket和定时器的父对象，工作线程模式下随之迁移到网络线程
     QTcpSocket* m_socket;
     QString m_host;
     quint16 m_port;
-    QTimer* m_reconnectTimer;
-    QTimer* m_heartbeatTimer;
+    TimerWheel* m_timerWheel;                   // 重连、连接超时、请求超时和保活共用一个时间轮
+    KeepaliveManager* m_keepalive;
+    TimerWheel::TimerId m_reconnectTimer;
+    TimerWheel::TimerId m_connectTimer;
+    int m_connectTimeout;
     bool m_autoReconnect;
-    QByteArray m_buffer;
+    int m_backoffAttempt;
+    int m_initialBackoffMs;
+    int m_maxBackoffMs;
+    FrameDecoder m_decoder;
+    QVector<ChatMessage> m_receivedMessages;
+    QByteArray m_sendQueue;
+    bool m_flushScheduled;
+    qint64 m_lowWaterMark;
+    qint64 m_highWaterMark;
     int m_currentUserId;
+    QString m_currentUsername;
+    MessageCodec::Encoding m_encoding;          // 本连接协商后的编码
+    MessageCodec::Encoding m_preferredEncoding;
+    bool m_compressionEnabled;
+    bool m_compressionActive;                   // 本连接是否已协商启用压缩
+    int m_compressionThreshold;
+    FrameCompressor m_compressor;
+    QByteArray m_compressBuffer;
+    QByteArray m_decompressBuffer;
+
+    // 可靠投递：等待发送的消息和已发出未确认的消息（按客户端消息ID排序）
+    struct OutgoingMessage {
+        qint64 clientMsgId = 0;
+        MessageType type = MSG_TEXT;
+        QCborMap data;
+        int attempts = 0;
+    };
+    QQueue<OutgoingMessage> m_outgoingMessages;
+    QMap<qint64, OutgoingMessage> m_inFlightMessages;
+    int m_sendWindow;
+    // 最近收到的消息（发送方ID, 客户端消息ID），用于丢弃重传造成的重复消息
+    QSet<QPair<int, qint64>> m_seenMessages;
+    QQueue<QPair<int, qint64>> m_seenMessageOrder;
+    int m_catchUpCount;                         // 本次追赶已收到的消息数
+
+    // 会话序号跟踪（本次登录内）：每个会话已连续收到的最大序号和超前到达的序号。
+    // 出现空洞且 BackfillDelayMs 内没有补上时，请求服务器补发该序号之后的消息；
+    // 空洞保留到服务器回复补发结束（MSG_BACKFILL）为止
+    struct ConversationTrack {
+        int peerId = 0;
+        bool isGroup = false;
+        qint64 contiguous = 0;
+        QSet<qint64> ahead;
+        TimerWheel::TimerId backfillTimer = 0;
+        int backfillAttempts = 0; // 已发出、尚未收到回复的补发请求数
+    };
+    QHash<quint64, ConversationTrack> m_conversations;
+    bool m_backfillSupported;                   // 服务器支持会话序号和 MSG_BACKFILL（协议版本4）
+
+    // 抓包和重放（只在网络线程中访问）
+    FrameCaptureWriter* m_capture;
+    FrameCaptureReader* m_replayReader;
+    FrameCaptureReader::Record m_replayRecord;  // 下一条待重放的记录
+    bool m_replayHasRecord;
+    ReplayPacing m_replayPacing;
+    QTimer* m_replayTimer;
+    QElapsedTimer m_replayClock;
+    qint64 m_replayBaseUs;                      // 第一条记录的到达时间
+    int m_replayFrames;
+    int m_replayMessages;
+
+    // 等待响应的请求，按请求ID索引，每个请求在时间轮上有自己的超时定时器
+    struct PendingRequest {
+        MessageType type = MSG_LOGIN;
+        TimerWheel::TimerId timer = 0;
+        QFutureInterface<RequestResult> promise;
+    };
+    QHash<quint32, PendingRequest> m_pendingRequests;
+    quint32 m_nextRequestId;
+    int m_requestTimeout;
+
+    // 供其他线程读取的状态
+    std::atomic<int> m_socketState;
+    std::atomic<int> m_state;
+    std::atomic<bool> m_backPressured;
+    std::atomic<qint64> m_pendingBytes;
+    std::atomic<int> m_queuedFrames;
+    std::atomic<quint64> m_totalFrames;
+    std::atomic<quint64> m_totalBytes;
+    std::atomic<quint64> m_totalWrites;
+    std::atomic<int> m_inFlightCount;
+    std::atomic<qint64> m_nextClientMsgId;
+    std::atomic<int> m_pendingRequestCount;
+    std::atomic<bool> m_reliableDelivery;       // 服务器是否支持MSG_ACK确认（协议版本2）
+    std::atomic<qint64> m_syncCursor;
+    std::atomic<bool> m_catchingUp;
+    std::atomic<bool> m_replaying;
+    std::atomic<quint32> m_maxFrameSize;        // 与 m_decoder 的上限同步更新
 };
 
+template <typename Func>
+void NetworkManager::onRequestFinished(const QFuture<RequestResult>& future, QObject* context, Func func)
+{
+    QFutureWatcher<RequestResult>* watcher = new QFutureWatcher<RequestResult>(context);
+    QObject::connect(watcher, &QFutureWatcherBase::finished, context, [watcher, func]() {
+        func(watcher->result());
+        watcher->deleteLater();
+    });
+    watcher->setFuture(future);
+}
+
 #endif // NETWORKMANAGER_H
@@ -0,0 +1,134 @@
+#include "chatserver.h"
+#include "serverworker.h"
+#include "serverstore.h"
+#include <QElapsedTimer>
+#include <QDebug>
+
+ChatServer::ChatServer(int ioThreads, int historyLimit, QObject* parent)
+    : QTcpServer(parent)
+    , m_state(historyLimit)
+    , m_store(nullptr)
+    , m_nextWorker(0)
+    , m_statsTimer(new QTimer(this))
+    , m_lastFramesIn(0)
+    , m_lastFramesOut(0)
+{
+    int count = qMax(1, ioThreads);
+    for (int i = 0; i < count; ++i) {
+        QThread* thread = new QThread;
+        thread->setObjectName(QString("chatserver-io-%1").arg(i));
+        ServerWorker* worker = new ServerWorker(i, &m_state);
+        worker->moveToThread(thread);
+        // 线程结束时在其中释放worker及其全部连接
+        connect(thread, &QThread::finished, worker, &QObject::deleteLater);
+        m_threads.append(thread);
+        m_workers.append(worker);
+    }
+    
+    connect(m_statsTimer, &QTimer::timeout, this, &ChatServer::printStats);
+}
+
+ChatServer::~ChatServer()
+{
+    stop();
+    qDeleteAll(m_threads);
+    delete m_store;
+}
+
+bool ChatServer::enablePersistence(const QString& databasePath)
+{
+    if (m_store) {
+        return true;
+    }
+    
+    QElapsedTimer timer;
+    timer.start();
+    m_store = new ServerStore(databasePath);
+    if (!m_store->load(m_state)) {
+        delete m_store;
+        m_store = nullptr;
+        return false;
+    }
+    qDebug() << "数据加载耗时" << timer.elapsed() << "毫秒";
+    
+    m_state.setStore(m_store);
+    m_store->start();
+    return true;
+}
+
+bool ChatServer::start(const QHostAddress& address, quint16 port)
+{
+    for (QThread* thread : qAsConst(m_threads)) {
+        if (!thread->isRunning()) {
+            thread->start();
+        }
+    }
+    
+    if (!listen(address, port)) {
+        qDebug() << "监听失败:" << errorString();
+        return false;
+    }
+    qDebug() << "聊天服务器已启动, 端口:" << serverPort() << "I/O线程:" << m_workers.size();
+    return true;
+}
+
+void ChatServer::stop()
+{
+    close();
+    m_statsTimer->stop();
+    
+    for (QThread* thread : qAsConst(m_threads)) {
+        thread->quit();
+    }
+    for (QThread* thread : qAsConst(m_threads)) {
+        thread->wait();
+    }
+    m_workers.clear();
+    
+    // 所有I/O线程结束后不会再有修改，写完剩余数据
+    if (m_store) {
+        m_state.setStore(nullptr);
+        m_store->stop();
+    }
+}
+
+void ChatServer::setStatsInterval(int msecs)
+{
+    if (msecs > 0) {
+        m_statsTimer->start(msecs);
+    } else {
+        m_statsTimer->stop();
+    }
+}
+
+void ChatServer::incomingConnection(qintptr socketDescriptor)
+{
+    // 轮询分配，连接的全部读写都在所分配的I/O线程中进行
+    ServerWorker* worker = m_workers.at(m_nextWorker);
+    m_nextWorker = (m_nextWorker + 1) % m_workers.size();
+    worker->addConnection(socketDescriptor);
+}
+
+void ChatServer::printStats()
+{
+    ServerWorker::Stats total;
+    for (ServerWorker* worker : qAsConst(m_workers)) {
+        ServerWorker::Stats stats = worker->stats();
+        total.connections += stats.connections;
+        total.framesIn += stats.framesIn;
+        total.framesOut += stats.framesOut;
+        total.bytesIn += stats.bytesIn;
+        total.bytesOut += stats.bytesOut;
+    }
+    
+    double seconds = m_statsTimer->interval() / 1000.0;
+    qDebug().noquote() << QString("连接: %1  收: %2 帧/秒  发: %3 帧/秒  累计收 %4 MB / 发 %5 MB  用户: %6")
+                              .arg(total.connections)
+                              .arg(static_cast<qint64>((total.framesIn - m_lastFramesIn) / seconds))
+                              .arg(static_cast<qint64>((total.framesOut - m_lastFramesOut) / seconds))
+                              .arg(total.bytesIn / (1024.0 * 1024.0), 0, 'f', 1)
+                              .arg(total.bytesOut / (1024.0 * 1024.0), 0, 'f', 1)
+                              .arg(m_state.userCount());
+    m_lastFramesIn = total.framesIn;
+    m_lastFramesOut = total.framesOut;
+}
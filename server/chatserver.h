@@ -0,0 +1,49 @@
+#ifndef CHATSERVER_H
+#define CHATSERVER_H
+
+#include <QTcpServer>
+#include <QThread>
+#include <QTimer>
+#include <QVector>
+#include "serverstate.h"
+
+class ServerWorker;
+class ServerStore;
+
+// 无界面的聊天服务器，用于本地压测客户端。
+// 主线程只负责accept，新连接按轮询分配给N个I/O线程，每个线程有自己的事件循环；
+// 状态保存在内存中（ServerState），指定数据库路径时异步持久化到SQLite
+class ChatServer : public QTcpServer
+{
+    Q_OBJECT
+
+public:
+    explicit ChatServer(int ioThreads, int historyLimit, QObject* parent = nullptr);
+    ~ChatServer();
+
+    // 加载并启用持久化，需在 start 之前调用
+    bool enablePersistence(const QString& databasePath);
+    bool start(const QHostAddress& address, quint16 port);
+    void stop();
+
+    // 每隔 msecs 输出一次连接数和吞吐量，0表示不输出
+    void setStatsInterval(int msecs);
+
+protected:
+    void incomingConnection(qintptr socketDescriptor) override;
+
+private slots:
+    void printStats();
+
+private:
+    ServerState m_state;
+    ServerStore* m_store;
+    QVector<QThread*> m_threads;
+    QVector<ServerWorker*> m_workers;
+    int m_nextWorker;
+    QTimer* m_statsTimer;
+    quint64 m_lastFramesIn;
+    quint64 m_lastFramesOut;
+};
+
+#endif // CHATSERVER_H
@@ -0,0 +1,35 @@
+QT += core network sql
+QT -= gui
+
+CONFIG += c++17 console
+CONFIG -= app_bundle
+
+TARGET = chatserver
+TEMPLATE = app
+
+# 与客户端共用帧解码、消息编解码和压缩
+INCLUDEPATH += ..
+
+SOURCES += \
+    main.cpp \
+    chatserver.cpp \
+    serverworker.cpp \
+    clientconnection.cpp \
+    serverstate.cpp \
+    serverstore.cpp \
+    ../framedecoder.cpp \
+    ../messagecodec.cpp \
+    ../framecompressor.cpp
+
+HEADERS += \
+    chatserver.h \
+    serverworker.h \
+    clientconnection.h \
+    serverstate.h \
+    serverstore.h \
+    ../framedecoder.h \
+    ../messagecodec.h \
+    ../framecompressor.h
+
+# 帧压缩使用zlib
+LIBS += -lz
@@ -0,0 +1,538 @@
+#include "clientconnection.h"
+#include "serverworker.h"
+#include "serverstate.h"
+#include "networkmanager.h"
+#include <QDateTime>
+#include <QDebug>
+
+namespace {
+// 服务器端连接数多，解码缓冲区按需增长
+const int DecoderInitialCapacity = 4 * 1024;
+}
+
+ClientConnection::ClientConnection(qintptr socketDescriptor, ServerWorker* worker)
+    : QObject(worker)
+    , m_worker(worker)
+    , m_state(worker->state())
+    , m_socket(new QTcpSocket(this))
+    , m_valid(false)
+    , m_id(worker->nextConnectionId())
+    , m_userId(0)
+    , m_protocolVersion(0)
+    , m_encoding(MessageCodec::EncodingJson)
+    , m_compression(false)
+    , m_queuedFrames(0)
+    , m_flushScheduled(false)
+{
+    m_decoder.setInitialCapacity(DecoderInitialCapacity);
+    
+    if (!m_socket->setSocketDescriptor(socketDescriptor)) {
+        qDebug() << "接受连接失败:" << m_socket->errorString();
+        return;
+    }
+    m_socket->setSocketOption(QAbstractSocket::LowDelayOption, 1);
+    m_valid = true;
+    
+    connect(m_socket, &QTcpSocket::readyRead, this, &ClientConnection::onReadyRead);
+    connect(m_socket, &QTcpSocket::disconnected, this, &ClientConnection::onDisconnected);
+}
+
+ClientConnection::~ClientConnection()
+{
+}
+
+void ClientConnection::onReadyRead()
+{
+    qint64 bytes = m_decoder.readFrom(m_socket);
+    int frames = 0;
+    
+    QByteArray frame;
+    int flags = 0;
+    for (;;) {
+        FrameDecoder::Status status = m_decoder.next(frame, &flags);
+        if (status == FrameDecoder::NeedMoreData) {
+            break;
+        }
+        if (status == FrameDecoder::FrameTooLarge) {
+            qDebug() << "连接" << m_id << "的帧长度" << m_decoder.lastFrameLength() << "超过上限，断开";
+            m_socket->abort();
+            return;
+        }
+        
+        ++frames;
+        if (flags & FrameDecoder::FlagCompressed) {
+            QByteArray& buffer = m_worker->decompressBuffer();
+            if (!m_worker->compressor().decompress(frame.constData(), frame.size(), buffer,
+                                                   m_decoder.maxFrameSize())) {
+                qDebug() << "解压消息失败，丢弃该帧";
+                continue;
+            }
+            handleFrame(buffer, flags & ~FrameDecoder::FlagCompressed);
+        } else {
+            handleFrame(frame, flags);
+        }
+    }
+    
+    m_decoder.squeeze();
+    m_worker->countIn(frames, bytes);
+    // 本次读取到的聊天消息合并确认
+    flushAcks();
+}
+
+void ClientConnection::onDisconnected()
+{
+    if (m_userId > 0) {
+        m_worker->unregisterUser(m_userId, this);
+    }
+    m_pendingDeliveries.clear();
+    m_sendQueue.clear();
+    emit closed(this);
+}
+
+void ClientConnection::handleFrame(const QByteArray& frame, int flags)
+{
+    int type = 0;
+    QCborMap request;
+    QString errorString;
+    if (!MessageCodec::decodeFrame(frame, flags, type, request, &errorString)) {
+        qDebug() << errorString;
+        return;
+    }
+    
+    switch (type) {
+    case NetworkManager::MSG_LOGIN:
+        handleLogin(request);
+        break;
+        
+    case NetworkManager::MSG_REGISTER:
+        handleRegister(request);
+        break;
+        
+    case NetworkManager::MSG_TEXT:
+    case NetworkManager::MSG_GROUP_MESSAGE:
+        handleChatMessage(type, request);
+        break;
+        
+    case NetworkManager::MSG_HEARTBEAT: {
+        // 协议版本2起回应心跳，客户端据此检测半开连接
+        QCborMap response;
+        response.insert(MessageCodec::FieldUserId, m_userId);
+        send(NetworkManager::MSG_HEARTBEAT, response);
+        break;
+    }
+    
+    case NetworkManager::MSG_GET_CONTACTS:
+        handleGetContacts(request);
+        break;
+        
+    case NetworkManager::MSG_ADD_CONTACT:
+        handleAddContact(request);
+        break;
+        
+    case NetworkManager::MSG_REMOVE_CONTACT:
+        handleRemoveContact(request);
+        break;
+        
+    case NetworkManager::MSG_BACKFILL:
+        handleBackfill(request);
+        break;
+        
+    case NetworkManager::MSG_ACK:
+        break;
+        
+    default:
+        qDebug() << "未知消息类型:" << type;
+    }
+}
+
+void ClientConnection::handleLogin(const QCborMap& request)
+{
+    int userId = static_cast<int>(request.value(MessageCodec::FieldUserId).toInteger());
+    QString username = request.value(MessageCodec::FieldUsername).toString();
+    
+    QCborMap response;
+    if (userId <= 0) {
+        response.insert(MessageCodec::FieldSuccess, false);
+        response.insert(MessageCodec::FieldReason, QStringLiteral("无效的用户ID"));
+        reply(NetworkManager::MSG_LOGIN, request, response);
+        return;
+    }
+    
+    // 同一连接切换用户时先注销旧用户
+    if (m_userId > 0 && m_userId != userId) {
+        m_worker->unregisterUser(m_userId, this);
+    }
+    m_userId = userId;
+    m_protocolVersion = static_cast<int>(request.value(MessageCodec::FieldProtocolVersion).toInteger());
+    m_state->touchUser(userId, username);
+    // 先登记在线再读取信箱，之后写入信箱的消息都会实时投递
+    m_worker->registerUser(userId, this);
+    
+    // 协商编码和压缩
+    MessageCodec::Encoding encoding = MessageCodec::EncodingJson;
+    const QCborArray encodings = request.value(MessageCodec::FieldEncodings).toArray();
+    for (const QCborValue& name : encodings) {
+        bool ok = false;
+        if (MessageCodec::encodingFromName(name.toString(), &ok) == MessageCodec::EncodingCbor && ok) {
+            encoding = MessageCodec::EncodingCbor;
+        }
+    }
+    bool compression = false;
+    const QCborArray compressions = request.value(MessageCodec::FieldCompression).toArray();
+    for (const QCborValue& name : compressions) {
+        compression = compression || name.toString() == QLatin1String("zlib");
+    }
+    
+    response.insert(MessageCodec::FieldSuccess, true);
+    response.insert(MessageCodec::FieldUserId, userId);
+    response.insert(MessageCodec::FieldUsername, username);
+    response.insert(MessageCodec::FieldProtocolVersion, MessageCodec::ProtocolVersion);
+    response.insert(MessageCodec::FieldEncoding, QString(MessageCodec::encodingName(encoding)));
+    if (compression) {
+        response.insert(MessageCodec::FieldCompression, QStringLiteral("zlib"));
+    }
+    
+    // 只有声明了同步游标的客户端才进行追赶
+    bool catchUp = request.contains(MessageCodec::FieldLastSeq);
+    if (catchUp) {
+        response.insert(MessageCodec::FieldLastSeq, m_state->lastSeq(userId));
+    }
+    
+    // 登录响应仍按协商前的方式发送，之后的帧使用协商结果
+    reply(NetworkManager::MSG_LOGIN, request, response);
+    m_encoding = encoding;
+    m_compression = compression;
+    
+    if (catchUp) {
+        sendCatchUp(request.value(MessageCodec::FieldLastSeq).toInteger());
+    }
+}
+
+void ClientConnection::sendCatchUp(qint64 afterSeq)
+{
+    const QVector<ServerState::MailboxEntry> entries = m_state->mailboxAfter(m_userId, afterSeq);
+    if (entries.isEmpty()) {
+        return;
+    }
+    
+    for (int start = 0; start < entries.size(); start += MaxMessagesPerBatch) {
+        int end = qMin(start + MaxMessagesPerBatch, entries.size());
+        QCborArray messages;
+        for (int i = start; i < end; ++i) {
+            messages.append(entries.at(i).data);
+        }
+        
+        QCborMap batch;
+        batch.insert(MessageCodec::FieldMessages, messages);
+        batch.insert(MessageCodec::FieldSeq, entries.at(end - 1).seq);
+        batch.insert(MessageCodec::FieldDone, end == entries.size());
+        send(NetworkManager::MSG_SYNC_BATCH, batch);
+    }
+}
+
+void ClientConnection::handleBackfill(const QCborMap& request)
+{
+    if (m_userId <= 0) {
+        return;
+    }
+    
+    int peerId = static_cast<int>(request.value(MessageCodec::FieldContactId).toInteger());
+    bool isGroup = request.value(MessageCodec::FieldIsGroup).toBool();
+    qint64 afterConvSeq = request.value(MessageCodec::FieldConvSeq).toInteger();
+    
+    // 先取会话最新序号再读信箱：回复中的序号之内信箱里没有的消息都已超出保留范围
+    qint64 lastConvSeq = m_state->conversationSeq(m_userId, peerId, isGroup);
+    const QVector<ServerState::MailboxEntry> entries = m_state->conversationAfter(m_userId, peerId, isGroup,
+                                                                                afterConvSeq);
+    
+    // 以多消息帧补发；客户端按 (发送者, client_msg_id) 去重，已收到的消息不会重复显示
+    for (int start = 0; start < entries.size(); start += MaxMessagesPerBatch) {
+        int end = qMin(start + MaxMessagesPerBatch, entries.size());
+        QCborArray messages;
+        for (int i = start; i < end; ++i) {
+            messages.append(entries.at(i).data);
+        }
+        
+        QCborMap batch;
+        batch.insert(MessageCodec::FieldMessages, messages);
+        send(NetworkManager::MSG_BATCH, batch);
+    }
+    
+    // 补发结束：客户端据此关闭空洞，而不是在请求发出时就认为已补齐
+    QCborMap done;
+    done.insert(MessageCodec::FieldContactId, peerId);
+    done.insert(MessageCodec::FieldIsGroup, isGroup);
+    done.insert(MessageCodec::FieldConvSeq, lastConvSeq);
+    send(NetworkManager::MSG_BACKFILL, done);
+}
+
+void ClientConnection::handleRegister(const QCborMap& request)
+{
+    int userId = m_state->registerUser(request.value(MessageCodec::FieldUsername).toString(),
+                                       request.value(MessageCodec::FieldPassword).toString(),
+                                       request.value(MessageCodec::FieldNickname).toString());
+                                       
+    QCborMap response;
+    response.insert(MessageCodec::FieldSuccess, userId > 0);
+    if (userId > 0) {
+        response.insert(MessageCodec::FieldUserId, userId);
+    } else {
+        response.insert(MessageCodec::FieldReason, QStringLiteral("用户名已存在"));
+    }
+    reply(NetworkManager::MSG_REGISTER, request, response);
+}
+
+void ClientConnection::handleChatMessage(int type, const QCborMap& request)
+{
+    if (m_userId <= 0) {
+        qDebug() << "连接" << m_id << "未登录就发送消息，丢弃";
+        return;
+    }
+    
+    qint64 clientMsgId = request.value(MessageCodec::FieldClientMsgId).toInteger();
+    // 重连后重传的消息已经投递过，以当时分配的会话序号再确认一次
+    qint64 convSeq = 0;
+    if (m_state->isDuplicate(m_userId, clientMsgId, &convSeq)) {
+        m_pendingAcks.append(clientMsgId);
+        m_pendingAckSeqs.append(convSeq);
+        return;
+    }
+    
+    int toUserId = static_cast<int>(request.value(MessageCodec::FieldToUserId).toInteger());
+    bool isGroup = type == NetworkManager::MSG_GROUP_MESSAGE || request.value(MessageCodec::FieldIsGroup).toBool();
+    qint64 timestamp = request.value(MessageCodec::FieldTimestamp).toInteger();
+    
+    // 会话序号在服务器上统一分配，与发送方的时钟无关
+    convSeq = m_state->nextConversationSeq(m_userId, toUserId, isGroup);
+    if (clientMsgId != 0) {
+        m_state->setClientMsgConvSeq(m_userId, clientMsgId, convSeq);
+        m_pendingAcks.append(clientMsgId);
+        m_pendingAckSeqs.append(convSeq);
+    }
+    
+    QCborMap message;
+    message.insert(MessageCodec::FieldClientMsgId, clientMsgId);
+    message.insert(MessageCodec::FieldFromUserId, m_userId);
+    message.insert(MessageCodec::FieldToUserId, toUserId);
+    message.insert(MessageCodec::FieldContent, request.value(MessageCodec::FieldContent));
+    message.insert(MessageCodec::FieldIsGroup, isGroup);
+    message.insert(MessageCodec::FieldTimestamp, timestamp > 0 ? timestamp : QDateTime::currentMSecsSinceEpoch());
+    message.insert(MessageCodec::FieldConvSeq, convSeq);
+    
+    // 群成员为向该群发过消息的用户，发送者不接收自己的消息
+    QVector<int> recipients;
+    if (isGroup) {
+        recipients = m_state->joinGroup(toUserId, m_userId);
+        recipients.removeAll(m_userId);
+    } else if (toUserId > 0) {
+        recipients.append(toUserId);
+    }
+    
+    // 先写入接收方信箱（分配序号），在线的接收方再由其所在线程投递
+    for (int recipient : qAsConst(recipients)) {
+        QCborMap delivery = message;
+        m_state->appendToMailbox(recipient, type, delivery);
+        ServerWorker* worker = m_state->workerFor(recipient);
+        if (worker) {
+            worker->post(recipient, type, delivery);
+        }
+    }
+}
+
+void ClientConnection::handleGetContacts(const QCborMap& request)
+{
+    int userId = m_userId > 0 ? m_userId : static_cast<int>(request.value(MessageCodec::FieldUserId).toInteger());
+    ServerState::RosterSnapshot snapshot = m_state->roster(userId,
+                                                           request.value(MessageCodec::FieldRosterVersion).toInteger());
+                                                           
+    QCborArray contacts;
+    for (const ServerState::ContactEntry& contact : qAsConst(snapshot.contacts)) {
+        QCborMap item;
+        item.insert(MessageCodec::FieldContactId, contact.contactId);
+        item.insert(MessageCodec::FieldContactName, contact.contactName);
+        item.insert(MessageCodec::FieldGroupName, contact.groupName);
+        item.insert(MessageCodec::FieldIsGroup, contact.isGroup);
+        contacts.append(item);
+    }
+    QCborArray removed;
+    for (int contactId : qAsConst(snapshot.removed)) {
+        removed.append(contactId);
+    }
+    
+    QCborMap response;
+    response.insert(MessageCodec::FieldUserId, userId);
+    response.insert(MessageCodec::FieldRosterVersion, snapshot.version);
+    response.insert(MessageCodec::FieldFull, snapshot.full);
+    response.insert(MessageCodec::FieldContacts, contacts);
+    response.insert(MessageCodec::FieldRemoved, removed);
+    reply(NetworkManager::MSG_GET_CONTACTS, request, response);
+}
+
+void ClientConnection::handleAddContact(const QCborMap& request)
+{
+    int userId = m_userId > 0 ? m_userId : static_cast<int>(request.value(MessageCodec::FieldUserId).toInteger());
+    int contactId = static_cast<int>(request.value(MessageCodec::FieldContactId).toInteger());
+    QString contactName = request.value(MessageCodec::FieldContactName).toString();
+    QString groupName = request.value(MessageCodec::FieldGroupName).toString();
+    if (groupName.isEmpty()) {
+        groupName = QStringLiteral("默认分组");
+    }
+    bool isGroup = request.value(MessageCodec::FieldIsGroup).toBool();
+    
+    QCborMap response;
+    if (userId <= 0 || contactId <= 0) {
+        response.insert(MessageCodec::FieldSuccess, false);
+        response.insert(MessageCodec::FieldReason, QStringLiteral("无效的联系人"));
+    } else {
+        qint64 version = m_state->addContact(userId, contactId, contactName, groupName, isGroup);
+        response.insert(MessageCodec::FieldSuccess, true);
+        response.insert(MessageCodec::FieldContactId, contactId);
+        response.insert(MessageCodec::FieldContactName, contactName);
+        response.insert(MessageCodec::FieldRosterVersion, version);
+    }
+    reply(NetworkManager::MSG_ADD_CONTACT, request, response);
+}
+
+void ClientConnection::handleRemoveContact(const QCborMap& request)
+{
+    int userId = m_userId > 0 ? m_userId : static_cast<int>(request.value(MessageCodec::FieldUserId).toInteger());
+    int contactId = static_cast<int>(request.value(MessageCodec::FieldContactId).toInteger());
+    
+    // 花名册中本来就没有的联系人（如只保存在客户端本地的）也算删除成功，客户端可以删掉本地记录
+    QCborMap response;
+    if (userId <= 0 || contactId <= 0) {
+        response.insert(MessageCodec::FieldSuccess, false);
+        response.insert(MessageCodec::FieldReason, QStringLiteral("无效的联系人"));
+    } else {
+        m_state->removeContact(userId, contactId);
+        response.insert(MessageCodec::FieldSuccess, true);
+        response.insert(MessageCodec::FieldContactId, contactId);
+    }
+    reply(NetworkManager::MSG_REMOVE_CONTACT, request, response);
+}
+
+void ClientConnection::deliver(int type, const QCborMap& data)
+{
+    Delivery delivery;
+    delivery.type = type;
+    delivery.data = data;
+    m_pendingDeliveries.append(delivery);
+    scheduleFlush();
+}
+
+void ClientConnection::reply(int type, const QCborMap& request, QCborMap response)
+{
+    if (request.contains(MessageCodec::FieldRequestId)) {
+        response.insert(MessageCodec::FieldRequestId, request.value(MessageCodec::FieldRequestId));
+    }
+    send(type, response);
+}
+
+void ClientConnection::send(int type, const QCborMap& data)
+{
+    QByteArray body = MessageCodec::encode(type, data, m_encoding);
+    int flags = MessageCodec::frameFlags(m_encoding);
+    
+    const QByteArray* payload = &body;
+    QByteArray& compressed = m_worker->compressBuffer();
+    if (m_compression && body.size() >= CompressionThreshold
+        && m_worker->compressor().compress(body.constData(), body.size(), compressed)
+        && compressed.size() < body.size()) {
+        payload = &compressed;
+        flags |= FrameDecoder::FlagCompressed;
+    }
+    
+    int offset = m_sendQueue.size();
+    m_sendQueue.resize(offset + FrameDecoder::HeaderSize);
+    FrameDecoder::writeHeader(m_sendQueue.data() + offset, static_cast<quint32>(payload->size()), flags);
+    m_sendQueue.append(*payload);
+    ++m_queuedFrames;
+    scheduleFlush();
+}
+
+void ClientConnection::flushAcks()
+{
+    if (m_pendingAcks.isEmpty()) {
+        return;
+    }
+    
+    QCborMap ack;
+    if (m_pendingAcks.size() == 1) {
+        ack.insert(MessageCodec::FieldClientMsgId, m_pendingAcks.first());
+        ack.insert(MessageCodec::FieldConvSeq, m_pendingAckSeqs.first());
+    } else {
+        QCborArray ids;
+        QCborArray seqs;
+        for (int i = 0; i < m_pendingAcks.size(); ++i) {
+            ids.append(m_pendingAcks.at(i));
+            seqs.append(m_pendingAckSeqs.at(i));
+        }
+        ack.insert(MessageCodec::FieldClientMsgIds, ids);
+        ack.insert(MessageCodec::FieldConvSeqs, seqs);
+    }
+    m_pendingAcks.clear();
+    m_pendingAckSeqs.clear();
+    send(NetworkManager::MSG_ACK, ack);
+}
+
+void ClientConnection::flushDeliveries()
+{
+    if (m_pendingDeliveries.isEmpty()) {
+        return;
+    }
+    
+    // 协议版本3的客户端接受多消息帧，一次送达的多条消息合并发送
+    if (m_protocolVersion >= 3 && m_pendingDeliveries.size() > 1) {
+        for (int start = 0; start < m_pendingDeliveries.size(); start += MaxMessagesPerBatch) {
+            int end = qMin(start + MaxMessagesPerBatch, m_pendingDeliveries.size());
+            QCborArray messages;
+            for (int i = start; i < end; ++i) {
+                messages.append(m_pendingDeliveries.at(i).data);
+            }
+            QCborMap batch;
+            batch.insert(MessageCodec::FieldMessages, messages);
+            send(NetworkManager::MSG_BATCH, batch);
+        }
+    } else {
+        for (const Delivery& delivery : qAsConst(m_pendingDeliveries)) {
+            send(delivery.type, delivery.data);
+        }
+    }
+    m_pendingDeliveries.clear();
+}
+
+void ClientConnection::scheduleFlush()
+{
+    // 同一轮事件循环内产生的帧合并为一次write
+    if (!m_flushScheduled) {
+        m_flushScheduled = true;
+        QMetaObject::invokeMethod(this, "flushSendQueue", Qt::QueuedConnection);
+    }
+}
+
+void ClientConnection::flushSendQueue()
+{
+    // 先把待投递的消息编码进发送队列，此时 send 不会再安排一次刷新
+    flushDeliveries();
+    m_flushScheduled = false;
+    
+    if (m_sendQueue.isEmpty() || m_socket->state() != QAbstractSocket::ConnectedState) {
+        m_sendQueue.clear();
+        m_queuedFrames = 0;
+        return;
+    }
+    
+    if (m_socket->bytesToWrite() > MaxPendingBytes) {
+        qDebug() << "连接" << m_id << "待发送数据过多，断开慢速客户端";
+        m_socket->abort();
+        return;
+    }
+    
+    qint64 written = m_socket->write(m_sendQueue);
+    if (written > 0) {
+        m_worker->countOut(m_queuedFrames, written);
+    }
+    // 连接数多，不为每个连接保留发送缓冲区的容量
+    m_sendQueue.clear();
+    m_queuedFrames = 0;
+}
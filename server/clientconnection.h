@@ -0,0 +1,88 @@
+#ifndef CLIENTCONNECTION_H
+#define CLIENTCONNECTION_H
+
+#include <QObject>
+#include <QTcpSocket>
+#include <QVector>
+#include <QCborMap>
+#include "framedecoder.h"
+#include "messagecodec.h"
+
+class ServerWorker;
+class ServerState;
+
+// 一个客户端连接，在所属 ServerWorker 的线程中运行。
+// 协议与客户端 NetworkManager 完全相同：登录时协商编码、压缩和协议版本，
+// 请求类消息原样回显 request_id，聊天消息分配会话序号后回复 MSG_ACK（同一次读取的确认合并为一帧）
+class ClientConnection : public QObject
+{
+    Q_OBJECT
+
+public:
+    // 每个 MSG_SYNC_BATCH / MSG_BATCH 帧最多携带的消息数
+    static const int MaxMessagesPerBatch = 256;
+    // 不小于该长度的帧在协商启用压缩后压缩发送
+    static const int CompressionThreshold = 1024;
+    // 对端读得太慢、待发送数据超过该值时断开，避免一个慢连接占满内存
+    static const qint64 MaxPendingBytes = 8 * 1024 * 1024;
+
+    ClientConnection(qintptr socketDescriptor, ServerWorker* worker);
+    ~ClientConnection();
+
+    bool isValid() const { return m_valid; }
+    quint64 id() const { return m_id; }
+    int userId() const { return m_userId; }
+
+    // 投递一条已写入信箱的聊天消息，本轮事件循环结束时与其他消息合并发送
+    void deliver(int type, const QCborMap& data);
+
+signals:
+    void closed(ClientConnection* connection);
+
+private slots:
+    void onReadyRead();
+    void onDisconnected();
+    void flushSendQueue();
+
+private:
+    struct Delivery {
+        int type = 0;
+        QCborMap data;
+    };
+
+    void handleFrame(const QByteArray& frame, int flags);
+    void handleLogin(const QCborMap& request);
+    void handleRegister(const QCborMap& request);
+    void handleChatMessage(int type, const QCborMap& request);
+    void handleGetContacts(const QCborMap& request);
+    void handleAddContact(const QCborMap& request);
+    void handleRemoveContact(const QCborMap& request);
+    void handleBackfill(const QCborMap& request);
+    void sendCatchUp(qint64 afterSeq);
+
+    void reply(int type, const QCborMap& request, QCborMap response);
+    void send(int type, const QCborMap& data);
+    void flushAcks();
+    void flushDeliveries();
+    void scheduleFlush();
+
+    ServerWorker* m_worker;
+    ServerState* m_state;
+    QTcpSocket* m_socket;
+    bool m_valid;
+    quint64 m_id;
+    int m_userId;
+    int m_protocolVersion;
+    MessageCodec::Encoding m_encoding;
+    bool m_compression;
+
+    FrameDecoder m_decoder;
+    QByteArray m_sendQueue;
+    int m_queuedFrames;
+    bool m_flushScheduled;
+    QVector<qint64> m_pendingAcks;
+    QVector<qint64> m_pendingAckSeqs; // 与 m_pendingAcks 一一对应的会话序号
+    QVector<Delivery> m_pendingDeliveries;
+};
+
+#endif // CLIENTCONNECTION_H
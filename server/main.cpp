@@ -0,0 +1,125 @@
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QHostAddress>
+#include <QThread>
+#include <QDebug>
+#include <csignal>
+#include "chatserver.h"
+
+#ifdef Q_OS_UNIX
+#include <QSocketNotifier>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <cerrno>
+#endif
+
+namespace {
+// 数万个连接需要同样多的文件描述符，把软限制提高到硬限制
+void raiseFileDescriptorLimit()
+{
+#ifdef Q_OS_UNIX
+    struct rlimit limit;
+    if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < limit.rlim_max) {
+        limit.rlim_cur = limit.rlim_max;
+        if (setrlimit(RLIMIT_NOFILE, &limit) != 0) {
+            qDebug() << "无法提高文件描述符上限";
+        }
+    }
+    if (getrlimit(RLIMIT_NOFILE, &limit) == 0) {
+        qDebug() << "文件描述符上限:" << static_cast<qulonglong>(limit.rlim_cur);
+    }
+#endif
+}
+
+#ifdef Q_OS_UNIX
+// 自管道：信号处理函数只向 socketpair 的一端写一个字节，另一端由事件循环中的 QSocketNotifier 读取后退出
+int signalFds[2] = {-1, -1};
+
+void handleSignal(int)
+{
+    // 只调用异步信号安全的 write，并保留被打断代码的 errno
+    int savedErrno = errno;
+    char byte = 1;
+    ssize_t written = ::write(signalFds[0], &byte, sizeof(byte));
+    Q_UNUSED(written)
+    errno = savedErrno;
+}
+
+bool installSignalHandlers(QCoreApplication& app)
+{
+    if (::socketpair(AF_UNIX, SOCK_STREAM, 0, signalFds) != 0) {
+        qDebug() << "创建信号通知套接字失败";
+        return false;
+    }
+    
+    QSocketNotifier* notifier = new QSocketNotifier(signalFds[1], QSocketNotifier::Read, &app);
+    QObject::connect(notifier, &QSocketNotifier::activated, &app, [notifier]() {
+        notifier->setEnabled(false);
+        char byte;
+        ssize_t received = ::read(signalFds[1], &byte, sizeof(byte));
+        Q_UNUSED(received)
+        QCoreApplication::quit();
+    });
+    
+    struct sigaction action;
+    action.sa_handler = handleSignal;
+    sigemptyset(&action.sa_mask);
+    action.sa_flags = SA_RESTART;
+    return sigaction(SIGINT, &action, nullptr) == 0 && sigaction(SIGTERM, &action, nullptr) == 0;
+}
+#else
+void handleSignal(int)
+{
+    // Windows 在单独的线程中调用控制台信号处理函数，投递到主线程的事件循环中退出
+    QMetaObject::invokeMethod(QCoreApplication::instance(), "quit", Qt::QueuedConnection);
+}
+
+bool installSignalHandlers(QCoreApplication& app)
+{
+    Q_UNUSED(app)
+    std::signal(SIGINT, handleSignal);
+    std::signal(SIGTERM, handleSignal);
+    return true;
+}
+#endif
+}
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+    app.setApplicationName("chatserver");
+    
+    QCommandLineParser parser;
+    parser.setApplicationDescription("聊天服务器（本地压测用）");
+    parser.addHelpOption();
+    QCommandLineOption portOption({"p", "port"}, "监听端口", "port", "8888");
+    QCommandLineOption addressOption("address", "监听地址", "address", "0.0.0.0");
+    QCommandLineOption threadsOption({"t", "threads"}, "I/O线程数（默认为CPU核数）", "count",
+                                     QString::number(qMax(1, QThread::idealThreadCount())));
+    QCommandLineOption databaseOption("db", "持久化到SQLite数据库（默认只保存在内存中）", "path");
+    QCommandLineOption historyOption("history", "每个用户保留的离线消息数", "count", "1000");
+    QCommandLineOption statsOption("stats", "统计输出间隔（秒），0为不输出", "seconds", "10");
+    parser.addOptions({portOption, addressOption, threadsOption, databaseOption, historyOption, statsOption});
+    parser.process(app);
+    
+    raiseFileDescriptorLimit();
+    
+    ChatServer server(parser.value(threadsOption).toInt(), parser.value(historyOption).toInt());
+    if (parser.isSet(databaseOption) && !server.enablePersistence(parser.value(databaseOption))) {
+        return 1;
+    }
+    if (!server.start(QHostAddress(parser.value(addressOption)), parser.value(portOption).toUShort())) {
+        return 1;
+    }
+    server.setStatsInterval(parser.value(statsOption).toInt() * 1000);
+    
+    // Ctrl+C 时正常退出，持久化的数据写完再结束；退出在事件循环中进行，不在信号处理函数中
+    if (!installSignalHandlers(app)) {
+        qDebug() << "安装信号处理失败，只能强制结束";
+    }
+    
+    int result = app.exec();
+    server.stop();
+    return result;
+}
@@ -0,0 +1,448 @@
+#include "serverstate.h"
+#include "serverstore.h"
+#include "messagecodec.h"
+#include <QMutexLocker>
+
+namespace {
+// 每个发送者保留的最近客户端消息ID数，重传只发生在重连后的短时间内
+const int RecentClientMsgLimit = 1024;
+
+// 单聊的两个方向属于同一会话；群会话以最高位区分
+quint64 conversationKey(int fromUserId, int toUserId, bool isGroup)
+{
+    if (isGroup) {
+        return (quint64(1) << 63) | static_cast<quint32>(toUserId);
+    }
+    return (quint64(static_cast<quint32>(qMin(fromUserId, toUserId))) << 32)
+           | static_cast<quint32>(qMax(fromUserId, toUserId));
+}
+
+// 会话所在的分片：群按群ID，单聊按较小的用户ID
+int conversationShardId(quint64 key)
+{
+    bool isGroup = (key >> 63) != 0;
+    return static_cast<int>(static_cast<quint32>(isGroup ? key : key >> 32));
+}
+}
+
+ServerState::ServerState(int historyLimit)
+    : m_historyLimit(qMax(1, historyLimit))
+    , m_store(nullptr)
+    , m_nextUserId(0)
+{
+}
+
+ServerState::~ServerState()
+{
+}
+
+int ServerState::registerUser(const QString& username, const QString& password, const QString& nickname)
+{
+    int userId = 0;
+    {
+        QMutexLocker locker(&m_usernameMutex);
+        if (username.isEmpty() || m_usernames.contains(username)) {
+            return 0;
+        }
+        userId = ++m_nextUserId;
+        m_usernames.insert(username, userId);
+    }
+    
+    Shard& shard = shardFor(userId);
+    {
+        QMutexLocker locker(&shard.mutex);
+        UserRecord& user = shard.users[userId];
+        user.username = username;
+        user.password = password;
+        user.nickname = nickname;
+    }
+    
+    if (m_store) {
+        m_store->saveUser(userId, username, password, nickname);
+    }
+    return userId;
+}
+
+void ServerState::touchUser(int userId, const QString& username)
+{
+    Shard& shard = shardFor(userId);
+    bool created = false;
+    {
+        QMutexLocker locker(&shard.mutex);
+        QHash<int, UserRecord>::iterator it = shard.users.find(userId);
+        if (it == shard.users.end()) {
+            it = shard.users.insert(userId, UserRecord());
+            created = true;
+        }
+        if (it->username.isEmpty() && !username.isEmpty()) {
+            it->username = username;
+            created = true;
+        }
+    }
+    
+    // 客户端可能以本地注册的ID登录，新分配的ID不与之重复
+    int expected = m_nextUserId.load();
+    while (expected < userId && !m_nextUserId.compare_exchange_weak(expected, userId)) {
+    }
+    
+    if (created && m_store) {
+        m_store->saveUser(userId, username, QString(), QString());
+    }
+}
+
+int ServerState::userCount() const
+{
+    int count = 0;
+    for (const Shard& shard : m_shards) {
+        QMutexLocker locker(&shard.mutex);
+        count += shard.users.size();
+    }
+    return count;
+}
+
+void ServerState::setOnline(int userId, ServerWorker* worker, quint64 connectionId)
+{
+    Shard& shard = shardFor(userId);
+    QMutexLocker locker(&shard.mutex);
+    UserRecord& user = shard.users[userId];
+    user.worker = worker;
+    user.connectionId = connectionId;
+}
+
+void ServerState::setOffline(int userId, quint64 connectionId)
+{
+    Shard& shard = shardFor(userId);
+    QMutexLocker locker(&shard.mutex);
+    QHash<int, UserRecord>::iterator it = shard.users.find(userId);
+    if (it != shard.users.end() && it->connectionId == connectionId) {
+        it->worker = nullptr;
+        it->connectionId = 0;
+    }
+}
+
+ServerWorker* ServerState::workerFor(int userId) const
+{
+    const Shard& shard = shardFor(userId);
+    QMutexLocker locker(&shard.mutex);
+    QHash<int, UserRecord>::const_iterator it = shard.users.constFind(userId);
+    return it != shard.users.constEnd() ? it->worker : nullptr;
+}
+
+bool ServerState::isDuplicate(int fromUserId, qint64 clientMsgId, qint64* convSeq)
+{
+    if (clientMsgId == 0) {
+        return false;
+    }
+    
+    Shard& shard = shardFor(fromUserId);
+    QMutexLocker locker(&shard.mutex);
+    UserRecord& user = shard.users[fromUserId];
+    QHash<qint64, qint64>::const_iterator it = user.recentClientMsgIds.constFind(clientMsgId);
+    if (it != user.recentClientMsgIds.constEnd()) {
+        if (convSeq) {
+            *convSeq = it.value();
+        }
+        return true;
+    }
+    
+    user.recentClientMsgIds.insert(clientMsgId, 0);
+    user.recentClientMsgOrder.enqueue(clientMsgId);
+    if (user.recentClientMsgOrder.size() > RecentClientMsgLimit) {
+        user.recentClientMsgIds.remove(user.recentClientMsgOrder.dequeue());
+    }
+    return false;
+}
+
+void ServerState::setClientMsgConvSeq(int fromUserId, qint64 clientMsgId, qint64 convSeq)
+{
+    if (clientMsgId == 0) {
+        return;
+    }
+    
+    Shard& shard = shardFor(fromUserId);
+    QMutexLocker locker(&shard.mutex);
+    QHash<int, UserRecord>::iterator it = shard.users.find(fromUserId);
+    if (it != shard.users.end() && it->recentClientMsgIds.contains(clientMsgId)) {
+        it->recentClientMsgIds.insert(clientMsgId, convSeq);
+    }
+}
+
+qint64 ServerState::nextConversationSeq(int fromUserId, int toUserId, bool isGroup)
+{
+    quint64 key = conversationKey(fromUserId, toUserId, isGroup);
+    qint64 convSeq = 0;
+    {
+        Shard& shard = shardFor(conversationShardId(key));
+        QMutexLocker locker(&shard.mutex);
+        convSeq = ++shard.conversationSeqs[key];
+    }
+    
+    if (m_store) {
+        m_store->saveConversationSeq(key, convSeq);
+    }
+    return convSeq;
+}
+
+qint64 ServerState::conversationSeq(int fromUserId, int toUserId, bool isGroup) const
+{
+    const Shard& shard = shardFor(isGroup ? toUserId : qMin(fromUserId, toUserId));
+    QMutexLocker locker(&shard.mutex);
+    return shard.conversationSeqs.value(conversationKey(fromUserId, toUserId, isGroup));
+}
+
+void ServerState::raiseConversationSeq(int fromUserId, int toUserId, bool isGroup, qint64 convSeq)
+{
+    loadConversationSeq(conversationKey(fromUserId, toUserId, isGroup), convSeq);
+}
+
+qint64 ServerState::appendToMailbox(int userId, int type, QCborMap& data)
+{
+    MailboxEntry entry;
+    qint64 trimmedSeq = 0;
+    {
+        Shard& shard = shardFor(userId);
+        QMutexLocker locker(&shard.mutex);
+        UserRecord& user = shard.users[userId];
+        
+        entry.seq = ++user.lastSeq;
+        entry.type = type;
+        data.insert(MessageCodec::FieldSeq, entry.seq);
+        entry.data = data;
+        user.mailbox.enqueue(entry);
+        
+        while (user.mailbox.size() > m_historyLimit) {
+            trimmedSeq = user.mailbox.dequeue().seq;
+        }
+    }
+    
+    if (m_store) {
+        m_store->saveMailboxEntry(userId, entry);
+        if (trimmedSeq > 0) {
+            m_store->trimMailbox(userId, trimmedSeq);
+        }
+    }
+    return entry.seq;
+}
+
+qint64 ServerState::lastSeq(int userId) const
+{
+    const Shard& shard = shardFor(userId);
+    QMutexLocker locker(&shard.mutex);
+    QHash<int, UserRecord>::const_iterator it = shard.users.constFind(userId);
+    return it != shard.users.constEnd() ? it->lastSeq : 0;
+}
+
+QVector<ServerState::MailboxEntry> ServerState::mailboxAfter(int userId, qint64 afterSeq) const
+{
+    QVector<MailboxEntry> entries;
+    
+    const Shard& shard = shardFor(userId);
+    QMutexLocker locker(&shard.mutex);
+    QHash<int, UserRecord>::const_iterator it = shard.users.constFind(userId);
+    if (it == shard.users.constEnd() || it->lastSeq <= afterSeq || it->mailbox.isEmpty()) {
+        return entries;
+    }
+    
+    // 信箱中的序号连续，直接算出起始位置
+    const QQueue<MailboxEntry>& mailbox = it->mailbox;
+    int start = static_cast<int>(qMax<qint64>(0, afterSeq + 1 - mailbox.first().seq));
+    entries.reserve(mailbox.size() - start);
+    for (int i = start; i < mailbox.size(); ++i) {
+        entries.append(mailbox.at(i));
+    }
+    return entries;
+}
+
+QVector<ServerState::MailboxEntry> ServerState::conversationAfter(int userId, int peerId, bool isGroup,
+                                                                  qint64 afterConvSeq) const
+{
+    QVector<MailboxEntry> entries;
+    
+    const Shard& shard = shardFor(userId);
+    QMutexLocker locker(&shard.mutex);
+    QHash<int, UserRecord>::const_iterator it = shard.users.constFind(userId);
+    if (it == shard.users.constEnd()) {
+        return entries;
+    }
+    
+    // 补齐只在收到乱序消息后偶尔发生，信箱不大，逐条筛选即可
+    for (const MailboxEntry& entry : it->mailbox) {
+        bool entryIsGroup = entry.data.value(MessageCodec::FieldIsGroup).toBool();
+        int entryPeer = static_cast<int>(entry.data.value(isGroup ? MessageCodec::FieldToUserId
+                                                                  : MessageCodec::FieldFromUserId).toInteger());
+        if (entryIsGroup == isGroup && entryPeer == peerId
+            && entry.data.value(MessageCodec::FieldConvSeq).toInteger() > afterConvSeq) {
+            entries.append(entry);
+        }
+    }
+    return entries;
+}
+
+qint64 ServerState::addContact(int userId, int contactId, const QString& contactName,
+                               const QString& groupName, bool isGroup)
+{
+    ContactEntry contact;
+    {
+        Shard& shard = shardFor(userId);
+        QMutexLocker locker(&shard.mutex);
+        UserRecord& user = shard.users[userId];
+        
+        ContactEntry& entry = user.contacts[contactId];
+        entry.contactId = contactId;
+        entry.contactName = contactName;
+        entry.groupName = groupName;
+        entry.isGroup = isGroup;
+        entry.removed = false;
+        entry.version = ++user.rosterVersion;
+        contact = entry;
+    }
+    
+    if (m_store) {
+        m_store->saveContact(userId, contact);
+    }
+    return contact.version;
+}
+
+bool ServerState::removeContact(int userId, int contactId)
+{
+    ContactEntry contact;
+    {
+        Shard& shard = shardFor(userId);
+        QMutexLocker locker(&shard.mutex);
+        QHash<int, UserRecord>::iterator user = shard.users.find(userId);
+        if (user == shard.users.end()) {
+            return false;
+        }
+        QHash<int, ContactEntry>::iterator it = user->contacts.find(contactId);
+        if (it == user->contacts.end() || it->removed) {
+            return false;
+        }
+        it->removed = true;
+        it->version = ++user->rosterVersion;
+        contact = *it;
+    }
+    
+    if (m_store) {
+        m_store->saveContact(userId, contact);
+    }
+    return true;
+}
+
+ServerState::RosterSnapshot ServerState::roster(int userId, qint64 sinceVersion) const
+{
+    RosterSnapshot snapshot;
+    
+    const Shard& shard = shardFor(userId);
+    QMutexLocker locker(&shard.mutex);
+    QHash<int, UserRecord>::const_iterator user = shard.users.constFind(userId);
+    if (user == shard.users.constEnd()) {
+        return snapshot;
+    }
+    
+    // 客户端的版本比服务器还新（服务器数据已重置）时只能返回完整列表
+    snapshot.version = user->rosterVersion;
+    snapshot.full = sinceVersion <= 0 || sinceVersion > user->rosterVersion;
+    for (const ContactEntry& contact : user->contacts) {
+        if (!snapshot.full && contact.version <= sinceVersion) {
+            continue;
+        }
+        if (contact.removed) {
+            if (!snapshot.full) {
+                snapshot.removed.append(contact.contactId);
+            }
+        } else {
+            snapshot.contacts.append(contact);
+        }
+    }
+    return snapshot;
+}
+
+QVector<int> ServerState::joinGroup(int groupId, int userId)
+{
+    QVector<int> members;
+    bool joined = false;
+    {
+        Shard& shard = shardFor(groupId);
+        QMutexLocker locker(&shard.mutex);
+        QSet<int>& group = shard.groups[groupId];
+        if (!group.contains(userId)) {
+            group.insert(userId);
+            joined = true;
+        }
+        members.reserve(group.size());
+        for (int member : qAsConst(group)) {
+            members.append(member);
+        }
+    }
+    
+    if (joined && m_store) {
+        m_store->saveGroupMember(groupId, userId);
+    }
+    return members;
+}
+
+void ServerState::loadUser(int userId, const QString& username, const QString& password, const QString& nickname)
+{
+    {
+        Shard& shard = shardFor(userId);
+        QMutexLocker locker(&shard.mutex);
+        UserRecord& user = shard.users[userId];
+        user.username = username;
+        user.password = password;
+        user.nickname = nickname;
+    }
+    
+    QMutexLocker locker(&m_usernameMutex);
+    if (!username.isEmpty()) {
+        m_usernames.insert(username, userId);
+    }
+    if (userId > m_nextUserId) {
+        m_nextUserId = userId;
+    }
+}
+
+void ServerState::loadContact(int userId, const ContactEntry& contact)
+{
+    Shard& shard = shardFor(userId);
+    QMutexLocker locker(&shard.mutex);
+    UserRecord& user = shard.users[userId];
+    user.contacts.insert(contact.contactId, contact);
+    user.rosterVersion = qMax(user.rosterVersion, contact.version);
+}
+
+void ServerState::loadMailboxEntry(int userId, const MailboxEntry& entry)
+{
+    // 按序号升序加载
+    Shard& shard = shardFor(userId);
+    QMutexLocker locker(&shard.mutex);
+    UserRecord& user = shard.users[userId];
+    user.mailbox.enqueue(entry);
+    while (user.mailbox.size() > m_historyLimit) {
+        user.mailbox.dequeue();
+    }
+    user.lastSeq = qMax(user.lastSeq, entry.seq);
+    locker.unlock();
+    
+    // 会话序号计数器另有保存（conversations表）；旧数据库没有该表时至少从信箱中已有的最大值继续
+    qint64 convSeq = entry.data.value(MessageCodec::FieldConvSeq).toInteger();
+    if (convSeq > 0) {
+        raiseConversationSeq(static_cast<int>(entry.data.value(MessageCodec::FieldFromUserId).toInteger()),
+                             static_cast<int>(entry.data.value(MessageCodec::FieldToUserId).toInteger()),
+                             entry.data.value(MessageCodec::FieldIsGroup).toBool(), convSeq);
+    }
+}
+
+void ServerState::loadConversationSeq(quint64 conversationKey, qint64 convSeq)
+{
+    Shard& shard = shardFor(conversationShardId(conversationKey));
+    QMutexLocker locker(&shard.mutex);
+    qint64& current = shard.conversationSeqs[conversationKey];
+    current = qMax(current, convSeq);
+}
+
+void ServerState::loadGroupMember(int groupId, int userId)
+{
+    Shard& shard = shardFor(groupId);
+    QMutexLocker locker(&shard.mutex);
+    shard.groups[groupId].insert(userId);
+}
@@ -0,0 +1,137 @@
+#ifndef SERVERSTATE_H
+#define SERVERSTATE_H
+
+#include <QString>
+#include <QVector>
+#include <QHash>
+#include <QSet>
+#include <QQueue>
+#include <QMutex>
+#include <QCborMap>
+#include <atomic>
+
+class ServerWorker;
+class ServerStore;
+
+// 服务器的共享状态：用户、联系人、群成员和每个用户的消息信箱，全部保存在内存中，
+// 可选地通过 ServerStore 异步写入SQLite。按用户ID分片加锁，不同用户的操作互不阻塞；
+// 所有方法都可以在任意I/O线程中调用
+class ServerState
+{
+public:
+    // 信箱中的一条消息：type 为 MSG_TEXT/MSG_GROUP_MESSAGE，data 已带有 seq 和 conv_seq 字段
+    struct MailboxEntry {
+        qint64 seq = 0;
+        int type = 0;
+        QCborMap data;
+    };
+
+    struct ContactEntry {
+        int contactId = 0;
+        QString contactName;
+        QString groupName;
+        bool isGroup = false;
+        qint64 version = 0;   // 最后一次修改时的花名册版本
+        bool removed = false; // 墓碑，供增量同步返回删除
+    };
+
+    // 花名册同步结果，含义与客户端的 RosterDelta 相同
+    struct RosterSnapshot {
+        qint64 version = 0;
+        bool full = true;
+        QVector<ContactEntry> contacts;
+        QVector<int> removed;
+    };
+
+    static const int ShardCount = 64;
+
+    // historyLimit：每个用户信箱保留的消息数，超出的最早消息不再参与重连追赶
+    explicit ServerState(int historyLimit = 1000);
+    ~ServerState();
+
+    // 持久化（可选），需在I/O线程启动前设置；加载数据时不回写
+    void setStore(ServerStore* store) { m_store = store; }
+    int historyLimit() const { return m_historyLimit; }
+
+    // 用户：注册成功返回新用户ID，用户名已存在时返回0
+    int registerUser(const QString& username, const QString& password, const QString& nickname);
+    // 登录时记录用户（客户端以本地用户ID登录，服务器不要求事先注册）
+    void touchUser(int userId, const QString& username);
+    int userCount() const;
+
+    // 在线目录：同一用户的新连接替换旧连接；下线时只移除仍属于该连接的记录
+    void setOnline(int userId, ServerWorker* worker, quint64 connectionId);
+    void setOffline(int userId, quint64 connectionId);
+    ServerWorker* workerFor(int userId) const;
+
+    // 发送方的 (client_msg_id) 去重：重传的消息已经投递过时返回true，convSeq 返回当时分配的会话序号
+    bool isDuplicate(int fromUserId, qint64 clientMsgId, qint64* convSeq = nullptr);
+    void setClientMsgConvSeq(int fromUserId, qint64 clientMsgId, qint64 convSeq);
+
+    // 会话序号：每个会话（两个用户之间的单聊、一个群）独立递增，客户端按它排列消息
+    qint64 nextConversationSeq(int fromUserId, int toUserId, bool isGroup);
+    // 会话最新的序号（没有消息时为0）
+    qint64 conversationSeq(int fromUserId, int toUserId, bool isGroup) const;
+
+    // 信箱：为接收方分配下一个序号并保存消息，data 中写入 seq 字段，返回序号
+    qint64 appendToMailbox(int userId, int type, QCborMap& data);
+    qint64 lastSeq(int userId) const;
+    // 序号大于 afterSeq 的消息（按序号升序）
+    QVector<MailboxEntry> mailboxAfter(int userId, qint64 afterSeq) const;
+    // 信箱中来自 peerId（单聊）或群 peerId 的、会话序号大于 afterConvSeq 的消息，供客户端补齐序号空洞
+    QVector<MailboxEntry> conversationAfter(int userId, int peerId, bool isGroup, qint64 afterConvSeq) const;
+
+    // 联系人：插入或更新，返回新的花名册版本
+    qint64 addContact(int userId, int contactId, const QString& contactName,
+                      const QString& groupName, bool isGroup);
+    bool removeContact(int userId, int contactId);
+    // sinceVersion 为0或已不可用时返回完整列表
+    RosterSnapshot roster(int userId, qint64 sinceVersion) const;
+
+    // 群：发送者加入群后返回全部成员
+    QVector<int> joinGroup(int groupId, int userId);
+
+    // 由 ServerStore 在启动时调用，直接写入内存，不触发持久化
+    void loadUser(int userId, const QString& username, const QString& password, const QString& nickname);
+    void loadContact(int userId, const ContactEntry& contact);
+    void loadMailboxEntry(int userId, const MailboxEntry& entry);
+    void loadGroupMember(int groupId, int userId);
+    void loadConversationSeq(quint64 conversationKey, qint64 convSeq);
+
+private:
+    struct UserRecord {
+        QString username;
+        QString password;
+        QString nickname;
+        ServerWorker* worker = nullptr;
+        quint64 connectionId = 0;
+        qint64 lastSeq = 0;
+        QQueue<MailboxEntry> mailbox;
+        qint64 rosterVersion = 0;
+        QHash<int, ContactEntry> contacts;
+        QHash<qint64, qint64> recentClientMsgIds; // 客户端消息ID -> 会话序号
+        QQueue<qint64> recentClientMsgOrder;
+    };
+
+    struct Shard {
+        mutable QMutex mutex;
+        QHash<int, UserRecord> users;
+        QHash<int, QSet<int>> groups; // 群ID -> 成员（按群ID分片）
+        QHash<quint64, qint64> conversationSeqs; // 会话 -> 最新会话序号（按群ID或较小的用户ID分片）
+    };
+
+    Shard& shardFor(int id) { return m_shards[static_cast<quint32>(id) % ShardCount]; }
+    const Shard& shardFor(int id) const { return m_shards[static_cast<quint32>(id) % ShardCount]; }
+    void raiseConversationSeq(int fromUserId, int toUserId, bool isGroup, qint64 convSeq);
+
+    int m_historyLimit;
+    ServerStore* m_store;
+    Shard m_shards[ShardCount];
+
+    // 用户名 -> 用户ID，注册时全局唯一
+    mutable QMutex m_usernameMutex;
+    QHash<QString, int> m_usernames;
+    std::atomic<int> m_nextUserId;
+};
+
+#endif // SERVERSTATE_H
@@ -0,0 +1,341 @@
+#include "serverstore.h"
+#include <QSqlQuery>
+#include <QSqlError>
+#include <QCborValue>
+#include <QTimer>
+#include <QMutexLocker>
+#include <QDebug>
+
+ServerStore::ServerStore(const QString& path, QObject* parent)
+    : QObject(parent)
+    , m_path(path)
+    , m_thread(nullptr)
+    , m_flushScheduled(false)
+    , m_writerConnection(QString("chatserver-writer-%1").arg(reinterpret_cast<quintptr>(this)))
+{
+}
+
+ServerStore::~ServerStore()
+{
+    stop();
+}
+
+bool ServerStore::openDatabase(QSqlDatabase& db, const QString& connectionName)
+{
+    db = QSqlDatabase::addDatabase("QSQLITE", connectionName);
+    db.setDatabaseName(m_path);
+    if (!db.open()) {
+        qDebug() << "无法打开服务器数据库:" << db.lastError().text();
+        return false;
+    }
+    
+    // 写线程整批提交，WAL下提交只追加日志，读写互不阻塞
+    QSqlQuery query(db);
+    query.exec("PRAGMA journal_mode=WAL");
+    query.exec("PRAGMA synchronous=NORMAL");
+    return true;
+}
+
+bool ServerStore::createTables(QSqlDatabase& db)
+{
+    QSqlQuery query(db);
+    const char* const statements[] = {
+        "CREATE TABLE IF NOT EXISTS users ("
+        "user_id INTEGER PRIMARY KEY, username TEXT, password TEXT, nickname TEXT)",
+        "CREATE TABLE IF NOT EXISTS contacts ("
+        "user_id INTEGER NOT NULL, contact_id INTEGER NOT NULL, contact_name TEXT, group_name TEXT, "
+        "is_group INTEGER DEFAULT 0, version INTEGER NOT NULL, removed INTEGER DEFAULT 0, "
+        "PRIMARY KEY (user_id, contact_id))",
+        "CREATE TABLE IF NOT EXISTS mailbox ("
+        "user_id INTEGER NOT NULL, seq INTEGER NOT NULL, type INTEGER NOT NULL, payload BLOB, "
+        "PRIMARY KEY (user_id, seq))",
+        "CREATE TABLE IF NOT EXISTS group_members ("
+        "group_id INTEGER NOT NULL, user_id INTEGER NOT NULL, PRIMARY KEY (group_id, user_id))",
+        "CREATE TABLE IF NOT EXISTS conversations ("
+        "conversation_key INTEGER PRIMARY KEY, conv_seq INTEGER NOT NULL)"
+    };
+    
+    for (const char* statement : statements) {
+        if (!query.exec(statement)) {
+            qDebug() << "创建服务器数据表失败:" << query.lastError().text();
+            return false;
+        }
+    }
+    return true;
+}
+
+bool ServerStore::load(ServerState& state)
+{
+    const QString connectionName = m_writerConnection + "-load";
+    bool success = false;
+    {
+        QSqlDatabase db;
+        if (openDatabase(db, connectionName) && createTables(db)) {
+            QSqlQuery query(db);
+            query.setForwardOnly(true);
+            
+            int users = 0;
+            query.exec("SELECT user_id, username, password, nickname FROM users");
+            while (query.next()) {
+                state.loadUser(query.value(0).toInt(), query.value(1).toString(),
+                               query.value(2).toString(), query.value(3).toString());
+                ++users;
+            }
+            
+            query.exec("SELECT user_id, contact_id, contact_name, group_name, is_group, version, removed FROM contacts");
+            while (query.next()) {
+                ServerState::ContactEntry contact;
+                contact.contactId = query.value(1).toInt();
+                contact.contactName = query.value(2).toString();
+                contact.groupName = query.value(3).toString();
+                contact.isGroup = query.value(4).toBool();
+                contact.version = query.value(5).toLongLong();
+                contact.removed = query.value(6).toBool();
+                state.loadContact(query.value(0).toInt(), contact);
+            }
+            
+            int messages = 0;
+            query.exec("SELECT user_id, seq, type, payload FROM mailbox ORDER BY user_id, seq");
+            while (query.next()) {
+                ServerState::MailboxEntry entry;
+                entry.seq = query.value(1).toLongLong();
+                entry.type = query.value(2).toInt();
+                entry.data = QCborValue::fromCbor(query.value(3).toByteArray()).toMap();
+                state.loadMailboxEntry(query.value(0).toInt(), entry);
+                ++messages;
+            }
+            
+            query.exec("SELECT group_id, user_id FROM group_members");
+            while (query.next()) {
+                state.loadGroupMember(query.value(0).toInt(), query.value(1).toInt());
+            }
+            
+            // 会话键的最高位表示群，按64位有符号整数保存
+            query.exec("SELECT conversation_key, conv_seq FROM conversations");
+            while (query.next()) {
+                state.loadConversationSeq(static_cast<quint64>(query.value(0).toLongLong()),
+                                          query.value(1).toLongLong());
+            }
+            
+            qDebug() << "已加载" << users << "个用户," << messages << "条信箱消息";
+            success = true;
+        }
+        db.close();
+    }
+    QSqlDatabase::removeDatabase(connectionName);
+    return success;
+}
+
+void ServerStore::start()
+{
+    if (m_thread) {
+        return;
+    }
+    
+    m_thread = new QThread;
+    m_thread->setObjectName("chatserver-store");
+    moveToThread(m_thread);
+    m_thread->start();
+}
+
+void ServerStore::stop()
+{
+    if (!m_thread) {
+        return;
+    }
+    
+    // 在写线程中写完剩余的修改并关闭连接，然后把对象交还给调用线程
+    QThread* owner = QThread::currentThread();
+    QMetaObject::invokeMethod(this, [this, owner]() {
+        flush();
+        {
+            QSqlDatabase db = QSqlDatabase::database(m_writerConnection, false);
+            db.close();
+        }
+        QSqlDatabase::removeDatabase(m_writerConnection);
+        moveToThread(owner);
+    }, Qt::BlockingQueuedConnection);
+    
+    m_thread->quit();
+    m_thread->wait();
+    delete m_thread;
+    m_thread = nullptr;
+}
+
+void ServerStore::saveUser(int userId, const QString& username, const QString& password, const QString& nickname)
+{
+    Operation operation;
+    operation.kind = SaveUser;
+    operation.userId = userId;
+    operation.text1 = username;
+    operation.text2 = password;
+    operation.text3 = nickname;
+    enqueue(operation);
+}
+
+void ServerStore::saveContact(int userId, const ServerState::ContactEntry& contact)
+{
+    Operation operation;
+    operation.kind = SaveContact;
+    operation.userId = userId;
+    operation.otherId = contact.contactId;
+    operation.value = contact.version;
+    operation.text1 = contact.contactName;
+    operation.text2 = contact.groupName;
+    operation.isGroup = contact.isGroup;
+    operation.removed = contact.removed;
+    enqueue(operation);
+}
+
+void ServerStore::saveMailboxEntry(int userId, const ServerState::MailboxEntry& entry)
+{
+    Operation operation;
+    operation.kind = SaveMailboxEntry;
+    operation.userId = userId;
+    operation.otherId = entry.type;
+    operation.value = entry.seq;
+    operation.payload = QCborValue(entry.data).toCbor();
+    enqueue(operation);
+}
+
+void ServerStore::trimMailbox(int userId, qint64 upToSeq)
+{
+    Operation operation;
+    operation.kind = TrimMailbox;
+    operation.userId = userId;
+    operation.value = upToSeq;
+    enqueue(operation);
+}
+
+void ServerStore::saveGroupMember(int groupId, int userId)
+{
+    Operation operation;
+    operation.kind = SaveGroupMember;
+    operation.userId = userId;
+    operation.otherId = groupId;
+    enqueue(operation);
+}
+
+void ServerStore::saveConversationSeq(quint64 conversationKey, qint64 convSeq)
+{
+    Operation operation;
+    operation.kind = SaveConversationSeq;
+    operation.conversationKey = conversationKey;
+    operation.value = convSeq;
+    enqueue(operation);
+}
+
+void ServerStore::enqueue(const Operation& operation)
+{
+    QMutexLocker locker(&m_mutex);
+    m_pending.append(operation);
+    if (m_flushScheduled || !m_thread) {
+        return;
+    }
+    
+    // 只为一批修改安排一次写入，定时器在写线程中启动
+    m_flushScheduled = true;
+    QMetaObject::invokeMethod(this, [this]() {
+        QTimer::singleShot(FlushDelayMs, this, &ServerStore::flush);
+    }, Qt::QueuedConnection);
+}
+
+void ServerStore::flush()
+{
+    QVector<Operation> operations;
+    {
+        QMutexLocker locker(&m_mutex);
+        operations.swap(m_pending);
+        m_flushScheduled = false;
+    }
+    if (operations.isEmpty()) {
+        return;
+    }
+    
+    QSqlDatabase db = QSqlDatabase::database(m_writerConnection, false);
+    if (!db.isValid() && !openDatabase(db, m_writerConnection)) {
+        qDebug() << "丢弃" << operations.size() << "个待写入的修改";
+        return;
+    }
+    if (!db.isOpen() && !db.open()) {
+        qDebug() << "无法打开服务器数据库:" << db.lastError().text();
+        return;
+    }
+    
+    db.transaction();
+    
+    QSqlQuery saveUser(db);
+    saveUser.prepare("INSERT INTO users (user_id, username, password, nickname) VALUES (?, ?, ?, ?) "
+                     "ON CONFLICT(user_id) DO UPDATE SET username = excluded.username, "
+                     "password = CASE WHEN excluded.password = '' THEN users.password ELSE excluded.password END, "
+                     "nickname = CASE WHEN excluded.nickname = '' THEN users.nickname ELSE excluded.nickname END");
+    QSqlQuery saveContact(db);
+    saveContact.prepare("INSERT OR REPLACE INTO contacts "
+                        "(user_id, contact_id, contact_name, group_name, is_group, version, removed) "
+                        "VALUES (?, ?, ?, ?, ?, ?, ?)");
+    QSqlQuery saveMailbox(db);
+    saveMailbox.prepare("INSERT OR REPLACE INTO mailbox (user_id, seq, type, payload) VALUES (?, ?, ?, ?)");
+    QSqlQuery trimMailbox(db);
+    trimMailbox.prepare("DELETE FROM mailbox WHERE user_id = ? AND seq <= ?");
+    QSqlQuery saveMember(db);
+    saveMember.prepare("INSERT OR IGNORE INTO group_members (group_id, user_id) VALUES (?, ?)");
+    // 不同I/O线程分配的序号可能乱序排队，只保留较大的值
+    QSqlQuery saveConversation(db);
+    saveConversation.prepare("INSERT INTO conversations (conversation_key, conv_seq) VALUES (?, ?) "
+                             "ON CONFLICT(conversation_key) DO UPDATE SET "
+                             "conv_seq = MAX(conv_seq, excluded.conv_seq)");
+    
+    for (const Operation& operation : qAsConst(operations)) {
+        QSqlQuery* query = nullptr;
+        switch (operation.kind) {
+        case SaveUser:
+            query = &saveUser;
+            query->addBindValue(operation.userId);
+            query->addBindValue(operation.text1);
+            query->addBindValue(operation.text2);
+            query->addBindValue(operation.text3);
+            break;
+        case SaveContact:
+            query = &saveContact;
+            query->addBindValue(operation.userId);
+            query->addBindValue(operation.otherId);
+            query->addBindValue(operation.text1);
+            query->addBindValue(operation.text2);
+            query->addBindValue(operation.isGroup ? 1 : 0);
+            query->addBindValue(operation.value);
+            query->addBindValue(operation.removed ? 1 : 0);
+            break;
+        case SaveMailboxEntry:
+            query = &saveMailbox;
+            query->addBindValue(operation.userId);
+            query->addBindValue(operation.value);
+            query->addBindValue(operation.otherId);
+            query->addBindValue(operation.payload);
+            break;
+        case TrimMailbox:
+            query = &trimMailbox;
+            query->addBindValue(operation.userId);
+            query->addBindValue(operation.value);
+            break;
+        case SaveGroupMember:
+            query = &saveMember;
+            query->addBindValue(operation.otherId);
+            query->addBindValue(operation.userId);
+            break;
+        case SaveConversationSeq:
+            query = &saveConversation;
+            query->addBindValue(static_cast<qint64>(operation.conversationKey));
+            query->addBindValue(operation.value);
+            break;
+        }
+        
+        if (!query->exec()) {
+            qDebug() << "写入服务器数据库失败:" << query->lastError().text();
+        }
+    }
+    
+    if (!db.commit()) {
+        qDebug() << "提交服务器数据库失败:" << db.lastError().text();
+        db.rollback();
+    }
+}
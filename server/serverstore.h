@@ -0,0 +1,78 @@
+#ifndef SERVERSTORE_H
+#define SERVERSTORE_H
+
+#include <QObject>
+#include <QThread>
+#include <QMutex>
+#include <QVector>
+#include <QSqlDatabase>
+#include "serverstate.h"
+
+// 服务器状态的SQLite持久化（可选）。启动时一次性加载到 ServerState；
+// 运行中的修改由I/O线程排队，在独立的写线程中合并为一个事务批量写入，I/O线程不等待磁盘
+class ServerStore : public QObject
+{
+    Q_OBJECT
+
+public:
+    // 写线程收到第一个修改后再等待该时间，让同一批修改合并到一个事务中
+    static const int FlushDelayMs = 20;
+
+    explicit ServerStore(const QString& path, QObject* parent = nullptr);
+    ~ServerStore();
+
+    // 在主线程中建表并加载全部数据，需在 start 之前调用
+    bool load(ServerState& state);
+    // 启动写线程；stop 写完排队中的修改后结束写线程
+    void start();
+    void stop();
+
+    // 以下方法可在任意线程调用
+    void saveUser(int userId, const QString& username, const QString& password, const QString& nickname);
+    void saveContact(int userId, const ServerState::ContactEntry& contact);
+    void saveMailboxEntry(int userId, const ServerState::MailboxEntry& entry);
+    void trimMailbox(int userId, qint64 upToSeq);
+    void saveGroupMember(int groupId, int userId);
+    // 会话序号计数器单独保存：信箱会被裁剪，只从信箱恢复时计数器可能倒退而重复使用序号
+    void saveConversationSeq(quint64 conversationKey, qint64 convSeq);
+
+private slots:
+    void flush();
+
+private:
+    enum OperationKind {
+        SaveUser,
+        SaveContact,
+        SaveMailboxEntry,
+        TrimMailbox,
+        SaveGroupMember,
+        SaveConversationSeq
+    };
+
+    struct Operation {
+        OperationKind kind = SaveUser;
+        int userId = 0;
+        int otherId = 0;   // 联系人ID或群ID
+        qint64 value = 0;  // 序号或花名册版本
+        QString text1;
+        QString text2;
+        QString text3;
+        bool isGroup = false;
+        bool removed = false;
+        QByteArray payload;
+        quint64 conversationKey = 0;
+    };
+
+    void enqueue(const Operation& operation);
+    bool openDatabase(QSqlDatabase& db, const QString& connectionName);
+    bool createTables(QSqlDatabase& db);
+
+    QString m_path;
+    QThread* m_thread;
+    QMutex m_mutex;
+    QVector<Operation> m_pending;
+    bool m_flushScheduled;
+    QString m_writerConnection;
+};
+
+#endif // SERVERSTORE_H
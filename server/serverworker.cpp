@@ -0,0 +1,121 @@
+#include "serverworker.h"
+#include "clientconnection.h"
+#include "serverstate.h"
+#include <QMutexLocker>
+#include <QDebug>
+
+ServerWorker::ServerWorker(int index, ServerState* state, QObject* parent)
+    : QObject(parent)
+    , m_index(index)
+    , m_state(state)
+    , m_nextConnectionId(0)
+    , m_compressor(1) // 服务器以吞吐为先，使用最快的压缩级别
+    , m_drainScheduled(false)
+    , m_connections(0)
+    , m_framesIn(0)
+    , m_framesOut(0)
+    , m_bytesIn(0)
+    , m_bytesOut(0)
+{
+}
+
+ServerWorker::~ServerWorker()
+{
+}
+
+ServerWorker::Stats ServerWorker::stats() const
+{
+    Stats stats;
+    stats.connections = m_connections;
+    stats.framesIn = m_framesIn;
+    stats.framesOut = m_framesOut;
+    stats.bytesIn = m_bytesIn;
+    stats.bytesOut = m_bytesOut;
+    return stats;
+}
+
+void ServerWorker::addConnection(qintptr socketDescriptor)
+{
+    QMetaObject::invokeMethod(this, [this, socketDescriptor]() {
+        ClientConnection* connection = new ClientConnection(socketDescriptor, this);
+        if (!connection->isValid()) {
+            delete connection;
+            return;
+        }
+        connect(connection, &ClientConnection::closed, this, &ServerWorker::onConnectionClosed);
+        ++m_connections;
+    }, Qt::QueuedConnection);
+}
+
+void ServerWorker::post(int userId, int type, const QCborMap& data)
+{
+    QMutexLocker locker(&m_inboxMutex);
+    Delivery delivery;
+    delivery.userId = userId;
+    delivery.type = type;
+    delivery.data = data;
+    m_inbox.append(delivery);
+    
+    // 一轮事件循环内投递给本线程的消息只唤醒一次
+    if (!m_drainScheduled) {
+        m_drainScheduled = true;
+        QMetaObject::invokeMethod(this, "drainInbox", Qt::QueuedConnection);
+    }
+}
+
+void ServerWorker::drainInbox()
+{
+    QVector<Delivery> deliveries;
+    {
+        QMutexLocker locker(&m_inboxMutex);
+        deliveries.swap(m_inbox);
+        m_drainScheduled = false;
+    }
+    
+    for (const Delivery& delivery : qAsConst(deliveries)) {
+        ClientConnection* connection = m_users.value(delivery.userId);
+        if (connection) {
+            connection->deliver(delivery.type, delivery.data);
+        }
+        // 投递途中下线的用户：消息已在信箱中，重连后由追赶补发
+    }
+}
+
+void ServerWorker::registerUser(int userId, ClientConnection* connection)
+{
+    m_users.insert(userId, connection);
+    m_state->setOnline(userId, this, connection->id());
+}
+
+void ServerWorker::unregisterUser(int userId, ClientConnection* connection)
+{
+    QHash<int, ClientConnection*>::iterator it = m_users.find(userId);
+    if (it != m_users.end() && it.value() == connection) {
+        m_users.erase(it);
+    }
+    m_state->setOffline(userId, connection->id());
+}
+
+quint64 ServerWorker::nextConnectionId()
+{
+    // 高16位为线程编号，连接ID在所有线程中唯一
+    return (static_cast<quint64>(m_index + 1) << 48) | ++m_nextConnectionId;
+}
+
+void ServerWorker::countIn(int frames, qint64 bytes)
+{
+    m_framesIn += frames;
+    m_bytesIn += bytes;
+}
+
+void ServerWorker::countOut(int frames, qint64 bytes)
+{
+    m_framesOut += frames;
+    m_bytesOut += bytes;
+}
+
+void ServerWorker::onConnectionClosed(ClientConnection* connection)
+{
+    --m_connections;
+    connection->deleteLater();
+}
@@ -0,0 +1,85 @@
+#ifndef SERVERWORKER_H
+#define SERVERWORKER_H
+
+#include <QObject>
+#include <QHash>
+#include <QVector>
+#include <QMutex>
+#include <QCborMap>
+#include <atomic>
+#include "framecompressor.h"
+
+class ServerState;
+class ClientConnection;
+
+// 一个I/O线程：持有分配到本线程的全部连接，拥有自己的事件循环。
+// 其他线程投递给本线程用户的消息先进入收件队列，每轮事件循环合并处理一次
+class ServerWorker : public QObject
+{
+    Q_OBJECT
+
+public:
+    // 统计（可在任意线程读取）
+    struct Stats {
+        int connections = 0;
+        quint64 framesIn = 0;
+        quint64 framesOut = 0;
+        quint64 bytesIn = 0;
+        quint64 bytesOut = 0;
+    };
+
+    ServerWorker(int index, ServerState* state, QObject* parent = nullptr);
+    ~ServerWorker();
+
+    int index() const { return m_index; }
+    ServerState* state() const { return m_state; }
+    Stats stats() const;
+
+    // 可在任意线程调用：把新接受的socket交给本线程
+    void addConnection(qintptr socketDescriptor);
+    // 可在任意线程调用：把消息投递给本线程上在线的用户，用户已下线时留在信箱中等待重连追赶
+    void post(int userId, int type, const QCborMap& data);
+
+    // 以下只在本线程中使用
+    void registerUser(int userId, ClientConnection* connection);
+    void unregisterUser(int userId, ClientConnection* connection);
+    quint64 nextConnectionId();
+    // 同一线程的连接共用压缩上下文和缓冲区，避免每个连接各占几百KB的zlib状态
+    FrameCompressor& compressor() { return m_compressor; }
+    QByteArray& compressBuffer() { return m_compressBuffer; }
+    QByteArray& decompressBuffer() { return m_decompressBuffer; }
+
+    void countIn(int frames, qint64 bytes);
+    void countOut(int frames, qint64 bytes);
+
+private slots:
+    void drainInbox();
+    void onConnectionClosed(ClientConnection* connection);
+
+private:
+    struct Delivery {
+        int userId = 0;
+        int type = 0;
+        QCborMap data;
+    };
+
+    int m_index;
+    ServerState* m_state;
+    QHash<int, ClientConnection*> m_users; // 本线程上已登录的用户
+    quint64 m_nextConnectionId;
+    FrameCompressor m_compressor;
+    QByteArray m_compressBuffer;
+    QByteArray m_decompressBuffer;
+
+    QMutex m_inboxMutex;
+    QVector<Delivery> m_inbox;
+    bool m_drainScheduled;
+
+    std::atomic<int> m_connections;
+    std::atomic<quint64> m_framesIn;
+    std::atomic<quint64> m_framesOut;
+    std::atomic<quint64> m_bytesIn;
+    std::atomic<quint64> m_bytesOut;
+};
+
+#endif // SERVERWORKER_H
@@ -0,0 +1,94 @@
+#include "statementcache.h"
+
+StatementCache::Statement::Statement(QSqlQuery* query, bool* inUse)
+    : m_query(query)
+    , m_inUse(inUse)
+{
+}
+
+StatementCache::Statement::Statement(Statement&& other) noexcept
+    : m_query(other.m_query)
+    , m_inUse(other.m_inUse)
+{
+    other.m_query = nullptr;
+    other.m_inUse = nullptr;
+}
+
+StatementCache::Statement::~Statement()
+{
+    if (!m_query) {
+        return;
+    }
+    if (m_inUse) {
+        // 复位而不释放：SQLite语句保留执行计划，下次只需重新绑定参数
+        m_query->finish();
+        *m_inUse = false;
+    } else {
+        delete m_query;
+    }
+}
+
+StatementCache::StatementCache(int capacity)
+    : m_capacity(capacity)
+    , m_hits(0)
+    , m_misses(0)
+    , m_size(0)
+{
+}
+
+StatementCache::~StatementCache()
+{
+    clear();
+}
+
+void StatementCache::setDatabase(const QSqlDatabase& db)
+{
+    clear();
+    m_db = db;
+}
+
+StatementCache::Statement StatementCache::prepare(const QString& sql)
+{
+    QHash<QString, Entry*>::const_iterator it = m_entries.constFind(sql);
+    if (it != m_entries.constEnd() && !it.value()->inUse) {
+        ++m_hits;
+        Entry* entry = it.value();
+        entry->inUse = true;
+        return Statement(entry->query, &entry->inUse);
+    }
+    
+    ++m_misses;
+    QSqlQuery* query = new QSqlQuery(m_db);
+    bool prepared = query->prepare(sql);
+    
+    // 嵌套使用同一条SQL、缓存已满（SQL文本不固定时）或准备失败：临时语句
+    if (!prepared || it != m_entries.constEnd() || m_entries.size() >= m_capacity) {
+        return Statement(query, nullptr);
+    }
+    
+    Entry* entry = new Entry;
+    entry->query = query;
+    entry->inUse = true;
+    m_entries.insert(sql, entry);
+    m_size = m_entries.size();
+    return Statement(query, &entry->inUse);
+}
+
+void StatementCache::clear()
+{
+    for (Entry* entry : qAsConst(m_entries)) {
+        delete entry->query;
+        delete entry;
+    }
+    m_entries.clear();
+    m_size = 0;
+}
+
+StatementCache::Stats StatementCache::stats() const
+{
+    Stats stats;
+    stats.hits = m_hits;
+    stats.misses = m_misses;
+    stats.size = m_size;
+    return stats;
+}
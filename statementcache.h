@@ -0,0 +1,70 @@
+#ifndef STATEMENTCACHE_H
+#define STATEMENTCACHE_H
+
+#include <QString>
+#include <QHash>
+#include <QSqlDatabase>
+#include <QSqlQuery>
+#include <atomic>
+
+// 一个数据库连接的预编译语句缓存，按SQL文本查找：同一条SQL只解析和生成执行计划一次，
+// 之后每次取出时复位并重新绑定参数。只在连接所在的线程中使用，连接关闭前调用 clear
+class StatementCache
+{
+public:
+    struct Stats {
+        quint64 hits = 0;
+        quint64 misses = 0;
+        int size = 0;
+    };
+
+    // 取出的语句，用法与 QSqlQuery 相同（通过 ->）。析构时复位，结束未读完的结果并释放读快照，
+    // 语句留在缓存中。同一条SQL正在使用时（嵌套调用）再次取出得到一条用完即释放的临时语句
+    class Statement
+    {
+    public:
+        Statement(Statement&& other) noexcept;
+        ~Statement();
+        Statement(const Statement&) = delete;
+        Statement& operator=(const Statement&) = delete;
+
+        QSqlQuery* operator->() const { return m_query; }
+        QSqlQuery& operator*() const { return *m_query; }
+
+    private:
+        friend class StatementCache;
+        Statement(QSqlQuery* query, bool* inUse);
+
+        QSqlQuery* m_query;
+        bool* m_inUse; // 缓存中语句的使用标记；临时语句为nullptr，析构时删除
+    };
+
+    static const int DefaultCapacity = 64;
+
+    explicit StatementCache(int capacity = DefaultCapacity);
+    ~StatementCache();
+
+    // 绑定到连接，之前缓存的语句全部释放
+    void setDatabase(const QSqlDatabase& db);
+    // SQL有错误时返回的语句 exec 失败，lastError 中有原因；这样的语句不缓存
+    Statement prepare(const QString& sql);
+    void clear();
+
+    // 命中和未命中次数，可在任意线程读取
+    Stats stats() const;
+
+private:
+    struct Entry {
+        QSqlQuery* query = nullptr;
+        bool inUse = false;
+    };
+
+    QSqlDatabase m_db;
+    int m_capacity;
+    QHash<QString, Entry*> m_entries;
+    std::atomic<quint64> m_hits;
+    std::atomic<quint64> m_misses;
+    std::atomic<int> m_size;
+};
+
+#endif // STATEMENTCACHE_H
@@ -0,0 +1,179 @@
+#include "timerwheel.h"
+#include <limits>
+
+namespace {
+const int SlotMask = TimerWheel::SlotCount - 1;
+
+int levelShift(int level)
+{
+    return TimerWheel::SlotBits * level;
+}
+}
+
+TimerWheel::TimerWheel(int tickMs, QObject* parent)
+    : QObject(parent)
+    , m_tickMs(qMax(1, tickMs))
+    , m_tick(0)
+    , m_nextId(0)
+    , m_wakeupTick(0)
+{
+    m_clock.start();
+    
+    m_wakeupTimer = new QTimer(this);
+    m_wakeupTimer->setSingleShot(true);
+    m_wakeupTimer->setTimerType(Qt::CoarseTimer);
+    connect(m_wakeupTimer, &QTimer::timeout, this, &TimerWheel::onTimeout);
+}
+
+TimerWheel::~TimerWheel()
+{
+}
+
+TimerWheel::TimerId TimerWheel::schedule(int delayMs, std::function<void()> callback)
+{
+    // 时间轮为空时没有需要补触发的定时器，直接跳到当前时刻，避免空闲很久后醒来逐tick追赶
+    if (m_timers.isEmpty()) {
+        m_tick = currentTick();
+    }
+    
+    quint64 ticks = qMax<quint64>(1, (static_cast<quint64>(qMax(0, delayMs)) + m_tickMs - 1) / m_tickMs);
+    
+    TimerId id = ++m_nextId;
+    Timer& timer = m_timers[id];
+    timer.expiry = currentTick() + ticks;
+    timer.callback = std::move(callback);
+    place(id, timer);
+    
+    if (!m_wakeupTimer->isActive() || timer.expiry < m_wakeupTick) {
+        scheduleWakeup();
+    }
+    return id;
+}
+
+bool TimerWheel::cancel(TimerId id)
+{
+    QHash<TimerId, Timer>::iterator it = m_timers.find(id);
+    if (it == m_timers.end()) {
+        return false;
+    }
+    
+    // 正在处理的槽已被取出，removeOne找不到也无妨
+    m_slots[it->level][it->slot].removeOne(id);
+    m_timers.erase(it);
+    
+    // 不为取消重新计算唤醒时间，多余的一次唤醒发现没有到期的定时器后继续休眠
+    return true;
+}
+
+void TimerWheel::place(TimerId id, Timer& timer)
+{
+    // 按距到期的tick数选层：第L层容纳 64^L <= diff < 64^(L+1) 的定时器；
+    // 超出最高层范围的定时器在该层槽位被提前下放时重新放置
+    quint64 diff = timer.expiry > m_tick ? timer.expiry - m_tick : 0;
+    int level = 0;
+    while (level < LevelCount - 1 && diff >= (Q_UINT64_C(1) << levelShift(level + 1))) {
+        ++level;
+    }
+    
+    timer.level = level;
+    timer.slot = static_cast<int>((timer.expiry >> levelShift(level)) & SlotMask);
+    m_slots[level][timer.slot].append(id);
+}
+
+void TimerWheel::onTimeout()
+{
+    advanceTo(currentTick());
+    scheduleWakeup();
+}
+
+void TimerWheel::advanceTo(quint64 tick)
+{
+    while (m_tick < tick && !m_timers.isEmpty()) {
+        ++m_tick;
+        
+        // 上层转过一格时，把该格的定时器下放到下层（先处理最高层）
+        for (int level = LevelCount - 1; level > 0; --level) {
+            if ((m_tick & ((Q_UINT64_C(1) << levelShift(level)) - 1)) == 0) {
+                cascade(level, m_tick);
+            }
+        }
+        expireSlot(m_tick);
+    }
+    
+    if (m_timers.isEmpty()) {
+        m_tick = qMax(m_tick, tick);
+    }
+}
+
+void TimerWheel::cascade(int level, quint64 tick)
+{
+    QVector<TimerId> ids;
+    ids.swap(m_slots[level][(tick >> levelShift(level)) & SlotMask]);
+    
+    for (TimerId id : qAsConst(ids)) {
+        QHash<TimerId, Timer>::iterator it = m_timers.find(id);
+        if (it != m_timers.end()) {
+            place(id, *it);
+        }
+    }
+}
+
+void TimerWheel::expireSlot(quint64 tick)
+{
+    QVector<TimerId> ids;
+    ids.swap(m_slots[0][tick & SlotMask]);
+    
+    for (TimerId id : qAsConst(ids)) {
+        QHash<TimerId, Timer>::iterator it = m_timers.find(id);
+        if (it == m_timers.end()) {
+            continue; // 已被前面的回调取消
+        }
+        if (it->expiry > tick) {
+            place(id, *it);
+            continue;
+        }
+        
+        // 先移除再回调，回调中可以安全地添加或取消定时器
+        std::function<void()> callback = std::move(it->callback);
+        m_timers.erase(it);
+        callback();
+    }
+}
+
+quint64 TimerWheel::nextExpiry() const
+{
+    quint64 next = std::numeric_limits<quint64>::max();
+    
+    // 第0层的槽对应确切的到期tick
+    for (int i = 1; i < SlotCount; ++i) {
+        if (!m_slots[0][(m_tick + i) & SlotMask].isEmpty()) {
+            next = m_tick + i;
+            break;
+        }
+    }
+    
+    // 上层只能确定下放时刻，醒来下放后再重新计算
+    for (int level = 1; level < LevelCount; ++level) {
+        quint64 base = m_tick >> levelShift(level);
+        for (int i = 1; i <= SlotCount; ++i) {
+            if (!m_slots[level][(base + i) & SlotMask].isEmpty()) {
+                next = qMin(next, (base + i) << levelShift(level));
+                break;
+            }
+        }
+    }
+    
+    return next;
+}
+
+void TimerWheel::scheduleWakeup()
+{
+    if (m_timers.isEmpty()) {
+        m_wakeupTimer->stop();
+        return;
+    }
+    
+    m_wakeupTick = nextExpiry();
+    qint64 delay = static_cast<qint64>(m_wakeupTick) * m_tickMs - m_clock.elapsed();
+    m_wakeupTimer->start(static_cast<int>(qBound<qint64>(0, delay, std::numeric_limits<int>::max())));
+}
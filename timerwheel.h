@@ -0,0 +1,69 @@
+#ifndef TIMERWHEEL_H
+#define TIMERWHEEL_H
+
+#include <QObject>
+#include <QTimer>
+#include <QVector>
+#include <QHash>
+#include <QElapsedTimer>
+#include <functional>
+
+// 分层时间轮：4层 x 64槽，第0层每槽一个tick（默认100ms），上层每槽为下层一整圈；
+// 以默认精度可覆盖约19天的延时。添加、取消定时器均为O(1)（同槽内的少量移动除外）。
+// 时间轮不按tick空转，只用一个单次QTimer睡到下一个非空槽，醒来后一次推进到当前时刻，
+// 空闲时没有定时器就不唤醒线程。回调在时间轮所在线程中执行，不是线程安全的
+class TimerWheel : public QObject
+{
+    Q_OBJECT
+
+public:
+    typedef quint64 TimerId;
+
+    static const int SlotBits = 6;
+    static const int SlotCount = 1 << SlotBits;
+    static const int LevelCount = 4;
+
+    explicit TimerWheel(int tickMs = 100, QObject* parent = nullptr);
+    ~TimerWheel();
+
+    // delayMs 后调用 callback（向上取整到tick，至少一个tick），返回非0的定时器ID
+    TimerId schedule(int delayMs, std::function<void()> callback);
+    // 取消尚未触发的定时器，已触发或不存在时返回false
+    bool cancel(TimerId id);
+    bool isScheduled(TimerId id) const { return m_timers.contains(id); }
+    int pendingCount() const { return m_timers.size(); }
+
+    int tickInterval() const { return m_tickMs; }
+    // 时间轮自身的单调时钟（毫秒）
+    qint64 elapsed() const { return m_clock.elapsed(); }
+
+private slots:
+    void onTimeout();
+
+private:
+    struct Timer {
+        quint64 expiry = 0; // 到期的tick
+        int level = 0;
+        int slot = 0;
+        std::function<void()> callback;
+    };
+
+    void place(TimerId id, Timer& timer);
+    void advanceTo(quint64 tick);
+    void cascade(int level, quint64 tick);
+    void expireSlot(quint64 tick);
+    void scheduleWakeup();
+    quint64 nextExpiry() const;
+    quint64 currentTick() const { return static_cast<quint64>(m_clock.elapsed()) / m_tickMs; }
+
+    int m_tickMs;
+    quint64 m_tick;                // 时间轮已推进到的tick
+    TimerId m_nextId;
+    QElapsedTimer m_clock;
+    QTimer* m_wakeupTimer;
+    quint64 m_wakeupTick;          // m_wakeupTimer 对准的tick
+    QHash<TimerId, Timer> m_timers;
+    QVector<TimerId> m_slots[LevelCount][SlotCount];
+};
+
+#endif // TIMERWHEEL_H
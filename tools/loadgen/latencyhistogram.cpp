@@ -0,0 +1,97 @@
+#include "latencyhistogram.h"
+#include <QtAlgorithms>
+#include <cmath>
+#include <limits>
+
+namespace {
+const int LinearBuckets = 64;  // [0, 64) 每个值一档
+const int SubBuckets = 32;     // 之后每个2的幂区间的档数
+const int MaxShift = 40;       // 覆盖到约 2^46 微秒，足够任何延迟
+const int BucketCount = LinearBuckets + MaxShift * SubBuckets;
+}
+
+LatencyHistogram::LatencyHistogram()
+    : m_buckets(BucketCount, 0)
+    , m_count(0)
+    , m_min(std::numeric_limits<qint64>::max())
+    , m_max(0)
+    , m_sum(0)
+{
+}
+
+int LatencyHistogram::bucketIndex(qint64 value)
+{
+    if (value < LinearBuckets) {
+        return static_cast<int>(qMax<qint64>(0, value));
+    }
+    
+    // value >= 64 时最高位至少为第6位，右移后保留5位有效精度（32~63）
+    int highestBit = 63 - qCountLeadingZeroBits(static_cast<quint64>(value));
+    int shift = qMin(highestBit - 5, MaxShift);
+    int top = static_cast<int>(qMin<qint64>(value >> shift, 2 * SubBuckets - 1));
+    return LinearBuckets + (shift - 1) * SubBuckets + (top - SubBuckets);
+}
+
+qint64 LatencyHistogram::bucketUpperBound(int index)
+{
+    if (index < LinearBuckets) {
+        return index;
+    }
+    
+    int shift = (index - LinearBuckets) / SubBuckets + 1;
+    qint64 top = (index - LinearBuckets) % SubBuckets + SubBuckets;
+    return ((top + 1) << shift) - 1;
+}
+
+void LatencyHistogram::record(qint64 micros)
+{
+    ++m_buckets[bucketIndex(micros)];
+    ++m_count;
+    m_min = qMin(m_min, micros);
+    m_max = qMax(m_max, micros);
+    m_sum += micros;
+}
+
+void LatencyHistogram::merge(const LatencyHistogram& other)
+{
+    for (int i = 0; i < BucketCount; ++i) {
+        m_buckets[i] += other.m_buckets.at(i);
+    }
+    m_count += other.m_count;
+    m_min = qMin(m_min, other.m_min);
+    m_max = qMax(m_max, other.m_max);
+    m_sum += other.m_sum;
+}
+
+void LatencyHistogram::reset()
+{
+    m_buckets.fill(0);
+    m_count = 0;
+    m_min = std::numeric_limits<qint64>::max();
+    m_max = 0;
+    m_sum = 0;
+}
+
+double LatencyHistogram::mean() const
+{
+    return m_count ? m_sum / m_count : 0.0;
+}
+
+qint64 LatencyHistogram::percentile(double quantile) const
+{
+    if (m_count == 0) {
+        return 0;
+    }
+    
+    quint64 target = static_cast<quint64>(std::ceil(qBound(0.0, quantile, 1.0) * m_count));
+    target = qMax<quint64>(1, target);
+    quint64 seen = 0;
+    for (int i = 0; i < BucketCount; ++i) {
+        seen += m_buckets.at(i);
+        if (seen >= target) {
+            // 档位上界可能超过实际记录的最大值
+            return qMin(bucketUpperBound(i), m_max);
+        }
+    }
+    return m_max;
+}
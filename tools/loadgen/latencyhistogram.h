@@ -0,0 +1,37 @@
+#ifndef LATENCYHISTOGRAM_H
+#define LATENCYHISTOGRAM_H
+
+#include <QVector>
+#include <QtGlobal>
+
+// 对数-线性直方图（微秒）：小于64的值精确记录，更大的值每个2的幂区间分成32档，
+// 相对误差不超过1/32。内存固定约10KB，记录为O(1)，适合在压测中记录数百万个样本。
+// 非线程安全：每个线程各用一个，结束后合并
+class LatencyHistogram
+{
+public:
+    LatencyHistogram();
+
+    void record(qint64 micros);
+    void merge(const LatencyHistogram& other);
+    void reset();
+
+    quint64 count() const { return m_count; }
+    qint64 min() const { return m_count ? m_min : 0; }
+    qint64 max() const { return m_max; }
+    double mean() const;
+    // quantile 取 0~1，例如 0.99；返回所在档位的上界
+    qint64 percentile(double quantile) const;
+
+private:
+    static int bucketIndex(qint64 value);
+    static qint64 bucketUpperBound(int index);
+
+    QVector<quint64> m_buckets;
+    quint64 m_count;
+    qint64 m_min;
+    qint64 m_max;
+    double m_sum;
+};
+
+#endif // LATENCYHISTOGRAM_H
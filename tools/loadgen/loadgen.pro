@@ -0,0 +1,43 @@
+QT += core network
+QT -= gui
+
+CONFIG += c++17 console
+CONFIG -= app_bundle
+
+TARGET = loadgen
+TEMPLATE = app
+
+# 模拟客户端直接使用客户端的网络层（帧解码、编解码、压缩、确认窗口和追赶）
+INCLUDEPATH += ../..
+
+SOURCES += \
+    main.cpp \
+    loadgenerator.cpp \
+    loadworker.cpp \
+    simulatedclient.cpp \
+    latencyhistogram.cpp \
+    ../../networkmanager.cpp \
+    ../../framedecoder.cpp \
+    ../../messagecodec.cpp \
+    ../../messageschema.cpp \
+    ../../framecompressor.cpp \
+    ../../framecapture.cpp \
+    ../../timerwheel.cpp \
+    ../../keepalivemanager.cpp
+
+HEADERS += \
+    loadgenerator.h \
+    loadworker.h \
+    simulatedclient.h \
+    latencyhistogram.h \
+    ../../networkmanager.h \
+    ../../framedecoder.h \
+    ../../messagecodec.h \
+    ../../messageschema.h \
+    ../../framecompressor.h \
+    ../../framecapture.h \
+    ../../timerwheel.h \
+    ../../keepalivemanager.h
+
+# 帧压缩使用zlib
+LIBS += -lz
@@ -0,0 +1,348 @@
+#include "loadgenerator.h"
+#include <QFile>
+#include <QJsonObject>
+#include <QJsonDocument>
+#include <QTextStream>
+#include <QDebug>
+
+#ifdef Q_OS_UNIX
+#include <unistd.h>
+#endif
+
+namespace {
+const int ProgressIntervalMs = 1000;
+const int DrainPollMs = 200;
+// 全部客户端登录的最长等待时间，在爬坡所需时间之外额外给出的余量
+const int ConnectGraceMs = 30000;
+
+double toMillis(qint64 micros)
+{
+    return micros / 1000.0;
+}
+
+QJsonObject histogramToJson(const LatencyHistogram& histogram)
+{
+    QJsonObject object;
+    object["count"] = static_cast<double>(histogram.count());
+    object["p50_ms"] = toMillis(histogram.percentile(0.50));
+    object["p99_ms"] = toMillis(histogram.percentile(0.99));
+    object["p999_ms"] = toMillis(histogram.percentile(0.999));
+    object["max_ms"] = toMillis(histogram.max());
+    object["mean_ms"] = histogram.mean() / 1000.0;
+    return object;
+}
+
+QString histogramToText(const LatencyHistogram& histogram)
+{
+    if (histogram.count() == 0) {
+        return QStringLiteral("无样本");
+    }
+    return QString("p50 %1  p99 %2  p999 %3  最大 %4  平均 %5 (毫秒, %6个样本)")
+        .arg(toMillis(histogram.percentile(0.50)), 0, 'f', 2)
+        .arg(toMillis(histogram.percentile(0.99)), 0, 'f', 2)
+        .arg(toMillis(histogram.percentile(0.999)), 0, 'f', 2)
+        .arg(toMillis(histogram.max()), 0, 'f', 2)
+        .arg(histogram.mean() / 1000.0, 0, 'f', 2)
+        .arg(histogram.count());
+}
+}
+
+LoadGenerator::LoadGenerator(const Settings& settings, QObject* parent)
+    : QObject(parent)
+    , m_settings(settings)
+    , m_phase(PhaseConnecting)
+    , m_progressTimer(new QTimer(this))
+    , m_drainTimer(new QTimer(this))
+    , m_reconnectTriggered(false)
+    , m_lastSent(0)
+    , m_lastReceived(0)
+    , m_sentAtStop(0)
+    , m_receivedAtStop(0)
+    , m_measuredSeconds(0)
+    , m_baselineMemory(-1)
+    , m_onlineMemory(-1)
+{
+    m_settings.clients = qMax(1, m_settings.clients);
+    m_settings.threads = qBound(1, m_settings.threads, m_settings.clients);
+    m_settings.client.totalClients = m_settings.clients;
+    
+    // 客户端尽量平均分到各线程，爬坡速率也按线程平分
+    LoadWorker::Options options = m_settings.client;
+    options.rampPerSecond = qMax(1, m_settings.client.rampPerSecond / m_settings.threads);
+    int firstClient = 0;
+    for (int i = 0; i < m_settings.threads; ++i) {
+        int count = m_settings.clients / m_settings.threads + (i < m_settings.clients % m_settings.threads ? 1 : 0);
+        QThread* thread = new QThread;
+        thread->setObjectName(QString("loadgen-%1").arg(i));
+        LoadWorker* worker = new LoadWorker(options, firstClient, count);
+        worker->moveToThread(thread);
+        connect(thread, &QThread::finished, worker, &QObject::deleteLater);
+        m_threads.append(thread);
+        m_workers.append(worker);
+        firstClient += count;
+    }
+    
+    connect(m_progressTimer, &QTimer::timeout, this, &LoadGenerator::onProgress);
+    connect(m_drainTimer, &QTimer::timeout, this, &LoadGenerator::onDrainPoll);
+}
+
+LoadGenerator::~LoadGenerator()
+{
+    for (QThread* thread : qAsConst(m_threads)) {
+        thread->quit();
+        thread->wait();
+    }
+    qDeleteAll(m_threads);
+}
+
+template <typename Func>
+void LoadGenerator::forEachWorker(Func func)
+{
+    for (LoadWorker* worker : qAsConst(m_workers)) {
+        QMetaObject::invokeMethod(worker, [worker, &func]() { func(worker); }, Qt::BlockingQueuedConnection);
+    }
+}
+
+void LoadGenerator::start()
+{
+    for (QThread* thread : qAsConst(m_threads)) {
+        thread->start();
+    }
+    
+    // 基线内存：线程已启动、客户端尚未创建
+    m_baselineMemory = residentBytes();
+    qDebug().noquote() << QString("连接 %1:%2, %3个客户端, %4个线程")
+                              .arg(m_settings.client.host).arg(m_settings.client.port)
+                              .arg(m_settings.clients).arg(m_settings.threads);
+    
+    m_phase = PhaseConnecting;
+    m_phaseClock.start();
+    forEachWorker([](LoadWorker* worker) { worker->startClients(); });
+    m_progressTimer->start(ProgressIntervalMs);
+}
+
+void LoadGenerator::onProgress()
+{
+    quint64 sent = totalSent();
+    quint64 received = totalReceived();
+    int online = totalOnline();
+    double seconds = ProgressIntervalMs / 1000.0;
+    
+    switch (m_phase) {
+    case PhaseConnecting: {
+        qDebug().noquote() << QString("[连接] 在线 %1/%2").arg(online).arg(m_settings.clients);
+        qint64 limit = static_cast<qint64>(m_settings.clients) * 1000 / qMax(1, m_settings.client.rampPerSecond)
+            + ConnectGraceMs;
+        if (online == m_settings.clients) {
+            enterWarmup();
+        } else if (m_phaseClock.elapsed() > limit) {
+            qDebug().noquote() << QString("等待登录超时, 仅%1个客户端在线, 继续测试").arg(online);
+            enterWarmup();
+        }
+        break;
+    }
+        
+    case PhaseWarmup:
+        if (m_phaseClock.elapsed() >= m_settings.warmupSec * 1000) {
+            enterMeasuring();
+        }
+        break;
+        
+    case PhaseMeasuring:
+        qDebug().noquote() << QString("[测量 %1s] 在线 %2, 发送 %3/s, 接收 %4/s")
+                                  .arg(m_phaseClock.elapsed() / 1000).arg(online)
+                                  .arg(static_cast<quint64>((sent - m_lastSent) / seconds))
+                                  .arg(static_cast<quint64>((received - m_lastReceived) / seconds));
+        if (!m_reconnectTriggered && m_settings.reconnectFraction > 0
+            && m_phaseClock.elapsed() >= m_settings.durationSec * 500) {
+            m_reconnectTriggered = true;
+            double fraction = m_settings.reconnectFraction;
+            int offlineMs = m_settings.offlineMs;
+            qDebug().noquote() << QString("断开%1%的客户端, %2毫秒后重连").arg(fraction * 100).arg(offlineMs);
+            forEachWorker([fraction, offlineMs](LoadWorker* worker) { worker->reconnectClients(fraction, offlineMs); });
+        }
+        if (m_phaseClock.elapsed() >= m_settings.durationSec * 1000) {
+            enterDraining();
+        }
+        break;
+        
+    case PhaseDraining:
+    case PhaseDone:
+        break;
+    }
+    
+    m_lastSent = sent;
+    m_lastReceived = received;
+}
+
+void LoadGenerator::enterWarmup()
+{
+    m_onlineMemory = residentBytes();
+    m_phase = PhaseWarmup;
+    m_phaseClock.restart();
+    
+    // 群成员是向群发过消息的用户，先让每个客户端加入自己的群
+    if (m_settings.client.groupRatio > 0) {
+        forEachWorker([](LoadWorker* worker) { worker->joinGroups(); });
+    }
+    forEachWorker([](LoadWorker* worker) { worker->startTraffic(); });
+    qDebug().noquote() << QString("预热%1秒").arg(m_settings.warmupSec);
+}
+
+void LoadGenerator::enterMeasuring()
+{
+    forEachWorker([](LoadWorker* worker) { worker->resetStats(); });
+    m_lastSent = 0;
+    m_lastReceived = 0;
+    m_phase = PhaseMeasuring;
+    m_phaseClock.restart();
+}
+
+void LoadGenerator::enterDraining()
+{
+    forEachWorker([](LoadWorker* worker) { worker->stopTraffic(); });
+    m_measuredSeconds = m_phaseClock.elapsed() / 1000.0;
+    m_sentAtStop = totalSent();
+    m_receivedAtStop = totalReceived();
+    
+    m_phase = PhaseDraining;
+    m_phaseClock.restart();
+    m_drainTimer->start(DrainPollMs);
+}
+
+void LoadGenerator::onDrainPoll()
+{
+    // 接收数不再增长或超过排空时限时结束
+    quint64 received = totalReceived();
+    bool idle = received == m_lastReceived;
+    m_lastReceived = received;
+    if (idle || m_phaseClock.elapsed() >= m_settings.drainMs) {
+        finish();
+    }
+}
+
+void LoadGenerator::finish()
+{
+    m_drainTimer->stop();
+    m_progressTimer->stop();
+    m_phase = PhaseDone;
+    
+    LoadWorker::Snapshot total;
+    forEachWorker([&total](LoadWorker* worker) {
+        LoadWorker::Snapshot snapshot = worker->snapshot();
+        total.clients += snapshot.clients;
+        total.online += snapshot.online;
+        total.sent += snapshot.sent;
+        total.skipped += snapshot.skipped;
+        total.acked += snapshot.acked;
+        total.failed += snapshot.failed;
+        total.received += snapshot.received;
+        total.caughtUp += snapshot.caughtUp;
+        total.disconnects += snapshot.disconnects;
+        total.latency.merge(snapshot.latency);
+        total.login.merge(snapshot.login);
+        total.reconnect.merge(snapshot.reconnect);
+        total.catchUp.merge(snapshot.catchUp);
+    });
+    report(total);
+    
+    forEachWorker([](LoadWorker* worker) { worker->shutdown(); });
+    emit finished(total.online > 0 ? 0 : 1);
+}
+
+void LoadGenerator::report(const LoadWorker::Snapshot& total)
+{
+    double seconds = qMax(0.001, m_measuredSeconds);
+    double sendRate = m_sentAtStop / seconds;
+    double receiveRate = m_receivedAtStop / seconds;
+    qint64 perClientMemory = -1;
+    if (m_baselineMemory >= 0 && m_onlineMemory >= 0) {
+        perClientMemory = (m_onlineMemory - m_baselineMemory) / qMax(1, total.clients);
+    }
+    
+    qDebug().noquote() << "========== 压测结果 ==========";
+    qDebug().noquote() << QString("客户端: %1 (结束时在线 %2, 意外断开 %3次)")
+                              .arg(total.clients).arg(total.online).arg(total.disconnects);
+    qDebug().noquote() << QString("测量时长: %1秒").arg(seconds, 0, 'f', 1);
+    qDebug().noquote() << QString("发送: %1条 (%2条/秒), 因背压跳过 %3条, 服务器确认 %4条, 失败 %5条")
+                              .arg(total.sent).arg(sendRate, 0, 'f', 0).arg(total.skipped)
+                              .arg(total.acked).arg(total.failed);
+    qDebug().noquote() << QString("接收: %1条 (%2条/秒), 追赶补发 %3条")
+                              .arg(total.received).arg(receiveRate, 0, 'f', 0).arg(total.caughtUp);
+    qDebug().noquote() << "端到端延迟:" << histogramToText(total.latency);
+    qDebug().noquote() << "首次登录:" << histogramToText(total.login);
+    qDebug().noquote() << "重连登录:" << histogramToText(total.reconnect);
+    qDebug().noquote() << "追赶完成:" << histogramToText(total.catchUp);
+    if (perClientMemory >= 0) {
+        qDebug().noquote() << QString("内存: 基线 %1 MB, 全部登录后 %2 MB, 每客户端约 %3 KB")
+                                  .arg(m_baselineMemory / 1048576.0, 0, 'f', 1)
+                                  .arg(m_onlineMemory / 1048576.0, 0, 'f', 1)
+                                  .arg(perClientMemory / 1024.0, 0, 'f', 1);
+    } else {
+        qDebug().noquote() << "内存: 当前平台不支持读取常驻内存";
+    }
+    
+    if (m_settings.json) {
+        QJsonObject result;
+        result["clients"] = total.clients;
+        result["online"] = total.online;
+        result["seconds"] = seconds;
+        result["sent"] = static_cast<double>(total.sent);
+        result["skipped"] = static_cast<double>(total.skipped);
+        result["acked"] = static_cast<double>(total.acked);
+        result["failed"] = static_cast<double>(total.failed);
+        result["received"] = static_cast<double>(total.received);
+        result["caught_up"] = static_cast<double>(total.caughtUp);
+        result["disconnects"] = static_cast<double>(total.disconnects);
+        result["send_rate"] = sendRate;
+        result["receive_rate"] = receiveRate;
+        result["latency"] = histogramToJson(total.latency);
+        result["login"] = histogramToJson(total.login);
+        result["reconnect"] = histogramToJson(total.reconnect);
+        result["catch_up"] = histogramToJson(total.catchUp);
+        result["memory_per_client_bytes"] = static_cast<double>(perClientMemory);
+        QTextStream(stdout) << QJsonDocument(result).toJson(QJsonDocument::Compact) << "\n";
+    }
+}
+
+int LoadGenerator::totalOnline() const
+{
+    int online = 0;
+    for (const LoadWorker* worker : m_workers) {
+        online += worker->onlineCount();
+    }
+    return online;
+}
+
+quint64 LoadGenerator::totalSent() const
+{
+    quint64 sent = 0;
+    for (const LoadWorker* worker : m_workers) {
+        sent += worker->sentCount();
+    }
+    return sent;
+}
+
+quint64 LoadGenerator::totalReceived() const
+{
+    quint64 received = 0;
+    for (const LoadWorker* worker : m_workers) {
+        received += worker->receivedCount();
+    }
+    return received;
+}
+
+qint64 LoadGenerator::residentBytes()
+{
+    // /proc/self/statm 第二列为常驻页数
+#ifdef Q_OS_LINUX
+    QFile file("/proc/self/statm");
+    if (file.open(QIODevice::ReadOnly)) {
+        QList<QByteArray> fields = file.readAll().split(' ');
+        if (fields.size() > 1) {
+            return fields.at(1).toLongLong() * sysconf(_SC_PAGESIZE);
+        }
+    }
+#endif
+    return -1;
+}
@@ -0,0 +1,84 @@
+#ifndef LOADGENERATOR_H
+#define LOADGENERATOR_H
+
+#include <QObject>
+#include <QVector>
+#include <QThread>
+#include <QTimer>
+#include <QElapsedTimer>
+#include "loadworker.h"
+
+// 压测流程：连接（按爬坡速率登录全部客户端）-> 预热（加入群并开始发送，不计入统计）
+// -> 测量（持续 duration 秒，中途可断开一部分客户端测量重连和追赶）-> 排空（停止发送，等待在途消息送达）
+// -> 汇总输出。各阶段之间在主线程中推进，模拟客户端分布在多个 LoadWorker 线程中
+class LoadGenerator : public QObject
+{
+    Q_OBJECT
+
+public:
+    struct Settings {
+        LoadWorker::Options client;
+        int clients = 100;
+        int threads = 1;
+        int durationSec = 30;
+        int warmupSec = 2;
+        double reconnectFraction = 0.0; // 测量阶段中点断开重连的客户端比例，0为不测
+        int offlineMs = 2000;           // 断开后等待多久再重连（期间的消息由追赶补发）
+        int drainMs = 5000;
+        bool json = false;              // 结束时向标准输出打印一行JSON，便于脚本比较
+    };
+
+    explicit LoadGenerator(const Settings& settings, QObject* parent = nullptr);
+    ~LoadGenerator();
+
+    void start();
+
+signals:
+    void finished(int exitCode);
+
+private slots:
+    void onProgress();
+    void onDrainPoll();
+
+private:
+    enum Phase {
+        PhaseConnecting,
+        PhaseWarmup,
+        PhaseMeasuring,
+        PhaseDraining,
+        PhaseDone
+    };
+
+    void enterWarmup();
+    void enterMeasuring();
+    void enterDraining();
+    void finish();
+    void report(const LoadWorker::Snapshot& total);
+
+    // 在每个 LoadWorker 的线程中执行 func 并等待完成
+    template <typename Func>
+    void forEachWorker(Func func);
+
+    int totalOnline() const;
+    quint64 totalSent() const;
+    quint64 totalReceived() const;
+    static qint64 residentBytes();
+
+    Settings m_settings;
+    QVector<QThread*> m_threads;
+    QVector<LoadWorker*> m_workers;
+    Phase m_phase;
+    QTimer* m_progressTimer;
+    QTimer* m_drainTimer;
+    QElapsedTimer m_phaseClock;
+    bool m_reconnectTriggered;
+    quint64 m_lastSent;
+    quint64 m_lastReceived;
+    quint64 m_sentAtStop;
+    quint64 m_receivedAtStop;
+    double m_measuredSeconds;
+    qint64 m_baselineMemory;
+    qint64 m_onlineMemory;
+};
+
+#endif // LOADGENERATOR_H
@@ -0,0 +1,223 @@
+#include "loadworker.h"
+#include "simulatedclient.h"
+#include <QRandomGenerator>
+#include <algorithm>
+#include <chrono>
+
+namespace {
+// 发送和连接爬坡的节拍，速率按实际经过的时间折算，节拍抖动不影响总速率
+const int TickIntervalMs = 10;
+}
+
+LoadWorker::LoadWorker(const Options& options, int firstClient, int clientCount, QObject* parent)
+    : QObject(parent)
+    , m_options(options)
+    , m_firstClient(firstClient)
+    , m_clientCount(clientCount)
+    , m_tickTimer(nullptr)
+    , m_nextToStart(0)
+    , m_connectCredit(0)
+    , m_trafficRunning(false)
+    , m_sendCredit(0)
+    , m_nextSender(0)
+    , m_online(0)
+    , m_sent(0)
+    , m_skipped(0)
+    , m_acked(0)
+    , m_failed(0)
+    , m_received(0)
+    , m_caughtUp(0)
+    , m_disconnects(0)
+{
+}
+
+LoadWorker::~LoadWorker()
+{
+}
+
+qint64 LoadWorker::nowNs()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void LoadWorker::startClients()
+{
+    // 客户端在本线程中创建，NetworkManager 的socket和定时器随之属于本线程
+    m_clients.reserve(m_clientCount);
+    for (int i = 0; i < m_clientCount; ++i) {
+        m_clients.append(new SimulatedClient(m_options.firstUserId + m_firstClient + i, this));
+    }
+    
+    m_tickTimer = new QTimer(this);
+    m_tickTimer->setTimerType(Qt::PreciseTimer);
+    connect(m_tickTimer, &QTimer::timeout, this, &LoadWorker::onTick);
+    m_tickClock.start();
+    m_tickTimer->start(TickIntervalMs);
+}
+
+void LoadWorker::startTraffic()
+{
+    m_trafficRunning = true;
+    m_sendCredit = 0;
+}
+
+void LoadWorker::stopTraffic()
+{
+    m_trafficRunning = false;
+}
+
+void LoadWorker::joinGroups()
+{
+    if (m_options.groupCount <= 0) {
+        return;
+    }
+    for (SimulatedClient* client : qAsConst(m_clients)) {
+        client->joinGroup(m_options.firstGroupId + client->userId() % m_options.groupCount);
+    }
+}
+
+void LoadWorker::reconnectClients(double fraction, int offlineMs)
+{
+    QVector<SimulatedClient*> online;
+    for (SimulatedClient* client : qAsConst(m_clients)) {
+        if (client->isOnline()) {
+            online.append(client);
+        }
+    }
+    
+    int count = qBound(0, static_cast<int>(online.size() * fraction + 0.5), online.size());
+    std::shuffle(online.begin(), online.end(), *QRandomGenerator::global());
+    for (int i = 0; i < count; ++i) {
+        online.at(i)->reconnectAfter(offlineMs);
+    }
+}
+
+void LoadWorker::resetStats()
+{
+    m_latency.reset();
+    m_reconnect.reset();
+    m_catchUp.reset();
+    // 登录耗时在连接阶段记录，不随测量阶段清零
+    m_sent = 0;
+    m_skipped = 0;
+    m_acked = 0;
+    m_failed = 0;
+    m_received = 0;
+    m_caughtUp = 0;
+    m_disconnects = 0;
+}
+
+LoadWorker::Snapshot LoadWorker::snapshot() const
+{
+    Snapshot snapshot;
+    snapshot.clients = m_clients.size();
+    snapshot.online = m_online;
+    snapshot.sent = m_sent;
+    snapshot.skipped = m_skipped;
+    snapshot.acked = m_acked;
+    snapshot.failed = m_failed;
+    snapshot.received = m_received;
+    snapshot.caughtUp = m_caughtUp;
+    snapshot.disconnects = m_disconnects;
+    snapshot.latency = m_latency;
+    snapshot.login = m_login;
+    snapshot.reconnect = m_reconnect;
+    snapshot.catchUp = m_catchUp;
+    return snapshot;
+}
+
+void LoadWorker::shutdown()
+{
+    if (m_tickTimer) {
+        m_tickTimer->stop();
+    }
+    m_trafficRunning = false;
+    qDeleteAll(m_clients);
+    m_clients.clear();
+    m_online = 0;
+}
+
+void LoadWorker::recordLogin(qint64 micros)
+{
+    m_login.record(micros);
+}
+
+void LoadWorker::recordReconnect(qint64 micros)
+{
+    m_reconnect.record(micros);
+}
+
+void LoadWorker::recordCatchUp(qint64 micros)
+{
+    m_catchUp.record(micros);
+}
+
+void LoadWorker::recordDelivery(qint64 micros)
+{
+    m_latency.record(micros);
+    ++m_received;
+}
+
+void LoadWorker::onTick()
+{
+    double elapsedSeconds = m_tickClock.restart() / 1000.0;
+    
+    // 连接爬坡，避免同时发起数万个连接把服务器的accept队列打满
+    if (m_nextToStart < m_clients.size()) {
+        m_connectCredit += m_options.rampPerSecond * elapsedSeconds;
+        while (m_connectCredit >= 1.0 && m_nextToStart < m_clients.size()) {
+            m_clients.at(m_nextToStart++)->start(m_options.host, m_options.port);
+            m_connectCredit -= 1.0;
+        }
+    }
+    
+    updateOnlineCount();
+    
+    if (m_trafficRunning && !m_clients.isEmpty()) {
+        m_sendCredit += m_options.messageRate * m_clients.size() * elapsedSeconds;
+        int count = static_cast<int>(m_sendCredit);
+        m_sendCredit -= count;
+        sendBatch(count);
+    }
+}
+
+void LoadWorker::updateOnlineCount()
+{
+    int online = 0;
+    for (SimulatedClient* client : qAsConst(m_clients)) {
+        if (client->isOnline()) {
+            ++online;
+        }
+    }
+    m_online = online;
+}
+
+void LoadWorker::sendBatch(int count)
+{
+    QRandomGenerator* random = QRandomGenerator::global();
+    for (int i = 0; i < count; ++i) {
+        // 发送者轮流选取，使每个客户端的发送速率相同
+        SimulatedClient* sender = m_clients.at(m_nextSender);
+        m_nextSender = (m_nextSender + 1) % m_clients.size();
+        
+        bool isGroup = m_options.groupCount > 0 && random->generateDouble() < m_options.groupRatio;
+        int toUserId = 0;
+        if (isGroup) {
+            toUserId = m_options.firstGroupId + sender->userId() % m_options.groupCount;
+        } else if (m_options.totalClients > 1) {
+            // 随机选一个其他模拟用户（可能在其他线程）
+            int offset = 1 + random->bounded(m_options.totalClients - 1);
+            toUserId = m_options.firstUserId
+                + (sender->userId() - m_options.firstUserId + offset) % m_options.totalClients;
+        } else {
+            toUserId = sender->userId();
+        }
+        
+        if (sender->sendChat(toUserId, isGroup, m_options.payloadSize)) {
+            ++m_sent;
+        } else {
+            ++m_skipped;
+        }
+    }
+}
@@ -0,0 +1,123 @@
+#ifndef LOADWORKER_H
+#define LOADWORKER_H
+
+#include <QObject>
+#include <QString>
+#include <QVector>
+#include <QTimer>
+#include <QElapsedTimer>
+#include <atomic>
+#include "latencyhistogram.h"
+#include "messagecodec.h"
+
+class SimulatedClient;
+
+// 一个压测线程：拥有分配给它的模拟客户端及其 NetworkManager，按配置的速率驱动流量。
+// 延迟直方图只在本线程中写入，由 LoadGenerator 在阶段结束时阻塞读取；计数器可在任意线程读取
+class LoadWorker : public QObject
+{
+    Q_OBJECT
+
+public:
+    struct Options {
+        QString host = QStringLiteral("127.0.0.1");
+        quint16 port = 8888;
+        int firstUserId = 100000;      // 模拟用户ID从此开始连续分配
+        int totalClients = 0;          // 所有线程的客户端总数，用于选取单聊对象
+        double messageRate = 1.0;      // 每个客户端每秒发送的消息数
+        int payloadSize = 64;          // 消息内容长度（字符）
+        double groupRatio = 0.0;       // 群消息占比 0~1
+        int groupCount = 10;           // 客户端按用户ID轮流加入这些群
+        int firstGroupId = 900000;
+        int rampPerSecond = 1000;      // 本线程每秒发起的连接数
+        int connectTimeoutMs = 10000;
+        int sendWindow = 128;
+        MessageCodec::Encoding encoding = MessageCodec::EncodingCbor;
+        bool compression = true;
+    };
+
+    // 一个阶段结束时的统计快照
+    struct Snapshot {
+        int clients = 0;
+        int online = 0;
+        quint64 sent = 0;
+        quint64 skipped = 0;
+        quint64 acked = 0;
+        quint64 failed = 0;
+        quint64 received = 0;
+        quint64 caughtUp = 0;
+        quint64 disconnects = 0;
+        LatencyHistogram latency;
+        LatencyHistogram login;
+        LatencyHistogram reconnect;
+        LatencyHistogram catchUp;
+    };
+
+    LoadWorker(const Options& options, int firstClient, int clientCount, QObject* parent = nullptr);
+    ~LoadWorker();
+
+    const Options& options() const { return m_options; }
+    // 进程内单调时钟（纳秒），发送方和接收方在同一进程中，可直接相减
+    static qint64 nowNs();
+
+    // 以下在本线程中调用（LoadGenerator 通过队列调用）
+    void startClients();
+    void startTraffic();
+    void stopTraffic();
+    void joinGroups();
+    // 随机选出 fraction 比例的在线客户端断开，offlineMs 后重连并追赶离线消息
+    void reconnectClients(double fraction, int offlineMs);
+    void resetStats();
+    Snapshot snapshot() const;
+    void shutdown();
+
+    // 可在任意线程读取
+    quint64 sentCount() const { return m_sent; }
+    quint64 receivedCount() const { return m_received; }
+    int onlineCount() const { return m_online; }
+
+    // 由 SimulatedClient 在本线程中调用
+    void recordLogin(qint64 micros);
+    void recordReconnect(qint64 micros);
+    void recordCatchUp(qint64 micros);
+    void recordDelivery(qint64 micros);
+    void recordCaughtUp() { ++m_caughtUp; }
+    void recordAck() { ++m_acked; }
+    void recordSendFailure() { ++m_failed; }
+    void recordUnexpectedDisconnect() { ++m_disconnects; }
+
+private slots:
+    void onTick();
+
+private:
+    void updateOnlineCount();
+    void sendBatch(int count);
+
+    Options m_options;
+    int m_firstClient;
+    int m_clientCount;
+    QVector<SimulatedClient*> m_clients;
+    QTimer* m_tickTimer;
+    QElapsedTimer m_tickClock;
+    int m_nextToStart;             // 连接爬坡：下一个发起连接的客户端
+    double m_connectCredit;
+    bool m_trafficRunning;
+    double m_sendCredit;
+    int m_nextSender;
+
+    LatencyHistogram m_latency;
+    LatencyHistogram m_login;
+    LatencyHistogram m_reconnect;
+    LatencyHistogram m_catchUp;
+
+    std::atomic<int> m_online;
+    std::atomic<quint64> m_sent;
+    std::atomic<quint64> m_skipped;
+    std::atomic<quint64> m_acked;
+    std::atomic<quint64> m_failed;
+    std::atomic<quint64> m_received;
+    std::atomic<quint64> m_caughtUp;
+    std::atomic<quint64> m_disconnects;
+};
+
+#endif // LOADWORKER_H
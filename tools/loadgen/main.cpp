@@ -0,0 +1,86 @@
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QThread>
+#include <QDebug>
+#include "loadgenerator.h"
+
+#ifdef Q_OS_UNIX
+#include <sys/resource.h>
+#endif
+
+namespace {
+// 每个模拟客户端占用一个socket，把文件描述符软限制提高到硬限制
+void raiseFileDescriptorLimit()
+{
+#ifdef Q_OS_UNIX
+    struct rlimit limit;
+    if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < limit.rlim_max) {
+        limit.rlim_cur = limit.rlim_max;
+        if (setrlimit(RLIMIT_NOFILE, &limit) != 0) {
+            qDebug() << "无法提高文件描述符上限";
+        }
+    }
+#endif
+}
+}
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+    app.setApplicationName("loadgen");
+    
+    QCommandLineParser parser;
+    parser.setApplicationDescription("聊天客户端压测工具：模拟多个客户端登录并收发消息，统计吞吐量和延迟");
+    parser.addHelpOption();
+    QCommandLineOption hostOption("host", "服务器地址", "host", "127.0.0.1");
+    QCommandLineOption portOption({"p", "port"}, "服务器端口", "port", "8888");
+    QCommandLineOption clientsOption({"c", "clients"}, "模拟客户端数", "count", "100");
+    QCommandLineOption threadsOption({"t", "threads"}, "压测线程数（默认为CPU核数）", "count",
+                                     QString::number(qMax(1, QThread::idealThreadCount())));
+    QCommandLineOption rateOption("rate", "每个客户端每秒发送的消息数", "count", "1");
+    QCommandLineOption sizeOption("size", "消息内容长度（字符）", "chars", "64");
+    QCommandLineOption groupRatioOption("group-ratio", "群消息占比（0~1）", "ratio", "0");
+    QCommandLineOption groupsOption("groups", "群数量，客户端按用户ID轮流加入", "count", "10");
+    QCommandLineOption durationOption({"d", "duration"}, "测量时长（秒）", "seconds", "30");
+    QCommandLineOption warmupOption("warmup", "预热时长（秒），不计入统计", "seconds", "2");
+    QCommandLineOption rampOption("ramp", "每秒发起的连接数", "count", "1000");
+    QCommandLineOption reconnectOption("reconnect", "测量中点断开并重连的客户端比例（0~1）", "ratio", "0");
+    QCommandLineOption offlineOption("offline", "断开后等待多久再重连（毫秒）", "msecs", "2000");
+    QCommandLineOption firstUserOption("first-user", "模拟用户的起始ID", "id", "100000");
+    QCommandLineOption windowOption("window", "发送窗口（未确认消息数上限）", "count", "128");
+    QCommandLineOption jsonEncodingOption("json-encoding", "使用JSON编码（默认协商CBOR）");
+    QCommandLineOption noCompressionOption("no-compression", "不启用帧压缩");
+    QCommandLineOption jsonOption("json", "结束时向标准输出打印一行JSON结果");
+    parser.addOptions({hostOption, portOption, clientsOption, threadsOption, rateOption, sizeOption,
+                       groupRatioOption, groupsOption, durationOption, warmupOption, rampOption,
+                       reconnectOption, offlineOption, firstUserOption, windowOption,
+                       jsonEncodingOption, noCompressionOption, jsonOption});
+    parser.process(app);
+    
+    raiseFileDescriptorLimit();
+    
+    LoadGenerator::Settings settings;
+    settings.client.host = parser.value(hostOption);
+    settings.client.port = parser.value(portOption).toUShort();
+    settings.client.messageRate = parser.value(rateOption).toDouble();
+    settings.client.payloadSize = parser.value(sizeOption).toInt();
+    settings.client.groupRatio = qBound(0.0, parser.value(groupRatioOption).toDouble(), 1.0);
+    settings.client.groupCount = parser.value(groupsOption).toInt();
+    settings.client.rampPerSecond = qMax(1, parser.value(rampOption).toInt());
+    settings.client.firstUserId = parser.value(firstUserOption).toInt();
+    settings.client.sendWindow = qMax(1, parser.value(windowOption).toInt());
+    settings.client.encoding = parser.isSet(jsonEncodingOption) ? MessageCodec::EncodingJson : MessageCodec::EncodingCbor;
+    settings.client.compression = !parser.isSet(noCompressionOption);
+    settings.clients = parser.value(clientsOption).toInt();
+    settings.threads = parser.value(threadsOption).toInt();
+    settings.durationSec = qMax(1, parser.value(durationOption).toInt());
+    settings.warmupSec = qMax(0, parser.value(warmupOption).toInt());
+    settings.reconnectFraction = qBound(0.0, parser.value(reconnectOption).toDouble(), 1.0);
+    settings.offlineMs = qMax(0, parser.value(offlineOption).toInt());
+    settings.json = parser.isSet(jsonOption);
+    
+    LoadGenerator generator(settings);
+    QObject::connect(&generator, &LoadGenerator::finished, &app, &QCoreApplication::exit);
+    generator.start();
+    return app.exec();
+}
@@ -0,0 +1,163 @@
+#include "simulatedclient.h"
+#include "loadworker.h"
+#include <QTimer>
+
+namespace {
+const QLatin1String ContentPrefix("lg:");
+}
+
+SimulatedClient::SimulatedClient(int userId, LoadWorker* worker)
+    : QObject(worker)
+    , m_userId(userId)
+    , m_worker(worker)
+    , m_network(new NetworkManager(this))
+    , m_port(0)
+    , m_connectStartNs(0)
+    , m_onlineNs(0)
+    , m_everOnline(false)
+    , m_reconnecting(false)
+{
+    const LoadWorker::Options& options = worker->options();
+    m_network->setPreferredEncoding(options.encoding);
+    m_network->setCompressionEnabled(options.compression);
+    m_network->setSendWindow(options.sendWindow);
+    // 压测中连接失败应尽快重试，并且不让请求超时掩盖服务器变慢
+    m_network->setReconnectBackoff(200, 5000);
+    m_network->setConnectTimeout(options.connectTimeoutMs);
+    m_network->setRequestTimeout(options.connectTimeoutMs);
+    
+    // 未启用工作线程时 NetworkManager 的信号在本线程中直接发出
+    connect(m_network, &NetworkManager::online, this, &SimulatedClient::onOnline);
+    connect(m_network, &NetworkManager::disconnected, this, &SimulatedClient::onDisconnected);
+    connect(m_network, &NetworkManager::messagesReceived, this, &SimulatedClient::onMessagesReceived);
+    connect(m_network, &NetworkManager::messageStateChanged, this, &SimulatedClient::onMessageStateChanged);
+    connect(m_network, &NetworkManager::catchUpFinished, this, &SimulatedClient::onCatchUpFinished);
+}
+
+SimulatedClient::~SimulatedClient()
+{
+}
+
+void SimulatedClient::start(const QString& host, quint16 port)
+{
+    m_host = host;
+    m_port = port;
+    m_network->setCredentials(m_userId, QString("loadgen%1").arg(m_userId));
+    beginConnect();
+}
+
+void SimulatedClient::beginConnect()
+{
+    m_connectStartNs = LoadWorker::nowNs();
+    m_network->connectToServer(m_host, m_port);
+}
+
+void SimulatedClient::reconnectAfter(int offlineMs)
+{
+    if (m_reconnecting) {
+        return;
+    }
+    m_reconnecting = true;
+    m_network->disconnectFromServer();
+    QTimer::singleShot(offlineMs, this, &SimulatedClient::beginConnect);
+}
+
+bool SimulatedClient::sendChat(int toUserId, bool isGroup, int payloadSize)
+{
+    if (!m_network->isOnline() || m_network->isBackPressured()) {
+        return false;
+    }
+    m_network->sendTextMessage(m_userId, toUserId, makeContent(LoadWorker::nowNs(), payloadSize), isGroup);
+    return true;
+}
+
+void SimulatedClient::joinGroup(int groupId)
+{
+    if (m_network->isOnline()) {
+        m_network->sendTextMessage(m_userId, groupId, QStringLiteral("join"), true);
+    }
+}
+
+QString SimulatedClient::makeContent(qint64 sentNs, int payloadSize)
+{
+    QString content = ContentPrefix + QString::number(sentNs) + QLatin1Char(':');
+    if (content.size() < payloadSize) {
+        content.append(QString(payloadSize - content.size(), QLatin1Char('x')));
+    }
+    return content;
+}
+
+qint64 SimulatedClient::parseSentTime(const QString& content)
+{
+    if (!content.startsWith(ContentPrefix)) {
+        return 0;
+    }
+    int end = content.indexOf(QLatin1Char(':'), ContentPrefix.size());
+    if (end < 0) {
+        return 0;
+    }
+    return content.mid(ContentPrefix.size(), end - ContentPrefix.size()).toLongLong();
+}
+
+void SimulatedClient::onOnline()
+{
+    m_onlineNs = LoadWorker::nowNs();
+    qint64 elapsedUs = (m_onlineNs - m_connectStartNs) / 1000;
+    
+    if (m_reconnecting) {
+        m_worker->recordReconnect(elapsedUs);
+        // 服务器没有需要重放的消息时不会发出 catchUpFinished
+        if (!m_network->isCatchingUp()) {
+            m_reconnecting = false;
+        }
+    } else if (!m_everOnline) {
+        m_worker->recordLogin(elapsedUs);
+    }
+    m_everOnline = true;
+}
+
+void SimulatedClient::onDisconnected()
+{
+    // 非主动断开（服务器关闭连接、保活超时）由 NetworkManager 自动重连
+    if (!m_reconnecting) {
+        m_worker->recordUnexpectedDisconnect();
+    }
+}
+
+void SimulatedClient::onMessagesReceived(const QVector<ChatMessage>& messages)
+{
+    qint64 now = LoadWorker::nowNs();
+    bool catchingUp = m_network->isCatchingUp();
+    for (const ChatMessage& message : messages) {
+        qint64 sentNs = parseSentTime(message.content);
+        if (sentNs <= 0) {
+            continue; // 加入群的消息
+        }
+        // 追赶重放的消息在离线期间发出，延迟包含离线时长，不计入端到端延迟
+        if (catchingUp) {
+            m_worker->recordCaughtUp();
+        } else {
+            m_worker->recordDelivery((now - sentNs) / 1000);
+        }
+    }
+}
+
+void SimulatedClient::onMessageStateChanged(qint64 clientMsgId, NetworkManager::DeliveryState state)
+{
+    Q_UNUSED(clientMsgId);
+    if (state == NetworkManager::DeliveryDelivered) {
+        m_worker->recordAck();
+    } else if (state == NetworkManager::DeliveryFailed) {
+        m_worker->recordSendFailure();
+    }
+}
+
+void SimulatedClient::onCatchUpFinished(qint64 lastSeq, int messageCount)
+{
+    Q_UNUSED(lastSeq);
+    Q_UNUSED(messageCount);
+    if (m_reconnecting) {
+        m_worker->recordCatchUp((LoadWorker::nowNs() - m_onlineNs) / 1000);
+        m_reconnecting = false;
+    }
+}
@@ -0,0 +1,59 @@
+#ifndef SIMULATEDCLIENT_H
+#define SIMULATEDCLIENT_H
+
+#include <QObject>
+#include <QString>
+#include <QVector>
+#include "networkmanager.h"
+
+class LoadWorker;
+
+// 一个模拟客户端：使用真实的 NetworkManager（不启用网络工作线程，运行在所属 LoadWorker 的线程中），
+// 登录后按 LoadWorker 的节奏发送消息。消息内容以发送时刻开头，接收方据此计算端到端延迟
+class SimulatedClient : public QObject
+{
+    Q_OBJECT
+
+public:
+    SimulatedClient(int userId, LoadWorker* worker);
+    ~SimulatedClient();
+
+    int userId() const { return m_userId; }
+    bool isOnline() const { return m_network->isOnline(); }
+    NetworkManager* network() const { return m_network; }
+
+    void start(const QString& host, quint16 port);
+    // 断开连接，offlineMs 毫秒后重新连接；测量从发起连接到登录完成、再到追赶完成的时间
+    void reconnectAfter(int offlineMs);
+
+    // 发送一条消息；发送队列处于背压状态时不发送并返回false
+    bool sendChat(int toUserId, bool isGroup, int payloadSize);
+    // 群成员为向群发过消息的用户，开始计时前每个客户端向自己的群发一条加入消息
+    void joinGroup(int groupId);
+
+    // 内容格式："lg:<发送时刻纳秒>:" + 填充
+    static QString makeContent(qint64 sentNs, int payloadSize);
+    static qint64 parseSentTime(const QString& content);
+
+private slots:
+    void onOnline();
+    void onDisconnected();
+    void onMessagesReceived(const QVector<ChatMessage>& messages);
+    void onMessageStateChanged(qint64 clientMsgId, NetworkManager::DeliveryState state);
+    void onCatchUpFinished(qint64 lastSeq, int messageCount);
+
+private:
+    void beginConnect();
+
+    int m_userId;
+    LoadWorker* m_worker;
+    NetworkManager* m_network;
+    QString m_host;
+    quint16 m_port;
+    qint64 m_connectStartNs;   // 本次连接的发起时刻
+    qint64 m_onlineNs;         // 本次登录完成的时刻
+    bool m_everOnline;
+    bool m_reconnecting;       // 由 reconnectAfter 发起的重连
+};
+
+#endif // SIMULATEDCLIENT_H